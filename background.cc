@@ -0,0 +1,337 @@
+/******************************************************************************
+  Copyright 2011 Todd Sundsted. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY TODD SUNDSTED ``AS IS'' AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+  EVENT SHALL TODD SUNDSTED OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+  OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  The views and conclusions contained in the software and documentation are
+  those of the authors and should not be interpreted as representing official
+  policies, either expressed or implied, of Todd Sundsted.
+ *****************************************************************************/
+
+/* Runs CPU-heavy work for built-in functions on a small pool of threads,
+ * leaving the calling task suspended until it is done.  The threads never
+ * see a MOO value: everything they read or write is set up beforehand, and
+ * turned into a value afterwards, by the server's main thread.  Finished
+ * jobs are handed back through a pipe, which the network module selects on
+ * along with everything else.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include "my-fcntl.h"
+#include "my-signal.h"
+#include "my-string.h"
+#include "my-unistd.h"
+
+#include "background.h"
+#include "execute.h"
+#include "functions.h"
+#include "log.h"
+#include "net_multi.h"
+#include "options.h"
+#include "storage.h"
+#include "structures.h"
+#include "tasks.h"
+#include "utils.h"
+
+typedef struct background_job background_job;
+
+struct background_job {
+    background_job *next;	/* in the waiting or finished queue */
+    background_job *prev_job, *next_job;	/* in the list of all jobs */
+    const char *name;
+    background_work work;
+    background_done done;
+    void *data;
+    int lane;			/* -1 if any thread will do */
+    int finished;		/* set by the thread, under queue_lock */
+    vm the_vm;			/* 0 once the task has been killed */
+};
+
+/* The queues are shared with the threads and guarded by queue_lock; the
+ * list of all jobs belongs to the main thread.  Each thread has a queue of
+ * its own for the jobs of the lanes it serves, which it empties before
+ * taking anything from the shared one.
+ */
+typedef struct job_queue {
+    background_job *first, **last;
+} job_queue;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_finished = PTHREAD_COND_INITIALIZER;
+static job_queue waiting;
+static job_queue lane_waiting[BACKGROUND_THREADS > 0 ? BACKGROUND_THREADS : 1];
+static background_job *finished = 0;
+
+static background_job *all_jobs = 0;
+
+static int threads_started = 0;	/* -1 if they could not be */
+static int wakeup_fds[2];
+
+static background_job *
+dequeue_job(job_queue *q)
+{
+    background_job *job = q->first;
+
+    if (job && !(q->first = job->next))
+	q->last = &q->first;
+
+    return job;
+}
+
+static void *
+background_thread(void *arg)
+{
+    job_queue *own = &lane_waiting[(long) arg];
+    background_job *job;
+
+    for (;;) {
+	pthread_mutex_lock(&queue_lock);
+	while (!(job = dequeue_job(own)) && !(job = dequeue_job(&waiting)))
+	    pthread_cond_wait(&queue_ready, &queue_lock);
+	pthread_mutex_unlock(&queue_lock);
+
+	(*job->work) (job->data);
+
+	pthread_mutex_lock(&queue_lock);
+	job->next = finished;
+	job->finished = 1;
+	finished = job;
+	pthread_cond_broadcast(&job_finished);
+	pthread_mutex_unlock(&queue_lock);
+
+	/* A full pipe already has a wakeup in it. */
+	while (write(wakeup_fds[1], "", 1) < 0 && errno == EINTR)
+	    continue;
+    }
+
+    return 0;
+}
+
+static void
+finish_jobs(int fd, void *data)
+{
+    char buffer[128];
+    background_job *job, *reversed, *next;
+    Var value;
+
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+	continue;
+
+    pthread_mutex_lock(&queue_lock);
+    job = finished;
+    finished = 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    /* Resume tasks in the order their jobs finished. */
+    for (reversed = 0; job; job = next) {
+	next = job->next;
+	job->next = reversed;
+	reversed = job;
+    }
+
+    for (job = reversed; job; job = next) {
+	next = job->next;
+
+	if (job->prev_job)
+	    job->prev_job->next_job = job->next_job;
+	else
+	    all_jobs = job->next_job;
+	if (job->next_job)
+	    job->next_job->prev_job = job->prev_job;
+
+	value = (*job->done) (job->data);
+	if (job->the_vm)
+	    resume_task(job->the_vm, value);
+	else
+	    free_var(value);
+
+	myfree(job, M_STRUCT);
+    }
+}
+
+/* Waits for the jobs already started in LANE and finishes them, so that the
+ * next one can be done in the main thread without overtaking them.
+ */
+static void
+wait_for_lane(int lane)
+{
+    background_job *job;
+
+    pthread_mutex_lock(&queue_lock);
+    do {
+	for (job = all_jobs; job; job = job->next_job)
+	    if (job->lane == lane && !job->finished)
+		break;
+	if (job)
+	    pthread_cond_wait(&job_finished, &queue_lock);
+    } while (job);
+    pthread_mutex_unlock(&queue_lock);
+
+    finish_jobs(wakeup_fds[0], 0);
+}
+
+static task_enum_action
+background_enumerator(task_closure closure, void *data)
+{
+    background_job *job;
+    task_enum_action action;
+
+    for (job = all_jobs; job; job = job->next_job)
+	if (job->the_vm) {
+	    action = (*closure) (job->the_vm, job->name, data);
+	    if (TEA_KILL == action)
+		job->the_vm = 0;	/* the thread may still have it */
+	    if (TEA_CONTINUE != action)
+		return action;
+	}
+
+    return TEA_CONTINUE;
+}
+
+static int
+start_threads(void)
+{
+    sigset_t all, old;
+    pthread_t thread;
+    int i, started = 0;
+
+    if (BACKGROUND_THREADS <= 0)
+	return 0;
+
+    if (pipe(wakeup_fds) < 0) {
+	log_perror("BACKGROUND: Creating wakeup pipe");
+	return 0;
+    }
+    for (i = 0; i < 2; i++) {
+	fcntl(wakeup_fds[i], F_SETFL, fcntl(wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+	fcntl(wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    waiting.first = 0;
+    waiting.last = &waiting.first;
+    for (i = 0; i < BACKGROUND_THREADS; i++) {
+	lane_waiting[i].first = 0;
+	lane_waiting[i].last = &lane_waiting[i].first;
+    }
+
+    /* Signals are for the main thread; the threads start with all of
+     * them blocked.
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 0; i < BACKGROUND_THREADS; i++)
+	if (pthread_create(&thread, 0, background_thread, (void *) (long) started) == 0) {
+	    pthread_detach(thread);
+	    started++;
+	}
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+
+    if (!started) {
+	errlog("BACKGROUND: Could not start any threads\n");
+	close(wakeup_fds[0]);
+	close(wakeup_fds[1]);
+	return 0;
+    }
+
+    network_register_fd(wakeup_fds[0], finish_jobs, 0, 0);
+    register_task_queue(background_enumerator);
+    oklog("BACKGROUND: Started %d thread%s\n", started, started == 1 ? "" : "s");
+
+    return started;
+}
+
+static enum error
+background_suspender(vm the_vm, void *data)
+{
+    background_job *job = (background_job *)data;
+    job_queue *q;
+
+    job->the_vm = the_vm;
+    job->prev_job = 0;
+    if ((job->next_job = all_jobs))
+	all_jobs->prev_job = job;
+    all_jobs = job;
+
+    q = job->lane < 0 ? &waiting : &lane_waiting[job->lane % threads_started];
+    job->next = 0;
+    pthread_mutex_lock(&queue_lock);
+    *q->last = job;
+    q->last = &job->next;
+    /* Only one thread can take a lane's jobs, so wake them all. */
+    if (job->lane < 0)
+	pthread_cond_signal(&queue_ready);
+    else
+	pthread_cond_broadcast(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+
+    return E_NONE;
+}
+
+int
+background_threads_running(void)
+{
+    if (!threads_started && !(threads_started = start_threads()))
+	threads_started = -1;
+
+    return threads_started > 0;
+}
+
+package
+background_suspend_in_lane(const char *name, int lane, background_work work,
+			   background_done done, void *data)
+{
+    background_job *job;
+    Var value;
+
+    /* The server reads some tasks' results as soon as they return, so
+     * those can't be suspended.
+     */
+    if (!background_threads_running() || task_result_is_wanted()) {
+	if (lane >= 0 && threads_started > 0)
+	    wait_for_lane(lane);
+	(*work) (data);
+	value = (*done) (data);
+	if (value.type == TYPE_ERR)
+	    return make_error_pack(value.v.err);
+	return make_var_pack(value);
+    }
+
+    job = (background_job *)mymalloc(sizeof(background_job), M_STRUCT);
+    job->name = name;
+    job->work = work;
+    job->done = done;
+    job->data = data;
+    job->lane = lane;
+    job->finished = 0;
+    job->the_vm = 0;
+
+    return make_suspend_pack(background_suspender, job);
+}
+
+package
+background_suspend(const char *name, background_work work,
+		   background_done done, void *data)
+{
+    return background_suspend_in_lane(name, -1, work, done, data);
+}
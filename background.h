@@ -0,0 +1,74 @@
+/******************************************************************************
+  Copyright 2011 Todd Sundsted. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY TODD SUNDSTED ``AS IS'' AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+  EVENT SHALL TODD SUNDSTED OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+  OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  The views and conclusions contained in the software and documentation are
+  those of the authors and should not be interpreted as representing official
+  policies, either expressed or implied, of Todd Sundsted.
+ *****************************************************************************/
+
+#ifndef Background_H
+#define Background_H 1
+
+#include "functions.h"
+#include "structures.h"
+
+typedef void (*background_work) (void *data);
+typedef Var (*background_done) (void *data);
+
+extern package background_suspend(const char *name, background_work work,
+				   background_done done, void *data);
+				/* Suspends the current task while WORK is
+				 * called on a background thread, passing
+				 * DATA; WORK must not touch MOO values or
+				 * allocate with mymalloc().  DONE is then
+				 * called in the server's main thread and
+				 * returns the value the task resumes with
+				 * (an error value is raised), and frees
+				 * DATA.  If the task is killed meanwhile,
+				 * DONE is still called and its value freed.
+				 * NAME is shown for the waiting task in
+				 * queued_tasks().  Without background
+				 * threads, or in a server task whose result
+				 * is wanted at once (see
+				 * task_result_is_wanted()), WORK and DONE
+				 * are called at once and the task isn't
+				 * suspended at all.
+				 */
+
+extern package background_suspend_in_lane(const char *name, int lane,
+					  background_work work,
+					  background_done done, void *data);
+				/* Like background_suspend(), but all jobs
+				 * started with the same (non-negative) LANE
+				 * run one at a time, in the order they were
+				 * started.  A job that can't suspend waits
+				 * for the lane's earlier ones first.
+				 */
+
+extern int background_threads_running(void);
+				/* Returns true if the background threads are
+				 * (or could just now be) started.
+				 */
+
+#endif
@@ -30,9 +30,11 @@
 #include <sstream>
 #include <string>
 
+#include "background.h"
 #include "base64.h"
 #include "functions.h"
 #include "log.h"
+#include "options.h"
 #include "storage.h"
 #include "utils.h"
 #include "server.h"
@@ -52,6 +54,82 @@ static const unsigned char base64_chars[] =
 static const unsigned char url_safe_base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
+/* Encodes LEN bytes from IN into OUT, which has room for
+ * encoded_length(LEN, SAFE) characters and a terminating null.  Touches
+ * nothing else, so that it can run on a background thread.
+ */
+static void
+encode(const unsigned char *in, int len, char *out,
+       const unsigned char *chars, int safe)
+{
+    const unsigned char *endp = in + len;
+    const unsigned char *inp = in;
+
+    while (endp - inp >= 3) {
+	*out++ = chars[inp[0] >> 2];
+	*out++ = chars[((inp[0] & 0x03) << 4) | (inp[1] >> 4)];
+	*out++ = chars[((inp[1] & 0x0f) << 2) | (inp[2] >> 6)];
+	*out++ = chars[inp[2] & 0x3f];
+	inp += 3;
+    }
+
+    if (endp - inp) {
+	*out++ = chars[inp[0] >> 2];
+	if (endp - inp == 2) {
+	    *out++ = chars[((inp[0] & 0x03) << 4) | (inp[1] >> 4)];
+	    *out++ = chars[(inp[1] & 0x0f) << 2];
+	} else {
+	    *out++ = chars[(inp[0] & 0x03) << 4];
+	    if (!safe)
+		*out++ = '=';
+	}
+	if (!safe)
+	    *out++ = '=';
+    }
+
+    *out = '\0';
+}
+
+static int
+encoded_length(int len, int safe)
+{
+    if (safe)
+	return (len / 3) * 4 + (len % 3 ? len % 3 + 1 : 0);
+    else
+	return ((len + 2) / 3) * 4;
+}
+
+struct encode_job {
+    char *in;
+    int len;
+    char *out;
+    const unsigned char *chars;
+    int safe;
+};
+
+static void
+encode_work(void *data)
+{
+    encode_job *job = (encode_job *)data;
+
+    encode((unsigned char *)job->in, job->len, job->out, job->chars, job->safe);
+}
+
+static Var
+encode_done(void *data)
+{
+    encode_job *job = (encode_job *)data;
+    Var ret;
+
+    ret.type = TYPE_STR;
+    ret.v.str = job->out;
+
+    myfree(job->in, M_STRING);
+    myfree(job, M_STRUCT);
+
+    return ret;
+}
+
 static package
 bf_encode_base64(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -77,42 +155,33 @@ bf_encode_base64(Var arglist, Byte next, void *vdata, Objid progr)
 	return pack;
     }
 
+    free_var(arglist);
+
     /* encode */
 
-    std::stringstream buffer;
-    const unsigned char *endp = (unsigned char *)(in + len);
-    const unsigned char *inp = (unsigned char *)in;
+    char *out = (char *)mymalloc(encoded_length(len, safe) + 1, M_STRING);
 
-    while (endp - inp >= 3) {
-	buffer << chars[inp[0] >> 2];
-	buffer << chars[((inp[0] & 0x03) << 4) | (inp[1] >> 4)];
-	buffer << chars[((inp[1] & 0x0f) << 2) | (inp[2] >> 6)];
-	buffer << chars[inp[2] & 0x3f];
-	inp += 3;
-    }
+    if (len >= BACKGROUND_MIN_BYTES) {
+	encode_job *job = (encode_job *)mymalloc(sizeof(encode_job), M_STRUCT);
 
-    if (endp - inp) {
-	buffer << chars[inp[0] >> 2];
-	if (endp - inp == 2) {
-	    buffer << chars[((inp[0] & 0x03) << 4) | (inp[1] >> 4)];
-	    buffer << chars[(inp[1] & 0x0f) << 2];
-	} else {
-	    buffer << chars[(inp[0] & 0x03) << 4];
-	    if (!safe)
-		buffer << '=';
-	}
-	if (!safe)
-	    buffer << '=';
+	job->in = (char *)mymalloc(len, M_STRING);
+	memcpy(job->in, in, len);
+	job->len = len;
+	job->out = out;
+	job->chars = chars;
+	job->safe = safe;
+
+	return background_suspend("encode_base64", encode_work, encode_done, job);
     }
 
+    encode((const unsigned char *)in, len, out, chars, safe);
+
     /* return */
 
     Var ret;
 
     ret.type = TYPE_STR;
-    ret.v.str = str_dup(buffer.str().c_str());
-
-    free_var(arglist);
+    ret.v.str = out;
 
     return make_var_pack(ret);
 }
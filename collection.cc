@@ -15,13 +15,264 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include "my-string.h"
+
 #include "bf_register.h"
 #include "collection.h"
 #include "functions.h"
 #include "list.h"
 #include "map.h"
+#include "options.h"
+#include "server.h"
+#include "storage.h"
 #include "utils.h"
 
+/**** hashing values ****/
+
+/* Values hash consistently with equality(): strings hash without regard
+ * to case, so a test that does care about case still finds its candidates
+ * among the values that hash alike.
+ */
+
+static unsigned value_hash(Var v);
+
+static unsigned
+mix_hash(unsigned h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static int
+do_map_hash(Var key, Var value, void *data, int first)
+{
+    unsigned *h = (unsigned *)data;
+
+    *h = *h * 31 + value_hash(key);
+    *h = *h * 31 + value_hash(value);
+
+    return 0;
+}
+
+static unsigned
+value_hash(Var v)
+{
+    unsigned h = v.type;
+    int i;
+
+    switch (v.type) {
+    case TYPE_INT:
+	h = h * 31 + (unsigned) v.v.num;
+	break;
+    case TYPE_OBJ:
+	h = h * 31 + (unsigned) v.v.obj;
+	break;
+    case TYPE_ERR:
+	h = h * 31 + (unsigned) v.v.err;
+	break;
+    case TYPE_STR:
+	h = h * 31 + str_hash(v.v.str);
+	break;
+    case TYPE_FLOAT:
+	{
+	    double d = *v.v.fnum;
+	    unsigned parts[sizeof(double) / sizeof(unsigned)];
+
+	    if (d == 0.0)
+		d = 0.0;	/* -0.0 == 0.0 */
+	    memcpy(parts, &d, sizeof(double));
+	    for (i = 0; i < (int) (sizeof(parts) / sizeof(unsigned)); i++)
+		h = h * 31 + parts[i];
+	}
+	break;
+    case TYPE_LIST:
+	for (i = 1; i <= v.v.list[0].v.num; i++)
+	    h = h * 31 + value_hash(v.v.list[i]);
+	break;
+    case TYPE_MAP:
+	mapforeach(v, do_map_hash, &h);
+	break;
+    case TYPE_ANON:
+	h = h * 31 + (unsigned) (size_t) v.v.anon;
+	break;
+    default:
+	break;
+    }
+
+    return mix_hash(h);
+}
+
+/**** sets of values ****/
+
+/* An open-addressed hash table of pointers to values held elsewhere,
+ * sized when it is made for the most values it will hold.  Values that
+ * hash alike are probed in the order they were added, so a lookup finds
+ * the first of several equal values.
+ */
+
+typedef struct value_slot {
+    unsigned hash;
+    const Var *value;		/* 0 if the slot is empty */
+} value_slot;
+
+typedef struct value_set {
+    value_slot *slots;
+    unsigned mask;
+} value_set;
+
+static void
+value_set_init(value_set *set, int count)
+{
+    unsigned size = 8;
+
+    while (size < 2 * (unsigned) count)
+	size <<= 1;
+    set->slots = (value_slot *) mymalloc(size * sizeof(value_slot), M_ARRAY);
+    memset(set->slots, 0, size * sizeof(value_slot));
+    set->mask = size - 1;
+}
+
+static void
+value_set_free(value_set *set)
+{
+    myfree(set->slots, M_ARRAY);
+}
+
+static const Var *
+value_set_find(const value_set *set, Var v, unsigned hash, int case_matters)
+{
+    unsigned i;
+
+    for (i = hash & set->mask; set->slots[i].value; i = (i + 1) & set->mask)
+	if (set->slots[i].hash == hash
+	    && equality(v, *set->slots[i].value, case_matters))
+	    return set->slots[i].value;
+
+    return 0;
+}
+
+static void
+value_set_add(value_set *set, const Var *v, unsigned hash)
+{
+    unsigned i;
+
+    for (i = hash & set->mask; set->slots[i].value; i = (i + 1) & set->mask)
+	;
+    set->slots[i].hash = hash;
+    set->slots[i].value = v;
+}
+
+static void
+value_set_add_list(value_set *set, Var list)
+{
+    int i;
+
+    for (i = 1; i <= list.v.list[0].v.num; i++)
+	value_set_add(set, &list.v.list[i], value_hash(list.v.list[i]));
+}
+
+/**** membership indexes ****/
+
+#if MEMBER_INDEX_CACHE > 0
+
+/* The indexes of the lists most recently searched, and the lists searched
+ * once so far.  A list is only indexed the second time it is searched, so
+ * that lists built up and searched once along the way are not indexed at
+ * every step.
+ */
+
+typedef struct member_index {
+    Var list;			/* held by a reference */
+    value_set set;
+    unsigned last_used;
+} member_index;
+
+typedef struct searched_list {
+    const Var *list;		/* for comparison only; may be stale */
+    int length;
+    int indexable;
+} searched_list;
+
+static member_index member_indexes[MEMBER_INDEX_CACHE];
+static searched_list searched_lists[MEMBER_INDEX_CACHE];
+static unsigned member_clock, next_searched;
+
+static int
+indexable(Var list)
+{
+    int i;
+
+    for (i = 1; i <= list.v.list[0].v.num; i++)
+	switch (list.v.list[i].type) {
+	case TYPE_INT:
+	case TYPE_OBJ:
+	case TYPE_STR:
+	case TYPE_ERR:
+	case TYPE_FLOAT:
+	    break;
+	default:
+	    return 0;
+	}
+
+    return 1;
+}
+
+static member_index *
+find_member_index(Var list)
+{
+    member_index *index;
+    int i, length = list.v.list[0].v.num;
+
+    for (i = 0; i < MEMBER_INDEX_CACHE; i++)
+	if (member_indexes[i].list.v.list == list.v.list) {
+	    member_indexes[i].last_used = ++member_clock;
+	    return &member_indexes[i];
+	}
+
+    for (i = 0; i < MEMBER_INDEX_CACHE; i++)
+	if (searched_lists[i].list == list.v.list
+	    && searched_lists[i].length == length)
+	    break;
+    if (i == MEMBER_INDEX_CACHE) {
+	searched_lists[next_searched].list = list.v.list;
+	searched_lists[next_searched].length = length;
+	searched_lists[next_searched].indexable = 1;
+	next_searched = (next_searched + 1) % MEMBER_INDEX_CACHE;
+	return 0;
+    }
+    if (!searched_lists[i].indexable)
+	return 0;
+    if (!indexable(list)) {
+	searched_lists[i].indexable = 0;
+	return 0;
+    }
+    searched_lists[i].list = 0;
+
+    index = &member_indexes[0];
+    for (i = 1; i < MEMBER_INDEX_CACHE; i++)
+	if (member_indexes[i].last_used < index->last_used)
+	    index = &member_indexes[i];
+    if (index->list.v.list) {
+	free_var(index->list);
+	value_set_free(&index->set);
+    }
+
+    index->list = var_ref(list);
+    index->last_used = ++member_clock;
+    value_set_init(&index->set, length);
+    value_set_add_list(&index->set, list);
+
+    return index;
+}
+
+#endif /* MEMBER_INDEX_CACHE > 0 */
+
+/**** membership ****/
+
 struct ismember_data {
     int i;
     Var value;
@@ -47,6 +298,17 @@ ismember(Var lhs, Var rhs, int case_matters)
 {
     if (rhs.type == TYPE_LIST) {
 	int i;
+#if MEMBER_INDEX_CACHE > 0
+	member_index *index;
+
+	if (rhs.v.list[0].v.num >= MEMBER_INDEX_MIN
+	    && (index = find_member_index(rhs)) != 0) {
+	    const Var *found = value_set_find(&index->set, lhs, value_hash(lhs),
+					      case_matters);
+
+	    return found ? found - rhs.v.list : 0;
+	}
+#endif
 
 	for (i = 1; i <= rhs.v.list[0].v.num; i++) {
 	    if (equality(lhs, rhs.v.list[i], case_matters)) {
@@ -87,8 +349,216 @@ bf_is_member(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+static package
+make_space_pack()
+{
+    if (server_flag_option_cached(SVO_MAX_CONCAT_CATCHABLE))
+	return make_error_pack(E_QUOTA);
+    else
+	return make_abort_pack(ABORT_SECONDS);
+}
+
+/* The set functions treat their lists as sets of distinct values, compared
+ * as `in' compares them, and return the distinct values in the order they
+ * first appear in the arguments.
+ */
+
+static package
+make_set_pack(const Var **values, int count)
+{
+    Var r = new_list(count);
+    int i;
+
+    for (i = 0; i < count; i++)
+	r.v.list[i + 1] = var_ref(*values[i]);
+
+    if (value_bytes(r) <= server_int_option_cached(SVO_MAX_LIST_VALUE_BYTES))
+	return make_var_pack(r);
+    else {
+	free_var(r);
+	return make_space_pack();
+    }
+}
+
+static int
+all_lists(Var arglist)
+{
+    int i;
+
+    for (i = 1; i <= arglist.v.list[0].v.num; i++)
+	if (arglist.v.list[i].type != TYPE_LIST)
+	    return 0;
+
+    return 1;
+}
+
+/* Adds the values in LIST that are not in SEEN, nor left out by KEEP, to
+ * SEEN and VALUES.
+ */
+static void
+collect_values(Var list, value_set *seen, const Var **values, int *count,
+	       int (*keep)(Var v, unsigned hash, void *data), void *data)
+{
+    int i;
+
+    for (i = 1; i <= list.v.list[0].v.num; i++) {
+	const Var *v = &list.v.list[i];
+	unsigned hash = value_hash(*v);
+
+	if (value_set_find(seen, *v, hash, 0))
+	    continue;
+	value_set_add(seen, v, hash);
+	if (!keep || (*keep)(*v, hash, data))
+	    values[(*count)++] = v;
+    }
+}
+
+static package
+bf_unique(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list) */
+    Var list = arglist.v.list[1];
+    int count = 0, length = list.v.list[0].v.num;
+    const Var **values;
+    value_set seen;
+    package p;
+
+    values = (const Var **) mymalloc((length + 1) * sizeof(Var *), M_ARRAY);
+    value_set_init(&seen, length);
+    collect_values(list, &seen, values, &count, 0, 0);
+    p = make_set_pack(values, count);
+
+    value_set_free(&seen);
+    myfree(values, M_ARRAY);
+    free_var(arglist);
+    return p;
+}
+
+static package
+bf_union(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list, list, ...) */
+    int i, count = 0, length = 0;
+    const Var **values;
+    value_set seen;
+    package p;
+
+    if (!all_lists(arglist)) {
+	free_var(arglist);
+	return make_error_pack(E_TYPE);
+    }
+    for (i = 1; i <= arglist.v.list[0].v.num; i++)
+	length += arglist.v.list[i].v.list[0].v.num;
+
+    values = (const Var **) mymalloc((length + 1) * sizeof(Var *), M_ARRAY);
+    value_set_init(&seen, length);
+    for (i = 1; i <= arglist.v.list[0].v.num; i++)
+	collect_values(arglist.v.list[i], &seen, values, &count, 0, 0);
+    p = make_set_pack(values, count);
+
+    value_set_free(&seen);
+    myfree(values, M_ARRAY);
+    free_var(arglist);
+    return p;
+}
+
+struct other_sets {
+    value_set *sets;
+    int count;
+};
+
+static int
+in_all_sets(Var v, unsigned hash, void *data)
+{
+    struct other_sets *others = (struct other_sets *)data;
+    int i;
+
+    for (i = 0; i < others->count; i++)
+	if (!value_set_find(&others->sets[i], v, hash, 0))
+	    return 0;
+
+    return 1;
+}
+
+static int
+in_no_set(Var v, unsigned hash, void *data)
+{
+    return !value_set_find((value_set *)data, v, hash, 0);
+}
+
+static package
+bf_intersection(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list, list, ...) */
+    Var list = arglist.v.list[1];
+    int i, count = 0, length = list.v.list[0].v.num;
+    struct other_sets others;
+    const Var **values;
+    value_set seen;
+    package p;
+
+    if (!all_lists(arglist)) {
+	free_var(arglist);
+	return make_error_pack(E_TYPE);
+    }
+
+    others.count = arglist.v.list[0].v.num - 1;
+    others.sets = (value_set *) mymalloc((others.count + 1) * sizeof(value_set),
+					 M_ARRAY);
+    for (i = 0; i < others.count; i++) {
+	value_set_init(&others.sets[i], arglist.v.list[i + 2].v.list[0].v.num);
+	value_set_add_list(&others.sets[i], arglist.v.list[i + 2]);
+    }
+
+    values = (const Var **) mymalloc((length + 1) * sizeof(Var *), M_ARRAY);
+    value_set_init(&seen, length);
+    collect_values(list, &seen, values, &count, in_all_sets, &others);
+    p = make_set_pack(values, count);
+
+    value_set_free(&seen);
+    myfree(values, M_ARRAY);
+    for (i = 0; i < others.count; i++)
+	value_set_free(&others.sets[i]);
+    myfree(others.sets, M_ARRAY);
+    free_var(arglist);
+    return p;
+}
+
+static package
+bf_diff(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list, list, ...) */
+    Var list = arglist.v.list[1];
+    int i, count = 0, length = list.v.list[0].v.num, other_length = 0;
+    const Var **values;
+    value_set seen, others;
+    package p;
+
+    if (!all_lists(arglist)) {
+	free_var(arglist);
+	return make_error_pack(E_TYPE);
+    }
+
+    for (i = 2; i <= arglist.v.list[0].v.num; i++)
+	other_length += arglist.v.list[i].v.list[0].v.num;
+    value_set_init(&others, other_length);
+    for (i = 2; i <= arglist.v.list[0].v.num; i++)
+	value_set_add_list(&others, arglist.v.list[i]);
+
+    values = (const Var **) mymalloc((length + 1) * sizeof(Var *), M_ARRAY);
+    value_set_init(&seen, length);
+    collect_values(list, &seen, values, &count, in_no_set, &others);
+    p = make_set_pack(values, count);
+
+    value_set_free(&seen);
+    value_set_free(&others);
+    myfree(values, M_ARRAY);
+    free_var(arglist);
+    return p;
+}
+
 void
 register_collection(void)
 {
     register_function("is_member", 2, 2, bf_is_member, TYPE_ANY, TYPE_ANY);
+    register_function("unique", 1, 1, bf_unique, TYPE_LIST);
+    register_function("union", 1, -1, bf_union, TYPE_LIST);
+    register_function("intersection", 1, -1, bf_intersection, TYPE_LIST);
+    register_function("diff", 1, -1, bf_diff, TYPE_LIST);
 }
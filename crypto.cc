@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "background.h"
 #include "functions.h"
 #include "crypto.h"
 #include "list.h"
@@ -40,6 +41,7 @@
 #include "nettle/ripemd160.h"
 #include "nettle/sha1.h"
 #include "nettle/sha2.h"
+#include "options.h"
 #include "random.h"
 #include "server.h"
 #include "storage.h"
@@ -168,24 +170,24 @@ parse_prefix(const char *prefix, size_t prefix_length,
 
 static char digits[] = "0123456789ABCDEF";
 
+/* The digest functions only write into RESULT (which must have room for
+ * 64 bytes) and return the digest length, so that they can run on a
+ * background thread; hex_digest() turns the result into a MOO string.
+ */
+typedef int (*digest_function) (const char *input, int length,
+				const char *key, int key_length,
+				unsigned char *result);
+
 #define DEF_HASH(algo, size)							\
-static const char *								\
-algo##_hash_bytes(const char *input, int length, int binary)			\
+static int									\
+algo##_hash_bytes(const char *input, int length,				\
+		  const char *key, int key_length, unsigned char *result)	\
 {										\
     algo##_ctx context;								\
-    unsigned char result[size];							\
-    char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);	\
-    const char *answer = hex;							\
     algo##_init(&context);							\
     algo##_update(&context, length, (unsigned char *)input);			\
     algo##_digest(&context, size, result);					\
-    for (int i = 0; i < size; i++) {						\
-	if (binary) *hex++ = '~';						\
-	*hex++ = digits[result[i] >> 4];					\
-	*hex++ = digits[result[i] & 0xF];					\
-    }										\
-    *hex = 0;									\
-    return answer;								\
+    return size;								\
 }
 
 DEF_HASH(md5, 16)
@@ -199,23 +201,15 @@ DEF_HASH(ripemd160, 20)
 #undef DEF_HASH
 
 #define DEF_HMAC(algo, size)										\
-static const char *											\
-algo##_bytes(const char *message, int message_length, const char *key, int key_length, int binary)	\
+static int												\
+algo##_bytes(const char *message, int message_length,							\
+	     const char *key, int key_length, unsigned char *result)					\
 {													\
     algo##_ctx context;											\
-    unsigned char result[size];										\
-    char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);				\
-    const char *answer = hex;										\
     algo##_set_key(&context, key_length, (unsigned char *)key);						\
     algo##_update(&context, message_length, (unsigned char *)message);					\
     algo##_digest(&context, size, result);								\
-    for (int i = 0; i < size; i++) {									\
-	if (binary) *hex++ = '~';									\
-	*hex++ = digits[result[i] >> 4];								\
-	*hex++ = digits[result[i] & 0xF];								\
-    }													\
-    *hex = 0;												\
-    return answer;											\
+    return size;											\
 }
 
 DEF_HMAC(hmac_sha1, 20)
@@ -223,6 +217,88 @@ DEF_HMAC(hmac_sha256, 32)
 
 #undef DEF_HMAC
 
+static Var
+hex_digest(const unsigned char *result, int size, int binary)
+{
+    char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);
+    Var r;
+
+    r.type = TYPE_STR;
+    r.v.str = hex;
+    for (int i = 0; i < size; i++) {
+	if (binary) *hex++ = '~';
+	*hex++ = digits[result[i] >> 4];
+	*hex++ = digits[result[i] & 0xF];
+    }
+    *hex = 0;
+
+    return r;
+}
+
+struct digest_job {
+    digest_function digest;
+    char *input;
+    int length;
+    char *key;
+    int key_length;
+    int binary;
+    unsigned char result[64];
+    int size;
+};
+
+static void
+digest_work(void *data)
+{
+    digest_job *job = (digest_job *)data;
+
+    job->size = (*job->digest) (job->input, job->length,
+				job->key, job->key_length, job->result);
+}
+
+static Var
+digest_done(void *data)
+{
+    digest_job *job = (digest_job *)data;
+    Var r = hex_digest(job->result, job->size, job->binary);
+
+    myfree(job->input, M_STRING);
+    if (job->key)
+	myfree(job->key, M_STRING);
+    myfree(job, M_STRUCT);
+
+    return r;
+}
+
+/* Small inputs are digested right away; large ones are copied and handed
+ * to a background thread.
+ */
+static package
+digest_pack(digest_function digest, const char *input, int length,
+	    const char *key, int key_length, int binary)
+{
+    if (length < BACKGROUND_MIN_BYTES) {
+	unsigned char result[64];
+	int size = (*digest) (input, length, key, key_length, result);
+	return make_var_pack(hex_digest(result, size, binary));
+    }
+
+    digest_job *job = (digest_job *)mymalloc(sizeof(digest_job), M_STRUCT);
+
+    job->digest = digest;
+    job->input = (char *)mymalloc(length, M_STRING);
+    memcpy(job->input, input, length);
+    job->length = length;
+    if (key) {
+	job->key = (char *)mymalloc(key_length ? key_length : 1, M_STRING);
+	memcpy(job->key, key, key_length);
+    } else
+	job->key = 0;
+    job->key_length = key_length;
+    job->binary = binary;
+
+    return background_suspend(key ? "hmac" : "hash", digest_work, digest_done, job);
+}
+
 /**** built in functions ****/
 
 static package
@@ -297,6 +373,46 @@ bf_salt(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+/* Blowfish is slow on purpose, so it always runs in the background. */
+struct bcrypt_job {
+    const char *key;
+    const char *salt;
+    char output[64];
+    int failed;
+};
+
+static void
+bcrypt_work(void *data)
+{
+    bcrypt_job *job = (bcrypt_job *)data;
+
+    errno = 0;
+    job->failed = !_crypt_blowfish_rn(job->key, job->salt,
+				      job->output, sizeof(job->output))
+		  || errno;
+}
+
+static Var
+bcrypt_done(void *data)
+{
+    bcrypt_job *job = (bcrypt_job *)data;
+    Var r;
+
+    if (job->failed) {
+	r.type = TYPE_ERR;
+	r.v.err = E_INVARG;
+    } else {
+	r.type = TYPE_STR;
+	r.v.str = str_dup(job->output);
+    }
+
+    free_str(job->key);
+    free_str(job->salt);
+    myfree(job, M_STRUCT);
+
+    return r;
+}
+
 static package
 bf_crypt(Var arglist, Byte next, void *vdata, Objid progr)
 {				/* (string, [salt]) */
@@ -346,18 +462,14 @@ bf_crypt(Var arglist, Byte next, void *vdata, Objid progr)
     }
 
     if (BCRYPT == format) {
-	errno = 0;
+	bcrypt_job *job = (bcrypt_job *)mymalloc(sizeof(bcrypt_job), M_STRUCT);
 
-	char output[64];
-	char *ret = _crypt_blowfish_rn(arglist.v.list[1].v.str, salt, output, sizeof(output));
+	job->key = str_ref(arglist.v.list[1].v.str);
+	job->salt = str_dup(salt);
 
-	if (errno) {
-	    free_var(arglist);
-	    return make_error_pack(E_INVARG);
-	}
+	free_var(arglist);
 
-	r.type = TYPE_STR;
-	r.v.str = str_dup(ret);
+	return background_suspend("crypt", bcrypt_work, bcrypt_done, job);
     }
     else {
 #if HAVE_CRYPT
@@ -389,7 +501,7 @@ make_space_pack()
 static package
 bf_string_hash(Var arglist, Byte next, void *vdata, Objid progr)
 {
-    Var r;
+    package p;
     int nargs = arglist.v.list[0].v.num;
     const char *str = arglist.v.list[1].v.str;
     const char *algo = (1 < nargs) ? arglist.v.list[2].v.str : "sha256";
@@ -397,8 +509,8 @@ bf_string_hash(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)							\
     op (!mystrcasecmp(#temp, algo)) {					\
-        r.type = TYPE_STR;						\
-        r.v.str = temp##_hash_bytes(str, memo_strlen(str), binary);	\
+        p = digest_pack(temp##_hash_bytes, str, memo_strlen(str),	\
+                        0, 0, binary);					\
     }
 
     CASE(if, md5)
@@ -416,7 +528,7 @@ bf_string_hash(Var arglist, Byte next, void *vdata, Objid progr)
 #undef CASE
 
     free_var(arglist);
-    return make_var_pack(r);
+    return p;
 }
 
 static package
@@ -426,7 +538,6 @@ bf_binary_hash(Var arglist, Byte next, void *vdata, Objid progr)
 
     TRY_STREAM;
     try {
-	Var r;
 	int length;
 	int nargs = arglist.v.list[0].v.num;
 	const char *bytes = binary_to_raw_bytes(arglist.v.list[1].v.str, &length);
@@ -435,9 +546,8 @@ bf_binary_hash(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)							\
 	op (!mystrcasecmp(#temp, algo)) {				\
-	    r.type = TYPE_STR;						\
-	    r.v.str = temp##_hash_bytes(bytes, length, binary);		\
-	    p = make_var_pack(r);					\
+	    p = digest_pack(temp##_hash_bytes, bytes, length,		\
+			    0, 0, binary);				\
 	}
 
 	if (!bytes) {
@@ -474,7 +584,6 @@ bf_value_hash(Var arglist, Byte next, void *vdata, Objid progr)
 
     TRY_STREAM;
     try {
-	Var r;
 	int nargs = arglist.v.list[0].v.num;
 	const char *algo = (1 < nargs) ? arglist.v.list[2].v.str : "sha256";
 	int binary = (2 < nargs) ? is_true(arglist.v.list[3]) : 0;
@@ -483,9 +592,8 @@ bf_value_hash(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)									\
 	op (!mystrcasecmp(#temp, algo)) {						\
-	    r.type = TYPE_STR;								\
-	    r.v.str = temp##_hash_bytes(stream_contents(s), stream_length(s), binary);	\
-	    p = make_var_pack(r);							\
+	    p = digest_pack(temp##_hash_bytes, stream_contents(s), stream_length(s),	\
+			    0, 0, binary);						\
 	}
 
 	CASE(if, md5)
@@ -520,8 +628,6 @@ bf_string_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
     TRY_STREAM;
     try {
-	Var r;
-
 	int nargs = arglist.v.list[0].v.num;
 	const char *algo = (2 < nargs) ? arglist.v.list[3].v.str : "sha256";
 	int binary = (3 < nargs) ? is_true(arglist.v.list[4]) : 0;
@@ -542,9 +648,8 @@ bf_string_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)										\
 	    op (!mystrcasecmp(#temp, algo)) {							\
-		r.type = TYPE_STR;								\
-		r.v.str = hmac_##temp##_bytes(str, str_length, key, key_length, binary);	\
-		p = make_var_pack(r);								\
+		p = digest_pack(hmac_##temp##_bytes, str, str_length,				\
+				key, key_length, binary);					\
 	    }
 
 	    CASE(if, sha1)
@@ -576,8 +681,6 @@ bf_binary_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
     TRY_STREAM;
     try {
-	Var r;
-
 	int nargs = arglist.v.list[0].v.num;
 	const char *algo = (2 < nargs) ? arglist.v.list[3].v.str : "sha256";
 	int binary = (3 < nargs) ? is_true(arglist.v.list[4]) : 0;
@@ -607,9 +710,8 @@ bf_binary_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)											\
 		op (!mystrcasecmp(#temp, algo)) {							\
-		    r.type = TYPE_STR;									\
-		    r.v.str = hmac_##temp##_bytes(bytes, bytes_length, key, key_length, binary);	\
-		    p = make_var_pack(r);								\
+		    p = digest_pack(hmac_##temp##_bytes, bytes, bytes_length,				\
+				    key, key_length, binary);						\
 		}
 
 		CASE(if, sha1)
@@ -643,8 +745,6 @@ bf_value_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
     TRY_STREAM;
     try {
-	Var r;
-
 	int nargs = arglist.v.list[0].v.num;
 	const char *algo = (2 < nargs) ? arglist.v.list[3].v.str : "sha256";
 	int binary = (3 < nargs) ? is_true(arglist.v.list[4]) : 0;
@@ -667,9 +767,8 @@ bf_value_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
 #define CASE(op, temp)										\
 	    op (!mystrcasecmp(#temp, algo)) {							\
-		r.type = TYPE_STR;								\
-		r.v.str = hmac_##temp##_bytes(lit, lit_length, key, key_length, binary);	\
-		p = make_var_pack(r);								\
+		p = digest_pack(hmac_##temp##_bytes, lit, lit_length,				\
+				key, key_length, binary);					\
 	    }
 
 	    CASE(if, sha1)
@@ -60,6 +60,12 @@ extern int db_initialize(int *pargc, char ***pargv);
 				 * database args were valid.
 				 */
 
+extern void db_set_dump_format(int binary);
+				/* Selects the binary (true) or text (false)
+				 * format for database dumps.  By default the
+				 * dumps use the format of the input database.
+				 */
+
 extern int db_load(void);
 				/* Does any necessary long-running preparations
 				 * of the database, such as loading significant
@@ -83,6 +89,18 @@ extern int db_flush(enum db_flush_type);
 				 * argument.  Returns true on success.
 				 */
 
+extern int db_flush_pending(void);
+				/* Returns true if the database has output
+				 * waiting that the next db_flush() will do
+				 * some of, so the server shouldn't sit idle.
+				 */
+
+extern void db_checkpoint_finished(int success);
+				/* Tells the database that the checkpoint most
+				 * recently begun by a forked server has
+				 * finished, successfully or not.
+				 */
+
 extern int32 db_disk_size(void);
 				/* Return the total size, in bytes, of the most
 				 * recent full representation of the database
@@ -393,7 +411,9 @@ enum bi_prop {
 typedef struct {
     enum bi_prop built_in;	/* true iff property is a built-in one */
     void *definer;		/* null iff property is a built-in one */
+    void *object;		/* the object the value is stored on */
     void *ptr;			/* null iff property not found */
+    int index;			/* of the value in the object's values */
 } db_prop_handle;
 
 extern db_prop_handle db_find_property(Var obj, const char *name,
@@ -475,6 +495,28 @@ extern int db_is_property_built_in(db_prop_handle);
 				/* Returns true iff the property is a built-in
 				 * property.
 				 */
+
+extern void db_clear_property_watches(void);
+extern void db_watch_properties(Objid oid);
+				/* Watches the values of all properties on OID
+				 * and on each of its ancestors.
+				 */
+extern void db_watch_property(Objid oid, const char *name);
+				/* Watches the value of the named property on
+				 * OID, if there is one.
+				 */
+extern int db_property_watches_triggered(void);
+				/* Returns true iff, since the last call to
+				 * `db_clear_property_watches()', a watched
+				 * property value has been written, or the
+				 * properties defined on or inherited by a
+				 * watched object (or the object itself) have
+				 * changed in any way.  This is meant for
+				 * invalidating caches of things like
+				 * $server_options; it is cheap to call, but
+				 * it is not meant for watching very many
+				 * objects.
+				 */
 
 
 /**** verbs ****/
@@ -637,7 +679,9 @@ extern void db_set_verb_program(db_verb_handle, Program *);
 				/* These functions do not change the reference
 				 * count of the program they accept/return.
 				 * Thus, the caller should program_ref() it if
-				 * it is to be persistent.
+				 * it is to be persistent.  A verb whose code,
+				 * as read from the DB, does not parse has a
+				 * program that raises E_INVARG.
 				 */
 
 extern void db_verb_arg_specs(db_verb_handle h,
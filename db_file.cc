@@ -19,8 +19,14 @@
  * Routines for initializing, loading, dumping, and shutting down the database
  *****************************************************************************/
 
+#include <sys/mman.h>
+
 #include "my-stat.h"
+#include "my-string.h"
+#include "my-sys-time.h"
 #include "my-unistd.h"
+#include "my-signal.h"
+#include "my-wait.h"
 #include "my-stdio.h"
 #include "my-stdlib.h"
 
@@ -31,6 +37,8 @@
 #include "db_private.h"
 #include "list.h"
 #include "log.h"
+#include "lz4/lz4.h"
+#include "map.h"
 #include "options.h"
 #include "server.h"
 #include "storage.h"
@@ -47,6 +55,11 @@ static const char *header_format_string
   = "** LambdaMOO Database, Format Version %u **\n";
 
 DB_Version dbio_input_version;
+
+static int reading_binary, writing_binary;
+static int name_table;		/* names go through the string table */
+static int writing_shard;	/* in a worker; see write_shards() */
+static int binary_dumps = -1;	/* -1: same format as the input DB */
 
 
 /*********** Format version 4 support ***********/
@@ -168,23 +181,185 @@ dbv4_count_properties(Objid oid)
  * dbpriv_set_dbio_input
  */
 
+/*********** Binary format support ***********/
+
+/*
+ * A binary DB starts with BINARY_MAGIC followed by a fixed-size header:
+ * the layout version, the DB_Version of the contents, and the file offset
+ * of each section below, all as eight-byte little-endian numbers.
+ *
+ * The users, objects and programs sections use the binary encoding of
+ * the dbio_write_*() routines.  Verb and property names are written as
+ * indices into the string table, which holds each distinct name once.
+ * Values pending finalization and the active connections are written by
+ * their owners with dbio_printf(), so they are kept as an embedded text
+ * section in exactly the text format.
+ *
+ * The task queue has a binary section of its own (see write_task_queue()),
+ * in which each program and each shared list or map is written only once.
+ * Layout 1 files, which carry it in the text section instead and have no
+ * BS_TASKS entry in the header, can still be read.
+ */
+
+static const char binary_magic[] = "** LambdaMOO Binary Database **\n";
+
+#define BINARY_DB_LAYOUT 2
+
+enum {
+    BS_USERS, BS_TEXT, BS_TASKS, BS_OBJECTS, BS_PROGRAMS, BS_STRINGS, BS_END,
+    Num_Binary_Sections
+};
+
+/* String table, as built while writing ... */
+static const char **names;
+static int num_names = 0, max_names = 0;
+static int *name_slots;		/* open hash of index + 1 into `names' */
+static int num_name_slots = 0;
+
+/* ... and as read while loading. */
+static const char **loaded_names;
+static int num_loaded_names = 0;
+
+/* str_hash() leaves similar names in neighbouring slots, which makes long
+ * runs for linear probing, so its bits are mixed before use.
+ */
+static inline unsigned
+name_hash(const char *name)
+{
+    unsigned h = str_hash(name);
+
+    h = (h ^ (h >> 16)) * 0x45d9f3b;
+    return h ^ (h >> 16);
+}
+
+static void
+rehash_names(int size)
+{
+    int i, j;
+
+    if (name_slots)
+	myfree(name_slots, M_STRUCT);
+    name_slots = (int *)mymalloc(size * sizeof(int), M_STRUCT);
+    num_name_slots = size;
+    memset(name_slots, 0, size * sizeof(int));
+
+    for (i = 0; i < num_names; i++) {
+	for (j = name_hash(names[i]) & (size - 1);
+	     name_slots[j];
+	     j = (j + 1) & (size - 1))
+	    ;
+	name_slots[j] = i + 1;
+    }
+}
+
+static int
+name_index(const char *name)
+{
+    int i;
+
+    if (num_names * 2 >= num_name_slots)
+	rehash_names(num_name_slots ? num_name_slots * 2 : 1024);
+
+    for (i = name_hash(name) & (num_name_slots - 1);
+	 name_slots[i];
+	 i = (i + 1) & (num_name_slots - 1))
+	if (!strcmp(names[name_slots[i] - 1], name))
+	    return name_slots[i] - 1;
+
+    if (num_names == max_names) {
+	const char **_new;
+
+	max_names = max_names ? max_names * 2 : 1024;
+	_new = (const char **)mymalloc(max_names * sizeof(const char *), M_STRUCT);
+	if (names) {
+	    memcpy(_new, names, num_names * sizeof(const char *));
+	    myfree(names, M_STRUCT);
+	}
+	names = _new;
+    }
+    names[num_names] = name;
+    name_slots[i] = ++num_names;
+
+    return num_names - 1;
+}
+
+static void
+free_names(void)
+{
+    int i;
+
+    if (names)
+	myfree(names, M_STRUCT);
+    if (name_slots)
+	myfree(name_slots, M_STRUCT);
+    names = 0;
+    name_slots = 0;
+    num_names = max_names = num_name_slots = 0;
+
+    for (i = 0; i < num_loaded_names; i++)
+	free_str(loaded_names[i]);
+    if (loaded_names)
+	myfree(loaded_names, M_STRUCT);
+    loaded_names = 0;
+    num_loaded_names = 0;
+}
+
+static const char *
+read_name(void)
+{
+    int i;
+
+    if (!name_table)
+	return dbio_read_string_intern();
+
+    i = dbio_read_num();
+    if (i < 0 || i >= num_loaded_names) {
+	errlog("READ_NAME: Bad string table index: %d\n", i);
+	return str_dup("");
+    }
+    return str_ref(loaded_names[i]);
+}
+
+static void
+write_name(const char *name)
+{
+    if (name_table)
+	dbio_write_num(name_index(name ? name : ""));
+    else
+	dbio_write_string(name);
+}
+
+static void
+write_binary_header(const long *sections)
+{
+    int i;
+
+    dbpriv_dbio_write_fixed(BINARY_DB_LAYOUT);
+    dbpriv_dbio_write_fixed(current_db_version);
+    for (i = 0; i < Num_Binary_Sections; i++)
+	dbpriv_dbio_write_fixed(sections[i]);
+}
+
+
 /*********** Verb and property I/O ***********/
 
 static void
 read_verbdef(Verbdef * v)
 {
-    v->name = dbio_read_string_intern();
+    v->name = read_name();
     v->owner = dbio_read_objid();
     v->perms = dbio_read_num();
     v->prep = dbio_read_num();
     v->next = 0;
     v->program = 0;
+    v->source = 0;
+    v->unparsable = 0;
 }
 
 static void
 write_verbdef(Verbdef * v)
 {
-    dbio_write_string(v->name);
+    write_name(v->name);
     dbio_write_objid(v->owner);
     dbio_write_num(v->perms);
     dbio_write_num(v->prep);
@@ -193,14 +368,14 @@ write_verbdef(Verbdef * v)
 static Propdef
 read_propdef()
 {
-    const char *name = dbio_read_string_intern();
+    const char *name = read_name();
     return dbpriv_new_propdef(name);
 }
 
 static void
 write_propdef(Propdef * p)
 {
-    dbio_write_string(p->name);
+    write_name(p->name);
 }
 
 static void
@@ -295,39 +470,13 @@ v4_read_object(void)
     return 1;
 }
 
-static int
-ng_read_object(int anonymous)
+static void
+read_object_body(Object *o)
 {
-    Objid oid;
-    Object *o;
-    char s[20];
     int i;
     Verbdef *v, **prevv;
     int nprops;
 
-    if (dbio_scanf("#%d", &oid) != 1)
-	return 0;
-    dbio_read_line(s, sizeof(s));
-
-    if (strcmp(s, " recycled\n") == 0) {
-	dbpriv_new_recycled_object();
-	return 1;
-    } else if (strcmp(s, "\n") != 0)
-	return 0;
-
-    /* At the point at which we're reading anonymous objects, we know
-     * we've already created all of the anonymous objects (they were
-     * created from references in tasks, other objects or the list
-     * of values pending finalization).
-     */
-    if (anonymous) {
-	o = dbpriv_find_object(oid);
-    }
-    else {
-	o = dbpriv_new_object();
-	dbpriv_assign_nonce(o);
-    }
-
     o->name = dbio_read_string_intern();
     o->flags = dbio_read_num();
 
@@ -364,6 +513,7 @@ ng_read_object(int anonymous)
 	}
     }
 
+    o->shared_layout = o->anon_layout = 0;
     o->nval = nprops = dbio_read_num();
     if (nprops)
 	o->propval = (Pval *)mymalloc(nprops * sizeof(Pval), M_PVAL);
@@ -373,6 +523,47 @@ ng_read_object(int anonymous)
     for (i = 0; i < nprops; i++) {
 	read_propval(o->propval + i);
     }
+}
+
+static int
+ng_read_object(int anonymous)
+{
+    Objid oid;
+    Object *o;
+    char s[20];
+
+    if (reading_binary) {
+	oid = dbio_read_objid();
+	if (!dbio_read_num()) {
+	    dbpriv_new_recycled_object();
+	    return 1;
+	}
+    } else {
+	if (dbio_scanf("#%d", &oid) != 1)
+	    return 0;
+	dbio_read_line(s, sizeof(s));
+
+	if (strcmp(s, " recycled\n") == 0) {
+	    dbpriv_new_recycled_object();
+	    return 1;
+	} else if (strcmp(s, "\n") != 0)
+	    return 0;
+    }
+
+    /* At the point at which we're reading anonymous objects, we know
+     * we've already created all of the anonymous objects (they were
+     * created from references in tasks, other objects or the list
+     * of values pending finalization).
+     */
+    if (anonymous) {
+	o = dbpriv_find_object(oid);
+    }
+    else {
+	o = dbpriv_new_object();
+	dbpriv_assign_nonce(o);
+    }
+
+    read_object_body(o);
 
     return 1;
 }
@@ -425,20 +616,12 @@ v4_write_object(Objid oid)
 }
 
 static void
-ng_write_object(Objid oid)
+write_object_body(Object *o)
 {
-    Object *o;
     Verbdef *v;
     int i;
     int nverbdefs, nprops;
 
-    if (!valid(oid)) {
-	dbio_printf("#%d recycled\n", oid);
-	return;
-    }
-    o = dbpriv_find_object(oid);
-
-    dbio_printf("#%d\n", oid);
     dbio_write_string(o->name);
     dbio_write_num(o->flags);
 
@@ -468,6 +651,37 @@ ng_write_object(Objid oid)
 }
 
 
+/* O is null if OID is recycled. */
+static void
+ng_write_object(Objid oid, Object *o)
+{
+    if (writing_binary) {
+	dbio_write_objid(oid);
+	dbio_write_num(o != 0);
+	if (!o)
+	    return;
+    } else if (!o) {
+	dbio_printf("#%d recycled\n", oid);
+	return;
+    } else
+	dbio_printf("#%d\n", oid);
+
+    write_object_body(o);
+}
+
+/* A verb that has not been compiled since it was read is written back out
+ * from its source text.
+ */
+static void
+write_verb_program(Verbdef *v)
+{
+    if (v->source)
+	dbio_write_program_text(v->source);
+    else if (v->program)
+	dbio_write_program(v->program);
+}
+
+
 /*********** File-level Input ***********/
 
 static int
@@ -862,6 +1076,42 @@ fmt_verb_name(void *data)
     return reset_stream(s);
 }
 
+static int
+read_verb_program(Objid oid, int vnum)
+{
+    db_verb_handle h;
+    Program *program;
+
+    if (!valid(oid)) {
+	errlog("READ_DB_FILE: Verb for non-existant object: #%d:%d.\n", oid, vnum);
+	return 0;
+    }
+    h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);	/* DB file is 0-based. */
+    if (!h.ptr) {
+	errlog("READ_DB_FILE: Unknown verb index: #%d:%d.\n", oid, vnum);
+	return 0;
+    }
+#ifdef DEFER_VERB_COMPILATION
+    if (dbio_input_version == current_db_version) {
+	const char *source = dbio_read_program_text(fmt_verb_name, &h);
+
+	if (!source) {
+	    errlog("READ_DB_FILE: Unparsable program #%d:%d.\n", oid, vnum);
+	    return 0;
+	}
+	dbpriv_set_verb_source(h, source);
+	return 1;
+    }
+#endif
+    program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
+    if (!program) {
+	errlog("READ_DB_FILE: Unparsable program #%d:%d.\n", oid, vnum);
+	return 0;
+    }
+    db_set_verb_program(h, program);
+    return 1;
+}
+
 static int
 read_db_file(void)
 {
@@ -869,8 +1119,6 @@ read_db_file(void)
     int nobjs, nprogs, nusers;
     Var user_list;
     int i, vnum, dummy;
-    db_verb_handle h;
-    Program *program;
 
     if (dbio_scanf(header_format_string, &dbio_input_version) != 1)
 	dbio_input_version = DBV_Prehistory;
@@ -1011,21 +1259,8 @@ read_db_file(void)
 	    errlog("READ_DB_FILE: Bad program header, i = %d.\n", i);
 	    return 0;
 	}
-	if (!valid(oid)) {
-	    errlog("READ_DB_FILE: Verb for non-existant object: #%d:%d.\n", oid, vnum);
-	    return 0;
-	}
-	h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);	/* DB file is 0-based. */
-	if (!h.ptr) {
-	    errlog("READ_DB_FILE: Unknown verb index: #%d:%d.\n", oid, vnum);
+	if (!read_verb_program(oid, vnum))
 	    return 0;
-	}
-	program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
-	if (!program) {
-	    errlog("READ_DB_FILE: Unparsable program #%d:%d.\n", oid, vnum);
-	    return 0;
-	}
-	db_set_verb_program(h, program);
 	if (i % 5000 == 0 || i == nprogs)
 	    oklog("LOADING: Done reading %d verb programs ...\n", i);
     }
@@ -1049,102 +1284,1580 @@ read_db_file(void)
 
     return 1;
 }
-
-
-/*********** File-level Output ***********/
 
 static int
-write_db_file(const char *reason)
+read_binary_db_file(FILE *f, const char *image, size_t size)
 {
-    Objid oid;
-    Objid last_oid = db_last_used_objid(), max_oid = -1;
-    int nprogs = 0;
-    Verbdef *v;
+    long sections[Num_Binary_Sections], prev;
+    int layout, nobjs, nprogs, nusers, nnames;
     Var user_list;
-    int i;
-    volatile int success = 1;
-
-    try {
-	dbio_printf(header_format_string, current_db_version);
-
-	user_list = db_all_users();
+    Objid oid;
+    int i, vnum, anonymous;
 
-	dbio_printf("%d\n", listlength(user_list));
+    dbpriv_set_dbio_input_buffer(image, size);
+    dbpriv_dbio_input_seek(sizeof(binary_magic) - 1);
 
-	for (i = 1; i <= user_list.v.list[0].v.num; i++)
-	    dbio_write_objid(user_list.v.list[i].v.obj);
+    if ((layout = dbpriv_dbio_read_fixed()) != BINARY_DB_LAYOUT
+	&& layout != 1) {
+	errlog("READ_DB_FILE: Unknown binary DB layout: %d\n", layout);
+	return 0;
+    }
+    dbio_input_version = (DB_Version) dbpriv_dbio_read_fixed();
+    if (!check_db_version(dbio_input_version)
+	|| dbio_input_version < DBV_Anon) {
+	errlog("READ_DB_FILE: Unknown DB version number: %d\n",
+	       dbio_input_version);
+	return 0;
+    }
+    for (i = 0, prev = 0; i < Num_Binary_Sections; i++) {
+	if (i == BS_TASKS && layout == 1) {
+	    sections[i] = -1;	/* tasks are in the text section */
+	    continue;
+	}
+	sections[i] = dbpriv_dbio_read_fixed();
+	if (sections[i] < dbpriv_dbio_input_position()
+	    || sections[i] < prev
+	    || sections[i] > (long) size) {
+	    errlog("READ_DB_FILE: Bad binary DB section table\n");
+	    return 0;
+	}
+	prev = sections[i];
+    }
+    if (sections[BS_END] != (long) size) {
+	errlog("READ_DB_FILE: Binary DB is truncated\n");
+	return 0;
+    }
 
-	oklog("%s: Writing values pending finalization ...\n", reason);
-	write_values_pending_finalization();
+    dbpriv_dbio_input_seek(sections[BS_STRINGS]);
+    nnames = dbio_read_num();
+    if (nnames < 0) {
+	errlog("READ_DB_FILE: Bad string table\n");
+	return 0;
+    }
+    loaded_names = (const char **)mymalloc((nnames ? nnames : 1) * sizeof(const char *), M_STRUCT);
+    for (i = 0; i < nnames; i++)
+	loaded_names[num_loaded_names++] = str_intern(dbio_read_string());
 
-	oklog("%s: Writing forked and suspended tasks ...\n", reason);
-	write_task_queue();
+    dbpriv_dbio_input_seek(sections[BS_USERS]);
+    nusers = dbio_read_num();
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+	user_list.v.list[i].type = TYPE_OBJ;
+	user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    dbpriv_set_all_users(user_list);
 
-	oklog("%s: Writing list of formerly active connections ...\n", reason);
-	write_active_connections();
+    /* The text section is read through stdio, exactly as in a text DB. */
+    fseek(f, sections[BS_TEXT], SEEK_SET);
+    dbpriv_set_dbio_input(f);
 
-	while (last_oid > max_oid) {
-	    dbio_printf("%d\n", last_oid - max_oid);
+    oklog("LOADING: Reading values pending finalization ...\n");
+    if (!read_values_pending_finalization()) {
+	errlog("READ_DB_FILE: Can't read values pending finalization.\n");
+	return 0;
+    }
 
-	    oklog("%s: Writing %d objects ...\n", reason, last_oid - max_oid);
-	    for (oid = max_oid + 1; oid <= last_oid; oid++) {
-		ng_write_object(oid);
-		if ((oid + 1) % 10000 == 0 || oid == last_oid)
-		    oklog("%s: Done writing %d objects ...\n", reason, last_oid - max_oid);
-	    }
-	    max_oid = last_oid;
-	    last_oid = db_last_used_objid();
+    if (sections[BS_TASKS] < 0) {
+	oklog("LOADING: Reading forked and suspended tasks ...\n");
+	if (!read_task_queue()) {
+	    errlog("READ_DB_FILE: Can't read task queue.\n");
+	    return 0;
 	}
+    }
 
-	dbio_printf("%d\n", 0);
+    oklog("LOADING: Reading list of formerly active connections ...\n");
+    if (!read_active_connections()) {
+	errlog("DB_READ: Can't read active connections.\n");
+	return 0;
+    }
 
-	for (oid = 0; oid <= max_oid; oid++) {
-	    if (valid(oid))
-		for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next)
-		    if (v->program)
-			nprogs++;
+    dbpriv_set_dbio_input_buffer(image, size);
+
+    if (sections[BS_TASKS] >= 0) {
+	dbpriv_dbio_input_seek(sections[BS_TASKS]);
+	oklog("LOADING: Reading forked and suspended tasks ...\n");
+	if (!read_task_queue()
+	    || dbpriv_dbio_input_position() != sections[BS_OBJECTS]) {
+	    errlog("READ_DB_FILE: Can't read task queue.\n");
+	    return 0;
 	}
+    }
 
-	dbio_printf("%d\n", nprogs);
+    dbpriv_dbio_input_seek(sections[BS_OBJECTS]);
 
-	oklog("%s: Writing %d MOO verb programs ...\n", reason, nprogs);
-	for (i = 0, oid = 0; oid <= max_oid; oid++) {
-	    if (valid(oid)) {
-		int vcount = 0;
-		for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next) {
-		    if (v->program) {
-			dbio_printf("#%d:%d\n", oid, vcount);
-			dbio_write_program(v->program);
-			if (++i % 5000 == 0 || i == nprogs)
-			    oklog("%s: Done writing %d verb programs ...\n",
-			          reason, i);
-		    }
-		    vcount++;
-		}
+    /* Permanent objects come first, then successive iterations of
+     * anonymous objects, as in the text format.
+     */
+    for (anonymous = 0; (nobjs = dbio_read_num()) != 0; anonymous = 1) {
+	oklog("LOADING: Reading %d objects ...\n", nobjs);
+	for (i = 1; i <= nobjs; i++) {
+	    if (!ng_read_object(anonymous)) {
+		errlog("READ_DB_FILE: Bad object #%d.\n", i - 1);
+		return 0;
 	    }
+	    if (i % 10000 == 0 || i == nobjs)
+		oklog("LOADING: Done reading %d objects ...\n", i);
 	}
     }
-    catch (dbpriv_dbio_failed& exception) {
-	success = 0;
+    if (dbpriv_dbio_input_position() != sections[BS_PROGRAMS]) {
+	errlog("READ_DB_FILE: Bad object section\n");
+	return 0;
     }
 
-    return success;
-}
+    if (!ng_validate_hierarchies()) {
+	errlog("READ_DB_FILE: Errors in object hierarchies.\n");
+	return 0;
+    }
 
-typedef enum {
-    DUMP_SHUTDOWN, DUMP_CHECKPOINT, DUMP_PANIC
-} Dump_Reason;
-const char *reason_names[] =
-{"DUMPING", "CHECKPOINTING", "PANIC-DUMPING"};
+    nprogs = dbio_read_num();
+    oklog("LOADING: Reading %d MOO verb programs ...\n", nprogs);
+    for (i = 1; i <= nprogs; i++) {
+	oid = dbio_read_objid();
+	vnum = dbio_read_num();
+	if (!read_verb_program(oid, vnum))
+	    return 0;
+	if (i % 5000 == 0 || i == nprogs)
+	    oklog("LOADING: Done reading %d verb programs ...\n", i);
+    }
+    if (dbpriv_dbio_input_position() != sections[BS_STRINGS]) {
+	errlog("READ_DB_FILE: Bad program section\n");
+	return 0;
+    }
 
-static int
-dump_database(Dump_Reason reason)
-{
+    /* see db_objects.c */
+    dbpriv_after_load();
+
+    return 1;
+}
+
+
+/*********** Journal ***********/
+
+/*
+ * The journal holds the changes made since the last checkpoint, as a
+ * series of records in the binary encoding following JOURNAL_MAGIC.
+ * Each record starts with one of the tags below:
+ *
+ *   JR_SEGMENT	The device and inode numbers of the DB file that the
+ *		following batches apply to, as eight-byte numbers.  One
+ *		is written whenever a checkpoint is begun.
+ *   JR_BATCH	The length of the rest of the record, as an eight-byte
+ *		number, followed by the last used object number, the list
+ *		of users, and the complete image of each object changed
+ *		since the previous batch.  The length is filled in (and
+ *		synced) only after the rest, so a torn batch at the end of
+ *		the file is recognizable and ignored.
+ *   JR_BARRIER	Something changed that the journal cannot describe
+ *		(anonymous objects live only in the full DB), so replaying
+ *		must stop here.  Nothing more is journaled until the next
+ *		checkpoint is begun.
+ */
+
+#ifdef DB_JOURNAL_INTERVAL
+
+static const char journal_magic[] = "** LambdaMOO Journal **\n";
+
+enum {
+    JR_SEGMENT = 1, JR_BATCH, JR_BARRIER
+};
+
+static char *journal_name;
+static FILE *journal;
+static long segment_end;	/* where the batches of the current segment
+				 * start */
+static int journal_suspended;	/* a barrier has been written */
+static unsigned int journal_nonce;	/* anonymous objects with smaller
+					 * nonces predate the segment */
+static time_t last_batch_time;
+static int pending_checkpoints;
+
+/* The set of permanent objects changed since the last batch. */
+static unsigned char *dirty_bits;
+static Objid num_dirty_bits = 0;
+static Objid *dirty_list;
+static int num_dirty = 0, max_dirty = 0;
+
+static void
+mark_dirty(Objid oid)
+{
+    if (oid >= num_dirty_bits) {
+	Objid size = num_dirty_bits ? num_dirty_bits : 1024;
+	unsigned char *_new;
+
+	while (size <= oid)
+	    size *= 2;
+	_new = (unsigned char *)mymalloc(size / 8, M_ARRAY);
+	memset(_new, 0, size / 8);
+	if (dirty_bits) {
+	    memcpy(_new, dirty_bits, num_dirty_bits / 8);
+	    myfree(dirty_bits, M_ARRAY);
+	}
+	dirty_bits = _new;
+	num_dirty_bits = size;
+    }
+
+    if (dirty_bits[oid / 8] & (1 << (oid % 8)))
+	return;
+    dirty_bits[oid / 8] |= 1 << (oid % 8);
+
+    if (num_dirty == max_dirty) {
+	Objid *_new;
+
+	max_dirty = max_dirty ? max_dirty * 2 : 256;
+	_new = (Objid *)mymalloc(max_dirty * sizeof(Objid), M_ARRAY);
+	if (dirty_list) {
+	    memcpy(_new, dirty_list, num_dirty * sizeof(Objid));
+	    myfree(dirty_list, M_ARRAY);
+	}
+	dirty_list = _new;
+    }
+    dirty_list[num_dirty++] = oid;
+}
+
+static void
+clear_dirty(void)
+{
+    int i;
+
+    for (i = 0; i < num_dirty; i++)
+	dirty_bits[dirty_list[i] / 8] = 0;
+    num_dirty = 0;
+}
+
+static void
+sync_journal(void)
+{
+    if (fflush(journal) != 0 || fsync(fileno(journal)) != 0)
+	throw dbpriv_dbio_failed();
+}
+
+static void
+journal_failed(void)
+{
+    log_perror("Writing journal");
+    errlog("JOURNAL: Disabled until the server is restarted.\n");
+    fclose(journal);
+    journal = 0;
+    clear_dirty();
+}
+
+static void
+write_journal_barrier(void)
+{
+    dbpriv_set_dbio_output(journal);
+    dbpriv_set_dbio_binary_output(1);
+    try {
+	dbio_write_num(JR_BARRIER);
+	sync_journal();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	journal_failed();
+    }
+    dbpriv_set_dbio_binary_output(0);
+
+    journal_suspended = 1;
+    clear_dirty();
+}
+
+static void
+journal_note_change(Object *o)
+{
+    if (!journal || journal_suspended)
+	return;
+
+    if (o->id != NOTHING)
+	mark_dirty(o->id);
+    else if (o->nonce < journal_nonce) {
+	errlog("JOURNAL: Anonymous object changed; "
+	       "suspended until the next checkpoint.\n");
+	write_journal_barrier();
+    }
+}
+
+static void
+journal_note_all_changed(void)
+{
+    Objid oid;
+
+    if (!journal || journal_suspended)
+	return;
+
+    for (oid = 0; oid <= db_last_used_objid(); oid++)
+	mark_dirty(oid);
+}
+
+static int refers_to_anonymous(Var);
+
+static int
+anonymous_in_list(Var value, void *data, int first)
+{
+    return refers_to_anonymous(value);
+}
+
+static int
+anonymous_in_map(Var key, Var value, void *data, int first)
+{
+    return refers_to_anonymous(key) || refers_to_anonymous(value);
+}
+
+static int
+refers_to_anonymous(Var v)
+{
+    switch (v.type) {
+    case TYPE_ANON:
+	return 1;
+    case TYPE_LIST:
+	return listforeach(v, anonymous_in_list, 0);
+    case TYPE_MAP:
+	return mapforeach(v, anonymous_in_map, 0);
+    default:
+	return 0;
+    }
+}
+
+static void
+write_journal_image(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+    Verbdef *v;
+
+    dbio_write_objid(oid);
+    dbio_write_num(o != 0);
+    if (!o)
+	return;
+
+    write_object_body(o);
+    for (v = o->verbdefs; v; v = v->next) {
+	dbio_write_num(v->program || v->source);
+	write_verb_program(v);
+    }
+}
+
+static void
+write_journal_batch(void)
+{
+    Var user_list;
+    long length_pos, end;
+    int i;
+    unsigned j;
+
+    for (i = 0; i < num_dirty; i++) {
+	Object *o = dbpriv_find_object(dirty_list[i]);
+
+	if (!o)
+	    continue;
+	for (j = 0; j < o->nval; j++)
+	    if (refers_to_anonymous(o->propval[j].var)) {
+		errlog("JOURNAL: #%d refers to an anonymous object; "
+		       "suspended until the next checkpoint.\n", o->id);
+		write_journal_barrier();
+		return;
+	    }
+    }
+
+    dbpriv_set_dbio_output(journal);
+    dbpriv_set_dbio_binary_output(1);
+    try {
+	dbio_write_num(JR_BATCH);
+	length_pos = dbpriv_dbio_output_position();
+	dbpriv_dbio_write_fixed(0);
+
+	dbio_write_objid(db_last_used_objid());
+	user_list = db_all_users();
+	dbio_write_num(listlength(user_list));
+	for (i = 1; i <= listlength(user_list); i++)
+	    dbio_write_objid(user_list.v.list[i].v.obj);
+
+	dbio_write_num(num_dirty);
+	for (i = 0; i < num_dirty; i++)
+	    write_journal_image(dirty_list[i]);
+
+	end = dbpriv_dbio_output_position();
+	sync_journal();
+	dbpriv_dbio_output_seek(length_pos);
+	dbpriv_dbio_write_fixed(end - length_pos - 8);
+	dbpriv_dbio_output_seek(end);
+	sync_journal();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	journal_failed();
+    }
+    dbpriv_set_dbio_binary_output(0);
+
+    clear_dirty();
+}
+
+static void
+write_journal_segment(const struct stat *base)
+{
+    dbpriv_set_dbio_output(journal);
+    dbpriv_set_dbio_binary_output(1);
+    try {
+	dbio_write_num(JR_SEGMENT);
+	dbpriv_dbio_write_fixed(base->st_dev);
+	dbpriv_dbio_write_fixed(base->st_ino);
+	segment_end = dbpriv_dbio_output_position();
+	sync_journal();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	journal_failed();
+    }
+    dbpriv_set_dbio_binary_output(0);
+
+    if (journal_suspended)
+	oklog("JOURNAL: Resumed after the checkpoint.\n");
+    journal_suspended = 0;
+    journal_nonce = dbpriv_current_nonce();
+    clear_dirty();
+}
+
+/* Replaces the journal with one that starts with a segment for BASE,
+ * followed by the bytes of FROM between START and END.
+ */
+static void
+start_journal(const struct stat *base, FILE *from, long start, long end)
+{
+    Stream *s = new_stream(100);
+    const char *temp_name;
+    FILE *f, *old = journal;
+    char buffer[8192];
+
+    stream_printf(s, "%s.#new#", journal_name);
+    temp_name = reset_stream(s);
+
+    if (!(f = fopen(temp_name, "w+"))) {
+	log_perror("Creating journal");
+	free_stream(s);
+	return;
+    }
+    fputs(journal_magic, f);
+    journal = f;
+    write_journal_segment(base);
+
+    if (journal && from && start < end) {
+	fseek(from, start, SEEK_SET);
+	while (start < end) {
+	    size_t n = end - start < (long) sizeof(buffer)
+		       ? end - start : sizeof(buffer);
+
+	    if (fread(buffer, 1, n, from) != n || fwrite(buffer, 1, n, f) != n) {
+		journal_failed();
+		break;
+	    }
+	    start += n;
+	}
+    }
+
+    if (journal && (fflush(f) != 0 || fsync(fileno(f)) != 0
+		    || rename(temp_name, journal_name) != 0))
+	journal_failed();
+    if (!journal)
+	remove(temp_name);
+    if (old)
+	fclose(old);
+
+    free_stream(s);
+}
+
+static void
+flush_journal(int force)
+{
+    time_t now = time(0);
+
+    if (!journal || journal_suspended || !num_dirty
+	|| (!force && now - last_batch_time < DB_JOURNAL_INTERVAL))
+	return;
+
+    write_journal_batch();
+    last_batch_time = now;
+}
+
+/* Called before a checkpoint is begun, and then with the checkpoint file
+ * once the snapshot has been taken (i.e., in the parent after the fork).
+ */
+static void
+journal_checkpoint_starting(void)
+{
+    flush_journal(1);
+}
+
+static void
+journal_checkpoint_begun(FILE *f)
+{
+    struct stat st;
+
+    if (!journal)
+	return;
+    if (fstat(fileno(f), &st) < 0) {
+	log_perror("Examining checkpoint file");
+	return;
+    }
+    write_journal_segment(&st);
+    pending_checkpoints++;
+}
+
+/* Called when a checkpoint finishes.  Once it is on disk, everything
+ * before the current segment is obsolete.
+ */
+static void
+journal_checkpoint_finished(int success)
+{
+    struct stat st;
+
+    if (!journal)
+	return;
+    if (pending_checkpoints > 0 && --pending_checkpoints > 0)
+	return;			/* can't tell which one it was */
+    if (!success)
+	return;
+
+    if (stat(dump_db_name, &st) < 0) {
+	log_perror("Examining new checkpoint");
+	return;
+    }
+    fflush(journal);
+    fseek(journal, 0, SEEK_END);
+    start_journal(&st, journal, segment_end, ftell(journal));
+}
+
+static void
+journal_shutdown(void)
+{
+    if (!journal)
+	return;
+    fclose(journal);
+    journal = 0;
+    remove(journal_name);
+}
+
+static int
+read_journal_batch(long end)
+{
+    Objid last, oid;
+    Var user_list;
+    int i, n, vnum;
+    Verbdef *v;
+
+    last = dbio_read_objid();
+
+    n = dbio_read_num();
+    user_list = new_list(n);
+    for (i = 1; i <= n; i++)
+	user_list.v.list[i] = Var::new_obj(dbio_read_objid());
+
+    for (n = dbio_read_num(); n > 0; n--) {
+	oid = dbio_read_objid();
+	if (oid < 0 || dbpriv_dbio_input_position() >= end)
+	    break;
+	if (!dbio_read_num()) {
+	    dbpriv_replace_object(oid, 0);
+	    continue;
+	}
+
+	Object *o = (Object *)mymalloc(sizeof(Object), M_OBJECT);
+	read_object_body(o);
+	dbpriv_replace_object(oid, o);
+
+	for (v = o->verbdefs, vnum = 0; v; v = v->next, vnum++)
+	    if (dbio_read_num() && !read_verb_program(oid, vnum))
+		break;
+    }
+
+    dbpriv_set_last_used_objid(last);
+    dbpriv_set_all_users(user_list);
+
+    return n == 0 && dbpriv_dbio_input_position() == end;
+}
+
+/* Applies the batches of NAME that follow the segment for BASE, and
+ * starts a new journal holding them.  Returns true if the journal
+ * existed and applied to BASE.
+ */
+static int
+replay_journal(const char *name, const struct stat *base)
+{
+    FILE *f;
+    struct stat st;
+    void *image;
+    const long magic_size = sizeof(journal_magic) - 1;
+    long start = -1, end, pos, length;
+    int tag, batches = 0, broken = 0;
+    DB_Version version;
+
+    if (!(f = fopen(name, "r")))
+	return 0;
+    if (fstat(fileno(f), &st) < 0 || st.st_size < magic_size
+	|| (image = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE,
+			 fileno(f), 0)) == MAP_FAILED) {
+	fclose(f);
+	return 0;
+    }
+    if (memcmp(image, journal_magic, magic_size)) {
+	errlog("JOURNAL: %s is not a journal.\n", name);
+	goto done;
+    }
+    dbpriv_set_dbio_input_buffer((const char *)image, st.st_size);
+
+    /* Find the last segment for BASE. */
+    for (pos = magic_size; st.st_size - pos >= 1;) {
+	dbpriv_dbio_input_seek(pos);
+	tag = dbio_read_num();
+	if (tag == JR_SEGMENT && st.st_size - pos >= 17) {
+	    if (dbpriv_dbio_read_fixed() == (uint64_t) base->st_dev
+		&& dbpriv_dbio_read_fixed() == (uint64_t) base->st_ino)
+		start = pos + 17;
+	    pos += 17;
+	} else if (tag == JR_BATCH && st.st_size - pos >= 9
+		   && (length = dbpriv_dbio_read_fixed()) > 0
+		   && length <= st.st_size - pos - 9)
+	    pos += 9 + length;
+	else if (tag == JR_BARRIER)
+	    pos++;
+	else
+	    break;
+    }
+    if (start < 0)
+	goto done;
+
+    oklog("JOURNAL: Replaying %s ...\n", name);
+    version = dbio_input_version;
+    dbio_input_version = current_db_version;
+    for (end = pos = start; st.st_size - pos >= 1;) {
+	dbpriv_dbio_input_seek(pos);
+	tag = dbio_read_num();
+	if (tag == JR_SEGMENT && st.st_size - pos >= 17)
+	    pos += 17;
+	else if (tag == JR_BATCH && st.st_size - pos >= 9
+		 && (length = dbpriv_dbio_read_fixed()) > 0
+		 && length <= st.st_size - pos - 9) {
+	    if (!read_journal_batch(pos + 9 + length)) {
+		errlog("JOURNAL: Bad batch at offset %ld.\n", pos);
+		broken = 1;
+		break;
+	    }
+	    pos += 9 + length;
+	    batches++;
+	} else
+	    break;
+	end = pos;
+    }
+    dbio_input_version = version;
+    oklog("JOURNAL: Replayed %d batch%s of changes.\n",
+	  batches, batches == 1 ? "" : "es");
+    db_priv_affected_callable_verb_lookup();
+
+  done:
+    munmap(image, st.st_size);
+    if (start >= 0 && !broken)
+	start_journal(base, f, start, end);
+    fclose(f);
+
+    return start >= 0;
+}
+
+/* Called after the input DB has been loaded. */
+static void
+journal_db_loaded(FILE *input)
+{
+    Stream *s = new_stream(100);
+    struct stat base;
+
+    stream_printf(s, "%s.journal", dump_db_name);
+    journal_name = str_dup(reset_stream(s));
+    free_stream(s);
+
+    if (fstat(fileno(input), &base) < 0) {
+	log_perror("Examining input database file");
+	return;
+    }
+
+    if (!replay_journal(journal_name, &base)) {
+	const char *name;
+
+	s = new_stream(100);
+	stream_printf(s, "%s.journal", input_db_name);
+	name = reset_stream(s);
+	if (strcmp(name, journal_name))
+	    replay_journal(name, &base);
+	free_stream(s);
+    }
+    dbpriv_set_dbio_input(input);
+
+    if (!journal)
+	start_journal(&base, 0, 0, 0);
+    last_batch_time = time(0);
+}
+
+#endif /* DB_JOURNAL_INTERVAL */
+
+
+/*********** Compression ***********/
+
+/*
+ * A compressed DB file is a text DB file cut into blocks of up to
+ * COMPRESSED_BLOCK_SIZE bytes, each compressed on its own with LZ4.  After
+ * the magic string, each block is written as its uncompressed length and its
+ * stored length, four bytes each and least significant first, followed by
+ * the stored bytes; a block that wouldn't get any smaller is stored as is,
+ * with both lengths the same.  An uncompressed length of zero ends the file.
+ * The compressing or decompressing is done by a forked process at the other
+ * end of a pipe, so it overlaps with writing or reading the DB and the rest
+ * of this file just sees an ordinary stream.
+ */
+
+static const char compressed_magic[] = "\211LambdaMOO LZ4\r\n\032\n";
+
+#define COMPRESSED_BLOCK_SIZE	(1 << 20)
+
+static pid_t coder_pid;
+static int coder_compressing;
+static void (*coder_old_handler) (int);
+
+static void
+put_le32(unsigned char *p, uint32_t n)
+{
+    p[0] = n;
+    p[1] = n >> 8;
+    p[2] = n >> 16;
+    p[3] = n >> 24;
+}
+
+static uint32_t
+get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int
+compress_stream(FILE *in, FILE *out)
+{
+    char *raw = (char *)mymalloc(COMPRESSED_BLOCK_SIZE, M_STRUCT);
+    char *packed = (char *)mymalloc(LZ4_COMPRESS_BOUND(COMPRESSED_BLOCK_SIZE),
+				    M_STRUCT);
+    unsigned char head[8];
+    size_t n, len;
+    const char *data;
+
+    if (fwrite(compressed_magic, 1, sizeof(compressed_magic) - 1, out)
+	!= sizeof(compressed_magic) - 1)
+	return 0;
+    while ((n = fread(raw, 1, COMPRESSED_BLOCK_SIZE, in)) > 0) {
+	len = lz4_compress(raw, n, packed,
+			   LZ4_COMPRESS_BOUND(COMPRESSED_BLOCK_SIZE));
+	if (len == 0 || len >= n) {
+	    data = raw;
+	    len = n;
+	} else
+	    data = packed;
+	put_le32(head, n);
+	put_le32(head + 4, len);
+	if (fwrite(head, 1, 8, out) != 8 || fwrite(data, 1, len, out) != len)
+	    return 0;
+    }
+    if (ferror(in))
+	return 0;
+    put_le32(head, 0);
+    put_le32(head + 4, 0);
+    return fwrite(head, 1, 8, out) == 8 && fflush(out) == 0;
+}
+
+static int
+decompress_stream(FILE *in, FILE *out)
+{
+    char *raw = (char *)mymalloc(COMPRESSED_BLOCK_SIZE, M_STRUCT);
+    char *packed = (char *)mymalloc(COMPRESSED_BLOCK_SIZE, M_STRUCT);
+    char magic[sizeof(compressed_magic) - 1];
+    unsigned char head[8];
+    uint32_t n, len;
+
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)
+	|| memcmp(magic, compressed_magic, sizeof(magic)))
+	return 0;
+    for (;;) {
+	if (fread(head, 1, 8, in) != 8)
+	    return 0;
+	n = get_le32(head);
+	len = get_le32(head + 4);
+	if (n == 0)
+	    return len == 0 && fflush(out) == 0;
+	if (n > COMPRESSED_BLOCK_SIZE || len > n
+	    || fread(packed, 1, len, in) != len)
+	    return 0;
+	if (len == n) {
+	    if (fwrite(packed, 1, n, out) != n)
+		return 0;
+	} else if (lz4_decompress(packed, len, raw, n) != (long) n
+		   || fwrite(raw, 1, n, out) != n)
+	    return 0;
+    }
+}
+
+/* Starts a process compressing what is written to the returned stream into
+ * F or, if !COMPRESSING, one decompressing F into the returned stream.
+ * Returns 0 (having logged why) if it can't be done.
+ */
+static FILE *
+start_coder(FILE *f, int compressing)
+{
+    int fds[2];
+    FILE *stream;
+
+    if (pipe(fds) < 0) {
+	log_perror("Creating compression pipe");
+	return 0;
+    }
+
+    /* As in write_shards(), the server mustn't reap the child. */
+    coder_old_handler = signal(SIGCHLD, SIG_DFL);
+    coder_compressing = compressing;
+    fflush(0);
+
+    if ((coder_pid = fork()) == 0) {
+	int ok;
+
+	if (compressing) {
+	    close(fds[1]);
+	    ok = compress_stream(fdopen(fds[0], "r"), f);
+	} else {
+	    close(fds[0]);
+	    ok = decompress_stream(f, fdopen(fds[1], "w"));
+	}
+	_exit(!ok);
+    } else if (coder_pid < 0) {
+	log_perror("Forking compression process");
+	close(fds[0]);
+	close(fds[1]);
+	signal(SIGCHLD, coder_old_handler);
+	return 0;
+    }
+
+    if (compressing) {
+	close(fds[0]);
+	stream = fdopen(fds[1], "w");
+    } else {
+	close(fds[1]);
+	stream = fdopen(fds[0], "r");
+    }
+    return stream;
+}
+
+/* Closes a stream returned by start_coder(), returning true if everything
+ * went through it.
+ */
+static int
+finish_coder(FILE *stream)
+{
+    char buffer[4096];
+    int status, ok = 1;
+
+    if (!coder_compressing)	/* let the child finish writing */
+	while (fread(buffer, 1, sizeof(buffer), stream) > 0)
+	    ;
+    if (fclose(stream) != 0)
+	ok = 0;
+    if (waitpid(coder_pid, &status, 0) != coder_pid
+	|| !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	ok = 0;
+    signal(SIGCHLD, coder_old_handler);
+
+    return ok;
+}
+
+static int
+is_compressed_db(FILE *f)
+{
+    char magic[sizeof(compressed_magic) - 1];
+    size_t n = fread(magic, 1, sizeof(magic), f);
+
+    rewind(f);
+    return n == sizeof(magic) && !memcmp(magic, compressed_magic, sizeof(magic));
+}
+
+
+/*********** File-level Output ***********/
+
+/* The parts of a DB file being written that outlive any one call. */
+typedef struct {
+    const char *reason;
+    const char *name;		/* of the file being written */
+    long header_pos;
+    long sections[Num_Binary_Sections];
+    int nprogs, progs_written;
+} Dump_State;
+
+/* Writes everything that precedes the objects. */
+static void
+begin_db_file(Dump_State *d)
+{
+    Var user_list;
+    int i;
+
+    /* In the text format, each dbio_write_num() below is a line
+     * containing just the number, as before.
+     */
+    if (writing_binary) {
+	dbio_printf("%s", binary_magic);
+	d->header_pos = dbpriv_dbio_output_position();
+	memset(d->sections, 0, sizeof(d->sections));
+	write_binary_header(d->sections);
+	d->sections[BS_USERS] = dbpriv_dbio_output_position();
+    } else
+	dbio_printf(header_format_string, current_db_version);
+
+    user_list = db_all_users();
+
+    dbio_write_num(listlength(user_list));
+
+    for (i = 1; i <= user_list.v.list[0].v.num; i++)
+	dbio_write_objid(user_list.v.list[i].v.obj);
+
+    if (writing_binary) {
+	d->sections[BS_TEXT] = dbpriv_dbio_output_position();
+	dbpriv_set_dbio_binary_output(0);
+    }
+
+    oklog("%s: Writing values pending finalization ...\n", d->reason);
+    write_values_pending_finalization();
+
+    if (!writing_binary) {
+	oklog("%s: Writing forked and suspended tasks ...\n", d->reason);
+	write_task_queue();
+    }
+
+    oklog("%s: Writing list of formerly active connections ...\n", d->reason);
+    write_active_connections();
+
+    if (writing_binary) {
+	dbpriv_set_dbio_binary_output(1);
+	d->sections[BS_TASKS] = dbpriv_dbio_output_position();
+	oklog("%s: Writing forked and suspended tasks ...\n", d->reason);
+	write_task_queue();
+	d->sections[BS_OBJECTS] = dbpriv_dbio_output_position();
+    }
+
+    d->nprogs = d->progs_written = 0;
+}
+
+static int
+count_programs(Object *o)
+{
+    Verbdef *v;
+    int n = 0;
+
+    for (v = o->verbdefs; v; v = v->next)
+	if (v->program || v->source)
+	    n++;
+
+    return n;
+}
+
+/* Called after the objects, once D->nprogs is known. */
+static void
+begin_db_programs(Dump_State *d)
+{
+    if (writing_binary)
+	d->sections[BS_PROGRAMS] = dbpriv_dbio_output_position();
+
+    dbio_write_num(d->nprogs);
+
+    oklog("%s: Writing %d MOO verb programs ...\n", d->reason, d->nprogs);
+}
+
+static void
+write_object_programs(Dump_State *d, Objid oid, Object *o)
+{
+    Verbdef *v;
+    int vcount = 0;
+
+    for (v = o->verbdefs; v; v = v->next) {
+	if (v->program || v->source) {
+	    if (writing_binary) {
+		dbio_write_objid(oid);
+		dbio_write_num(vcount);
+	    } else
+		dbio_printf("#%d:%d\n", oid, vcount);
+	    write_verb_program(v);
+	    if (!writing_shard
+		&& (++d->progs_written % 5000 == 0
+		    || d->progs_written == d->nprogs))
+		oklog("%s: Done writing %d verb programs ...\n",
+		      d->reason, d->progs_written);
+	}
+	vcount++;
+    }
+}
+
+static void
+finish_db_file(Dump_State *d)
+{
+    int i;
+
+    if (writing_binary) {
+	d->sections[BS_STRINGS] = dbpriv_dbio_output_position();
+	dbio_write_num(num_names);
+	for (i = 0; i < num_names; i++)
+	    dbio_write_string(names[i]);
+	d->sections[BS_END] = dbpriv_dbio_output_position();
+
+	dbpriv_dbio_output_seek(d->header_pos);
+	write_binary_header(d->sections);
+	dbpriv_dbio_output_seek(d->sections[BS_END]);
+    }
+}
+
+static void
+write_object_range(Dump_State *d, Objid first, Objid last)
+{
+    Objid oid;
+
+    for (oid = first; oid <= last; oid++) {
+	ng_write_object(oid, valid(oid) ? dbpriv_find_object(oid) : 0);
+	if (!writing_shard && ((oid + 1) % 10000 == 0 || oid == last))
+	    oklog("%s: Done writing %d objects ...\n", d->reason, last - first + 1);
+    }
+}
+
+static void
+write_program_range(Dump_State *d, Objid first, Objid last)
+{
+    Objid oid;
+
+    for (oid = first; oid <= last; oid++)
+	if (valid(oid))
+	    write_object_programs(d, oid, dbpriv_find_object(oid));
+}
+
+#ifdef DB_DUMP_SHARDS
+
+/*
+ * A range of objects (or of their programs) is split into shards, each
+ * written by a forked worker into a file next to the DB file, and the
+ * shards are then copied into the DB file in order.  Names in the binary
+ * format's string table are entered in the order the serial writer would
+ * have used before the workers start, so a worker never adds one and the
+ * file comes out the same either way.  Anonymous objects are numbered in
+ * the order they are first written, so a worker that meets a new one gives
+ * up, and the whole range is then written serially.
+ */
+
+static void
+enter_object_names(Object *o)
+{
+    Verbdef *v;
+    int i;
+
+    for (v = o->verbdefs; v; v = v->next)
+	name_index(v->name ? v->name : "");
+    for (i = 0; i < o->propdefs.cur_length; i++)
+	name_index(o->propdefs.l[i].name ? o->propdefs.l[i].name : "");
+}
+
+/* Returns true if the range was written, false if it should be written
+ * serially instead.
+ */
+static int
+write_shards(Dump_State *d, Objid first, Objid last, int programs)
+{
+    FILE *shard[DB_DUMP_SHARDS];
+    pid_t pid[DB_DUMP_SHARDS];
+    Objid start[DB_DUMP_SHARDS + 1];
+    int nprogs[DB_DUMP_SHARDS];
+    int nshards = (last - first + 1) / DB_DUMP_SHARD_OBJECTS;
+    Stream *s;
+    Objid oid;
+    int i, status;
+    volatile int success = 1;
+    void (*old_handler) (int);
+
+    if (nshards > DB_DUMP_SHARDS)
+	nshards = DB_DUMP_SHARDS;
+    if (nshards < 2 || !d->name)
+	return 0;
+
+    for (i = 0; i <= nshards; i++)
+	start[i] = first + (Objid) ((long long) (last - first + 1) * i / nshards);
+    for (i = 0; i < nshards; i++) {
+	nprogs[i] = 0;
+	for (oid = start[i]; oid < start[i + 1]; oid++)
+	    if (valid(oid)) {
+		if (programs)
+		    nprogs[i] += count_programs(dbpriv_find_object(oid));
+		else if (name_table)
+		    enter_object_names(dbpriv_find_object(oid));
+	    }
+    }
+
+    s = new_stream(100);
+    for (i = 0; i < nshards; i++) {
+	stream_printf(s, "%s.%d", d->name, i);
+	shard[i] = fopen(stream_contents(s), "w+");
+	remove(reset_stream(s));
+	if (!shard[i]) {
+	    log_perror("Opening dump shard");
+	    while (i-- > 0)
+		fclose(shard[i]);
+	    free_stream(s);
+	    return 0;
+	}
+    }
+    free_stream(s);
+
+    /* Don't let the server's handler reap the workers, nor a worker
+     * flush output buffered by this process.
+     */
+    old_handler = signal(SIGCHLD, SIG_DFL);
+    fflush(0);
+
+    for (i = 0; i < nshards; i++) {
+	if ((pid[i] = fork()) == 0) {
+	    int names = num_names;
+	    int ok = 1;
+
+	    writing_shard = 1;
+	    dbpriv_set_dbio_output(shard[i]);
+	    try {
+		if (programs)
+		    write_program_range(d, start[i], start[i + 1] - 1);
+		else
+		    write_object_range(d, start[i], start[i + 1] - 1);
+	    }
+	    catch (dbpriv_dbio_failed& exception) {
+		ok = 0;
+	    }
+	    if (fflush(shard[i]) != 0 || num_names != names)
+		ok = 0;
+	    _exit(!ok);
+	} else if (pid[i] < 0) {
+	    log_perror("Forking dump shard writer");
+	    success = 0;
+	}
+    }
+    for (i = 0; i < nshards; i++)
+	if (pid[i] > 0
+	    && (waitpid(pid[i], &status, 0) != pid[i]
+		|| !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+	    success = 0;
+
+    signal(SIGCHLD, old_handler);
+
+    if (!success)
+	oklog("%s: Writing these in one process instead ...\n", d->reason);
+
+    try {
+	for (i = 0; success && i < nshards; i++) {
+	    rewind(shard[i]);
+	    dbpriv_dbio_copy(shard[i]);
+	    if (programs) {
+		d->progs_written += nprogs[i];
+		oklog("%s: Done writing %d verb programs ...\n",
+		      d->reason, d->progs_written);
+	    } else
+		oklog("%s: Done writing %d objects ...\n",
+		      d->reason, start[i + 1] - first);
+	}
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	for (i = 0; i < nshards; i++)
+	    fclose(shard[i]);
+	throw;
+    }
+
+    for (i = 0; i < nshards; i++)
+	fclose(shard[i]);
+
+    return success;
+}
+
+#else /* !DB_DUMP_SHARDS */
+
+static int
+write_shards(Dump_State *d, Objid first, Objid last, int programs)
+{
+    return 0;
+}
+
+#endif /* DB_DUMP_SHARDS */
+
+static int
+write_db_file(const char *reason, const char *name)
+{
+    Dump_State d;
+    Objid oid;
+    Objid last_oid = db_last_used_objid(), max_oid = -1;
+    volatile int success = 1;
+
+    d.reason = reason;
+    d.name = name;
+    name_table = writing_binary = binary_dumps;
+    dbpriv_set_dbio_binary_output(writing_binary);
+
+    try {
+	begin_db_file(&d);
+
+	while (last_oid > max_oid) {
+	    dbio_write_num(last_oid - max_oid);
+
+	    oklog("%s: Writing %d objects ...\n", reason, last_oid - max_oid);
+	    if (!write_shards(&d, max_oid + 1, last_oid, 0))
+		write_object_range(&d, max_oid + 1, last_oid);
+	    max_oid = last_oid;
+	    last_oid = db_last_used_objid();
+	}
+
+	dbio_write_num(0);
+
+	for (oid = 0; oid <= max_oid; oid++)
+	    if (valid(oid))
+		d.nprogs += count_programs(dbpriv_find_object(oid));
+
+	begin_db_programs(&d);
+
+	if (!write_shards(&d, 0, max_oid, 1))
+	    write_program_range(&d, 0, max_oid);
+
+	finish_db_file(&d);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	success = 0;
+    }
+
+    free_names();
+    dbpriv_set_dbio_binary_output(name_table = writing_binary = 0);
+
+    return success;
+}
+
+typedef enum {
+    DUMP_SHUTDOWN, DUMP_CHECKPOINT, DUMP_PANIC
+} Dump_Reason;
+const char *reason_names[] =
+{"DUMPING", "CHECKPOINTING", "PANIC-DUMPING"};
+
+#ifdef SNAPSHOT_CHECKPOINTS
+
+/*
+ * A snapshot checkpoint is written by the server itself, a slice at a time
+ * from db_flush(), instead of by a forked child.  Everything up to the
+ * objects is written when the snapshot is taken, which starts a new epoch.
+ * An object from an older epoch that is about to change before it has been
+ * completely written is first copied (see dbpriv_note_change()), and the
+ * copy is written in its place.  Objects of the snapshot's epoch that have
+ * no copy were created since, and are written as recycled.  Anonymous
+ * objects can't be written this way; finding one falls back to forking.
+ */
+
+static int dump_database(Dump_Reason);
+
+static FILE *snapshot_file;
+static char *snapshot_temp_name;
+static Dump_State snapshot_dump;
+static unsigned int snapshot_epoch;
+static Objid snapshot_last;	/* the last object in the snapshot */
+static Objid snapshot_next;	/* the next object (or its programs) to
+				 * write */
+static int snapshot_programs;	/* writing programs, not objects */
+static Object **snapshot_copies;
+static int writing_snapshot, snapshot_found_anonymous, snapshot_disabled;
+
+static void
+snapshot_note_change(Object *o)
+{
+    Objid oid = o->id;
+
+    if (!snapshot_file || o->epoch == snapshot_epoch || oid == NOTHING)
+	return;
+
+    o->epoch = snapshot_epoch;
+    if (oid <= snapshot_last && (!snapshot_programs || oid >= snapshot_next))
+	snapshot_copies[oid] = dbpriv_copy_object(o);
+}
+
+static Object *
+snapshot_image(Objid oid)
+{
+    Object *o;
+
+    if (snapshot_copies[oid])
+	return snapshot_copies[oid];
+
+    o = dbpriv_find_object(oid);
+    return o && o->epoch != snapshot_epoch ? o : 0;
+}
+
+static void
+end_snapshot(void)
+{
+    Objid oid;
+
+    for (oid = 0; oid <= snapshot_last; oid++)
+	if (snapshot_copies[oid])
+	    dbpriv_free_object(snapshot_copies[oid]);
+    myfree(snapshot_copies, M_STRUCT);
+    snapshot_copies = 0;
+
+    free_str(snapshot_temp_name);
+    snapshot_temp_name = 0;
+    snapshot_file = 0;
+    free_names();
+}
+
+/* Begins writing a snapshot checkpoint to F, returning false (with F
+ * emptied again) if it can't be done.
+ */
+static int
+start_snapshot(FILE *f, const char *temp_name)
+{
+    volatile int success = 1;
+
+    snapshot_dump.reason = reason_names[DUMP_CHECKPOINT];
+    snapshot_epoch = dbpriv_begin_epoch();
+    snapshot_last = db_last_used_objid();
+    snapshot_next = 0;
+    snapshot_programs = 0;
+    snapshot_found_anonymous = 0;
+
+    dbpriv_set_dbio_output(f);
+    name_table = writing_binary = binary_dumps;
+    dbpriv_set_dbio_binary_output(writing_binary);
+    writing_snapshot = 1;
+    try {
+	begin_db_file(&snapshot_dump);
+	dbio_write_num(snapshot_last + 1);
+	oklog("%s: Writing %d objects ...\n", snapshot_dump.reason,
+	      snapshot_last + 1);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	success = 0;
+    }
+    writing_snapshot = 0;
+    dbpriv_set_dbio_binary_output(name_table = writing_binary = 0);
+
+    if (!success) {
+	if (snapshot_found_anonymous)
+	    oklog("%s: Anonymous objects present; forking instead ...\n",
+		  snapshot_dump.reason);
+	else
+	    log_perror("Trying to dump database");
+	free_names();
+	fflush(f);
+	ftruncate(fileno(f), 0);
+	rewind(f);
+	return 0;
+    }
+
+    snapshot_copies = (Object **)mymalloc((snapshot_last + 1) * sizeof(Object *),
+					  M_STRUCT);
+    memset(snapshot_copies, 0, (snapshot_last + 1) * sizeof(Object *));
+    snapshot_temp_name = str_dup(temp_name);
+    snapshot_file = f;
+
+    return 1;
+}
+
+/* Writes the next piece of the snapshot, returning false when there is
+ * nothing left.
+ */
+static int
+write_snapshot_step(void)
+{
+    Objid oid = snapshot_next;
+    Object *o;
+
+    if (oid <= snapshot_last) {
+	o = snapshot_image(oid);
+	if (!snapshot_programs) {
+	    ng_write_object(oid, o);
+	    if (o)
+		snapshot_dump.nprogs += count_programs(o);
+	    if ((oid + 1) % 10000 == 0 || oid == snapshot_last)
+		oklog("%s: Done writing %d objects ...\n",
+		      snapshot_dump.reason, oid + 1);
+	} else {
+	    if (o)
+		write_object_programs(&snapshot_dump, oid, o);
+	    if (snapshot_copies[oid]) {
+		dbpriv_free_object(snapshot_copies[oid]);
+		snapshot_copies[oid] = 0;
+	    }
+	}
+	snapshot_next++;
+	return 1;
+    }
+
+    if (!snapshot_programs) {
+	dbio_write_num(0);
+	begin_db_programs(&snapshot_dump);
+	snapshot_programs = 1;
+	snapshot_next = 0;
+	return 1;
+    }
+
+    finish_db_file(&snapshot_dump);
+    return 0;
+}
+
+static void
+continue_snapshot(long max_usecs)
+{
+    struct timeval start, now;
+    volatile int done = 0, success = 1;
+    int i;
+
+    gettimeofday(&start, 0);
+
+    dbpriv_set_dbio_output(snapshot_file);
+    name_table = writing_binary = binary_dumps;
+    dbpriv_set_dbio_binary_output(writing_binary);
+    writing_snapshot = 1;
+    try {
+	do {
+	    for (i = 0; i < 100 && !done; i++)
+		done = !write_snapshot_step();
+	    gettimeofday(&now, 0);
+	} while (!done && ((now.tv_sec - start.tv_sec) * 1000000
+			   + (now.tv_usec - start.tv_usec)) < max_usecs);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	success = 0;
+    }
+    writing_snapshot = 0;
+    dbpriv_set_dbio_binary_output(name_table = writing_binary = 0);
+
+    if (success && !done)
+	return;
+
+    if (success) {
+	if (fflush(snapshot_file) != 0 || fsync(fileno(snapshot_file)) != 0)
+	    success = 0;
+	if (fclose(snapshot_file) != 0)
+	    success = 0;
+    } else
+	fclose(snapshot_file);
+
+    if (success) {
+	oklog("%s on %s finished\n", snapshot_dump.reason, snapshot_temp_name);
+	remove(dump_db_name);
+	if (rename(snapshot_temp_name, dump_db_name) != 0) {
+	    log_perror("Renaming temporary dump file");
+	    success = 0;
+	}
+	end_snapshot();
+	server_checkpoint_finished(success);
+    } else if (snapshot_found_anonymous) {
+	oklog("%s: Found an anonymous object; forking instead ...\n",
+	      snapshot_dump.reason);
+	remove(snapshot_temp_name);
+	end_snapshot();
+#ifdef DB_JOURNAL_INTERVAL
+	journal_checkpoint_finished(0);
+#endif
+	snapshot_disabled = 1;
+	if (!dump_database(DUMP_CHECKPOINT))
+	    server_checkpoint_finished(0);
+	snapshot_disabled = 0;
+    } else {
+	log_perror("Trying to dump database");
+	errlog("Abandoning checkpoint attempt ...\n");
+	remove(snapshot_temp_name);
+	end_snapshot();
+	server_checkpoint_finished(0);
+    }
+}
+
+/* Gives up on a snapshot in progress, for a dump that can't wait. */
+static void
+abandon_snapshot(void)
+{
+    errlog("Abandoning checkpoint in progress on %s ...\n", snapshot_temp_name);
+    fclose(snapshot_file);
+    remove(snapshot_temp_name);
+    end_snapshot();
+}
+
+#endif /* SNAPSHOT_CHECKPOINTS */
+
+int
+dbpriv_dump_refuses_anonymous(void)
+{
+#ifdef SNAPSHOT_CHECKPOINTS
+    if (writing_snapshot) {
+	snapshot_found_anonymous = 1;
+	return 1;
+    }
+#endif
+#ifdef DB_DUMP_SHARDS
+    if (writing_shard)
+	return 1;
+#endif
+    return 0;
+}
+
+void
+dbpriv_note_change(Object *o)
+{
+#ifdef DB_JOURNAL_INTERVAL
+    journal_note_change(o);
+#endif
+#ifdef SNAPSHOT_CHECKPOINTS
+    snapshot_note_change(o);
+#endif
+}
+
+void
+dbpriv_note_all_changed(void)
+{
+#ifdef DB_JOURNAL_INTERVAL
+    journal_note_all_changed();
+#endif
+#ifdef SNAPSHOT_CHECKPOINTS
+    Objid oid;
+    Object *o;
+
+    for (oid = 0; oid <= db_last_used_objid(); oid++)
+	if ((o = dbpriv_find_object(oid)))
+	    snapshot_note_change(o);
+#endif
+}
+
+/* Only text dumps can be compressed, since binary ones are written out of
+ * order; panic dumps are kept as simple as possible.
+ */
+static int
+compressing_dump(Dump_Reason reason)
+{
+    if (binary_dumps)
+	return 0;
+#ifdef COMPRESS_CHECKPOINTS
+    if (reason == DUMP_CHECKPOINT)
+	return 1;
+#endif
+#ifdef COMPRESS_SHUTDOWN_DUMPS
+    if (reason == DUMP_SHUTDOWN)
+	return 1;
+#endif
+    return 0;
+}
+
+static int
+dump_database(Dump_Reason reason)
+{
     Stream *s = new_stream(100);
     char *temp_name;
-    FILE *f;
+    FILE *f, *out;
     int success;
 
+#ifdef SNAPSHOT_CHECKPOINTS
+    if (snapshot_file) {
+	if (reason == DUMP_CHECKPOINT) {
+	    errlog("%s: Previous checkpoint still in progress\n",
+		   reason_names[reason]);
+	    free_stream(s);
+	    return 0;
+	}
+	abandon_snapshot();
+    }
+#endif
+
   retryDumping:
 
     stream_printf(s, "%s.#%d#", dump_db_name, dump_generation);
@@ -1160,16 +2873,47 @@ dump_database(Dump_Reason reason)
 
     oklog("%s on %s ...\n", reason_names[reason], temp_name);
 
+    if ((f = out = fopen(temp_name, "w")) == 0) {
+	log_perror("Opening temporary dump file");
+	free_stream(s);
+	return 0;
+    }
+
+#ifdef DB_JOURNAL_INTERVAL
+    if (reason == DUMP_CHECKPOINT)
+	journal_checkpoint_starting();
+#endif
+
 #ifdef UNFORKED_CHECKPOINTS
     reset_command_history();
+#ifdef DB_JOURNAL_INTERVAL
+    if (reason == DUMP_CHECKPOINT)
+	journal_checkpoint_begun(f);
+#endif
 #else
     if (reason == DUMP_CHECKPOINT) {
+#ifdef SNAPSHOT_CHECKPOINTS
+	if (!snapshot_disabled && start_snapshot(f, temp_name)) {
+#ifdef DB_JOURNAL_INTERVAL
+	    journal_checkpoint_begun(f);
+#endif
+	    reset_command_history();
+	    free_stream(s);
+	    return 1;
+	}
+#endif
 	switch (fork_server("checkpointer")) {
 	case FORK_PARENT:
+#ifdef DB_JOURNAL_INTERVAL
+	    journal_checkpoint_begun(f);
+#endif
+	    fclose(f);
 	    reset_command_history();
 	    free_stream(s);
 	    return 1;
 	case FORK_ERROR:
+	    fclose(f);
+	    remove(temp_name);
 	    free_stream(s);
 	    return 0;
 	case FORK_CHILD:
@@ -1179,44 +2923,54 @@ dump_database(Dump_Reason reason)
     }
 #endif
 
-    success = 1;
-    if ((f = fopen(temp_name, "w")) != 0) {
-	dbpriv_set_dbio_output(f);
-	if (!write_db_file(reason_names[reason])) {
-	    log_perror("Trying to dump database");
-	    fclose(f);
-	    remove(temp_name);
-	    if (reason == DUMP_CHECKPOINT) {
-		errlog("Abandoning checkpoint attempt ...\n");
-		success = 0;
-	    } else {
-		int retry_interval = 60;
+    if (compressing_dump(reason) && !(out = start_coder(f, 1)))
+	success = 0;
+    else {
+	dbpriv_set_dbio_output(out);
+	success = write_db_file(reason_names[reason],
+				reason == DUMP_PANIC ? 0 : temp_name);
+	if (out != f && !finish_coder(out))
+	    success = 0;
+    }
+    if (!success) {
+	log_perror("Trying to dump database");
+	fclose(f);
+	remove(temp_name);
+	if (reason == DUMP_CHECKPOINT)
+	    errlog("Abandoning checkpoint attempt ...\n");
+	else {
+	    int retry_interval = 60;
 
-		errlog("Waiting %d seconds and retrying dump ...\n",
-		       retry_interval);
-		timer_sleep(retry_interval);
-		goto retryDumping;
-	    }
-	} else {
-	    fflush(f);
-	    fsync(fileno(f));
-	    fclose(f);
-	    oklog("%s on %s finished\n", reason_names[reason], temp_name);
-	    if (reason != DUMP_PANIC) {
-		remove(dump_db_name);
-		if (rename(temp_name, dump_db_name) != 0) {
-		    log_perror("Renaming temporary dump file");
-		    success = 0;
-		}
-	    }
+	    errlog("Waiting %d seconds and retrying dump ...\n",
+		   retry_interval);
+	    timer_sleep(retry_interval);
+	    goto retryDumping;
 	}
     } else {
-	log_perror("Opening temporary dump file");
-	success = 0;
+	fflush(f);
+	fsync(fileno(f));
+	fclose(f);
+	oklog("%s on %s finished\n", reason_names[reason], temp_name);
+	if (reason != DUMP_PANIC) {
+	    remove(dump_db_name);
+	    if (rename(temp_name, dump_db_name) != 0) {
+		log_perror("Renaming temporary dump file");
+		success = 0;
+	    }
+	}
     }
 
     free_stream(s);
 
+#ifdef DB_JOURNAL_INTERVAL
+#ifdef UNFORKED_CHECKPOINTS
+    if (reason == DUMP_CHECKPOINT)
+	journal_checkpoint_finished(success);
+#endif
+    if (reason == DUMP_SHUTDOWN && success)
+	journal_shutdown();
+#endif
+
 #ifndef UNFORKED_CHECKPOINTS
     if (reason == DUMP_CHECKPOINT)
 	/* We're a child, so we'd better go away. */
@@ -1235,6 +2989,12 @@ db_usage_string(void)
     return "input-db-file output-db-file";
 }
 
+void
+db_set_dump_format(int binary)
+{
+    binary_dumps = binary;
+}
+
 static FILE *input_db;
 
 int
@@ -1261,18 +3021,78 @@ db_initialize(int *pargc, char ***pargv)
     return 1;
 }
 
+static int
+is_binary_db(FILE *f)
+{
+    char magic[sizeof(binary_magic) - 1];
+    size_t n = fread(magic, 1, sizeof(magic), f);
+
+    rewind(f);
+    return n == sizeof(magic) && !memcmp(magic, binary_magic, sizeof(magic));
+}
+
+static int
+load_binary_db(FILE *f)
+{
+    struct stat st;
+    void *image;
+    int success;
+
+    if (fstat(fileno(f), &st) < 0) {
+	log_perror("Examining input database file");
+	return 0;
+    }
+    image = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (image == MAP_FAILED) {
+	log_perror("Mapping input database file");
+	return 0;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(image, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    name_table = reading_binary = 1;
+    success = read_binary_db_file(f, (const char *)image, st.st_size);
+    name_table = reading_binary = 0;
+
+    dbpriv_set_dbio_input(f);
+    free_names();
+    munmap(image, st.st_size);
+
+    return success;
+}
+
 int
 db_load(void)
 {
-    dbpriv_set_dbio_input(input_db);
+    int binary = is_binary_db(input_db);
+    int compressed = !binary && is_compressed_db(input_db);
+    FILE *input = compressed ? start_coder(input_db, 0) : input_db;
+    int success;
+
+    if (!input) {
+	errlog("DB_LOAD: Cannot load database!\n");
+	return 0;
+    }
+    dbpriv_set_dbio_input(input);
 
     str_intern_open(0);
 
-    oklog("LOADING: %s\n", input_db_name);
-    if (!read_db_file()) {
+    oklog("LOADING: %s%s\n", input_db_name, compressed ? " (compressed)" : "");
+    success = binary ? load_binary_db(input_db) : read_db_file();
+    if (compressed && !finish_coder(input)) {
+	errlog("DB_LOAD: Compressed database is truncated or corrupt\n");
+	success = 0;
+    }
+    if (!success) {
 	errlog("DB_LOAD: Cannot load database!\n");
 	return 0;
     }
+    if (binary_dumps < 0)
+	binary_dumps = binary;
+#ifdef DB_JOURNAL_INTERVAL
+    journal_db_loaded(input_db);
+#endif
     oklog("LOADING: %s done, will dump new database on %s\n",
 	  input_db_name, dump_db_name);
 
@@ -1290,6 +3110,13 @@ db_flush(enum db_flush_type type)
     switch (type) {
     case FLUSH_IF_FULL:
     case FLUSH_ONE_SECOND:
+#ifdef SNAPSHOT_CHECKPOINTS
+	if (snapshot_file)
+	    continue_snapshot(SNAPSHOT_SLICE_USECS);
+#endif
+#ifdef DB_JOURNAL_INTERVAL
+	flush_journal(0);
+#endif
 	success = 1;
 	break;
 
@@ -1305,6 +3132,24 @@ db_flush(enum db_flush_type type)
     return success;
 }
 
+void
+db_checkpoint_finished(int success)
+{
+#ifdef DB_JOURNAL_INTERVAL
+    journal_checkpoint_finished(success);
+#endif
+}
+
+int
+db_flush_pending(void)
+{
+#ifdef SNAPSHOT_CHECKPOINTS
+    return snapshot_file != 0;
+#else
+    return 0;
+#endif
+}
+
 int32
 db_disk_size(void)
 {
@@ -24,6 +24,7 @@
 #include "my-stdarg.h"
 #include "my-stdio.h"
 #include "my-stdlib.h"
+#include "my-string.h"
 
 #include "db.h"
 #include "db_io.h"
@@ -42,20 +43,261 @@
 #include "version.h"
 
 
+/*********** Binary encoding ***********/
+
+/* In the binary DB format, numbers are zigzag-encoded varints, floats are
+ * eight little-endian bytes, and strings are a varint length followed by
+ * the bytes and a terminating null, so that the loader can hand out
+ * pointers straight into the mapped file.
+ */
+
+static inline uint32_t
+zigzag(int32_t n)
+{
+    return ((uint32_t) n << 1) ^ (uint32_t) (n >> 31);
+}
+
+static inline int32_t
+unzigzag(uint32_t n)
+{
+    return (int32_t) (n >> 1) ^ -(int32_t) (n & 1);
+}
+
+
 /*********** Input ***********/
 
 static FILE *input;
+static const char *input_base, *input_cursor, *input_end;
+				/* binary input, if INPUT_END is set */
+
+/* Text input is read from INPUT into a large buffer of our own, and
+ * tokens are taken from the buffer in place: each line read is
+ * terminated where its newline was, so strings can be handed out (and
+ * interned) without copying them anywhere else first.  Lines longer than
+ * the buffer make it grow.
+ */
+#define TEXT_BUFFER_SIZE	(1 << 20)
+
+static char *text_buffer;
+static size_t text_size;
+static char *text_cursor, *text_limit;
+static int reading_text_record;	/* the buffer holds all there is */
 
 void
 dbpriv_set_dbio_input(FILE * f)
 {
     input = f;
+    input_base = input_cursor = input_end = 0;
+    if (text_buffer) {
+	myfree(text_buffer, M_STRUCT);
+	text_buffer = text_cursor = text_limit = 0;
+    }
+}
+
+/* Moves any unread text to the start of the buffer and reads more after
+ * it, returning false if there was no more to read.
+ */
+static int
+fill_text_buffer(void)
+{
+    size_t unread = text_limit - text_cursor, n;
+
+    if (reading_text_record)
+	return 0;
+    if (!text_buffer) {
+	text_size = TEXT_BUFFER_SIZE;
+	text_buffer = (char *)mymalloc(text_size + 1, M_STRUCT);
+	unread = 0;
+    } else if (unread == text_size) {
+	char *b = (char *)mymalloc(2 * text_size + 1, M_STRUCT);
+
+	memcpy(b, text_cursor, unread);
+	myfree(text_buffer, M_STRUCT);
+	text_buffer = b;
+	text_size *= 2;
+    } else
+	memmove(text_buffer, text_cursor, unread);
+
+    n = fread(text_buffer + unread, 1, text_size - unread, input);
+    text_cursor = text_buffer;
+    text_limit = text_buffer + unread + n;
+    return n > 0;
+}
+
+static inline int
+text_getc(void)
+{
+    if (text_cursor == text_limit && !fill_text_buffer())
+	return EOF;
+    return (unsigned char) *text_cursor++;
+}
+
+static inline void
+text_ungetc(int c)
+{
+    if (c != EOF)
+	text_cursor--;
+}
+
+/* Returns the next line, without its newline, or 0 at the end of the
+ * input.  The line stays valid until the next read.
+ */
+static char *
+read_text_line(void)
+{
+    char *line, *nl;
+    size_t scanned = 0;
+
+    while (!(nl = (char *)memchr(text_cursor + scanned, '\n',
+				 text_limit - text_cursor - scanned))) {
+	scanned = text_limit - text_cursor;
+	if (!fill_text_buffer()) {
+	    if (text_cursor == text_limit)
+		return 0;
+	    nl = text_limit;	/* a last line without a newline */
+	    break;
+	}
+    }
+
+    line = text_cursor;
+    *nl = '\0';
+    text_cursor = nl < text_limit ? nl + 1 : nl;
+    return line;
+}
+
+/* Parses a decimal integer with an optional minus sign, leaving *END just
+ * after it.
+ */
+static inline int
+parse_text_num(const char *s, const char **end)
+{
+    uint32_t n = 0;
+    int neg = (*s == '-');
+
+    s += neg;
+    while ((unsigned) (*s - '0') < 10)
+	n = n * 10 + (*s++ - '0');
+    *end = s;
+    return (int32_t) (neg ? 0 - n : n);
+}
+
+void
+dbpriv_set_dbio_input_buffer(const char *base, size_t size)
+{
+    input_base = input_cursor = base;
+    input_end = base + size;
+}
+
+int
+dbio_reading_binary(void)
+{
+    return input_end != 0;
+}
+
+long
+dbpriv_dbio_input_position(void)
+{
+    if (input_end)
+	return input_cursor - input_base;
+    else {
+	long pos = ftell(input);
+
+	return pos < 0 ? pos : pos - (text_limit - text_cursor);
+    }
+}
+
+int
+dbpriv_dbio_input_seek(long pos)
+{
+    if (pos < 0 || pos > input_end - input_base)
+	return 0;
+    input_cursor = input_base + pos;
+    return 1;
+}
+
+static int
+binary_input_exhausted(int n)
+{
+    if (input_end - input_cursor >= n)
+	return 0;
+    errlog("DBIO: Unexpected end of binary data\n");
+    input_cursor = input_end;
+    return 1;
+}
+
+static uint32_t
+read_varint(void)
+{
+    uint32_t n = 0;
+    int shift = 0;
+    unsigned char c;
+
+    do {
+	if (binary_input_exhausted(1))
+	    return 0;
+	c = *input_cursor++;
+	n |= (uint32_t) (c & 0x7f) << shift;
+	shift += 7;
+    } while ((c & 0x80) && shift < 35);
+
+    return n;
+}
+
+uint64_t
+dbpriv_dbio_read_fixed(void)
+{
+    uint64_t n = 0;
+    int i;
+
+    if (binary_input_exhausted(8))
+	return 0;
+    for (i = 7; i >= 0; i--)
+	n = (n << 8) | (unsigned char) input_cursor[i];
+    input_cursor += 8;
+
+    return n;
 }
 
 void
 dbio_read_line(char *s, int n)
 {
-    fgets(s, n, input);
+    int c = 0;
+
+    while (n > 1 && c != '\n' && (c = text_getc()) != EOF) {
+	*s++ = c;
+	n--;
+    }
+    *s = '\0';
+}
+
+/* Reads a number as scanf()'s %d would, returning 1, 0 if there wasn't
+ * one, or EOF.
+ */
+static int
+scan_text_num(int *ip)
+{
+    char digits[24];
+    const char *end;
+    int c, len = 0;
+
+    do
+	c = text_getc();
+    while (isspace(c));
+    if (c == EOF)
+	return EOF;
+    if (c == '-' || c == '+') {
+	digits[len++] = c;
+	c = text_getc();
+    }
+    while (isdigit(c) && len < (int) sizeof(digits) - 1) {
+	digits[len++] = c;
+	c = text_getc();
+    }
+    text_ungetc(c);
+    digits[len] = '\0';
+
+    *ip = parse_text_num(digits + (digits[0] == '+'), &end);
+    return end > digits + (digits[0] == '-' || digits[0] == '+');
 }
 
 int
@@ -84,33 +326,35 @@ dbio_scanf(const char *format,...)
 
 	if (isspace(*ptr)) {
 	    do
-		c = fgetc(input);
+		c = text_getc();
 	    while (isspace(c));
-	    ungetc(c, input);
+	    text_ungetc(c);
 	} else if (*ptr != '%') {
 	    do
-		c = fgetc(input);
+		c = text_getc();
 	    while (isspace(c));
 
 	    if (c == EOF)
 		return count ? count : EOF;
 	    else if (c != *ptr) {
-		ungetc(c, input);
+		text_ungetc(c);
 		return count;
 	    }
 	} else
 	    switch (*++ptr) {
 	    case 'd':
 		ip = va_arg(args, int *);
-		n = fscanf(input, "%d", ip);
+		n = scan_text_num(ip);
 		goto finish;
 	    case 'u':
 		up = va_arg(args, unsigned *);
-		n = fscanf(input, "%u", up);
+		n = scan_text_num((int *) up);
 		goto finish;
 	    case 'c':
 		cp = va_arg(args, char *);
-		n = fscanf(input, "%c", cp);
+		c = text_getc();
+		*cp = c;
+		n = (c == EOF ? EOF : 1);
 	      finish:
 		if (n == 1)
 		    count++;
@@ -132,30 +376,40 @@ dbio_scanf(const char *format,...)
 int
 dbio_read_num(void)
 {
-    char s[20];
-    char *p;
+    const char *s, *p;
     int i;
 
-    fgets(s, 20, input);
-    i = strtol(s, &p, 10);
-    if (isspace(*s) || *p != '\n')
+    if (input_end)
+	return unzigzag(read_varint());
+
+    if (!(s = read_text_line()))
+	s = "";
+    i = parse_text_num(s, &p);
+    if (*p)
 	errlog("DBIO_READ_NUM: Bad number: \"%s\" at file pos. %ld\n",
-	       s, ftell(input));
+	       s, dbpriv_dbio_input_position());
     return i;
 }
 
 double
 dbio_read_float(void)
 {
-    char s[40];
-    char *p;
+    char *s, *p;
     double d;
 
-    fgets(s, 40, input);
+    if (input_end) {
+	uint64_t bits = dbpriv_dbio_read_fixed();
+
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+    }
+
+    if (!(s = read_text_line()))
+	s = (char *) "";
     d = strtod(s, &p);
-    if (isspace(*s) || *p != '\n')
+    if (isspace(*s) || *p)
 	errlog("DBIO_READ_FLOAT: Bad number: \"%s\" at file pos. %ld\n",
-	       s, ftell(input));
+	       s, dbpriv_dbio_input_position());
     return d;
 }
 
@@ -168,42 +422,61 @@ dbio_read_objid(void)
 const char *
 dbio_read_string(void)
 {
-    static Stream *str = 0;
-    static char buffer[1024];
-    int len, used_stream = 0;
-
-    if (str == 0)
-	str = new_stream(1024);
-
-  try_again:
-    fgets(buffer, sizeof(buffer), input);
-    len = strlen(buffer);
-    if (len == sizeof(buffer) - 1 && buffer[len - 1] != '\n') {
-	stream_add_string(str, buffer);
-	used_stream = 1;
-	goto try_again;
+    const char *s;
+    int len;
+
+    if (input_end) {
+	const char *r;
+
+	len = read_varint();
+	if (binary_input_exhausted(len + 1))
+	    return "";
+	r = input_cursor;
+	input_cursor += len + 1;
+	return r;
     }
-    if (buffer[len - 1] == '\n')
-	buffer[len - 1] = '\0';
 
-    if (used_stream) {
-	stream_add_string(str, buffer);
-	return reset_stream(str);
-    } else
-	return buffer;
+    return (s = read_text_line()) ? s : "";
 }
 
 const char *
 dbio_read_string_intern(void)
 {
-    const char *s, *r;
+    return str_intern(dbio_read_string());
+}
 
-    s = dbio_read_string();
-    r = str_intern(s);
+int
+dbio_read_text_record(int (*reader) (void *), void *data)
+{
+    const char *s, *saved_end = input_end;
+    char *saved_buffer = text_buffer, *saved_cursor = text_cursor;
+    char *saved_limit = text_limit;
+    size_t saved_size = text_size, len;
+    int result;
 
-    /* puts(r); */
+    if (!input_end)
+	return (*reader) (data);
 
-    return r;
+    s = dbio_read_string();
+    len = strlen(s);
+    text_buffer = text_cursor = (char *)mymalloc(len + 1, M_STRUCT);
+    memcpy(text_buffer, s, len + 1);
+    text_limit = text_buffer + len;
+    text_size = len;
+    input_end = 0;
+    reading_text_record = 1;
+
+    result = (*reader) (data);
+
+    reading_text_record = 0;
+    input_end = saved_end;
+    myfree(text_buffer, M_STRUCT);
+    text_buffer = saved_buffer;
+    text_cursor = saved_cursor;
+    text_limit = saved_limit;
+    text_size = saved_size;
+
+    return result;
 }
 
 Var
@@ -259,7 +532,7 @@ dbio_read_var(void)
 	break;
     default:
 	errlog("DBIO_READ_VAR: Unknown type (%d) at DB file pos. %ld\n",
-	       l, ftell(input));
+	       l, dbpriv_dbio_input_position());
 	r = zero;
 	break;
     }
@@ -268,6 +541,7 @@ dbio_read_var(void)
 
 struct state {
     char prev_char;
+    const char *text;		/* program source, when reading binary */
     const char *(*fmtr) (void *);
     void *data;
 };
@@ -301,10 +575,10 @@ my_getc(void *data)
     struct state *s = (state *)data;
     int c;
 
-    c = fgetc(input);
+    c = text_getc();
     if (c == '.' && s->prev_char == '\n') {
 	/* end-of-verb marker in DB */
-	c = fgetc(input);	/* skip next newline */
+	c = text_getc();	/* skip next newline */
 	return EOF;
     }
     if (c == EOF)
@@ -313,9 +587,20 @@ my_getc(void *data)
     return c;
 }
 
+static int
+my_sgetc(void *data)
+{
+    struct state *s = (state *)data;
+
+    return *s->text ? (unsigned char) *s->text++ : EOF;
+}
+
 static Parser_Client parser_client =
 {my_error, my_warning, my_getc};
 
+static Parser_Client string_parser_client =
+{my_error, my_warning, my_sgetc};
+
 Program *
 dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
 {
@@ -324,13 +609,56 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
     s.prev_char = '\n';
     s.fmtr = fmtr;
     s.data = data;
+    if (input_end) {
+	s.text = dbio_read_string();
+	return parse_program(version, string_parser_client, &s);
+    }
+    s.text = 0;
     return parse_program(version, parser_client, &s);
 }
+
+const char *
+dbio_read_program_text(const char *(*fmtr) (void *), void *data)
+{
+    static Stream *str = 0;
+    struct state s;
+    int c;
+
+    if (input_end)
+	return str_dup(dbio_read_string());
+
+    if (!str)
+	str = new_stream(1000);
+    s.prev_char = '\n';
+    s.fmtr = fmtr;
+    s.data = data;
+    while ((c = my_getc(&s)) != EOF)
+	stream_add_char(str, c);
+    if (s.prev_char != '\n') {	/* my_getc() hit the real EOF */
+	reset_stream(str);
+	return 0;
+    }
+    return str_dup(reset_stream(str));
+}
+
+Program *
+dbio_parse_program_text(DB_Version version, const char *text,
+			const char *(*fmtr) (void *), void *data)
+{
+    struct state s;
+
+    s.prev_char = '\n';
+    s.text = text;
+    s.fmtr = fmtr;
+    s.data = data;
+    return parse_program(version, string_parser_client, &s);
+}
 
 
 /*********** Output ***********/
 
 static FILE *output;
+static int output_binary;
 
 void
 dbpriv_set_dbio_output(FILE * f)
@@ -338,6 +666,79 @@ dbpriv_set_dbio_output(FILE * f)
     output = f;
 }
 
+void
+dbpriv_set_dbio_binary_output(int binary)
+{
+    output_binary = binary;
+}
+
+int
+dbio_writing_binary(void)
+{
+    return output_binary;
+}
+
+long
+dbpriv_dbio_output_position(void)
+{
+    long pos = ftell(output);
+
+    if (pos < 0)
+	throw dbpriv_dbio_failed();
+    return pos;
+}
+
+void
+dbpriv_dbio_output_seek(long pos)
+{
+    if (fseek(output, pos, SEEK_SET) != 0)
+	throw dbpriv_dbio_failed();
+}
+
+static void
+write_bytes(const void *buffer, size_t len)
+{
+    if (len && fwrite(buffer, 1, len, output) != len)
+	throw dbpriv_dbio_failed();
+}
+
+void
+dbpriv_dbio_copy(FILE *from)
+{
+    char buffer[65536];
+    size_t len;
+
+    while ((len = fread(buffer, 1, sizeof(buffer), from)) > 0)
+	write_bytes(buffer, len);
+    if (ferror(from))
+	throw dbpriv_dbio_failed();
+}
+
+static void
+write_varint(uint32_t n)
+{
+    unsigned char buffer[5];
+    int len = 0;
+
+    while (n >= 0x80) {
+	buffer[len++] = (n & 0x7f) | 0x80;
+	n >>= 7;
+    }
+    buffer[len++] = n;
+    write_bytes(buffer, len);
+}
+
+void
+dbpriv_dbio_write_fixed(uint64_t n)
+{
+    unsigned char buffer[8];
+    int i;
+
+    for (i = 0; i < 8; i++, n >>= 8)
+	buffer[i] = n & 0xff;
+    write_bytes(buffer, 8);
+}
+
 void
 dbio_printf(const char *format,...)
 {
@@ -352,7 +753,10 @@ dbio_printf(const char *format,...)
 void
 dbio_write_num(int n)
 {
-    dbio_printf("%d\n", n);
+    if (output_binary)
+	write_varint(zigzag(n));
+    else
+	dbio_printf("%d\n", n);
 }
 
 void
@@ -361,6 +765,14 @@ dbio_write_float(double d)
     static const char *fmt = 0;
     static char buffer[10];
 
+    if (output_binary) {
+	uint64_t bits;
+
+	memcpy(&bits, &d, sizeof(bits));
+	dbpriv_dbio_write_fixed(bits);
+	return;
+    }
+
     if (!fmt) {
 	sprintf(buffer, "%%.%dg\n", DBL_DIG + 4);
 	fmt = buffer;
@@ -377,7 +789,13 @@ dbio_write_objid(Objid oid)
 void
 dbio_write_string(const char *s)
 {
-    dbio_printf("%s\n", s ? s : "");
+    if (output_binary) {
+	size_t len = s ? strlen(s) : 0;
+
+	write_varint(len);
+	write_bytes(s ? s : "", len + 1);
+    } else
+	dbio_printf("%s\n", s ? s : "");
 }
 
 static int
@@ -442,19 +860,93 @@ dbio_write_var(Var v)
 static void
 receiver(void *data, const char *line)
 {
-    dbio_printf("%s\n", line);
+    if (data) {
+	stream_add_string((Stream *) data, line);
+	stream_add_char((Stream *) data, '\n');
+    } else
+	dbio_printf("%s\n", line);
+}
+
+static void
+write_program(Program * program, int f_index)
+{
+    static Stream *s = 0;
+
+    if (output_binary) {
+	/* The binary format stores the source as one length-prefixed
+	 * string instead of a sequence of lines ended by a `.'.
+	 */
+	if (!s)
+	    s = new_stream(1000);
+	unparse_program(program, receiver, s, 1, 0, f_index);
+	dbio_write_string(reset_stream(s));
+    } else {
+	unparse_program(program, receiver, 0, 1, 0, f_index);
+	dbio_printf(".\n");
+    }
 }
 
 void
 dbio_write_program(Program * program)
 {
-    unparse_program(program, receiver, 0, 1, 0, MAIN_VECTOR);
-    dbio_printf(".\n");
+    write_program(program, MAIN_VECTOR);
 }
 
 void
 dbio_write_forked_program(Program * program, int f_index)
 {
-    unparse_program(program, receiver, 0, 1, 0, f_index);
-    dbio_printf(".\n");
+    write_program(program, f_index);
+}
+
+void
+dbio_write_program_text(const char *text)
+{
+    if (output_binary)
+	dbio_write_string(text);
+    else
+	dbio_printf("%s.\n", text);
+}
+
+void
+dbio_write_text_record(void (*writer) (void *), void *data)
+{
+    FILE *saved = output;
+    char *text = 0;
+    size_t len = 0;
+    int ok;
+
+    if (!output_binary) {
+	(*writer) (data);
+	return;
+    }
+
+    if (!(output = open_memstream(&text, &len))) {
+	output = saved;
+	throw dbpriv_dbio_failed();
+    }
+    output_binary = 0;
+    try {
+	(*writer) (data);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	fclose(output);
+	free(text);
+	output = saved;
+	output_binary = 1;
+	throw;
+    }
+    ok = fclose(output) == 0;
+    output = saved;
+    output_binary = 1;
+
+    try {
+	if (!ok)
+	    throw dbpriv_dbio_failed();
+	dbio_write_string(text);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	free(text);
+	throw;
+    }
+    free(text);
 }
@@ -28,6 +28,12 @@
 extern DB_Version dbio_input_version;
 				/* What DB-format version are we reading? */
 
+extern int dbio_reading_binary(void);
+				/* Is the input in the binary encoding?  Only
+				 * dbio_scanf() and dbio_read_line() are then
+				 * unavailable; see dbio_read_text_record().
+				 */
+
 extern void dbio_read_line(char *s, int n);
 				/* Reads at most N-1 characters through the
 				 * next newline into S, terminating S with a
@@ -68,6 +74,27 @@ extern Program *dbio_read_program(DB_Version version,
 				 * be the required string.
 				 */
 
+extern const char *dbio_read_program_text(const char *(*fmtr) (void *),
+					  void *data);
+				/* Like dbio_read_program(), but returns the
+				 * source text of the program, as a string
+				 * the caller must free_str(), instead of
+				 * parsing it.  Returns null on EOF.
+				 */
+extern Program *dbio_parse_program_text(DB_Version version, const char *text,
+					const char *(*fmtr) (void *),
+					void *data);
+				/* Parses source text returned by
+				 * dbio_read_program_text().
+				 */
+
+extern int dbio_read_text_record(int (*reader) (void *), void *data);
+				/* Calls READER with DATA to read something
+				 * written by dbio_write_text_record(), and
+				 * returns what it does.  In binary input,
+				 * READER sees the record as text input.
+				 */
+
 
 /*********** Output ***********/
 
@@ -80,6 +107,8 @@ extern Program *dbio_read_program(DB_Version version,
  * event.
  */
 
+extern int dbio_writing_binary(void);
+
 extern void dbio_printf(const char *format,...);
 
 extern void dbio_write_num(int);
@@ -94,4 +123,14 @@ extern void dbio_write_string(const char *);
 extern void dbio_write_var(Var);
 
 extern void dbio_write_program(Program *);
+extern void dbio_write_program_text(const char *);
+				/* Writes source text as returned by
+				 * dbio_read_program_text().
+				 */
 extern void dbio_write_forked_program(Program * prog, int f_index);
+
+extern void dbio_write_text_record(void (*writer) (void *), void *data);
+				/* Calls WRITER with DATA, which may use
+				 * dbio_printf() even in binary output; what
+				 * it writes is then kept as a string.
+				 */
@@ -38,6 +38,7 @@ static int num_objects = 0;
 static int max_objects = 0;
 
 static unsigned int nonce = 0;
+static unsigned int epoch = 0;
 
 static Var all_users;
 
@@ -131,6 +132,18 @@ dbpriv_assign_nonce(Object *o)
     o->nonce = nonce++;
 }
 
+unsigned int
+dbpriv_current_nonce(void)
+{
+    return nonce;
+}
+
+unsigned int
+dbpriv_begin_epoch(void)
+{
+    return ++epoch;
+}
+
 void
 dbpriv_after_load(void)
 {
@@ -157,6 +170,8 @@ dbpriv_new_object(void)
     ensure_new_object();
     o = objects[num_objects] = (Object *)mymalloc(sizeof(Object), M_OBJECT);
     o->id = num_objects;
+    o->epoch = epoch;
+    o->shared_layout = o->anon_layout = 0;
     num_objects++;
 
     return o;
@@ -170,6 +185,8 @@ dbpriv_new_anonymous_object(void)
     ensure_new_object();
     o = objects[num_objects] = (Object *)mymalloc(sizeof(Object), M_ANON);
     o->id = NOTHING;
+    o->epoch = epoch;
+    o->shared_layout = o->anon_layout = 0;
     num_objects++;
 
     return o;
@@ -211,10 +228,146 @@ db_create_object(void)
 
     o = dbpriv_new_object();
     db_init_object(o);
+    dbpriv_note_change(o);
 
     return o->id;
 }
 
+Object *
+dbpriv_copy_object(Object *o)
+{
+    Object *c = (Object *)mymalloc(sizeof(Object), M_OBJECT);
+    Verbdef *v, **prevv;
+    int i;
+
+    *c = *o;
+    c->name = str_ref(o->name);
+    c->location = var_ref(o->location);
+    c->contents = var_ref(o->contents);
+    c->parents = var_ref(o->parents);
+    c->children = var_ref(o->children);
+    c->shared_layout = c->anon_layout = 0;
+
+    if (o->nval) {
+	c->propval = (Pval *)mymalloc(o->nval * sizeof(Pval), M_PVAL);
+	for (i = 0; i < o->nval; i++) {
+	    c->propval[i] = o->propval[i];
+	    c->propval[i].var = var_ref(o->propval[i].var);
+	}
+    }
+
+    if (o->propdefs.cur_length) {
+	c->propdefs.l = (Propdef *)mymalloc(o->propdefs.cur_length * sizeof(Propdef),
+					    M_PROPDEF);
+	c->propdefs.max_length = o->propdefs.cur_length;
+	for (i = 0; i < o->propdefs.cur_length; i++) {
+	    c->propdefs.l[i] = o->propdefs.l[i];
+	    c->propdefs.l[i].name = str_ref(o->propdefs.l[i].name);
+	}
+    } else {
+	c->propdefs.l = 0;
+	c->propdefs.max_length = 0;
+    }
+
+    prevv = &(c->verbdefs);
+    for (v = o->verbdefs; v; v = v->next) {
+	*prevv = (Verbdef *)mymalloc(sizeof(Verbdef), M_VERBDEF);
+	**prevv = *v;
+	(*prevv)->name = str_ref(v->name);
+	if (v->program)
+	    (*prevv)->program = program_ref(v->program);
+	if (v->source)
+	    (*prevv)->source = str_ref(v->source);
+	prevv = &((*prevv)->next);
+    }
+    *prevv = 0;
+
+    return c;
+}
+
+void
+dbpriv_free_object(Object *o)
+{
+    Verbdef *v, *w;
+    int i;
+
+    free_str(o->name);
+    free_var(o->parents);
+    free_var(o->children);
+    free_var(o->location);
+    free_var(o->contents);
+
+    for (i = 0; i < o->propdefs.cur_length; i++)
+	free_str(o->propdefs.l[i].name);
+    if (o->propdefs.l)
+	myfree(o->propdefs.l, M_PROPDEF);
+    dbpriv_free_propvals(o);
+
+    for (v = o->verbdefs; v; v = w) {
+	if (v->program)
+	    free_program(v->program);
+	if (v->source)
+	    free_str(v->source);
+	free_str(v->name);
+	w = v->next;
+	myfree(v, M_VERBDEF);
+    }
+
+    myfree(o, M_OBJECT);
+}
+
+/* True if anonymous children of OLD can stay valid with NEW in its
+ * place, i.e., the property layout is unchanged.
+ */
+static int
+same_layout(Object *old, Object *_new)
+{
+    int i;
+
+    if (old->nval != _new->nval
+	|| old->propdefs.cur_length != _new->propdefs.cur_length
+	|| !equality(old->parents, _new->parents, 1))
+	return 0;
+    for (i = 0; i < old->propdefs.cur_length; i++)
+	if (strcmp(old->propdefs.l[i].name, _new->propdefs.l[i].name))
+	    return 0;
+
+    return 1;
+}
+
+void
+dbpriv_replace_object(Objid oid, Object *o)
+{
+    Object *old;
+
+    extend(oid + 1);
+    old = objects[oid];
+
+    if (o) {
+	o->id = oid;
+	o->epoch = epoch;
+	if (old && same_layout(old, o))
+	    o->nonce = old->nonce;
+	else
+	    dbpriv_assign_nonce(o);
+    }
+    if (old)
+	dbpriv_free_object(old);
+
+    objects[oid] = o;
+    if (oid >= num_objects)
+	num_objects = oid + 1;
+
+    db_priv_affected_callable_verb_lookup();
+}
+
+void
+dbpriv_set_last_used_objid(Objid oid)
+{
+    extend(oid + 1);
+    num_objects = oid + 1;
+}
+
 void
 db_destroy_object(Objid oid)
 {
@@ -227,6 +380,8 @@ db_destroy_object(Objid oid)
     if (!o)
 	panic("DB_DESTROY_OBJECT: Invalid object!");
 
+    dbpriv_note_change(o);
+
     if (o->location.v.obj != NOTHING ||
 	o->contents.v.list[0].v.num != 0 ||
 	(o->parents.type == TYPE_OBJ && o->parents.v.obj != NOTHING) ||
@@ -249,22 +404,20 @@ db_destroy_object(Objid oid)
     }
     free_str(o->name);
 
-    for (i = 0; i < o->propdefs.cur_length; i++) {
-	/* As an orphan, the only properties on this object are the ones
-	 * defined on it directly, so these two arrays must be the same length.
-	 */
+    /* As an orphan, the only properties on this object are the ones
+     * defined on it directly.
+     */
+    for (i = 0; i < o->propdefs.cur_length; i++)
 	free_str(o->propdefs.l[i].name);
-	free_var(o->propval[i].var);
-    }
     if (o->propdefs.l)
 	myfree(o->propdefs.l, M_PROPDEF);
-    if (o->propval)
-	myfree(o->propval, M_PVAL);
-    o->nval = 0;
+    dbpriv_free_propvals(o);
 
     for (v = o->verbdefs; v; v = w) {
 	if (v->program)
 	    free_program(v->program);
+	if (v->source)
+	    free_str(v->source);
 	free_str(v->name);
 	w = v->next;
 	myfree(v, M_VERBDEF);
@@ -317,6 +470,8 @@ db_write_anonymous(Var v)
     else if (o->id != NOTHING)
 	oid = o->id;
     else {
+	if (dbpriv_dump_refuses_anonymous())
+	    throw dbpriv_dbio_failed();
 	ensure_new_object();
 	objects[num_objects] = o;
 	oid = o->id = num_objects;
@@ -336,12 +491,18 @@ db_make_anonymous(Objid oid, Objid last)
     Var parent;
     int i, c;
 
+    dbpriv_note_change(o);
+
     /* remove me from my old parents' children */
-    if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING)
+    if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING) {
+	dbpriv_note_change(objects[old_parents.v.obj]);
 	objects[old_parents.v.obj]->children = setremove(objects[old_parents.v.obj]->children, me);
+    }
     else if (old_parents.type == TYPE_LIST)
-	FOR_EACH(parent, old_parents, i, c)
+	FOR_EACH(parent, old_parents, i, c) {
+	    dbpriv_note_change(objects[parent.v.obj]);
 	    objects[parent.v.obj]->children = setremove(objects[parent.v.obj]->children, me);
+	}
 
     objects[oid] = 0;
     db_set_last_used_objid(last);
@@ -369,6 +530,8 @@ db_destroy_anonymous_object(void *obj)
     Verbdef *v, *w;
     int i;
 
+    dbpriv_note_change(o);
+
     free_str(o->name);
     o->name = NULL;
 
@@ -378,15 +541,13 @@ db_destroy_anonymous_object(void *obj)
 	free_str(o->propdefs.l[i].name);
     if (o->propdefs.l)
 	myfree(o->propdefs.l, M_PROPDEF);
-    for (i = 0; i < o->nval; i++)
-	free_var(o->propval[i].var);
-    if (o->propval)
-	myfree(o->propval, M_PVAL);
-    o->nval = 0;
+    dbpriv_free_propvals(o);
 
     for (v = o->verbdefs; v; v = w) {
 	if (v->program)
 	    free_program(v->program);
+	if (v->source)
+	    free_str(v->source);
 	free_str(v->name);
 	w = v->next;
 	myfree(v, M_VERBDEF);
@@ -450,6 +611,9 @@ db_renumber_object(Objid old)
 
     for (_new = 0; _new < old; _new++) {
 	if (objects[_new] == NULL) {
+	    /* Renumbering can touch the owner fields of any object. */
+	    dbpriv_note_all_changed();
+
 	    /* Change the identity of the object. */
 	    o = objects[_new] = objects[old];
 	    objects[old] = 0;
@@ -507,6 +671,7 @@ db_renumber_object(Objid old)
 	    {
 		Objid oid;
 
+		dbpriv_forget_anon_layouts();
 		for (oid = 0; oid < num_objects; oid++) {
 		    Object *o = objects[oid];
 		    Verbdef *v;
@@ -558,6 +723,7 @@ db_object_bytes(Var obj)
     for (v = o->verbdefs; v; v = v->next) {
 	count += sizeof(Verbdef);
 	count += memo_strlen(v->name) + 1;
+	dbpriv_compile_verb(o, v);
 	if (v->program)
 	    count += program_bytes(v->program);
     }
@@ -719,6 +885,7 @@ db_object_has_flag2(Var obj, db_object_flag f)
 void
 db_set_object_flag2(Var obj, db_object_flag f)
 {
+    dbpriv_note_change(dbpriv_dereference(obj));
     (TYPE_ANON == obj.type) ?
       dbpriv_set_object_flag(obj.v.anon, f) :
       db_set_object_flag(obj.v.obj, f);
@@ -727,6 +894,7 @@ db_set_object_flag2(Var obj, db_object_flag f)
 void
 db_clear_object_flag2(Var obj, db_object_flag f)
 {
+    dbpriv_note_change(dbpriv_dereference(obj));
     (TYPE_ANON == obj.type) ?
       dbpriv_clear_object_flag(obj.v.anon, f) :
       db_clear_object_flag(obj.v.obj, f);
@@ -741,6 +909,7 @@ dbpriv_object_owner(Object *o)
 void
 dbpriv_set_object_owner(Object *o, Objid owner)
 {
+    dbpriv_note_change(o);
     o->owner = owner;
 }
 
@@ -765,6 +934,7 @@ dbpriv_object_name(Object *o)
 void
 dbpriv_set_object_name(Object *o, const char *name)
 {
+    dbpriv_note_change(o);
     if (o->name)
 	free_str(o->name);
     o->name = name;
@@ -900,20 +1070,29 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
 	int i, c;
 
 	/* remove me/obj from my old parents' children */
-	if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING)
+	if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING) {
+	    dbpriv_note_change(objects[old_parents.v.obj]);
 	    objects[old_parents.v.obj]->children = setremove(objects[old_parents.v.obj]->children, obj);
+	}
 	else if (old_parents.type == TYPE_LIST)
-	    FOR_EACH(parent, old_parents, i, c)
+	    FOR_EACH(parent, old_parents, i, c) {
+		dbpriv_note_change(objects[parent.v.obj]);
 		objects[parent.v.obj]->children = setremove(objects[parent.v.obj]->children, obj);
+	    }
 
 	/* add me/obj to my new parents' children */
-	if (new_parents.type == TYPE_OBJ && new_parents.v.obj != NOTHING)
+	if (new_parents.type == TYPE_OBJ && new_parents.v.obj != NOTHING) {
+	    dbpriv_note_change(objects[new_parents.v.obj]);
 	    objects[new_parents.v.obj]->children = setadd(objects[new_parents.v.obj]->children, obj);
+	}
 	else if (new_parents.type == TYPE_LIST)
-	    FOR_EACH(parent, new_parents, i, c)
+	    FOR_EACH(parent, new_parents, i, c) {
+		dbpriv_note_change(objects[parent.v.obj]);
 		objects[parent.v.obj]->children = setadd(objects[parent.v.obj]->children, obj);
+	    }
     }
 
+    dbpriv_note_change(o);
     free_var(o->parents);
     o->parents = var_dup(new_parents);
 
@@ -976,12 +1155,17 @@ db_change_location(Objid oid, Objid new_location)
 
     Objid old_location = objects[oid]->location.v.obj;
 
-    if (valid(old_location))
+    if (valid(old_location)) {
+	dbpriv_note_change(objects[old_location]);
 	objects[old_location]->contents = setremove(objects[old_location]->contents, var_dup(me));
+    }
 
-    if (valid(new_location))
+    if (valid(new_location)) {
+	dbpriv_note_change(objects[new_location]);
 	objects[new_location]->contents = setadd(objects[new_location]->contents, me);
+    }
 
+    dbpriv_note_change(objects[oid]);
     free_var(objects[oid]->location);
 
     objects[oid]->location = Var::new_obj(new_location);
@@ -1014,6 +1198,7 @@ db_object_has_flag(Objid oid, db_object_flag f)
 void
 db_set_object_flag(Objid oid, db_object_flag f)
 {
+    dbpriv_note_change(objects[oid]);
     dbpriv_set_object_flag(objects[oid], f);
 
     if (f == FLAG_USER)
@@ -1023,6 +1208,7 @@ db_set_object_flag(Objid oid, db_object_flag f)
 void
 db_clear_object_flag(Objid oid, db_object_flag f)
 {
+    dbpriv_note_change(objects[oid]);
     dbpriv_clear_object_flag(objects[oid], f);
     if (f == FLAG_USER)
 	all_users = setremove(all_users, Var::new_obj(oid));
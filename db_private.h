@@ -30,9 +30,11 @@ typedef struct Verbdef Verbdef;
 struct Verbdef {
     const char *name;
     Program *program;
+    const char *source;		/* if not yet compiled; see db_verbs.c */
     Objid owner;
     short perms;
     short prep;
+    char unparsable;		/* source failed to compile; see db_verbs.c */
     Verbdef *next;
 };
 
@@ -72,6 +74,14 @@ typedef struct Object {
     Pval *propval;
     unsigned int nval;
 
+    /* While the property values of an anonymous object are still the
+     * clear ones it was created with, `propval' is that of a layout
+     * shared with its siblings.  A parent keeps the last layout it
+     * made for its anonymous children.  See db_properties.cc.
+     */
+    struct Proplayout *shared_layout;
+    struct Proplayout *anon_layout;
+
     Verbdef *verbdefs;
     Proplist propdefs;
 
@@ -80,6 +90,11 @@ typedef struct Object {
      * globally unique.
      */
     unsigned int nonce;
+
+    /* The epoch in which the object was created or last preserved for
+     * a snapshot checkpoint (see db_file.cc).
+     */
+    unsigned int epoch;
 } Object;
 
 /*
@@ -117,6 +132,15 @@ extern Var db_read_anonymous();
 extern void db_write_anonymous(Var);
 
 extern void dbpriv_assign_nonce(Object *);
+extern unsigned int dbpriv_current_nonce(void);
+				/* Returns the nonce the next call to
+				 * dbpriv_assign_nonce() will hand out.
+				 */
+
+extern unsigned int dbpriv_begin_epoch(void);
+				/* Starts a new epoch and returns it.  Objects
+				 * created from now on belong to it.
+				 */
 
 extern Objid dbpriv_object_owner(Object *);
 extern void dbpriv_set_object_owner(Object *, Objid owner);
@@ -168,6 +192,23 @@ extern Object *dbpriv_find_object(Objid);
 				/* Returns 0 if given object is not valid.
 				 */
 
+extern void dbpriv_replace_object(Objid, Object *);
+				/* Frees whatever is stored at the given
+				 * object number and stores the given object
+				 * (or null) there instead, without fixing up
+				 * any other object.  Used when replaying the
+				 * journal, which supplies the related objects
+				 * as well.
+				 */
+extern void dbpriv_set_last_used_objid(Objid);
+
+extern Object *dbpriv_copy_object(Object *);
+extern void dbpriv_free_object(Object *);
+				/* Copy and free the contents of an object
+				 * without touching any of the objects it is
+				 * related to.
+				 */
+
 extern void dbpriv_after_load(void);
 
 /*********** Properties ***********/
@@ -195,6 +236,24 @@ extern void dbpriv_fix_properties_after_chparent(Var obj,
 				 * appropriate for its new parents.
 				 */
 
+extern void dbpriv_own_propvals(Object *);
+				/* Gives the object its own copy of any
+				 * property values it shares, so that they
+				 * can be changed.
+				 */
+
+extern void dbpriv_free_propvals(Object *);
+				/* Frees (or lets go of) the property values
+				 * of the object and any layout it keeps for
+				 * anonymous children.
+				 */
+
+extern void dbpriv_forget_anon_layouts(void);
+				/* Called when property owners change in
+				 * place, so that new anonymous objects
+				 * don't share stale ones.
+				 */
+
 /*********** Verbs ***********/
 
 extern void dbpriv_build_prep_table(void);
@@ -203,6 +262,31 @@ extern void dbpriv_build_prep_table(void);
 				 * prepositional-phrase matching table.
 				 */
 
+extern void dbpriv_set_verb_source(db_verb_handle, const char *);
+				/* Gives the verb source text read from the
+				 * DB, to be compiled when it is first needed.
+				 * The string is consumed.
+				 */
+extern void dbpriv_compile_verb(Object *, Verbdef *);
+				/* Compiles the verb's source text, if it has
+				 * any.
+				 */
+
+/*********** Journal ***********/
+
+extern void dbpriv_note_change(Object *);
+				/* Must be called before any persistent
+				 * field of the given object is changed, so
+				 * that the object is written to the journal.
+				 */
+extern void dbpriv_note_all_changed(void);
+
+extern int dbpriv_dump_refuses_anonymous(void);
+				/* True while writing a snapshot checkpoint or
+				 * one shard of a DB file, neither of which
+				 * can include anonymous objects.
+				 */
+
 /*********** DBIO ***********/
 
 class dbpriv_dbio_failed: public std::exception
@@ -225,6 +309,31 @@ public:
 extern void dbpriv_set_dbio_input(FILE *);
 extern void dbpriv_set_dbio_output(FILE *);
 
+extern void dbpriv_set_dbio_input_buffer(const char *, size_t);
+				/* Switches DBIO input to the binary encoding,
+				 * reading from the given in-memory image of
+				 * the DB file.  Strings returned by
+				 * dbio_read_string() then point directly into
+				 * the image.  dbpriv_set_dbio_input() switches
+				 * back to text.
+				 */
+extern long dbpriv_dbio_input_position(void);
+extern int dbpriv_dbio_input_seek(long);
+extern uint64_t dbpriv_dbio_read_fixed(void);
+
+extern void dbpriv_set_dbio_binary_output(int);
+				/* Selects the binary encoding for the
+				 * dbio_write_*() routines.  dbio_printf()
+				 * output is always text.
+				 */
+extern long dbpriv_dbio_output_position(void);
+extern void dbpriv_dbio_output_seek(long);
+extern void dbpriv_dbio_write_fixed(uint64_t);
+extern void dbpriv_dbio_copy(FILE *);
+				/* Copies the rest of the given file to the
+				 * output.
+				 */
+
 /****/
 
 static inline Object *
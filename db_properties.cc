@@ -40,6 +40,286 @@ dbpriv_new_propdef(const char *name)
     return newprop;
 }
 
+/*********** Shared layouts ***********/
+
+/*
+ * The properties of a new anonymous object are all clear, with owners and
+ * permissions that depend only on its parents and its owner, so instead of
+ * each getting an array of its own, siblings share one kept by their first
+ * parent.  It is made again after the layout of any parent changes (see the
+ * nonce) or property owners or permissions change anywhere.  An object gets
+ * its own copy (dbpriv_own_propvals()) before any of its property values
+ * is changed.
+ */
+
+typedef struct Proplayout {
+    int refcount;
+    Var parents;
+    Objid owner;		/* of the objects sharing it */
+    unsigned int nonce;		/* the next nonce when it was made */
+    unsigned int generation;
+    Pval *propval;
+} Proplayout;
+
+static unsigned int layout_generation = 0;
+
+void
+dbpriv_forget_anon_layouts(void)
+{
+    layout_generation++;
+}
+
+static Proplayout *
+new_layout(Object *o, Pval *propval)
+{
+    Proplayout *l = (Proplayout *)mymalloc(sizeof(Proplayout), M_STRUCT);
+
+    l->refcount = 1;
+    l->parents = var_ref(o->parents);
+    l->owner = o->owner;
+    l->nonce = dbpriv_current_nonce();
+    l->generation = layout_generation;
+    l->propval = propval;
+
+    return l;
+}
+
+static void
+release_layout(Proplayout *l)
+{
+    if (--l->refcount == 0) {
+	free_var(l->parents);
+	myfree(l->propval, M_PVAL);
+	myfree(l, M_STRUCT);
+    }
+}
+
+static int
+layout_fits(Proplayout *l, Object *o)
+{
+    Var parent;
+    int i, c;
+
+    if (l->generation != layout_generation || l->owner != o->owner
+	|| !equality(l->parents, o->parents, 1))
+	return 0;
+
+    if (TYPE_LIST == o->parents.type) {
+	FOR_EACH(parent, o->parents, i, c)
+	    if (dbpriv_find_object(parent.v.obj)->nonce >= l->nonce)
+		return 0;
+    } else if (dbpriv_find_object(o->parents.v.obj)->nonce >= l->nonce)
+	return 0;
+
+    return 1;
+}
+
+void
+dbpriv_own_propvals(Object *o)
+{
+    Proplayout *l = o->shared_layout;
+
+    if (!l)
+	return;
+
+    /* They're all clear, so there are no values to reference. */
+    o->propval = (Pval *)mymalloc(o->nval * sizeof(Pval), M_PVAL);
+    memcpy(o->propval, l->propval, o->nval * sizeof(Pval));
+    o->shared_layout = 0;
+    release_layout(l);
+}
+
+static void
+free_propvals(Object *o)
+{
+    unsigned int i;
+
+    if (o->shared_layout) {
+	release_layout(o->shared_layout);
+	o->shared_layout = 0;
+    } else {
+	for (i = 0; i < o->nval; i++)
+	    free_var(o->propval[i].var);
+	if (o->propval)
+	    myfree(o->propval, M_PVAL);
+    }
+    o->propval = 0;
+    o->nval = 0;
+}
+
+void
+dbpriv_free_propvals(Object *o)
+{
+    free_propvals(o);
+    if (o->anon_layout) {
+	release_layout(o->anon_layout);
+	o->anon_layout = 0;
+    }
+}
+
+/* Returns the property value H refers to.  The object's values may have
+ * moved since H was made, if it has stopped sharing a layout, so this
+ * goes by index rather than H's pointer.
+ */
+static Pval *
+handle_propval(db_prop_handle h)
+{
+    return ((Object *)h.object)->propval + h.index;
+}
+
+/* Returns the property value H refers to, where it can be changed. */
+static Pval *
+writable_propval(db_prop_handle h)
+{
+    Object *o = (Object *)h.object;
+
+    if (o->shared_layout)
+	dbpriv_own_propvals(o);
+
+    return handle_propval(h);
+}
+
+/*********** Property watches ***********/
+
+typedef struct Watch {
+    Objid oid;
+    Object *o;			/* used to notice recycling/renumbering */
+    unsigned int nonce;		/* used to notice propval layout changes */
+    Pval *first, *last;		/* watched property values, [first, last) */
+} Watch;
+
+static Watch *watches = 0;
+static int watch_count = 0;
+static int watch_max = 0;
+static int watch_triggered = 0;
+
+static Watch *
+find_watch(Object *o)
+{
+    int i;
+
+    for (i = 0; i < watch_count; i++)
+	if (watches[i].o == o)
+	    return &watches[i];
+
+    return 0;
+}
+
+static void
+add_watch(Object *o, Pval *first, Pval *last)
+{
+    Watch *w;
+
+    if (watch_count == watch_max) {
+	Watch *new_watches;
+	int new_max = watch_max ? 2 * watch_max : 8;
+
+	new_watches = (Watch *)mymalloc(new_max * sizeof(Watch), M_STRUCT);
+	if (watches) {
+	    memcpy(new_watches, watches, watch_count * sizeof(Watch));
+	    myfree(watches, M_STRUCT);
+	}
+	watches = new_watches;
+	watch_max = new_max;
+    }
+
+    w = &watches[watch_count++];
+    w->oid = o->id;
+    w->o = o;
+    w->nonce = o->nonce;
+    w->first = first;
+    w->last = last;
+}
+
+/* Watches OID and its ancestors for layout changes and, if WHOLE is
+ * true, for writes to any of their property values.
+ */
+static void
+watch_ancestry(Objid oid, bool whole)
+{
+    Var ancestor, ancestors;
+    int i, c;
+
+    ancestors = db_ancestors(Var::new_obj(oid), true);
+    FOR_EACH(ancestor, ancestors, i, c) {
+	Object *o = dbpriv_find_object(ancestor.v.obj);
+	Watch *w;
+
+	if (!o)
+	    continue;
+	else if (!(w = find_watch(o)))
+	    add_watch(o, whole ? o->propval : 0,
+		      whole ? o->propval + o->nval : 0);
+	else if (whole) {
+	    w->first = o->propval;
+	    w->last = o->propval + o->nval;
+	}
+    }
+    free_var(ancestors);
+}
+
+void
+db_clear_property_watches(void)
+{
+    watch_count = 0;
+    watch_triggered = 0;
+}
+
+void
+db_watch_properties(Objid oid)
+{
+    if (valid(oid))
+	watch_ancestry(oid, true);
+}
+
+void
+db_watch_property(Objid oid, const char *name)
+{
+    db_prop_handle h;
+
+    if (!valid(oid))
+	return;
+
+    watch_ancestry(oid, false);
+
+    h = db_find_property(Var::new_obj(oid), name, 0);
+    if (h.ptr && !h.built_in) {
+	Pval *prop = (Pval *)h.ptr;
+
+	add_watch(dbpriv_find_object(oid), prop, prop + 1);
+    }
+}
+
+int
+db_property_watches_triggered(void)
+{
+    int i;
+
+    if (watch_triggered)
+	return 1;
+
+    for (i = 0; i < watch_count; i++) {
+	Watch *w = &watches[i];
+
+	if (dbpriv_find_object(w->oid) != w->o || w->o->nonce != w->nonce)
+	    return watch_triggered = 1;
+    }
+
+    return 0;
+}
+
+static void
+note_property_write(Pval *prop)
+{
+    int i;
+
+    for (i = 0; i < watch_count; i++)
+	if (watches[i].first <= prop && prop < watches[i].last) {
+	    watch_triggered = 1;
+	    return;
+	}
+}
+
 /*
  * Finds the offset of the properties defined on `target' in `this'.
  * Returns -1 if `target' is not an ancestor of `this'.
@@ -116,6 +396,9 @@ insert_prop2(Var obj, int pos, Pval pval)
     Pval *new_propval;
     int i, nprops;
 
+    dbpriv_note_change(o);
+    dbpriv_own_propvals(o);
+
     nprops = ++o->nval;
     new_propval = (Pval *)mymalloc(nprops * sizeof(Pval), M_PVAL);
 
@@ -232,10 +515,14 @@ db_rename_propdef(Var obj, const char *old, const char *_new)
 		if (h.ptr || property_defined_at_or_below(_new, str_hash(_new), o))
 		    return 0;
 	    }
+	    dbpriv_note_change(o);
 	    free_str(props->l[i].name);
 	    props->l[i].name = str_ref(_new);
 	    props->l[i].hash = str_hash(_new);
 
+	    if (find_watch(o))
+		watch_triggered = 1;
+
 	    return 1;
 	}
     }
@@ -250,6 +537,9 @@ remove_prop2(Var obj, int pos)
     Pval *new_propval;
     int i, nprops;
 
+    dbpriv_note_change(o);
+    dbpriv_own_propvals(o);
+
     nprops = --o->nval;
 
     dbpriv_assign_nonce(o);
@@ -313,6 +603,7 @@ db_delete_propdef(Var obj, const char *pname)
 
 	p = props->l[i];
 	if (p.hash == hash && !mystrcasecmp(p.name, pname)) {
+	    dbpriv_note_change(o);
 	    if (p.name)
 		free_str(p.name);
 
@@ -476,7 +767,9 @@ db_find_property(Var obj, const char *name, Var *value)
     }
 
     h.definer = 0;
+    h.object = o;
     h.ptr = 0;
+    h.index = 0;
 
     for (i = 0; i < Arraysize(ptable); i++) {
 	if (ptable[i].hash == hash && !mystrcasecmp(name, ptable[i].name)) {
@@ -502,6 +795,7 @@ db_find_property(Var obj, const char *name, Var *value)
 	if (defs[i].hash == hash && !mystrcasecmp(defs[i].name, name)) {
 		h.definer = o;
 		h.ptr = o->propval + n;
+		h.index = n;
 		goto done;
 	    }
 	}
@@ -523,6 +817,7 @@ db_find_property(Var obj, const char *name, Var *value)
 	    if (defs[i].hash == hash && !mystrcasecmp(defs[i].name, name)) {
 		h.definer = t;
 		h.ptr = o->propval + n;
+		h.index = n;
 		goto done;
 	    }
 	}
@@ -586,7 +881,7 @@ db_property_value(db_prop_handle h)
     if (h.built_in)
 	get_bi_value(h, &value);
     else {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = handle_propval(h);
 
 	value = prop->var;
     }
@@ -598,14 +893,20 @@ void
 db_set_property_value(db_prop_handle h, Var value)
 {
     if (!h.built_in) {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = writable_propval(h);
 
+	if (watch_count)
+	    note_property_write(prop);
+
+	dbpriv_note_change((Object *)h.object);
 	free_var(prop->var);
 	prop->var = value;
     } else {
 	Object *o = (Object *)h.ptr;
 	db_object_flag flag;
 
+	dbpriv_note_change(o);
+
 	switch (h.built_in) {
 	case BP_NAME:
 	    if (value.type != TYPE_STR)
@@ -659,7 +960,7 @@ db_property_owner(db_prop_handle h)
 	panic("Built-in property in DB_PROPERTY_OWNER!");
 	return NOTHING;
     } else {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = handle_propval(h);
 
 	return prop->owner;
     }
@@ -671,9 +972,12 @@ db_set_property_owner(db_prop_handle h, Objid oid)
     if (h.built_in)
 	panic("Built-in property in DB_SET_PROPERTY_OWNER!");
     else {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = writable_propval(h);
 
+	dbpriv_note_change((Object *)h.object);
 	prop->owner = oid;
+	if (((Object *)h.object)->id != NOTHING)
+	    dbpriv_forget_anon_layouts();
     }
 }
 
@@ -684,7 +988,7 @@ db_property_flags(db_prop_handle h)
 	panic("Built-in property in DB_PROPERTY_FLAGS!");
 	return 0;
     } else {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = handle_propval(h);
 
 	return prop->perms;
     }
@@ -696,9 +1000,12 @@ db_set_property_flags(db_prop_handle h, unsigned flags)
     if (h.built_in)
 	panic("Built-in property in DB_SET_PROPERTY_FLAGS!");
     else {
-	Pval *prop = (Pval *)h.ptr;
+	Pval *prop = writable_propval(h);
 
+	dbpriv_note_change((Object *)h.object);
 	prop->perms = flags;
+	if (((Object *)h.object)->id != NOTHING)
+	    dbpriv_forget_anon_layouts();
     }
 }
 
@@ -899,10 +1206,26 @@ dbpriv_fix_properties_after_chparent(Var obj, Var old_ancestors, Var new_ancesto
      */
     Object *me = dbpriv_dereference(obj);
     Pval *new_propval = NULL;
+    Proplayout *layout = NULL, **kept = NULL;
 
     assert(old_count == me->nval);
 
-    if (new_count != 0) {
+    dbpriv_note_change(me);
+
+    /* A new anonymous object shares its clear values with its siblings. */
+    if (TYPE_ANON == obj.type && old_count == 0 && new_count != 0) {
+	Objid first = (TYPE_LIST == me->parents.type
+		       ? me->parents.v.list[1].v.obj
+		       : me->parents.v.obj);
+
+	kept = &dbpriv_find_object(first)->anon_layout;
+	if (*kept && layout_fits(*kept, me)) {
+	    layout = *kept;
+	    new_propval = layout->propval;
+	}
+    }
+
+    if (new_count != 0 && !layout) {
 	new_propval = (Pval *)mymalloc(new_count * sizeof(Pval), M_PVAL);
 	int i2, c2, i3, c3;
 	FOR_EACH(ancestor, new_ancestors, i2, c2) {
@@ -935,17 +1258,22 @@ dbpriv_fix_properties_after_chparent(Var obj, Var old_ancestors, Var new_ancesto
 	}
     }
 
+    if (kept && !layout) {
+	if (*kept)
+	    release_layout(*kept);
+	layout = *kept = new_layout(me, new_propval);
+    }
+
     /*
      * Clean up.
      */
-    int c;
-    if (me->propval) {
-	for (c = 0; c < old_count; c++)
-	  free_var(me->propval[c].var);
-	myfree(me->propval, M_PVAL);
-    }
+    free_propvals(me);
     me->propval = new_propval;
     me->nval = new_count;
+    if (layout) {
+	layout->refcount++;
+	me->shared_layout = layout;
+    }
 
     dbpriv_assign_nonce(me);
 
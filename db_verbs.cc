@@ -27,6 +27,7 @@
 
 #include "config.h"
 #include "db.h"
+#include "db_io.h"
 #include "db_private.h"
 #include "db_tune.h"
 #include "list.h"
@@ -35,7 +36,9 @@
 #include "program.h"
 #include "server.h"
 #include "storage.h"
+#include "streams.h"
 #include "utils.h"
+#include "version.h"
 
 
 /*********** Prepositions ***********/
@@ -206,6 +209,7 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
     int count;
 
     db_priv_affected_callable_verb_lookup();
+    dbpriv_note_change(o);
 
     newv = (Verbdef *)mymalloc(sizeof(Verbdef), M_VERBDEF);
     newv->name = vnames;
@@ -214,6 +218,8 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
     newv->prep = prep;
     newv->next = 0;
     newv->program = 0;
+    newv->source = 0;
+    newv->unparsable = 0;
     if (o->verbdefs) {
 	for (v = o->verbdefs, count = 2; v->next; v = v->next, ++count);
 	v->next = newv;
@@ -282,6 +288,7 @@ db_delete_verb(db_verb_handle vh)
     Verbdef *vv;
 
     db_priv_affected_callable_verb_lookup();
+    dbpriv_note_change(o);
 
     vv = o->verbdefs;
     if (vv == v)
@@ -294,6 +301,8 @@ db_delete_verb(db_verb_handle vh)
 
     if (v->program)
 	free_program(v->program);
+    if (v->source)
+	free_str(v->source);
     if (v->name)
 	free_str(v->name);
     myfree(v, M_VERBDEF);
@@ -762,6 +771,7 @@ db_set_verb_names(db_verb_handle vh, const char *names)
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	dbpriv_note_change(h->definer);
 	if (h->verbdef->name)
 	    free_str(h->verbdef->name);
 	h->verbdef->name = names;
@@ -786,9 +796,10 @@ db_set_verb_owner(db_verb_handle vh, Objid owner)
 {
     handle *h = (handle *) vh.ptr;
 
-    if (h)
+    if (h) {
+	dbpriv_note_change(h->definer);
 	h->verbdef->owner = owner;
-    else
+    } else
 	panic("DB_SET_VERB_OWNER: Null handle!");
 }
 
@@ -812,6 +823,7 @@ db_set_verb_flags(db_verb_handle vh, unsigned flags)
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	dbpriv_note_change(h->definer);
 	h->verbdef->perms &= ~PERMMASK;
 	h->verbdef->perms |= flags;
     } else
@@ -824,9 +836,14 @@ db_verb_program(db_verb_handle vh)
     handle *h = (handle *) vh.ptr;
 
     if (h) {
-	Program *p = h->verbdef->program;
+	Program *p;
 
-	return p ? p : null_program();
+	dbpriv_compile_verb(h->definer, h->verbdef);
+	p = h->verbdef->program;
+
+	if (p)
+	    return p;
+	return h->verbdef->unparsable ? unparsable_program() : null_program();
     }
     panic("DB_VERB_PROGRAM: Null handle!");
     return 0;
@@ -838,13 +855,72 @@ db_set_verb_program(db_verb_handle vh, Program * program)
     handle *h = (handle *) vh.ptr;
 
     if (h) {
+	dbpriv_note_change(h->definer);
 	if (h->verbdef->program)
 	    free_program(h->verbdef->program);
+	if (h->verbdef->source) {
+	    free_str(h->verbdef->source);
+	    h->verbdef->source = 0;
+	}
 	h->verbdef->program = program;
+	h->verbdef->unparsable = 0;
     } else
 	panic("DB_SET_VERB_PROGRAM: Null handle!");
 }
 
+/* Verb programs read from the DB may be left as source text (see
+ * DEFER_VERB_COMPILATION in options.h) until something needs the
+ * program itself.  Compiling one is not a change to the object.  If
+ * the source does not parse, it is kept, so that it is written back
+ * out unchanged, and the verb is marked so that it is parsed (and
+ * logged) only once; calling it raises E_INVARG.
+ */
+
+void
+dbpriv_set_verb_source(db_verb_handle vh, const char *source)
+{
+    handle *h = (handle *) vh.ptr;
+
+    if (h) {
+	dbpriv_note_change(h->definer);
+	if (h->verbdef->program) {
+	    free_program(h->verbdef->program);
+	    h->verbdef->program = 0;
+	}
+	if (h->verbdef->source)
+	    free_str(h->verbdef->source);
+	h->verbdef->source = source;
+	h->verbdef->unparsable = 0;
+    } else
+	panic("DBPRIV_SET_VERB_SOURCE: Null handle!");
+}
+
+void
+dbpriv_compile_verb(Object *o, Verbdef *v)
+{
+    static Stream *s = 0;
+    const char *source = v->source;
+
+    if (!source || v->unparsable)
+	return;
+
+    if (!s)
+	s = new_stream(40);
+    stream_printf(s, "#%d:%s", o->id, v->name);
+
+    v->program = dbio_parse_program_text(current_db_version, source,
+					 0, (void *) stream_contents(s));
+    if (v->program) {
+	v->source = 0;
+	free_str(source);
+    } else {
+	v->unparsable = 1;
+	errlog("DB_VERB_PROGRAM: Unparsable program %s; "
+	       "keeping its source.\n", stream_contents(s));
+    }
+    reset_stream(s);
+}
+
 void
 db_verb_arg_specs(db_verb_handle vh,
 	     db_arg_spec * dobj, db_prep_spec * prep, db_arg_spec * iobj)
@@ -868,6 +944,7 @@ db_set_verb_arg_specs(db_verb_handle vh,
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	dbpriv_note_change(h->definer);
 	h->verbdef->perms = ((h->verbdef->perms & PERMMASK)
 			     | (dobj << DOBJSHIFT)
 			     | (iobj << IOBJSHIFT));
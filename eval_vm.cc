@@ -87,11 +87,17 @@ write_vm(vm the_vm)
 {
     unsigned i;
 
-    dbio_write_var(the_vm->local);
-
-    dbio_printf("%u %d %u %u\n",
-		the_vm->top_activ_stack, the_vm->root_activ_vector,
-		the_vm->func_id, the_vm->max_stack_size);
+    write_task_value(the_vm->local);
+
+    if (dbio_writing_binary()) {
+	dbio_write_num(the_vm->top_activ_stack);
+	dbio_write_num(the_vm->root_activ_vector);
+	dbio_write_num(the_vm->func_id);
+	dbio_write_num(the_vm->max_stack_size);
+    } else
+	dbio_printf("%u %d %u %u\n",
+		    the_vm->top_activ_stack, the_vm->root_activ_vector,
+		    the_vm->func_id, the_vm->max_stack_size);
 
     for (i = 0; i <= the_vm->top_activ_stack; i++)
 	write_activ(the_vm->activ_stack[i]);
@@ -107,11 +113,16 @@ read_vm(int task_id)
 
     Var local;
     if (dbio_input_version >= DBV_TaskLocal)
-	local = dbio_read_var();
+	local = read_task_value();
     else
 	local = new_map();
 
-    if (dbio_scanf("%u %d %u%c", &top, &vector, &func_id, &c) != 4
+    if (dbio_reading_binary()) {
+	top = dbio_read_num();
+	vector = dbio_read_num();
+	func_id = dbio_read_num();
+	max = dbio_read_num();
+    } else if (dbio_scanf("%u %d %u%c", &top, &vector, &func_id, &c) != 4
 	|| (c == ' '
 	    ? dbio_scanf("%u%c", &max, &c) != 2 || c != '\n'
 	    : (max = DEFAULT_MAX_STACK_DEPTH, c != '\n'))) {
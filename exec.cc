@@ -28,6 +28,7 @@
  *****************************************************************************/
 
 #include <errno.h>
+#include <spawn.h>
 #include <sys/stat.h>
 
 #include "my-fcntl.h"
@@ -82,8 +83,12 @@ volatile static sig_atomic_t sigchild_interrupt = 0;
 
 static sigset_t block_sigchld;
 
-#define BLOCK_SIGCHLD sigprocmask(SIG_BLOCK, &block_sigchld, NULL)
-#define UNBLOCK_SIGCHLD sigprocmask(SIG_UNBLOCK, &block_sigchld, NULL)
+/* Callers save the previous mask and restore it, rather than unblocking,
+ * since some of them run with SIGCHLD already blocked (for instance,
+ * start_worker() from deal_with_child_exit()).
+ */
+#define BLOCK_SIGCHLD(old) sigprocmask(SIG_BLOCK, &block_sigchld, &(old))
+#define RESTORE_SIGCHLD(old) sigprocmask(SIG_SETMASK, &(old), NULL)
 
 static task_waiting_on_exec *
 malloc_task_waiting_on_exec()
@@ -129,8 +134,9 @@ static task_enum_action
 exec_waiter_enumerator(task_closure closure, void *data)
 {
     task_enum_action action = TEA_CONTINUE;
+    sigset_t old_mask;
 
-    BLOCK_SIGCHLD;
+    BLOCK_SIGCHLD(old_mask);
 
     int i;
     for (i = 0; i < EXEC_MAX_PROCESSES; i++) {
@@ -147,7 +153,7 @@ exec_waiter_enumerator(task_closure closure, void *data)
 	}
     }
 
-    UNBLOCK_SIGCHLD;
+    RESTORE_SIGCHLD(old_mask);
 
     return action;
 }
@@ -188,14 +194,23 @@ stderr_readable(int fd, void *data)
     }
 }
 
+/* The child is started with posix_spawn() rather than fork(), so that the
+ * server's (possibly very large) address space is never copied just to be
+ * thrown away by execve().  It is still our own child, so its exit is
+ * noticed through SIGCHLD as before.
+ */
 static pid_t
-fork_and_exec(const char *cmd, const char *const args[], const char *const env[],
-	      int *in, int *out, int *err)
+spawn_and_exec(const char *cmd, const char *const args[], const char *const env[],
+	       int *in, int *out, int *err)
 {
     pid_t pid;
     int pipeIn[2];
     int pipeOut[2];
     int pipeErr[2];
+    int status;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none, defaults;
 
     if (pipe(pipeIn) < 0) {
 	log_perror("EXEC: Couldn't create pipe - in");
@@ -209,33 +224,39 @@ fork_and_exec(const char *cmd, const char *const args[], const char *const env[]
 	log_perror("EXEC: Couldn't create pipe - err");
 	goto close_out;
     }
-    else if ((pid = fork()) < 0) {
-	log_perror("EXEC: Couldn't fork");
-	goto close_err;
-    }
-    else if (0 == pid) { /* child */
-	int status;
 
-	if ((status = dup2(pipeIn[0], STDIN_FILENO)) < 0) {
-	    perror("dup2");
-	    exit(status);
-	}
-	if ((status = dup2(pipeOut[1], STDOUT_FILENO)) < 0) {
-	    perror("dup2");
-	    exit(status);
-	}
-	if ((status = dup2(pipeErr[1], STDERR_FILENO)) < 0) {
-	    perror("dup2");
-	    exit(status);
-	}
+    /* Our ends of the pipes must not leak into this or any later child. */
+    fcntl(pipeIn[1], F_SETFD, FD_CLOEXEC);
+    fcntl(pipeOut[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipeErr[0], F_SETFD, FD_CLOEXEC);
 
-	close(pipeIn[1]);
-	close(pipeOut[0]);
-	close(pipeErr[0]);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeIn[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipeOut[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipeErr[1], STDERR_FILENO);
 
-	status = execve(cmd, (char *const *)args, (char *const *)env);
-	perror("execve");
-	exit(status);
+    /* SIGCHLD is blocked while we get here, and the server ignores some
+     * signals; don't pass either on to the command.
+     */
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGFPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    status = posix_spawn(&pid, cmd, &actions, &attr,
+			 (char *const *)args, (char *const *)env);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (status != 0) {
+	errno = status;
+	log_perror("EXEC: Couldn't spawn");
+	goto close_err;
     }
 
     close(pipeIn[0]);
@@ -281,8 +302,9 @@ exec_waiter_suspender(vm the_vm, void *data)
 {
     task_waiting_on_exec *tw = (task_waiting_on_exec *)data;
     enum error error = E_QUOTA;
+    sigset_t old_mask;
 
-    BLOCK_SIGCHLD;
+    BLOCK_SIGCHLD(old_mask);
 
     int i;
     for (i = 0; i < EXEC_MAX_PROCESSES; i++) {
@@ -298,7 +320,7 @@ exec_waiter_suspender(vm the_vm, void *data)
 
     static const char *env[] = { "PATH=/bin:/usr/bin", NULL };
 
-    if ((tw->pid = fork_and_exec(tw->cmd, tw->args, env, &tw->fin, &tw->fout, &tw->ferr)) == 0) {
+    if ((tw->pid = spawn_and_exec(tw->cmd, tw->args, env, &tw->fin, &tw->fout, &tw->ferr)) == 0) {
 	error = E_EXEC;
 	goto clear_process_slot;
     }
@@ -324,7 +346,7 @@ exec_waiter_suspender(vm the_vm, void *data)
     tw->the_vm = the_vm;
 
  /* success */
-    UNBLOCK_SIGCHLD;
+    RESTORE_SIGCHLD(old_mask);
     return E_NONE;
 
  close_fin:
@@ -337,10 +359,34 @@ exec_waiter_suspender(vm the_vm, void *data)
     free_task_waiting_on_exec(tw);
 
  /* fail */
-    UNBLOCK_SIGCHLD;
+    RESTORE_SIGCHLD(old_mask);
     return error;
 }
 
+/* Return the path of the executable named CMD inside EXEC_SUBDIR, or 0 if
+ * CMD could name something outside it.
+ */
+static const char *
+command_path(const char *cmd)
+{
+    static Stream *s;
+
+    if (0 == strlen(cmd))
+	return 0;
+    if (('/' == cmd[0])
+	|| (1 < strlen(cmd) && '.' == cmd[0] && '.' == cmd[1]))
+	return 0;
+    if (strstr(cmd, "/.") || strstr(cmd, "./"))
+	return 0;
+
+    /* prepend the exec subdirectory path */
+    if (!s)
+	s = new_stream(strlen(EXEC_SUBDIR) * 2);
+    stream_add_string(s, EXEC_SUBDIR);
+    stream_add_string(s, cmd);
+    return str_dup(reset_stream(s));
+}
+
 static package
 bf_exec(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -371,29 +417,11 @@ bf_exec(Var arglist, Byte next, void *vdata, Objid progr)
     }
 
     /* check the path */
-    cmd = arglist.v.list[1].v.list[1].v.str;
-    if (0 == strlen(cmd)) {
-	pack = make_raise_pack(E_INVARG, "Invalid path", var_ref(zero));
-	goto free_arglist;
-    }
-    if (('/' == cmd[0])
-	|| (1 < strlen(cmd) && '.' == cmd[0] && '.' == cmd[1])) {
-	pack = make_raise_pack(E_INVARG, "Invalid path", var_ref(zero));
-	goto free_arglist;
-    }
-    if (strstr(cmd, "/.") || strstr(cmd, "./")) {
+    if (!(cmd = command_path(arglist.v.list[1].v.list[1].v.str))) {
 	pack = make_raise_pack(E_INVARG, "Invalid path", var_ref(zero));
 	goto free_arglist;
     }
 
-    /* prepend the exec subdirectory path */
-    static Stream *s;
-    if (!s)
-	s = new_stream(strlen(EXEC_SUBDIR) * 2);
-    stream_add_string(s, EXEC_SUBDIR);
-    stream_add_string(s, cmd);
-    cmd = str_dup(reset_stream(s));
-
     /* clean input */
     in = NULL;
     len = 0;
@@ -451,6 +479,542 @@ bf_exec(Var arglist, Byte next, void *vdata, Objid progr)
     return pack;
 }
 
+/*
+ * Worker pools.  worker_call() hands a one-line request to one of a pool
+ * of long-running processes started from the same command line, and
+ * resumes the calling task with the first line that process writes back.
+ * Each worker has at most one request outstanding; further requests wait
+ * in the pool's queue until a worker is free or, while the pool is below
+ * its limit, a new worker has been started for them.
+ */
+
+struct worker_pool;
+
+typedef struct worker_request {
+    struct worker_request *next;
+    struct worker_pool *pool;
+    const char *line;		/* raw bytes, including the newline */
+    int len;
+    int written;		/* bytes of LINE sent so far */
+    vm the_vm;			/* 0 once the task has been killed */
+} worker_request;
+
+typedef struct exec_worker {
+    struct exec_worker *next;
+    struct worker_pool *pool;
+    pid_t pid;
+    int fin;
+    int fout;
+    int ferr;
+    int writing;		/* true while FIN is registered */
+    int exited;			/* set by exec_complete() */
+    Stream *sout;		/* partial response */
+    worker_request *request;	/* request outstanding, if any */
+} exec_worker;
+
+typedef struct worker_pool {
+    struct worker_pool *next;
+    Var command;		/* the command line, as given */
+    const char *cmd;		/* path of the executable */
+    int max_workers;
+    int num_workers;
+    int closing;		/* set by kill_worker_pool() */
+    exec_worker *workers;
+    worker_request *first;	/* requests waiting for a worker */
+    worker_request **last;
+} worker_pool;
+
+static worker_pool *worker_pools = 0;
+static int num_worker_pools = 0;
+
+static void
+free_worker_request(worker_request * r)
+{
+    myfree((void *)r->line, M_STRING);
+    myfree(r, M_TASK);
+}
+
+static void
+finish_worker_request(worker_request * r, Var v)
+{
+    if (r->the_vm)
+	resume_task(r->the_vm, v);
+    else
+	free_var(v);
+    free_worker_request(r);
+}
+
+static Var
+exec_error(void)
+{
+    Var v;
+
+    v.type = TYPE_ERR;
+    v.v.err = E_EXEC;
+    return v;
+}
+
+static void send_worker_request(exec_worker * w);
+
+static void
+worker_writable(int fd, void *data)
+{
+    send_worker_request((exec_worker *)data);
+}
+
+/* Send as much of the worker's request as its pipe will take, waiting
+ * for the rest to become writable.
+ */
+static void
+send_worker_request(exec_worker * w)
+{
+    worker_request *r = w->request;
+    ssize_t n;
+
+    while (r && r->written < r->len) {
+	n = write(w->fin, r->line + r->written, r->len - r->written);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	    if (!w->writing) {
+		network_register_fd(w->fin, NULL, worker_writable, w);
+		w->writing = 1;
+	    }
+	    return;
+	}
+	if (n < 0)		/* the worker is going away */
+	    break;
+	r->written += n;
+    }
+    if (w->writing) {
+	network_unregister_fd(w->fin);
+	w->writing = 0;
+    }
+}
+
+static void
+worker_readable(int fd, void *data)
+{
+    exec_worker *w = (exec_worker *)data;
+    char buffer[1000];
+    const char *contents, *nl;
+    int n;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+	stream_add_bytes(w->sout, buffer, n);
+    if (n == 0)			/* EOF; wait for the process to exit */
+	network_unregister_fd(fd);
+
+    contents = stream_contents(w->sout);
+    while ((nl = (const char *)memchr(contents, '\n',
+				      stream_length(w->sout)))) {
+	int len = nl - contents;
+	int rest = stream_length(w->sout) - len - 1;
+	char *tail;
+
+	/* Anything written without a request outstanding is dropped. */
+	if (w->request) {
+	    Var v;
+
+	    v.type = TYPE_STR;
+	    v.v.str = str_dup(raw_bytes_to_binary(contents, len));
+	    finish_worker_request(w->request, v);
+	    w->request = 0;
+	}
+	tail = (char *)mymalloc(rest + 1, M_STRING);
+	memcpy(tail, nl + 1, rest);
+	reset_stream(w->sout);
+	stream_add_bytes(w->sout, tail, rest);
+	myfree(tail, M_STRING);
+	contents = stream_contents(w->sout);
+    }
+}
+
+static void dispatch_worker_requests(worker_pool * pool);
+
+static void
+worker_response_readable(int fd, void *data)
+{
+    exec_worker *w = (exec_worker *)data;
+
+    worker_readable(fd, data);
+    dispatch_worker_requests(w->pool);
+}
+
+/* Workers' stderr is read only to keep them from blocking on it. */
+static void
+worker_stderr_readable(int fd, void *data)
+{
+    char buffer[1000];
+
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+	continue;
+}
+
+static exec_worker *
+start_worker(worker_pool * pool)
+{
+    static const char *env[] = { "PATH=/bin:/usr/bin", NULL };
+    int count = listlength(pool->command);
+    const char **args;
+    exec_worker *w;
+    int i, fin, fout, ferr;
+    pid_t pid;
+    sigset_t old_mask;
+
+    args = (const char **)mymalloc(sizeof(const char *) * (count + 1), M_ARRAY);
+    for (i = 1; i <= count; i++)
+	args[i - 1] = pool->command.v.list[i].v.str;
+    args[count] = NULL;
+
+    BLOCK_SIGCHLD(old_mask);
+
+    pid = spawn_and_exec(pool->cmd, args, env, &fin, &fout, &ferr);
+    myfree(args, M_ARRAY);
+    if (pid == 0) {
+	RESTORE_SIGCHLD(old_mask);
+	return 0;
+    }
+
+    w = (exec_worker *)mymalloc(sizeof(exec_worker), M_TASK);
+    w->pool = pool;
+    w->pid = pid;
+    w->fin = fin;
+    w->fout = fout;
+    w->ferr = ferr;
+    w->writing = 0;
+    w->exited = 0;
+    w->sout = new_stream(100);
+    w->request = 0;
+    w->next = pool->workers;
+    pool->workers = w;
+    pool->num_workers++;
+
+    RESTORE_SIGCHLD(old_mask);
+
+    oklog("EXEC: worker %s (%d)...\n", pool->cmd, pid);
+
+    set_nonblocking(fin);
+    set_nonblocking(fout);
+    set_nonblocking(ferr);
+
+    network_register_fd(fout, worker_response_readable, NULL, w);
+    network_register_fd(ferr, worker_stderr_readable, NULL, w);
+
+    return w;
+}
+
+static void
+free_worker(exec_worker * w)
+{
+    if (w->writing)
+	network_unregister_fd(w->fin);
+    network_unregister_fd(w->fout);
+    network_unregister_fd(w->ferr);
+    close(w->fin);
+    close(w->fout);
+    close(w->ferr);
+    free_stream(w->sout);
+    if (w->request)
+	finish_worker_request(w->request, exec_error());
+    myfree(w, M_TASK);
+}
+
+static void
+free_worker_pool(worker_pool * pool)
+{
+    worker_pool **pp;
+
+    for (pp = &worker_pools; *pp != pool; pp = &(*pp)->next)
+	;
+    *pp = pool->next;
+    num_worker_pools--;
+    free_var(pool->command);
+    free_str(pool->cmd);
+    myfree(pool, M_TASK);
+}
+
+/* Fail every request waiting in POOL's queue. */
+static void
+fail_worker_requests(worker_pool * pool)
+{
+    worker_request *r;
+
+    while ((r = pool->first)) {
+	pool->first = r->next;
+	finish_worker_request(r, exec_error());
+    }
+    pool->last = &pool->first;
+}
+
+static void
+dispatch_worker_requests(worker_pool * pool)
+{
+    exec_worker *w;
+    worker_request *r;
+
+    while (pool->first) {
+	for (w = pool->workers; w; w = w->next)
+	    if (!w->request && !w->exited)
+		break;
+	if (!w && pool->num_workers < pool->max_workers)
+	    w = start_worker(pool);
+	if (!w) {
+	    /* With no worker at all, nothing would ever serve the queue. */
+	    if (pool->num_workers == 0)
+		fail_worker_requests(pool);
+	    return;
+	}
+	r = pool->first;
+	if (!(pool->first = r->next))
+	    pool->last = &pool->first;
+	r->next = 0;
+	w->request = r;
+	send_worker_request(w);
+    }
+}
+
+/* Called with SIGCHLD blocked, once some worker has exited. */
+static void
+reap_workers(void)
+{
+    worker_pool *pool, *next_pool;
+    exec_worker **ww, *w;
+
+    for (pool = worker_pools; pool; pool = next_pool) {
+	next_pool = pool->next;
+	for (ww = &pool->workers; (w = *ww);)
+	    if (w->exited) {
+		*ww = w->next;
+		pool->num_workers--;
+		worker_readable(w->fout, w);	/* a last response? */
+		free_worker(w);
+	    } else
+		ww = &w->next;
+	if (pool->closing && pool->num_workers == 0)
+	    free_worker_pool(pool);
+	else
+	    dispatch_worker_requests(pool);
+    }
+}
+
+static task_enum_action
+worker_waiter_enumerator(task_closure closure, void *data)
+{
+    worker_pool *pool;
+    exec_worker *w;
+    worker_request **rr, *r;
+    task_enum_action action;
+
+    for (pool = worker_pools; pool; pool = pool->next) {
+	for (w = pool->workers; w; w = w->next)
+	    if (w->request && w->request->the_vm) {
+		action = (*closure) (w->request->the_vm, pool->cmd, data);
+		if (TEA_KILL == action)
+		    w->request->the_vm = 0;	/* drop the response */
+		if (TEA_CONTINUE != action)
+		    return action;
+	    }
+	for (rr = &pool->first; (r = *rr); rr = &r->next) {
+	    action = (*closure) (r->the_vm, pool->cmd, data);
+	    if (TEA_KILL == action) {
+		if (!(*rr = r->next))
+		    pool->last = rr;
+		free_worker_request(r);
+	    }
+	    if (TEA_CONTINUE != action)
+		return action;
+	}
+    }
+
+    return TEA_CONTINUE;
+}
+
+static enum error
+worker_waiter_suspender(vm the_vm, void *data)
+{
+    worker_request *r = (worker_request *)data;
+    worker_pool *pool = r->pool;
+
+    r->the_vm = the_vm;
+    r->next = 0;
+    *pool->last = r;
+    pool->last = &r->next;
+    dispatch_worker_requests(pool);
+
+    return E_NONE;
+}
+
+static worker_pool *
+find_worker_pool(Var command)
+{
+    worker_pool *pool;
+
+    for (pool = worker_pools; pool; pool = pool->next)
+	if (!pool->closing && equality(pool->command, command, 1))
+	    return pool;
+
+    return 0;
+}
+
+static package
+bf_worker_call(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    /* (LIST command, STR request [, INT max-workers]) */
+    Var command = arglist.v.list[1];
+    worker_pool *pool;
+    worker_request *r;
+    const char *cmd, *raw;
+    int i, c, len, max_workers = 0;
+    struct stat buf;
+    Var v;
+
+    if (!is_wizard(progr)) {
+	free_var(arglist);
+	return make_error_pack(E_PERM);
+    }
+
+    FOR_EACH(v, command, i, c)
+	if (TYPE_STR != v.type) {
+	    free_var(arglist);
+	    return make_error_pack(E_INVARG);
+	}
+    if (1 == i) {
+	free_var(arglist);
+	return make_error_pack(E_INVARG);
+    }
+    if (listlength(arglist) > 2) {
+	max_workers = arglist.v.list[3].v.num;
+	if (max_workers < 1 || max_workers > EXEC_MAX_POOL_WORKERS) {
+	    free_var(arglist);
+	    return make_error_pack(E_INVARG);
+	}
+    }
+
+    /* The request is one line, so it can't contain a newline itself. */
+    if (!(raw = binary_to_raw_bytes(arglist.v.list[2].v.str, &len))
+	|| memchr(raw, '\n', len)) {
+	free_var(arglist);
+	return make_error_pack(E_INVARG);
+    }
+
+    if (!(pool = find_worker_pool(command))) {
+	if (!(cmd = command_path(command.v.list[1].v.str))) {
+	    free_var(arglist);
+	    return make_raise_pack(E_INVARG, "Invalid path", var_ref(zero));
+	}
+	if (stat(cmd, &buf) != 0 || !S_ISREG(buf.st_mode)) {
+	    free_str(cmd);
+	    free_var(arglist);
+	    return make_raise_pack(E_INVARG, "Does not exist", var_ref(zero));
+	}
+	if (num_worker_pools >= EXEC_MAX_POOLS) {
+	    free_str(cmd);
+	    free_var(arglist);
+	    return make_error_pack(E_QUOTA);
+	}
+	pool = (worker_pool *)mymalloc(sizeof(worker_pool), M_TASK);
+	pool->command = var_ref(command);
+	pool->cmd = cmd;
+	pool->max_workers = EXEC_POOL_WORKERS;
+	pool->num_workers = 0;
+	pool->closing = 0;
+	pool->workers = 0;
+	pool->first = 0;
+	pool->last = &pool->first;
+	pool->next = worker_pools;
+	worker_pools = pool;
+	num_worker_pools++;
+    }
+    if (max_workers)
+	pool->max_workers = max_workers;
+
+    r = (worker_request *)mymalloc(sizeof(worker_request), M_TASK);
+    r->pool = pool;
+    r->len = len + 1;
+    r->line = (const char *)mymalloc(r->len, M_STRING);
+    memcpy((char *)r->line, raw, len);
+    ((char *)r->line)[len] = '\n';
+    r->written = 0;
+    r->the_vm = 0;
+
+    free_var(arglist);
+
+    return make_suspend_pack(worker_waiter_suspender, r);
+}
+
+static package
+bf_worker_pools(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    worker_pool *pool;
+    exec_worker *w;
+    worker_request *r;
+    Var list, entry;
+    int busy, waiting;
+
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    list = new_list(0);
+    for (pool = worker_pools; pool; pool = pool->next) {
+	if (pool->closing)
+	    continue;
+	busy = waiting = 0;
+	for (w = pool->workers; w; w = w->next)
+	    if (w->request)
+		busy++;
+	for (r = pool->first; r; r = r->next)
+	    waiting++;
+	entry = new_list(5);
+	entry.v.list[1] = var_ref(pool->command);
+	entry.v.list[2].type = TYPE_INT;
+	entry.v.list[2].v.num = pool->max_workers;
+	entry.v.list[3].type = TYPE_INT;
+	entry.v.list[3].v.num = pool->num_workers;
+	entry.v.list[4].type = TYPE_INT;
+	entry.v.list[4].v.num = busy;
+	entry.v.list[5].type = TYPE_INT;
+	entry.v.list[5].v.num = waiting;
+	list = listappend(list, entry);
+    }
+
+    return make_var_pack(list);
+}
+
+static package
+bf_kill_worker_pool(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    worker_pool *pool;
+    exec_worker *w;
+
+    if (!is_wizard(progr)) {
+	free_var(arglist);
+	return make_error_pack(E_PERM);
+    }
+
+    pool = find_worker_pool(arglist.v.list[1]);
+    free_var(arglist);
+    if (!pool)
+	return make_error_pack(E_INVARG);
+
+    /* The workers are freed as they exit; the pool along with the last. */
+    pool->closing = 1;
+    fail_worker_requests(pool);
+    for (w = pool->workers; w; w = w->next)
+	kill(w->pid, SIGTERM);
+    if (pool->num_workers == 0) {
+	sigset_t old_mask;
+
+	BLOCK_SIGCHLD(old_mask);
+	free_worker_pool(pool);
+	RESTORE_SIGCHLD(old_mask);
+    }
+
+    return no_var_pack();
+}
+
 /*
  * Called from child_completed_signal() in server.c.
  * SIGCHLD is already blocked.
@@ -478,6 +1042,17 @@ exec_complete(pid_t pid, int code)
 	return pid;
     }
 
+    worker_pool *pool;
+    exec_worker *w;
+
+    for (pool = worker_pools; pool; pool = pool->next)
+	for (w = pool->workers; w; w = w->next)
+	    if (w->pid == pid) {
+		sigchild_interrupt = 1;
+		w->exited = 1;
+		return pid;
+	    }
+
     /* We wind up here if the child process was a checkpoint process,
      * or if an exec task was explicitly killed while the process
      * itself was still executing.
@@ -491,10 +1066,12 @@ exec_complete(pid_t pid, int code)
 void
 deal_with_child_exit(void)
 {
+    sigset_t old_mask;
+
     if (!sigchild_interrupt)
 	return;
 
-    BLOCK_SIGCHLD;
+    BLOCK_SIGCHLD(old_mask);
 
     sigchild_interrupt = 0;
 
@@ -523,7 +1100,9 @@ deal_with_child_exit(void)
 	}
     }
 
-    UNBLOCK_SIGCHLD;
+    reap_workers();
+
+    RESTORE_SIGCHLD(old_mask);
 }
 
 void
@@ -534,4 +1113,10 @@ register_exec(void)
 
     register_task_queue(exec_waiter_enumerator);
     register_function("exec", 1, 2, bf_exec, TYPE_LIST, TYPE_STR);
+    register_task_queue(worker_waiter_enumerator);
+    register_function("worker_call", 2, 3, bf_worker_call,
+		      TYPE_LIST, TYPE_STR, TYPE_INT);
+    register_function("worker_pools", 0, 0, bf_worker_pools);
+    register_function("kill_worker_pool", 1, 1, bf_kill_worker_pool,
+		      TYPE_LIST);
 }
@@ -58,6 +58,7 @@ static int root_activ_vector;	/* root_activ_vector == MAIN_VECTOR
 static int ticks_remaining;
 int task_timed_out;
 static int interpreter_is_running = 0;
+static int result_is_wanted = 0;
 static Timer_ID task_alarm_id;
 
 static const char *handler_verb_name;	/* For in-DB traceback handling */
@@ -2665,21 +2666,23 @@ run_interpreter(char raise, enum error e,
     enum outcome ret;
     Var args;
 
-    setup_task_execution_limits(is_fg ? server_int_option("fg_seconds",
-						      DEFAULT_FG_SECONDS)
-				: server_int_option("bg_seconds",
-						    DEFAULT_BG_SECONDS),
-				is_fg ? server_int_option("fg_ticks",
-							DEFAULT_FG_TICKS)
-				: server_int_option("bg_ticks",
-						    DEFAULT_BG_TICKS));
+    refresh_server_options();
+
+    setup_task_execution_limits(is_fg
+				? server_int_option_cached(SVO_FG_SECONDS)
+				: server_int_option_cached(SVO_BG_SECONDS),
+				is_fg
+				? server_int_option_cached(SVO_FG_TICKS)
+				: server_int_option_cached(SVO_BG_TICKS));
 
     /* handler_verb_* is garbage/unreferenced outside of run()
      * and this is the only place run() is called. */
     handler_verb_args = zero;
     handler_verb_name = 0;
     interpreter_is_running = 1;
+    result_is_wanted = (result != 0);
     ret = run(raise, e, result);
+    result_is_wanted = 0;
     interpreter_is_running = 0;
     args = handler_verb_args;
 
@@ -2715,6 +2718,16 @@ run_interpreter(char raise, enum error e,
 }
 
 
+/* A server task whose result the server reads as soon as it returns (for
+ * instance, $do_login_command()) can't usefully suspend to wait for
+ * anything.
+ */
+int
+task_result_is_wanted(void)
+{
+    return result_is_wanted;
+}
+
 Var
 caller()
 {
@@ -2736,12 +2749,7 @@ check_activ_stack_size(int max)
 static int
 current_max_stack_size(void)
 {
-    int max = server_int_option("max_stack_depth", DEFAULT_MAX_STACK_DEPTH);
-
-    if (max < DEFAULT_MAX_STACK_DEPTH)
-	max = DEFAULT_MAX_STACK_DEPTH;
-
-    return max;
+    return server_int_option_cached(SVO_MAX_STACK_DEPTH);
 }
 
 /**** There are two methods of starting a new task:
@@ -3258,6 +3266,18 @@ write_activ_as_pi(activation a)
 {
     Var dummy;
 
+    if (dbio_writing_binary()) {
+	dbio_write_var(a._this);
+	dbio_write_var(a.vloc);
+	dbio_write_objid(a.recv);
+	dbio_write_objid(a.player);
+	dbio_write_objid(a.progr);
+	dbio_write_num(a.debug);
+	dbio_write_string(a.verb);
+	dbio_write_string(a.verbname);
+	return;
+    }
+
     dummy.type = TYPE_INT;
     dummy.v.num = -111;
     dbio_write_var(dummy);
@@ -3280,6 +3300,18 @@ read_activ_as_pi(activation * a)
     int dummy, vloc_oid;
     char c;
 
+    if (dbio_reading_binary()) {
+	a->_this = dbio_read_var();
+	a->vloc = dbio_read_var();
+	a->recv = dbio_read_objid();
+	a->player = dbio_read_objid();
+	a->progr = dbio_read_objid();
+	a->debug = dbio_read_num();
+	a->verb = dbio_read_string_intern();
+	a->verbname = dbio_read_string_intern();
+	return 1;
+    }
+
     free_var(dbio_read_var());
 
     Var _this, vloc;
@@ -3406,28 +3438,341 @@ free_reordered_rt_env_values(void)
     free_var(temp_vars);
 }
 
+/*
+ * In a binary DB, the programs and the larger values of the task queue are
+ * shared: each program (or fork vector) is written in full only the first
+ * time it is used by a task, as is each list or map with more than one
+ * reference, and afterwards as the number of that first writing.  A program
+ * is written with its variable names, so that on loading each task's
+ * variables can be matched up by name, as in reorder_rt_env(), against
+ * however the program compiles now.  Loaded tasks running the same program
+ * share it again.
+ */
+
+#define SHARED_VALUE	(-2)	/* tag for values; programs use f_index */
+
+typedef struct {
+    const void *key;
+    int tag;
+    int index;
+} shared_slot;
+
+static shared_slot *shared_slots;
+static int num_shared_slots, num_shared;
+
+typedef struct {
+    Program *prog;		/* or 0, for a value */
+    int *slots;			/* where each saved variable goes, or -1 */
+    int num_saved;
+    Var value;
+} loaded_state;
+
+static loaded_state *loaded;
+static int num_loaded, max_loaded;
+
+static inline unsigned
+shared_hash(const void *key, int tag)
+{
+    unsigned h = (unsigned) ((uintptr_t) key >> 3) ^ (unsigned) tag;
+
+    h *= 0x9e3779b1U;
+    return h ^ (h >> 15);
+}
+
+/* Returns the number under which KEY and TAG were first written, or -1
+ * after giving them the next one.
+ */
+static int
+find_shared(const void *key, int tag)
+{
+    int i, mask;
+
+    if (num_shared * 2 >= num_shared_slots) {
+	shared_slot *old = shared_slots;
+	int old_size = num_shared_slots;
+
+	num_shared_slots = old_size ? old_size * 2 : 1024;
+	shared_slots = (shared_slot *)mymalloc(num_shared_slots
+					       * sizeof(shared_slot),
+					       M_STRUCT);
+	memset(shared_slots, 0, num_shared_slots * sizeof(shared_slot));
+	mask = num_shared_slots - 1;
+	for (i = 0; i < old_size; i++)
+	    if (old[i].key) {
+		int j = shared_hash(old[i].key, old[i].tag) & mask;
+
+		while (shared_slots[j].key)
+		    j = (j + 1) & mask;
+		shared_slots[j] = old[i];
+	    }
+	if (old)
+	    myfree(old, M_STRUCT);
+    }
+
+    mask = num_shared_slots - 1;
+    for (i = shared_hash(key, tag) & mask;
+	 shared_slots[i].key;
+	 i = (i + 1) & mask)
+	if (shared_slots[i].key == key && shared_slots[i].tag == tag)
+	    return shared_slots[i].index;
+
+    shared_slots[i].key = key;
+    shared_slots[i].tag = tag;
+    shared_slots[i].index = num_shared++;
+    return -1;
+}
+
+static loaded_state *
+new_loaded_state(void)
+{
+    loaded_state *l;
+
+    if (num_loaded == max_loaded) {
+	loaded_state *_new;
+
+	max_loaded = max_loaded ? max_loaded * 2 : 256;
+	_new = (loaded_state *)mymalloc(max_loaded * sizeof(loaded_state),
+					M_STRUCT);
+	if (loaded) {
+	    memcpy(_new, loaded, num_loaded * sizeof(loaded_state));
+	    myfree(loaded, M_STRUCT);
+	}
+	loaded = _new;
+    }
+    l = &loaded[num_loaded++];
+    l->prog = 0;
+    l->slots = 0;
+    l->num_saved = 0;
+    l->value.type = TYPE_NONE;
+    return l;
+}
+
+/* Returns the state referred to by the next number in the input, or 0 if
+ * it is a new one (or, for values, -1 if it isn't shared at all).
+ */
+static int
+read_shared_ref(int *ref)
+{
+    *ref = dbio_read_num();
+    if (*ref > num_loaded || *ref < -1) {
+	errlog("READ_TASK_STATE: Bad reference: %d\n", *ref);
+	return 0;
+    }
+    return 1;
+}
+
+void
+begin_task_state(void)
+{
+    num_shared = num_loaded = 0;
+}
+
+void
+end_task_state(void)
+{
+    int i;
+
+    for (i = 0; i < num_loaded; i++)
+	if (loaded[i].prog) {
+	    free_program(loaded[i].prog);
+	    myfree(loaded[i].slots, M_STRUCT);
+	} else			/* see reorder_rt_env() */
+	    temp_vars = listappend(temp_vars, loaded[i].value);
+    if (loaded)
+	myfree(loaded, M_STRUCT);
+    loaded = 0;
+    num_loaded = max_loaded = 0;
+
+    if (shared_slots)
+	myfree(shared_slots, M_STRUCT);
+    shared_slots = 0;
+    num_shared_slots = num_shared = 0;
+}
+
+void
+write_task_value(Var v)
+{
+    const void *key = 0;
+    int i;
+
+    if (!dbio_writing_binary()) {
+	dbio_write_var(v);
+	return;
+    }
+
+    if (v.type == TYPE_LIST && refcount(v.v.list) > 1)
+	key = v.v.list;
+    else if (v.type == TYPE_MAP && refcount(v.v.tree) > 1)
+	key = v.v.tree;
+
+    if (!key) {
+	dbio_write_num(-1);
+	dbio_write_var(v);
+    } else if ((i = find_shared(key, SHARED_VALUE)) >= 0)
+	dbio_write_num(i + 1);
+    else {
+	dbio_write_num(0);
+	dbio_write_var(v);
+    }
+}
+
+Var
+read_task_value(void)
+{
+    loaded_state *l;
+    int ref;
+
+    if (!dbio_reading_binary())
+	return dbio_read_var();
+
+    if (!read_shared_ref(&ref))
+	return var_ref(zero);
+    else if (ref < 0)
+	return dbio_read_var();
+    else if (ref > 0) {
+	if (loaded[ref - 1].prog) {
+	    errlog("READ_TASK_STATE: Program used as a value\n");
+	    return var_ref(zero);
+	}
+	return var_ref(loaded[ref - 1].value);
+    }
+
+    l = new_loaded_state();
+    l->value = dbio_read_var();
+    return var_ref(l->value);
+}
+
+void
+write_task_program(Program * prog, int f_index, Var * rt_env)
+{
+    int ref;
+    unsigned i;
+
+    if ((ref = find_shared(prog, f_index)) >= 0)
+	dbio_write_num(ref + 1);
+    else {
+	dbio_write_num(0);
+	dbio_write_num(prog->version);
+	dbio_write_forked_program(prog, f_index);
+	dbio_write_num(prog->num_var_names);
+	for (i = 0; i < prog->num_var_names; i++)
+	    dbio_write_string(prog->var_names[i]);
+    }
+
+    for (i = 0; i < prog->num_var_names; i++)
+	write_task_value(rt_env[i]);
+}
+
+Program *
+read_task_program(Var ** rt_env, const char *what)
+{
+    loaded_state *l;
+    int ref, i;
+    unsigned j;
+
+    if (!read_shared_ref(&ref) || ref < 0)
+	return 0;
+    if (ref > 0) {
+	l = &loaded[ref - 1];
+	if (!l->prog) {
+	    errlog("READ_TASK_STATE: Value used as a program\n");
+	    return 0;
+	}
+    } else {
+	DB_Version version = (DB_Version) dbio_read_num();
+	Program *prog;
+	int n;
+
+	if (!check_db_version(version)) {
+	    errlog("READ_TASK_STATE: Unrecognized language version: %d\n",
+		   version);
+	    return 0;
+	}
+	if (!(prog = dbio_read_program(version, 0, (void *) what)))
+	    return 0;
+	if ((n = dbio_read_num()) < 0) {
+	    free_program(prog);
+	    return 0;
+	}
+
+	l = new_loaded_state();
+	l->prog = prog;
+	l->num_saved = n;
+	l->slots = (int *)mymalloc((n ? n : 1) * sizeof(int), M_STRUCT);
+	for (i = 0; i < n; i++) {
+	    const char *name = dbio_read_string();
+
+	    l->slots[i] = -1;
+	    for (j = 0; j < prog->num_var_names; j++)
+		if (!mystrcasecmp(name, prog->var_names[j])) {
+		    l->slots[i] = j;
+		    break;
+		}
+	}
+    }
+
+    *rt_env = new_rt_env(l->prog->num_var_names);
+    for (i = 0; i < l->num_saved; i++) {
+	Var v = read_task_value();
+
+	if (l->slots[i] >= 0)
+	    (*rt_env)[l->slots[i]] = v;
+	else			/* see reorder_rt_env() */
+	    temp_vars = listappend(temp_vars, v);
+    }
+
+    return program_ref(l->prog);
+}
+
+static void
+write_bi_func_state(void *data)
+{
+    activation *a = (activation *)data;
+
+    write_bi_func_data(a->bi_func_data, a->bi_func_id);
+}
+
+static int
+read_bi_func_state(void *data)
+{
+    activation *a = (activation *)data;
+
+    return read_bi_func_data(a->bi_func_id, &a->bi_func_data,
+			     &a->bi_func_pc);
+}
+
 void
 write_activ(activation a)
 {
     register Var *v;
 
-    dbio_printf("language version %u\n", a.prog->version);
-    dbio_write_program(a.prog);
-    write_rt_env(a.prog->var_names, a.rt_env, a.prog->num_var_names);
+    if (dbio_writing_binary()) {
+	write_task_program(a.prog, MAIN_VECTOR, a.rt_env);
+	dbio_write_num(a.top_rt_stack - a.base_rt_stack);
+    } else {
+	dbio_printf("language version %u\n", a.prog->version);
+	dbio_write_program(a.prog);
+	write_rt_env(a.prog->var_names, a.rt_env, a.prog->num_var_names);
 
-    dbio_printf("%d rt_stack slots in use\n",
-		a.top_rt_stack - a.base_rt_stack);
+	dbio_printf("%d rt_stack slots in use\n",
+		    a.top_rt_stack - a.base_rt_stack);
+    }
 
     for (v = a.base_rt_stack; v != a.top_rt_stack; v++)
-	dbio_write_var(*v);
+	write_task_value(*v);
 
     write_activ_as_pi(a);
-    dbio_write_var(a.temp);
+    write_task_value(a.temp);
 
-    dbio_printf("%u %u %u\n", a.pc, a.bi_func_pc, a.error_pc);
+    if (dbio_writing_binary()) {
+	dbio_write_num(a.pc);
+	dbio_write_num(a.bi_func_pc);
+	dbio_write_num(a.error_pc);
+    } else
+	dbio_printf("%u %u %u\n", a.pc, a.bi_func_pc, a.error_pc);
     if (a.bi_func_pc != 0) {
 	dbio_write_string(name_func_by_num(a.bi_func_id));
-	write_bi_func_data(a.bi_func_data, a.bi_func_id);
+	dbio_write_text_record(write_bi_func_state, &a);
     }
 }
 
@@ -3457,58 +3802,79 @@ read_activ(activation * a, int which_vector)
     const char *func_name;
     int max_stack;
     char c;
+    int binary = dbio_reading_binary();
 
-    if (dbio_input_version < DBV_Float)
-	version = dbio_input_version;
-    else if (dbio_scanf("language version %u\n", &version) != 1) {
-	errlog("READ_ACTIV: Malformed language version\n");
-	return 0;
-    } else if (!check_db_version(version)) {
-	errlog("READ_ACTIV: Unrecognized language version: %d\n",
-	       version);
-	return 0;
-    }
-    if (!(a->prog = dbio_read_program(version,
-				      0, (void *) "suspended task"))) {
-	errlog("READ_ACTIV: Malformed program\n");
-	return 0;
-    }
-    if (!read_rt_env(&old_names, &old_rt_env, &old_size)) {
-	errlog("READ_ACTIV: Malformed runtime environment\n");
-	return 0;
+    if (binary) {
+	if (!(a->prog = read_task_program(&a->rt_env, "suspended task"))) {
+	    errlog("READ_ACTIV: Malformed program\n");
+	    return 0;
+	}
+    } else {
+	if (dbio_input_version < DBV_Float)
+	    version = dbio_input_version;
+	else if (dbio_scanf("language version %u\n", &version) != 1) {
+	    errlog("READ_ACTIV: Malformed language version\n");
+	    return 0;
+	} else if (!check_db_version(version)) {
+	    errlog("READ_ACTIV: Unrecognized language version: %d\n",
+		   version);
+	    return 0;
+	}
+	if (!(a->prog = dbio_read_program(version,
+					  0, (void *) "suspended task"))) {
+	    errlog("READ_ACTIV: Malformed program\n");
+	    return 0;
+	}
+	if (!read_rt_env(&old_names, &old_rt_env, &old_size)) {
+	    errlog("READ_ACTIV: Malformed runtime environment\n");
+	    return 0;
+	}
+	a->rt_env = reorder_rt_env(old_rt_env, old_names, old_size, a->prog);
     }
-    a->rt_env = reorder_rt_env(old_rt_env, old_names, old_size, a->prog);
 
     max_stack = (which_vector == MAIN_VECTOR
 		 ? a->prog->main_vector.max_stack
 		 : a->prog->fork_vectors[which_vector].max_stack);
     alloc_rt_stack(a, max_stack);
 
-    if (dbio_scanf("%d rt_stack slots in use\n", &stack_in_use) != 1) {
+    if (binary)
+	stack_in_use = dbio_read_num();
+    else if (dbio_scanf("%d rt_stack slots in use\n", &stack_in_use) != 1) {
+	errlog("READ_ACTIV: Bad stack_in_use number\n");
+	return 0;
+    }
+    if (binary && (stack_in_use < 0 || stack_in_use > max_stack)) {
 	errlog("READ_ACTIV: Bad stack_in_use number\n");
 	return 0;
     }
     a->top_rt_stack = a->base_rt_stack;
     for (i = 0; i < stack_in_use; i++)
-	*(a->top_rt_stack++) = dbio_read_var();
+	*(a->top_rt_stack++) = read_task_value();
 
     if (!read_activ_as_pi(a)) {
 	errlog("READ_ACTIV: Bad activ.\n", stack_in_use);
 	return 0;
     }
-    a->temp = dbio_read_var();
+    a->temp = read_task_value();
 
-    if (dbio_scanf("%u %u%c", &a->pc, &i, &c) != 3) {
-	errlog("READ_ACTIV: bad pc, next. stack_in_use = %d\n", stack_in_use);
-	return 0;
-    }
-    a->bi_func_pc = i;
+    if (binary) {
+	a->pc = dbio_read_num();
+	a->bi_func_pc = dbio_read_num();
+	a->error_pc = dbio_read_num();
+    } else {
+	if (dbio_scanf("%u %u%c", &a->pc, &i, &c) != 3) {
+	    errlog("READ_ACTIV: bad pc, next. stack_in_use = %d\n",
+		   stack_in_use);
+	    return 0;
+	}
+	a->bi_func_pc = i;
 
-    if (c == '\n')
-	a->error_pc = a->pc;
-    else if (dbio_scanf("%u\n", &a->error_pc) != 1) {
-	errlog("READ_ACTIV: no error pc.\n");
-	return 0;
+	if (c == '\n')
+	    a->error_pc = a->pc;
+	else if (dbio_scanf("%u\n", &a->error_pc) != 1) {
+	    errlog("READ_ACTIV: no error pc.\n");
+	    return 0;
+	}
     }
     if (!check_pc_validity(a->prog, which_vector, a->pc)) {
 	errlog("READ_ACTIV: Bad PC for suspended task.\n");
@@ -3521,8 +3887,7 @@ read_activ(activation * a, int which_vector)
 	    return 0;
 	}
 	a->bi_func_id = i;
-	if (!read_bi_func_data(a->bi_func_id, &a->bi_func_data,
-			       &a->bi_func_pc)) {
+	if (!dbio_read_text_record(read_bi_func_state, a)) {
 	    errlog("READ_ACTIV: Bad saved state for built-in function `%s'\n",
 		   func_name);
 	    return 0;
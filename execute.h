@@ -116,6 +116,7 @@ extern enum outcome do_server_program_task(Var _this, const char *verb,
 extern enum outcome resume_from_previous_vm(vm the_vm, Var value);
 
 extern int task_timed_out;
+extern int task_result_is_wanted(void);
 extern void abort_running_task(void);
 extern void print_error_backtrace(const char *, void (*)(const char *));
 extern Var caller();
@@ -132,4 +133,22 @@ extern void free_reordered_rt_env_values(void);
 extern void write_activ(activation a);
 extern int read_activ(activation * a, int which_vector);
 
+/* Programs and values shared between the tasks in a binary DB; see
+ * execute.cc.  Around writing or reading a task queue, call
+ * begin_task_state() and end_task_state().
+ */
+extern void begin_task_state(void);
+extern void end_task_state(void);
+extern void write_task_value(Var);
+extern Var read_task_value(void);
+extern void write_task_program(Program * prog, int f_index, Var * rt_env);
+				/* Writes PROG, or the fork vector F_INDEX of
+				 * it, and the variables in RT_ENV.
+				 */
+extern Program *read_task_program(Var ** rt_env, const char *what);
+				/* Reads what write_task_program() wrote,
+				 * storing the variables in a new *RT_ENV.
+				 * Returns 0 if it can't.
+				 */
+
 #endif
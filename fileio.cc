@@ -31,6 +31,7 @@
 
 #include "tasks.h"
 #include "log.h"
+#include "background.h"
 
 #include "fileio.h"
 
@@ -63,6 +64,36 @@ file_type file_type_text = NULL;
 
 typedef unsigned char file_mode;
 
+/*
+ *  Where a line starts in a file, as of its size and modification
+ *  time, so that the next file_readlines() need not count from the top
+ */
+
+typedef struct file_position file_position;
+
+struct file_position {
+  int32 line;
+  off_t offset;
+  off_t size;
+  time_t mtime;
+  long mtime_nsec;
+};
+
+/*
+ *  The nanoseconds of a file's modification time, where struct stat
+ *  has them: macOS calls the field st_mtimespec, while systems that
+ *  define st_mtime in terms of st_mtim (POSIX.1-2008) have st_mtim.
+ *  Elsewhere only whole seconds (and the size) are compared.
+ */
+
+#if defined(__APPLE__)
+#define STAT_MTIME_NSEC(st)  ((st).st_mtimespec.tv_nsec)
+#elif defined(st_mtime)
+#define STAT_MTIME_NSEC(st)  ((st).st_mtim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(st)  0L
+#endif
+
 typedef struct file_handle file_handle;
 
 struct file_handle {
@@ -72,13 +103,9 @@ struct file_handle {
   file_mode mode;            /* readin', writin' or both */
  
   FILE  *file;               /* the actual file handle   */  
-};
-
-typedef struct line_buffer line_buffer;
-
-struct line_buffer {
-  char *line;
-  struct line_buffer *next;
+  int pending;               /* background jobs not done */
+  int stamp;                 /* changes with every write */
+  file_position next;        /* after the last readlines */
 };
 
 /***************************************************************
@@ -127,6 +154,18 @@ file_mode file_handle_mode(Var fhandle) {
 }  
 
 
+static int file_stamp = 0;
+
+/*
+ *  Forgets where file_readlines() left off, since the file is about
+ *  to change under it.
+ */
+void file_handle_written(Var fhandle) {
+  int32 i = fhandle.v.num;
+  file_table[i].stamp = ++file_stamp;
+  memset(&file_table[i].next, 0, sizeof(file_position));
+}
+
 void file_handle_destroy(Var fhandle) {
   int32 i = fhandle.v.num;
   file_table[i].file = NULL;
@@ -172,6 +211,7 @@ Var file_handle_new(const char *name, file_type type, file_mode mode) {
 	 file_table[handle].name = str_dup(name);
 	 file_table[handle].type = type;
 	 file_table[handle].mode = mode;
+	 file_handle_written(r);
   }
 
   return r;
@@ -356,6 +396,199 @@ const char *file_resolve_path(const char *pathname) {
   
 }
 
+/***************************************************************
+ * Background I/O
+ ***************************************************************/
+
+/*
+ *  The functions that touch the file system describe the work in a
+ *  file_job.  WORK does the I/O and fills in the results using
+ *  nothing but malloc, so that it can run on a background thread;
+ *  FINISH turns them into a package back on the main thread.  With
+ *  $server_options.background_file_io set, the job runs on a
+ *  background thread while the task is suspended, and all the jobs
+ *  of one FHANDLE run in the order they were started.
+ */
+
+typedef struct file_job file_job;
+
+struct file_job {
+  void (*work)(file_job *);
+  package (*finish)(file_job *);
+  int32 handle;              /* -1 if the job has none   */
+  FILE *f;
+  file_type type;
+  file_mode mode;
+  const char *name;          /* raised as the error value */
+  const char *path;          /* for stat() and readdir() */
+  int failed;
+  int error;                 /* errno, or 0 at EOF       */
+  const char *error_value;   /* if not NAME              */
+  int32 begin, end;
+  char *data;                /* bytes read or to write   */
+  int length, size;
+  int *lines;                /* line offsets into DATA   */
+  int count, lines_size;
+  int written;
+  long offset;               /* for file_seek(), file_tell() */
+  int whence, eof;
+  int detailed;
+  struct stat buf;
+  struct stat *stats;        /* for detailed file_list() */
+  Var (*value)(struct stat *);
+  int stamp;                 /* the handle's, when begun */
+  file_position position;    /* where readlines may start */
+};
+
+static file_job *
+new_file_job(void (*work)(file_job *), package (*finish)(file_job *)) {
+  file_job *job = (file_job *)mymalloc(sizeof(file_job), M_STRUCT);
+  memset(job, 0, sizeof(file_job));
+  job->work = work;
+  job->finish = finish;
+  job->handle = -1;
+  return job;
+}
+
+static void
+free_file_job(file_job *job) {
+  if(job->name)
+	 free_str(job->name);
+  if(job->path)
+	 free_str(job->path);
+  free(job->data);
+  free(job->lines);
+  free(job->stats);
+  myfree(job, M_STRUCT);
+}
+
+/*
+ *  Makes room for N more bytes (and a NUL) in the job's DATA.
+ */
+static int
+file_job_reserve(file_job *job, int n) {
+  if(job->length + n + 1 > job->size) {
+	 int size = job->size ? job->size : FILE_IO_BUFFER_LENGTH;
+	 char *data;
+	 while(job->length + n + 1 > size)
+		size *= 2;
+	 if((data = (char *)realloc(job->data, size)) == NULL) {
+		job->failed = 1;
+		job->error = ENOMEM;
+		return 0;
+	 }
+	 job->data = data;
+	 job->size = size;
+  }
+  return 1;
+}
+
+/*
+ *  Appends N bytes to the job's DATA.
+ */
+static int
+file_job_append(file_job *job, const char *bytes, int n) {
+  if(!file_job_reserve(job, n))
+	 return 0;
+  memcpy(job->data + job->length, bytes, n);
+  job->length += n;
+  job->data[job->length] = 0;
+  return 1;
+}
+
+static void
+file_job_fail(file_job *job) {
+  job->failed = 1;
+  job->error = errno;
+}
+
+static package
+file_job_raise(file_job *job) {
+  errno = job->error;
+  return file_raise_errno(job->error_value ? job->error_value : job->name);
+}
+
+static void
+file_job_work(void *data) {
+  file_job *job = (file_job *)data;
+  errno = 0;
+  (*job->work)(job);
+}
+
+/*
+ *  The task resumes with the value; errors lose their message and
+ *  value on the way.
+ */
+static Var
+file_job_done(void *data) {
+  file_job *job = (file_job *)data;
+  package p;
+  Var r;
+
+  if(job->handle >= 0)
+	 file_table[job->handle].pending--;
+  p = (*job->finish)(job);
+  free_file_job(job);
+
+  if(p.kind == package::BI_RETURN)
+	 return p.u.ret;
+  r = p.u.raise.code;
+  free_str(p.u.raise.msg);
+  free_var(p.u.raise.value);
+  return r;
+}
+
+static package
+file_run_job(file_job *job, const char *funcid) {
+  package r;
+
+  if((job->handle >= 0 && file_table[job->handle].pending)
+	  || (server_flag_option_cached(SVO_BACKGROUND_FILE_IO)
+			&& background_threads_running())) {
+	 if(job->handle >= 0)
+		file_table[job->handle].pending++;
+	 return background_suspend_in_lane(funcid, job->handle,
+												  file_job_work, file_job_done, job);
+  }
+
+  file_job_work(job);
+  r = (*job->finish)(job);
+  free_file_job(job);
+  return r;
+}
+
+static file_job *
+new_handle_job(Var fhandle, void (*work)(file_job *), package (*finish)(file_job *)) {
+  file_job *job = new_file_job(work, finish);
+  job->handle = fhandle.v.num;
+  job->f = file_handle_file(fhandle);
+  job->type = file_handle_type(fhandle);
+  job->mode = file_handle_mode(fhandle);
+  job->name = str_ref(file_handle_name(fhandle));
+  job->stamp = file_table[job->handle].stamp;
+  job->position = file_table[job->handle].next;
+  return job;
+}
+
+/*
+ *  Turns LEN raw bytes at DATA, which are followed by a NUL, into a
+ *  MOO string.  Printable bytes come through either filter unchanged,
+ *  so they are copied straight into the string.
+ */
+static char *
+file_job_string(file_job *job, const char *data, int len) {
+  if(printable_prefix_length(data, len, job->type == file_type_text) == len)
+	 return str_dup(data);
+  return str_dup((job->type->in_filter)(data, len));
+}
+
+static package
+finish_none(file_job *job) {
+  if(job->failed)
+	 return file_job_raise(job);
+  return no_var_pack();
+}
+
 /***************************************************************
  * Built in functions
  * file_version
@@ -425,23 +658,29 @@ bf_file_open(Var arglist, Byte next, void *vdata, Objid progr)
  * void file_close(FHANDLE handle);
  */
 
+static void
+work_close(file_job *job) {
+  fclose(job->f);
+}
+
 static package
 bf_file_close(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
   Var fhandle = arglist.v.list[1];
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr))
 	 r = file_raise_notokcall("file_close", progr);
-  else if ((f = file_handle_file_safe(fhandle)) == NULL)
+  else if (file_handle_file_safe(fhandle) == NULL)
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   else {
-	 fclose(f);
+	 /* the FHANDLE is gone now, the file once earlier jobs are done */
+	 job = new_handle_job(fhandle, work_close, finish_none);
 	 file_handle_destroy(fhandle);
-	 r = no_var_pack();
+	 r = file_run_job(job, "file_close");
   }
   free_var(arglist);
   return r;
@@ -525,65 +764,88 @@ bf_file_openmode(Var arglist, Byte next, void *vdata, Objid progr)
  **********************************************************/
 
 /* 
- * common functionality of file_readline and file_readlines 
+ * common functionality of file_readlines and file_list: lines are
+ * appended to the job's DATA, each with its terminating NUL, with
+ * their offsets in LINES
  */
 
-static const char *file_read_line(Var fhandle, int *count) {
-  static Stream *str = 0;
-  FILE *f;
-  int c;
-
-  f = file_handle_file(fhandle);
-  
-  if(str == 0)
-	 str = new_stream(FILE_IO_BUFFER_LENGTH);
-  
-  while((c = fgetc(f)) != EOF && c != '\n')
-	 stream_add_char(str, c);
-
-  if(c == EOF && stream_length(str) == 0) {
-	 reset_stream(str);
-	 *count = 0;
-	 return NULL;
+static int
+file_job_add_line(file_job *job, const char *line, int len) {
+  if(job->count + 2 > job->lines_size) {
+	 int size = job->lines_size ? job->lines_size * 2 : 64;
+	 int *lines;
+	 if((lines = (int *)realloc(job->lines, size * sizeof(int))) == NULL) {
+		job->failed = 1;
+		job->error = ENOMEM;
+		return 0;
+	 }
+	 job->lines = lines;
+	 job->lines_size = size;
   }
+  job->lines[job->count] = job->length;
+  if(!file_job_append(job, line, len))
+	 return 0;
+  job->length++;
+  job->count++;
+  job->lines[job->count] = job->length;
+  return 1;
+}
 
-  *count = stream_length(str);
-  return reset_stream(str);
+static const char *
+file_job_line(file_job *job, int i, int *len) {
+  *len = job->lines[i + 1] - job->lines[i] - 1;
+  return job->data + job->lines[i];
 }
-  
 
 /*
  * STR file_readline(FHANDLE handle)
  */
 
+static void
+work_readline(file_job *job) {
+  size_t size = 0;
+  ssize_t len;
+
+  if((len = getline(&job->data, &size, job->f)) < 0) {
+	 file_job_fail(job);
+	 return;
+  }
+  if(len && job->data[len - 1] == '\n')
+	 job->data[--len] = 0;
+  job->length = len;
+}
+
+static package
+finish_read(file_job *job) {
+  Var rv;
+
+  if(job->failed)
+	 return file_job_raise(job);
+  rv.type = TYPE_STR;
+  rv.v.str = job->data ? file_job_string(job, job->data, job->length) : str_dup("");
+  return make_var_pack(rv);
+}
+
 static package
 bf_file_readline(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
   Var fhandle = arglist.v.list[1];
-  Var rv;
-  int len;
   file_mode mode;
-  file_type type;
-  const char *line;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_readline", progr);
-  } else if (!file_handle_valid(fhandle)) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!(mode = file_handle_mode(fhandle)) & FILE_O_READ)
 	 r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
   else {
-	 type = file_handle_type(fhandle);
-	 if((line = file_read_line(fhandle, &len)) == NULL)
-		r = file_raise_errno("readline");
-	 else {		
-		rv.type = TYPE_STR;
-		rv.v.str = str_dup((type->in_filter)(line, len));
-		r = make_var_pack(rv);
-	 }
+	 job = new_handle_job(fhandle, work_readline, finish_read);
+	 job->error_value = "readline";
+	 r = file_run_job(job, "file_readline");
   }
   free_var(arglist);
   return r;			 
@@ -593,27 +855,204 @@ bf_file_readline(Var arglist, Byte next, void *vdata, Objid progr)
  * STR file_readlines(FHANDLE handle, INT start, INT end)
  */
 
-void free_line_buffer(line_buffer *head, int strings_too) {
-  line_buffer *next;
-  if(head) {
-	 next = head->next;
-	 myfree(head, M_STRUCT);
-	 head = next;
-	 while(head != NULL) {
-		next = head->next;
-		if(strings_too)
-		  free_str(head->line);
-		myfree(head, M_STRUCT);
-		head = next;
-	 }   
+/*
+ *  Hands out the lines of a file read in large blocks with pread(),
+ *  which (unlike a mapping of the file) just sees EOF if the file is
+ *  truncated underneath it.  A line is good until the next call.
+ */
+typedef struct line_scanner line_scanner;
+
+struct line_scanner {
+  int fd;
+  off_t offset;              /* of DATA[0] in the file   */
+  char *data;
+  size_t size, start, length; /* DATA[START..LENGTH) unread */
+  int eof;
+};
+
+static int
+scan_line(line_scanner *sc, const char **line, size_t *len) {
+  const char *nl;
+  ssize_t n;
+
+  for(;;) {
+	 nl = (const char *)memchr(sc->data + sc->start, '\n', sc->length - sc->start);
+	 if(nl || (sc->eof && sc->start < sc->length)) {
+		*line = sc->data + sc->start;
+		*len = (nl ? nl : sc->data + sc->length) - *line;
+		sc->start += *len + (nl ? 1 : 0);
+		return 1;
+	 }
+	 if(sc->eof)
+		return 0;
+
+	 /* keep the partial line, and read more after it */
+	 if(sc->start) {
+		memmove(sc->data, sc->data + sc->start, sc->length - sc->start);
+		sc->offset += sc->start;
+		sc->length -= sc->start;
+		sc->start = 0;
+	 }
+	 if(sc->length == sc->size) {
+		char *data = (char *)realloc(sc->data, sc->size * 2);
+		if(data == NULL) {
+		  errno = ENOMEM;
+		  return -1;
+		}
+		sc->data = data;
+		sc->size *= 2;
+	 }
+	 n = pread(sc->fd, sc->data + sc->length, sc->size - sc->length,
+				  sc->offset + sc->length);
+	 if(n < 0) {
+		if(errno == EINTR)
+		  continue;
+		return -1;
+	 }
+	 if(n == 0)
+		sc->eof = 1;
+	 sc->length += n;
   }
 }
-    
-line_buffer *new_line_buffer(char *line) {
-  line_buffer *p = (line_buffer *)mymalloc(sizeof(line_buffer), M_STRUCT);
-  p->line = line;
-  p->next = NULL;
-  return p;
+
+/*
+ *  Reads the lines of a regular file with a line_scanner, starting
+ *  from where the last call left off if the file has not changed
+ *  since.  Returns 0 if the file isn't suitable, in which case the
+ *  caller falls back on getline().
+ */
+static int
+scan_readlines(file_job *job) {
+  struct stat st;
+  file_position *from = &job->position;
+  int32 current_line = 0;
+  off_t begin_loc;
+  line_scanner sc;
+  const char *line;
+  size_t len;
+  int r = 1;
+
+  sc.fd = fileno(job->f);
+  if(fflush(job->f) || fstat(sc.fd, &st) || !S_ISREG(st.st_mode)
+	  || st.st_size == 0)
+	 return 0;
+  if((sc.data = (char *)malloc(FILE_IO_BUFFER_LENGTH * 16)) == NULL)
+	 return 0;
+  sc.size = FILE_IO_BUFFER_LENGTH * 16;
+  sc.offset = 0;
+  sc.start = sc.length = 0;
+  sc.eof = 0;
+
+  if(from->line && from->line <= job->begin
+	  && from->size == st.st_size
+	  && from->mtime == st.st_mtime
+	  && from->mtime_nsec == STAT_MTIME_NSEC(st)) {
+	 current_line = from->line;
+	 sc.offset = from->offset;
+  }
+  from->line = 0;
+
+  /* "seek" to that line */
+  while((current_line != job->begin) && (r = scan_line(&sc, &line, &len)) > 0)
+	 current_line++;
+
+  if(r < 0) {
+	 file_job_fail(job);
+	 job->error_value = "read_line";
+  } else if(current_line != job->begin) {
+	 job->failed = 1;
+	 job->error = 0;
+	 job->error_value = "read_line";
+  } else {
+	 begin_loc = sc.offset + sc.start;
+	 while((current_line != job->end) && (r = scan_line(&sc, &line, &len)) > 0) {
+		if(!file_job_add_line(job, line, len))
+		  break;
+		current_line++;
+	 }
+
+	 if(r < 0 && !job->failed) {
+		file_job_fail(job);
+		job->error_value = "read_line";
+	 } else if(!job->failed && fseek(job->f, begin_loc, SEEK_SET) == -1) {
+		file_job_fail(job);
+		job->error_value = "seeking";
+	 } else if(!job->failed) {
+		from->line = current_line;
+		from->offset = sc.offset + sc.start;
+		from->size = st.st_size;
+		from->mtime = st.st_mtime;
+		from->mtime_nsec = STAT_MTIME_NSEC(st);
+	 }
+  }
+  free(sc.data);
+  return 1;
+}
+
+static void
+work_readlines(file_job *job) {
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len = 0;
+  int32 current_line = 0;
+  long begin_loc = 0;
+
+  if(scan_readlines(job))
+	 return;
+  job->position.line = 0;
+
+  /* Back to the beginning ... */
+  rewind(job->f);
+
+  /* "seek" to that line */
+  while((current_line != job->begin)
+		  && ((len = getline(&line, &size, job->f)) >= 0))
+	 current_line++;
+
+  if(((job->begin != 0) && (len < 0)) || ((begin_loc = ftell(job->f)) == -1)) {
+	 file_job_fail(job);
+	 job->error_value = "read_line";
+  } else {
+	 /* 
+	  * now that we have where to begin, it's time to slurp lines 
+	  * and seek to EOF or to the end_line, whichever comes first
+	  */
+	 while((current_line != job->end)
+			 && ((len = getline(&line, &size, job->f)) >= 0)) {
+		if(len && line[len - 1] == '\n')
+		  len--;
+		if(!file_job_add_line(job, line, len))
+		  break;
+		current_line++;
+	 }
+
+	 if(!job->failed && fseek(job->f, begin_loc, SEEK_SET) == -1) {
+		file_job_fail(job);
+		job->error_value = "seeking";
+	 }
+  }
+  free(line);
+}
+
+static package
+finish_readlines(file_job *job) {
+  Var rv;
+  const char *line;
+  int i, len;
+
+  if(job->failed)
+	 return file_job_raise(job);
+  rv = new_list(job->count);
+  for(i = 0; i < job->count; i++) {
+	 line = file_job_line(job, i, &len);
+	 rv.v.list[i + 1].type = TYPE_STR;
+	 rv.v.list[i + 1].v.str = file_job_string(job, line, len);
+  }
+  if(job->position.line
+	  && file_table[job->handle].valid
+	  && file_table[job->handle].stamp == job->stamp)
+	 file_table[job->handle].next = job->position;
+  return make_var_pack(rv);
 }
 
 static package
@@ -623,14 +1062,8 @@ bf_file_readlines(Var arglist, Byte next, void *vdata, Objid progr)
   Var fhandle = arglist.v.list[1];
   int32 begin = arglist.v.list[2].v.num;
   int32 end   = arglist.v.list[3].v.num;
-  int32 begin_loc = 0, linecount = 0;
-  file_type type;
   file_mode mode;
-  Var rv;
-  int current_line = 0, len = 0, i = 0;
-  const char *line = NULL;
-  FILE *f;
-  line_buffer *linebuf_head = NULL, *linebuf_cur = NULL;
+  file_job *job;
 
   errno = 0;
 
@@ -638,60 +1071,15 @@ bf_file_readlines(Var arglist, Byte next, void *vdata, Objid progr)
 	 return make_error_pack(E_INVARG);
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_readlines", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!(mode = file_handle_mode(fhandle)) & FILE_O_READ)
 	 r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
   else {
-
-	 /* Back to the beginning ... */
-	 rewind(f);
-
-	 /* "seek" to that line */
-	 begin--;
-	 while((current_line != begin) 
-			 && ((line = file_read_line(fhandle, &len)) != NULL)) 
-		current_line++;	
-	 
-	 if(((begin != 0) && (line == NULL)) || ((begin_loc = ftell(f)) == -1))
-		r = file_raise_errno("read_line");
-	 else {
-		type = file_handle_type(fhandle);
-
-		/* 
-		 * now that we have where to begin, it's time to slurp lines 
-		 * and seek to EOF or to the end_line, whichever comes first
-		 */
-		
-		linebuf_head = linebuf_cur = new_line_buffer(NULL);
-		
-		while((current_line != end) 
-				&& ((line = file_read_line(fhandle, &len)) != NULL)) {
-		  linebuf_cur->next = new_line_buffer(str_dup((type->in_filter)(line, len)));
-		  linebuf_cur = linebuf_cur->next;
-		  
-		  current_line++;
-		  }	
-		linecount =  current_line - begin;
-
-		linebuf_cur = linebuf_head->next;
-
-		if(fseek(f, begin_loc, SEEK_SET) == -1) {
-		  free_line_buffer(linebuf_head, 1);
-		  r = file_raise_errno("seeking");
-		} else {
-		  rv = new_list(linecount);		  
-		  i = 1;
-		  while(linebuf_cur != NULL) {
-			 rv.v.list[i].type = TYPE_STR;
-			 rv.v.list[i].v.str = linebuf_cur->line;
-			 linebuf_cur = linebuf_cur->next;
-			 i++;
-		  }
-		  free_line_buffer(linebuf_head, 0);
-		  r = make_var_pack(rv);
-		}
-	 }
+	 job = new_handle_job(fhandle, work_readlines, finish_readlines);
+	 job->begin = begin - 1;
+	 job->end = end;
+	 r = file_run_job(job, "file_readlines");
   }
 
   free_var(arglist);
@@ -702,6 +1090,14 @@ bf_file_readlines(Var arglist, Byte next, void *vdata, Objid progr)
  * void file_writeline(FHANDLE handle, STR line)
  */
 
+static void
+work_writeline(file_job *job) {
+  if((fputs(job->data, job->f) == EOF) || (fputc('\n', job->f) != '\n'))
+	 file_job_fail(job);
+  else if(job->mode & FILE_O_FLUSH)
+	 fflush(job->f);
+}
+
 static package
 bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -712,13 +1108,13 @@ bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
   file_mode mode;
   file_type type;
   int len;
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_writeline", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!(mode = file_handle_mode(fhandle)) & FILE_O_WRITE)
 	 r = make_raise_pack(E_INVARG, "File is open read-only", var_ref(fhandle));
@@ -726,13 +1122,15 @@ bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
 	 type = file_handle_type(fhandle);
 	 if((rawbuffer = (type->out_filter)(buffer, &len)) == NULL)
 		r = make_raise_pack(E_INVARG, "Invalid binary string", var_ref(fhandle));
-	 else if((fputs(rawbuffer, f) == EOF) || (fputc('\n', f) != '\n'))
-		r = file_raise_errno(file_handle_name(fhandle));
 	 else {
-		  if(mode & FILE_O_FLUSH) {
-			 fflush(f);
-		  }
-		r = no_var_pack();
+		file_handle_written(fhandle);
+		job = new_handle_job(fhandle, work_writeline, finish_none);
+		if(file_job_append(job, rawbuffer, len))
+		  r = file_run_job(job, "file_writeline");
+		else {
+		  r = file_job_raise(job);
+		  free_file_job(job);
+		}
 	 }
   }
   free_var(arglist);
@@ -747,6 +1145,42 @@ bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
  * STR file_read(FHANDLE handle, INT record_length)
  */
 
+/*
+ *  Reads straight into the job's DATA, sized up front from what is
+ *  left of a regular file so that a bulk read is one allocation.
+ */
+static void
+work_read(file_job *job) {
+  int32 record_length = job->begin;
+  int32 want = record_length;
+  struct stat st;
+  off_t at;
+  int read;
+
+  if(!fstat(fileno(job->f), &st) && S_ISREG(st.st_mode)
+	  && (at = ftello(job->f)) >= 0 && st.st_size - at < want)
+	 want = (st.st_size > at) ? st.st_size - at : 1;
+
+  while(job->length < record_length) {
+	 if(!file_job_reserve(job, want))
+		return;
+	 if(!(read = fread(job->data + job->length, sizeof(char), want, job->f))) {
+		/* 
+		 * No more to read.  This is only an error if nothing
+		 * has been read so far.
+		 */
+		if(!job->length)
+		  file_job_fail(job);
+		return;
+	 }
+	 job->length += read;
+	 job->data[job->length] = 0;
+	 want = record_length - job->length;
+	 if(want > FILE_IO_BUFFER_LENGTH)
+		want = FILE_IO_BUFFER_LENGTH;
+  }
+}
+
 static package
 bf_file_read(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -754,65 +1188,21 @@ bf_file_read(Var arglist, Byte next, void *vdata, Objid progr)
 
   Var fhandle = arglist.v.list[1];
   file_mode mode;
-  file_type type;
   int32 record_length = arglist.v.list[2].v.num;
-  int32 read_length;
-
-  char buffer[FILE_IO_BUFFER_LENGTH];
-
-  Var rv;
-
-  static Stream *str = 0;
-  int len = 0, read = 0;
-
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
-  read_length = (record_length > sizeof(buffer)) ? sizeof(buffer) : record_length;
-
-  if(str == 0)
-	 str = new_stream(FILE_IO_BUFFER_LENGTH);
-
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_read", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!(mode = file_handle_mode(fhandle)) & FILE_O_READ)
 	 r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
   else {
-	 type = file_handle_type(fhandle);
-
-  try_again:
-	 read = fread(buffer, sizeof(char), read_length, f);
-	 if(!read && !len) {
-		/* 
-		 * No more to read.  This is only an error if nothing
-		 * has been read so far.
-		 *
-		 */
-		r = file_raise_errno(file_handle_name(fhandle));		
-	 } else if (read && ((len += read) < record_length)){
-		/*
-		 * We got something this time, but it isn't enough.
-		 */
-		stream_add_string(str, (type->in_filter)(buffer, read));
-		read = 0;
-		goto try_again;
-	 } else {
-		/*
-		 * We didn't get anything last time, but we have something already
-		 * OR
-		 * We got everything we need.
-		 */
-		
-		stream_add_string(str, (type->in_filter)(buffer, read));
-
-		rv.type = TYPE_STR;
-		rv.v.str = str_dup(reset_stream(str));					 
-
-		r = make_var_pack(rv);
-	 }
+	 job = new_handle_job(fhandle, work_read, finish_read);
+	 job->begin = record_length;
+	 r = file_run_job(job, "file_read");
   }
   free_var(arglist);
   return r;			 
@@ -822,24 +1212,29 @@ bf_file_read(Var arglist, Byte next, void *vdata, Objid progr)
  * void file_flush(FHANDLE handle)
  */
 
+static void
+work_flush(file_job *job) {
+  if(fflush(job->f))
+	 file_job_fail(job);
+}
+
 static package
 bf_file_flush(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
   Var fhandle = arglist.v.list[1];
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_flush", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else {
-	 if(fflush(f))
-		r = file_raise_errno("flushing");
-	 else
-		r = no_var_pack();
+	 job = new_handle_job(fhandle, work_flush, finish_none);
+	 job->error_value = "flushing";
+	 r = file_run_job(job, "file_flush");
   }
   free_var(arglist);
   return r;
@@ -850,24 +1245,42 @@ bf_file_flush(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_write(FHANDLE fh, STR data)
  */
 
+static void
+work_write(file_job *job) {
+  if(!(job->written = fwrite(job->data, sizeof(char), job->length, job->f)))
+	 file_job_fail(job);
+  else if(job->mode & FILE_O_FLUSH)
+	 fflush(job->f);
+}
+
+static package
+finish_write(file_job *job) {
+  Var rv;
+
+  if(job->failed)
+	 return file_job_raise(job);
+  rv.type = TYPE_INT;
+  rv.v.num = job->written;
+  return make_var_pack(rv);
+}
+
 static package
 bf_file_write(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
-  Var fhandle = arglist.v.list[1], rv;  
+  Var fhandle = arglist.v.list[1];  
   const char *buffer = arglist.v.list[2].v.str;
   const char *rawbuffer;
   file_mode mode;
   file_type type;
   int len;
-  int written;
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_write", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!(mode = file_handle_mode(fhandle)) & FILE_O_WRITE)
 	 r = make_raise_pack(E_INVARG, "File is open read-only", var_ref(fhandle));
@@ -875,14 +1288,15 @@ bf_file_write(Var arglist, Byte next, void *vdata, Objid progr)
 	 type = file_handle_type(fhandle);
 	 if((rawbuffer = (type->out_filter)(buffer, &len)) == NULL)
 		r = make_raise_pack(E_INVARG, "Invalid binary string", var_ref(fhandle));
-	 else if(!(written = fwrite(rawbuffer, sizeof(char), len, f)))
-		r = file_raise_errno(file_handle_name(fhandle));
 	 else {
-		if(mode & FILE_O_FLUSH)
-		  fflush(f);
-		rv.type = TYPE_INT;
-		rv.v.num = written;
-		r = make_var_pack(rv);
+		file_handle_written(fhandle);
+		job = new_handle_job(fhandle, work_write, finish_write);
+		if(len == 0 || file_job_append(job, rawbuffer, len))
+		  r = file_run_job(job, "file_write");
+		else {
+		  r = file_job_raise(job);
+		  free_file_job(job);
+		}
 	 }
   }
   free_var(arglist);
@@ -899,6 +1313,12 @@ bf_file_write(Var arglist, Byte next, void *vdata, Objid progr)
  * whence in {"SEEK_SET", "SEEK_CUR", "SEEK_END"}
  */
 
+static void
+work_seek(file_job *job) {
+  if(fseek(job->f, job->offset, job->whence))
+	 file_job_fail(job);
+}
+
 static package
 bf_file_seek(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -907,7 +1327,7 @@ bf_file_seek(Var arglist, Byte next, void *vdata, Objid progr)
   int32 seek_to = arglist.v.list[2].v.num;
   const char *whence = arglist.v.list[3].v.str;
   int whnce = 0, whence_ok = 1;
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
@@ -922,15 +1342,15 @@ bf_file_seek(Var arglist, Byte next, void *vdata, Objid progr)
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_seek", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else if (!whence_ok) {
 	 r = make_raise_pack(E_INVARG, "Invalid whence", zero);
   } else {
-	 if(fseek(f, seek_to, whnce))
-		r = file_raise_errno(file_handle_name(fhandle));		
-	 else
-		r = no_var_pack();
+	 job = new_handle_job(fhandle, work_seek, finish_none);
+	 job->offset = seek_to;
+	 job->whence = whnce;
+	 r = file_run_job(job, "file_seek");
   }
   free_var(arglist);
   return r;
@@ -940,26 +1360,39 @@ bf_file_seek(Var arglist, Byte next, void *vdata, Objid progr)
  * FLOC file_tell(FHANDLE handle)
  */
 
+static void
+work_tell(file_job *job) {
+  if((job->offset = ftell(job->f)) < 0)
+	 file_job_fail(job);
+}
+
+static package
+finish_tell(file_job *job) {
+  Var rv;
+
+  if(job->failed)
+	 return file_job_raise(job);
+  rv.type = TYPE_INT;
+  rv.v.num = job->offset;
+  return make_var_pack(rv);
+}
+
 static package
 bf_file_tell(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
   Var fhandle = arglist.v.list[1];
-  Var rv;
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_tell", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else {
-	 rv.type = TYPE_INT;
-	 if((rv.v.num = ftell(f)) < 0)
-		r = file_raise_errno(file_handle_name(fhandle));		
-	 else
-		r = make_var_pack(rv);
+	 job = new_handle_job(fhandle, work_tell, finish_tell);
+	 r = file_run_job(job, "file_tell");
   }
   free_var(arglist);
   return r;
@@ -969,24 +1402,36 @@ bf_file_tell(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_eof(FHANDLE handle)
  */
 
+static void
+work_eof(file_job *job) {
+  job->eof = feof(job->f);
+}
+
+static package
+finish_eof(file_job *job) {
+  Var rv;
+
+  rv.type = TYPE_INT;
+  rv.v.num = job->eof;
+  return make_var_pack(rv);
+}
+
 static package
 bf_file_eof(Var arglist, Byte next, void *vdata, Objid progr)
 {
   package r;
   Var fhandle = arglist.v.list[1];
-  Var rv;
-  FILE *f;
+  file_job *job;
 
   errno = 0;
 
   if(!file_verify_caller(progr)) {
 	 r = file_raise_notokcall("file_eof", progr);
-  } else if ((f = file_handle_file_safe(fhandle)) == NULL) {
+  } else if (file_handle_file_safe(fhandle) == NULL) {
 	 r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
   } else {
-	 rv.type = TYPE_INT;
-	 rv.v.num = feof(f);	 
-	 r = make_var_pack(rv);
+	 job = new_handle_job(fhandle, work_eof, finish_eof);
+	 r = file_run_job(job, "file_eof");
   }
   free_var(arglist);
   return r;
@@ -996,41 +1441,46 @@ bf_file_eof(Var arglist, Byte next, void *vdata, Objid progr)
  * Functions that stat()
  *****************************************************************/
 
+static void
+work_stat(file_job *job) {
+  if((job->handle < 0 ? stat(job->path, &job->buf) : fstat(fileno(job->f), &job->buf)) != 0)
+	 file_job_fail(job);
+}
+
+static package
+finish_stat(file_job *job) {
+  if(job->failed)
+	 return file_job_raise(job);
+  return make_var_pack((*job->value)(&job->buf));
+}
+
 /*
- * (internal) int(statok) file_stat(Var filespec, package *r, struct stat *buf)
+ * (internal) file_stat(Var filespec, Var (*value)(struct stat *))
+ * Calls VALUE with the result of stat()ing the file or FHANDLE.
  */
 
-int file_stat(Objid progr, Var filespec, package *r, struct stat *buf) {
-  int statok = 0;
-  
+static package
+file_stat(Objid progr, Var filespec, Var (*value)(struct stat *), const char *funcid) {
+  file_job *job;
+
   if(!file_verify_caller(progr)) {
-	 *r = file_raise_notokcall("file_stat", progr);
+	 return file_raise_notokcall(funcid, progr);
   } else if (filespec.type == TYPE_STR) {
 	 const char *filename = filespec.v.str;
 	 const char *real_filename;
 
-	 if((real_filename = file_resolve_path(filename)) == NULL) {
-		*r =  file_raise_notokfilename("file_stat", filename);
-	 } else {
-		if(stat(real_filename, buf) != 0)		  
-		  *r = file_raise_errno(filename);
-		else {
-		  statok = 1;
-		}
-	 }
+	 if((real_filename = file_resolve_path(filename)) == NULL)
+		return file_raise_notokfilename(funcid, filename);
+	 job = new_file_job(work_stat, finish_stat);
+	 job->path = str_dup(real_filename);
+	 job->name = str_ref(filename);
+  } else if (file_handle_file_safe(filespec) == NULL) {
+	 return make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(filespec));
   } else {
-	 FILE *f;
-	 if((f = file_handle_file_safe(filespec)) == NULL)
-		*r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(filespec));
-	 else {
-		if(fstat(fileno(f), buf) != 0)
-		  *r = file_raise_errno(file_handle_name(filespec));
-		else {
-		  statok = 1;
-		}
-	 }
+	 job = new_handle_job(filespec, work_stat, finish_stat);
   }
-  return statok;
+  job->value = value;
+  return file_run_job(job, funcid);
 }
 
 const char *file_type_string(mode_t st_mode) {
@@ -1061,19 +1511,18 @@ const char *file_mode_string(mode_t st_mode) {
  * INT file_size(FHANDLE fh)
  */
 
+static Var
+stat_size(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_INT;
+  rv.v.num = buf->st_size;
+  return rv;
+}
+
 static package
 bf_file_size(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_INT;
-	 rv.v.num = buf.st_size;
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_size, "file_size");
   free_var(arglist);
   return r;
 }
@@ -1083,19 +1532,18 @@ bf_file_size(Var arglist, Byte next, void *vdata, Objid progr)
  * STR file_mode(FHANDLE fh)
  */
 
+static Var
+stat_mode(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_STR;
+  rv.v.str = str_dup(file_mode_string(buf->st_mode));
+  return rv;
+}
+
 static package
 bf_file_mode(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_STR;
-	 rv.v.str = str_dup(file_mode_string(buf.st_mode));
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_mode, "file_mode");
   free_var(arglist);
   return r;
 }
@@ -1105,19 +1553,18 @@ bf_file_mode(Var arglist, Byte next, void *vdata, Objid progr)
  * STR file_type(FHANDLE fh)
  */
 
+static Var
+stat_type(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_STR;
+  rv.v.str = str_dup(file_type_string(buf->st_mode));
+  return rv;
+}
+
 static package
 bf_file_type(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_STR;
-	 rv.v.str = str_dup(file_type_string(buf.st_mode));
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_type, "file_type");
   free_var(arglist);
   return r;
 }
@@ -1127,19 +1574,18 @@ bf_file_type(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_last_access(FHANDLE fh)
  */
 
+static Var
+stat_last_access(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_INT;
+  rv.v.num = buf->st_atime;
+  return rv;
+}
+
 static package
 bf_file_last_access(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_INT;
-	 rv.v.num = buf.st_atime;
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_last_access, "file_last_access");
   free_var(arglist);
   return r;
 }
@@ -1149,19 +1595,18 @@ bf_file_last_access(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_last_modify(FHANDLE fh)
  */
 
+static Var
+stat_last_modify(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_INT;
+  rv.v.num = buf->st_mtime;
+  return rv;
+}
+
 static package
 bf_file_last_modify(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_INT;
-	 rv.v.num = buf.st_mtime;
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_last_modify, "file_last_modify");
   free_var(arglist);
   return r;
 }
@@ -1171,19 +1616,18 @@ bf_file_last_modify(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_last_change(FHANDLE fh)
  */
 
+static Var
+stat_last_change(struct stat *buf) {
+  Var rv;
+  rv.type = TYPE_INT;
+  rv.v.num = buf->st_ctime;
+  return rv;
+}
+
 static package
 bf_file_last_change(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv.type = TYPE_INT;
-	 rv.v.num = buf.st_ctime;
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_last_change, "file_last_change");
   free_var(arglist);
   return r;
 }
@@ -1193,34 +1637,32 @@ bf_file_last_change(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_stat(FHANDLE fh)
  */
 
+static Var
+stat_all(struct stat *buf) {
+  Var rv = new_list(8);
+  rv.v.list[1].type = TYPE_INT;
+  rv.v.list[1].v.num = buf->st_size;
+  rv.v.list[2].type = TYPE_STR;
+  rv.v.list[2].v.str = str_dup(file_type_string(buf->st_mode));
+  rv.v.list[3].type = TYPE_STR;
+  rv.v.list[3].v.str = str_dup(file_mode_string(buf->st_mode));
+  rv.v.list[4].type = TYPE_STR;
+  rv.v.list[4].v.str = str_dup("");
+  rv.v.list[5].type = TYPE_STR;
+  rv.v.list[5].v.str = str_dup("");
+  rv.v.list[6].type = TYPE_INT;
+  rv.v.list[6].v.num = buf->st_atime;
+  rv.v.list[7].type = TYPE_INT;
+  rv.v.list[7].v.num = buf->st_mtime;
+  rv.v.list[8].type = TYPE_INT;
+  rv.v.list[8].v.num = buf->st_ctime;
+  return rv;
+}
+
 static package
 bf_file_stat(Var arglist, Byte next, void *vdata, Objid progr)
 {  
-  package r;
-  Var     rv;
-  Var filespec = arglist.v.list[1];
-  struct stat buf;
-
-  if (file_stat(progr, filespec, &r, &buf)) {
-	 rv = new_list(8);
-	 rv.v.list[1].type = TYPE_INT;
-	 rv.v.list[1].v.num = buf.st_size;
-	 rv.v.list[2].type = TYPE_STR;
-	 rv.v.list[2].v.str = str_dup(file_type_string(buf.st_mode));
-	 rv.v.list[3].type = TYPE_STR;
-	 rv.v.list[3].v.str = str_dup(file_mode_string(buf.st_mode));
-	 rv.v.list[4].type = TYPE_STR;
-	 rv.v.list[4].v.str = str_dup("");
-	 rv.v.list[5].type = TYPE_STR;
-	 rv.v.list[5].v.str = str_dup("");
-	 rv.v.list[6].type = TYPE_INT;
-	 rv.v.list[6].v.num = buf.st_atime;
-	 rv.v.list[7].type = TYPE_INT;
-	 rv.v.list[7].v.num = buf.st_mtime;
-	 rv.v.list[8].type = TYPE_INT;
-	 rv.v.list[8].v.num = buf.st_ctime;
-	 r = make_var_pack(rv);
-  }
+  package r = file_stat(progr, arglist.v.list[1], stat_all, "file_stat");
   free_var(arglist);
   return r;
 }
@@ -1244,70 +1686,111 @@ int file_list_select(const struct dirent *d) {
 	 return 1;
 }
 
-static package
-bf_file_list(Var arglist, Byte next, void *vdata, Objid progr)
-{  
+static void
+work_list(file_job *job) {
   /* modified to use opendir/readdir which is slightly more "standard"
      than the original scandir method.   -- AAB 06/03/97
    */
+  DIR *curdir;
+  struct dirent *curfile;
+  struct stat *stats;
+  char *pathname = NULL;
+  size_t path_length = strlen(job->path), size = 0, needed;
+  int stats_size = 0;
+
+  if (!(curdir = opendir (job->path))) {
+	 file_job_fail(job);
+	 return;
+  }
+  while ( (curfile = readdir(curdir)) != 0 ) {
+	 if (strncmp(curfile->d_name, ".", 2) != 0 && strncmp(curfile->d_name, "..", 3) != 0) {
+		if (!file_job_add_line(job, curfile->d_name, strlen(curfile->d_name)))
+		  break;
+		if (job->detailed) {
+		  needed = path_length + strlen(curfile->d_name) + 2;
+		  if (needed > size) {
+			 char *p = (char *)realloc(pathname, needed);
+			 if (!p) {
+				job->failed = 1;
+				job->error = ENOMEM;
+				break;
+			 }
+			 pathname = p;
+			 size = needed;
+		  }
+		  if (stats_size < job->lines_size) {
+			 if (!(stats = (struct stat *)realloc(job->stats, job->lines_size * sizeof(struct stat)))) {
+				job->failed = 1;
+				job->error = ENOMEM;
+				break;
+			 }
+			 job->stats = stats;
+			 stats_size = job->lines_size;
+		  }
+		  sprintf(pathname, "%s/%s", job->path, curfile->d_name);
+		  if (stat(pathname, &job->stats[job->count - 1]) != 0) {
+			 file_job_fail(job);
+			 break;
+		  }
+		}
+	 }
+  }
+  free(pathname);
+  closedir(curdir);
+}
+
+static package
+finish_list(file_job *job) {
+  Var rv, detail;
+  const char *name;
+  int i, len;
+
+  if(job->failed)
+	 return file_job_raise(job);
+  rv = new_list(job->count);
+  for(i = 0; i < job->count; i++) {
+	 name = file_job_line(job, i, &len);
+	 if (job->detailed) {
+		struct stat *buf = &job->stats[i];
+		detail = new_list(4);
+		detail.v.list[1].type = TYPE_STR;
+		detail.v.list[1].v.str = str_dup(name);
+		detail.v.list[2].type = TYPE_STR;
+		detail.v.list[2].v.str = str_dup(file_type_string(buf->st_mode));
+		detail.v.list[3].type = TYPE_STR;
+		detail.v.list[3].v.str = str_dup(file_mode_string(buf->st_mode));
+		detail.v.list[4].type = TYPE_INT;
+		detail.v.list[4].v.num = buf->st_size;
+	 } else {
+		detail.type = TYPE_STR;
+		detail.v.str = str_dup(name);
+	 }
+	 rv.v.list[i + 1] = detail;
+  }
+  return make_var_pack(rv);
+}
+
+static package
+bf_file_list(Var arglist, Byte next, void *vdata, Objid progr)
+{  
   package r;
   const char *pathspec = arglist.v.list[1].v.str;
   const char *real_pathname;
   int	detailed = (arglist.v.list[0].v.num > 1
 						? is_true(arglist.v.list[2])
 						: 0);
+  file_job *job;
   
     if(!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_list", progr);
     } else if((real_pathname = file_resolve_path(pathspec)) == NULL) {
         r =  file_raise_notokfilename("file_list", pathspec);
     } else {
-        DIR *curdir;
-        Stream *s = new_stream(64);
-        int failed = 0;
-        struct stat buf;
-        Var     rv, detail;
-	struct dirent *curfile;
-
-	if (!(curdir = opendir (real_pathname)))
-		r = file_raise_errno(pathspec);
-	else {
-		rv = new_list(0);
-		while ( (curfile = readdir(curdir)) != 0 ) {
-		    if (strncmp(curfile->d_name, ".", 2) != 0 && strncmp(curfile->d_name, "..", 3) != 0) {
-			if (detailed) {
-				stream_add_string(s, real_pathname);
-				stream_add_char(s, '/');
-				stream_add_string(s, curfile->d_name);
-				if (stat(reset_stream(s), &buf) != 0) {
-					failed = 1;
-					break;
-				} else {
-					detail = new_list(4);
-					detail.v.list[1].type = TYPE_STR;
-					detail.v.list[1].v.str = str_dup(curfile->d_name);
-					detail.v.list[2].type = TYPE_STR;
-					detail.v.list[2].v.str = str_dup(file_type_string(buf.st_mode));
-					detail.v.list[3].type = TYPE_STR;
-					detail.v.list[3].v.str = str_dup(file_mode_string(buf.st_mode));
-					detail.v.list[4].type = TYPE_INT;
-					detail.v.list[4].v.num = buf.st_size;
-				}
-			} else {
-				detail.type = TYPE_STR;
-				detail.v.str = str_dup(curfile->d_name);
-			}
-			rv = listappend(rv, detail);
-		    }
-		}
-		if(failed) {
-			free_var(rv);
-			r = file_raise_errno(pathspec);
-		} else
-			r = make_var_pack(rv);
-		closedir(curdir);
-	}
-  	free_stream(s);
+        job = new_file_job(work_list, finish_list);
+        job->path = str_dup(real_pathname);
+        job->name = str_ref(pathspec);
+        job->detailed = detailed;
+        r = file_run_job(job, "file_list");
     }
     free_var(arglist);
     return r;
@@ -477,6 +477,15 @@ load_server_options(void)
     SERVER_OPTIONS_CACHED_MISC(_SVO_DO, value);
 
 # undef _SVO_DO
+
+    watch_server_options();
+}
+
+void
+refresh_server_options(void)
+{
+    if (db_property_watches_triggered())
+	load_server_options();
 }
 
 static package
@@ -96,5 +96,10 @@ extern int read_bi_func_data(Byte f_id, void **bi_func_state,
 extern Byte *pc_for_bi_func_data(void);
 
 extern void load_server_options(void);
+extern void refresh_server_options(void);
+				/* Calls `load_server_options()' iff any of
+				 * the options it caches might have changed
+				 * since it was last called.
+				 */
 
 #endif
@@ -16,9 +16,11 @@
  *****************************************************************************/
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include "my-ctype.h"
+#include "my-signal.h"
 #include "my-string.h"
 
 #include "bf_register.h"
@@ -28,6 +30,7 @@
 #include "list.h"
 #include "log.h"
 #include "map.h"
+#include "numbers.h"
 #include "options.h"
 #include "pattern.h"
 #include "streams.h"
@@ -756,6 +759,268 @@ bf_equal(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+/* sort(list [, keys [, natural [, reverse]]]) sorts the list by its own
+ * elements or, if KEYS is a non-empty list of the same length, by the
+ * corresponding keys.  The keys must all be integers, floats, objects,
+ * errors, or strings, and all of the same type; they are ordered the way
+ * `<' orders them, so strings are compared without regard to case.  The
+ * sort is a stable merge sort of element indices.  Large lists are split
+ * into runs that are sorted on separate threads and merged; the threads
+ * only read the keys, never allocate or touch reference counts.
+ */
+
+#define SORT_RUN 16		/* insertion sort runs of this length */
+
+typedef struct sort_context {
+    const Var *keys;		/* zero-based */
+    var_type type;
+    int natural;		/* compare digit runs as numbers */
+    int reverse;
+} sort_context;
+
+static int
+natural_strcasecmp(const char *ss, const char *tt)
+{
+    const unsigned char *s = (const unsigned char *) ss;
+    const unsigned char *t = (const unsigned char *) tt;
+
+    for (;;) {
+	if (isdigit(*s) && isdigit(*t)) {
+	    const unsigned char *s0, *t0;
+	    int r;
+
+	    while (*s == '0')
+		s++;
+	    while (*t == '0')
+		t++;
+	    for (s0 = s; isdigit(*s); s++)
+		;
+	    for (t0 = t; isdigit(*t); t++)
+		;
+	    if (s - s0 != t - t0)
+		return (s - s0) - (t - t0);
+	    if ((r = strncmp((const char *) s0, (const char *) t0, s - s0)))
+		return r;
+	    continue;
+	}
+	if (tolower(*s) != tolower(*t))
+	    return tolower(*s) - tolower(*t);
+	if (!*s)
+	    return 0;
+	s++;
+	t++;
+    }
+}
+
+static int
+sort_compare(const sort_context *ctx, int i, int j)
+{
+    Var a = ctx->keys[i], b = ctx->keys[j];
+    int r;
+
+    switch (ctx->type) {
+    case TYPE_INT:
+	r = compare_integers(a.v.num, b.v.num);
+	break;
+    case TYPE_OBJ:
+	r = compare_integers(a.v.obj, b.v.obj);
+	break;
+    case TYPE_ERR:
+	r = ((int) a.v.err) - ((int) b.v.err);
+	break;
+    case TYPE_FLOAT:
+	r = (*a.v.fnum < *b.v.fnum) ? -1 : (*a.v.fnum > *b.v.fnum);
+	break;
+    case TYPE_STR:
+	r = ctx->natural ? natural_strcasecmp(a.v.str, b.v.str)
+	    : mystrcasecmp(a.v.str, b.v.str);
+	break;
+    default:
+	r = 0;
+	break;
+    }
+
+    return ctx->reverse ? -r : r;
+}
+
+/* Merges the sorted runs A[lo..mid-1] and A[mid..hi-1], using TMP[lo..mid-1]
+ * to hold the first.  Ties go to the first run, which keeps the sort stable.
+ */
+static void
+sort_merge(const sort_context *ctx, int *a, int *tmp, int lo, int mid, int hi)
+{
+    int i = lo, j = mid, k = lo;
+
+    if (lo == mid || mid == hi || sort_compare(ctx, a[mid - 1], a[mid]) <= 0)
+	return;
+    memcpy(tmp + lo, a + lo, (mid - lo) * sizeof(int));
+    while (i < mid && j < hi)
+	a[k++] = (sort_compare(ctx, a[j], tmp[i]) < 0) ? a[j++] : tmp[i++];
+    while (i < mid)
+	a[k++] = tmp[i++];
+}
+
+static void
+sort_range(const sort_context *ctx, int *a, int *tmp, int lo, int hi)
+{
+    int i, j, x, mid;
+
+    if (hi - lo <= SORT_RUN) {
+	for (i = lo + 1; i < hi; i++) {
+	    x = a[i];
+	    for (j = i; j > lo && sort_compare(ctx, x, a[j - 1]) < 0; j--)
+		a[j] = a[j - 1];
+	    a[j] = x;
+	}
+	return;
+    }
+    mid = lo + (hi - lo) / 2;
+    sort_range(ctx, a, tmp, lo, mid);
+    sort_range(ctx, a, tmp, mid, hi);
+    sort_merge(ctx, a, tmp, lo, mid, hi);
+}
+
+typedef struct sort_job {
+    const sort_context *ctx;
+    int *a, *tmp;
+    int lo, mid, hi;		/* MID < 0 to sort A[lo..hi-1] */
+} sort_job;
+
+static void *
+sort_thread(void *data)
+{
+    sort_job *job = (sort_job *) data;
+
+    if (job->mid < 0)
+	sort_range(job->ctx, job->a, job->tmp, job->lo, job->hi);
+    else
+	sort_merge(job->ctx, job->a, job->tmp, job->lo, job->mid, job->hi);
+    return 0;
+}
+
+/* Runs the first job on this thread and the others on threads of their
+ * own, which start with all signals blocked so that signals still go to
+ * the main thread.  A job whose thread can't be started runs here too.
+ */
+static void
+run_sort_jobs(sort_job *jobs, int count)
+{
+    pthread_t threads[PARALLEL_SORT_THREADS];
+    int started[PARALLEL_SORT_THREADS];
+    sigset_t all, old;
+    int i;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < count; i++)
+	started[i] = !pthread_create(&threads[i], 0, sort_thread, &jobs[i]);
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+
+    sort_thread(&jobs[0]);
+    for (i = 1; i < count; i++)
+	if (started[i])
+	    pthread_join(threads[i], 0);
+	else
+	    sort_thread(&jobs[i]);
+}
+
+static void
+sort_indices(const sort_context *ctx, int *a, int *tmp, int n)
+{
+    int bounds[PARALLEL_SORT_THREADS + 1];
+    sort_job jobs[PARALLEL_SORT_THREADS];
+    int runs = (n >= PARALLEL_SORT_MIN) ? PARALLEL_SORT_THREADS : 1;
+    int i, count;
+
+    if (runs == 1) {
+	sort_range(ctx, a, tmp, 0, n);
+	return;
+    }
+
+    for (i = 0; i <= runs; i++)
+	bounds[i] = (int) ((long long) n * i / runs);
+    for (i = 0; i < runs; i++) {
+	jobs[i].ctx = ctx;
+	jobs[i].a = a;
+	jobs[i].tmp = tmp;
+	jobs[i].lo = bounds[i];
+	jobs[i].mid = -1;
+	jobs[i].hi = bounds[i + 1];
+    }
+    run_sort_jobs(jobs, runs);
+
+    /* Merge neighbouring runs in pairs until only one is left. */
+    while (runs > 1) {
+	for (count = 0; 2 * count + 1 < runs; count++) {
+	    jobs[count].lo = bounds[2 * count];
+	    jobs[count].mid = bounds[2 * count + 1];
+	    jobs[count].hi = bounds[2 * count + 2];
+	}
+	run_sort_jobs(jobs, count);
+	for (i = 0; 2 * i < runs; i++)
+	    bounds[i] = bounds[2 * i];
+	bounds[i] = bounds[runs];
+	runs = i;
+    }
+}
+
+static package
+bf_sort(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list [, keys [, natural [, reverse]]]) */
+    Var list = arglist.v.list[1];
+    Var keys = list;
+    int nargs = arglist.v.list[0].v.num;
+    int n = list.v.list[0].v.num;
+    sort_context ctx;
+    int *a, *tmp;
+    int i;
+    Var r;
+
+    if (nargs >= 2 && arglist.v.list[2].v.list[0].v.num > 0) {
+	keys = arglist.v.list[2];
+	if (keys.v.list[0].v.num != n) {
+	    free_var(arglist);
+	    return make_error_pack(E_INVARG);
+	}
+    }
+    ctx.keys = keys.v.list + 1;
+    ctx.type = n ? keys.v.list[1].type : TYPE_INT;
+    ctx.natural = nargs >= 3 && is_true(arglist.v.list[3]);
+    ctx.reverse = nargs >= 4 && is_true(arglist.v.list[4]);
+
+    if (ctx.type != TYPE_INT && ctx.type != TYPE_FLOAT && ctx.type != TYPE_OBJ
+	&& ctx.type != TYPE_ERR && ctx.type != TYPE_STR) {
+	free_var(arglist);
+	return make_error_pack(E_TYPE);
+    }
+    for (i = 2; i <= n; i++)
+	if (keys.v.list[i].type != ctx.type) {
+	    free_var(arglist);
+	    return make_error_pack(E_TYPE);
+	}
+
+    if (n < 2) {
+	r = var_ref(list);
+	free_var(arglist);
+	return make_var_pack(r);
+    }
+
+    a = (int *) mymalloc(n * sizeof(int), M_ARRAY);
+    tmp = (int *) mymalloc(n * sizeof(int), M_ARRAY);
+    for (i = 0; i < n; i++)
+	a[i] = i;
+    sort_indices(&ctx, a, tmp, n);
+
+    r = new_list(n);
+    for (i = 0; i < n; i++)
+	r.v.list[i + 1] = var_ref(list.v.list[a[i] + 1]);
+
+    myfree(a, M_ARRAY);
+    myfree(tmp, M_ARRAY);
+    free_var(arglist);
+    return make_var_pack(r);
+}
+
 static package
 bf_strsub(Var arglist, Byte next, void *vdata, Objid progr)
 {				/* (source, what, with [, case-matters]) */
@@ -788,6 +1053,459 @@ bf_strsub(Var arglist, Byte next, void *vdata, Objid progr)
     return p;
 }
 
+/* strsubs(source, replacements [, case-matters]) makes all of the
+ * substitutions in REPLACEMENTS, a map from strings to strings or a list
+ * of {what, with} pairs, in a single pass over SOURCE.  At each position
+ * the longest WHAT found there is replaced and the scan resumes after it,
+ * as strsub() does for a single WHAT.  The WHATs are found with an
+ * Aho-Corasick automaton; the automata for the most recently used
+ * replacements are cached, as the patterns for match() are.
+ */
+
+typedef struct substitutions {
+    int count;			/* number of WHATs */
+    const char **with;		/* borrowed from the cached replacements */
+    int *what_length;
+    int *first_child, *next_sibling;
+    unsigned char *edge;	/* character leading into each state */
+    int *fail;
+    int *found;			/* WHAT ending at each state, or -1 */
+    int *output;		/* nearest state down the fail links
+				 * (or itself) that ends a WHAT; 0 if none */
+    int *depth;
+    int root[256];		/* transitions out of the start state */
+} substitutions;
+
+static int
+substitution_step(const substitutions *subs, int state, unsigned char c)
+{
+    int t;
+
+    while (state) {
+	for (t = subs->first_child[state]; t >= 0; t = subs->next_sibling[t])
+	    if (subs->edge[t] == c)
+		return t;
+	state = subs->fail[state];
+    }
+    return subs->root[c];
+}
+
+static void
+free_substitutions(substitutions *subs)
+{
+    myfree(subs->with, M_ARRAY);
+    myfree(subs->what_length, M_ARRAY);
+    myfree(subs->first_child, M_ARRAY);
+    myfree(subs->next_sibling, M_ARRAY);
+    myfree(subs->edge, M_ARRAY);
+    myfree(subs->fail, M_ARRAY);
+    myfree(subs->found, M_ARRAY);
+    myfree(subs->output, M_ARRAY);
+    myfree(subs->depth, M_ARRAY);
+    myfree(subs, M_STRUCT);
+}
+
+static substitutions *
+new_substitutions(const char **what, const char **with, int count,
+		  int case_matters)
+{
+    substitutions *subs = (substitutions *) mymalloc(sizeof(substitutions),
+						     M_STRUCT);
+    int i, j, c, t, state, states = 1, max_states = 1;
+    int *queue, head, tail;
+
+    for (i = 0; i < count; i++)
+	max_states += strlen(what[i]);
+
+    subs->count = count;
+    subs->with = (const char **) mymalloc(count * sizeof(char *), M_ARRAY);
+    subs->what_length = (int *) mymalloc(count * sizeof(int), M_ARRAY);
+    subs->first_child = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+    subs->next_sibling = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+    subs->edge = (unsigned char *) mymalloc(max_states, M_ARRAY);
+    subs->fail = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+    subs->found = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+    subs->output = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+    subs->depth = (int *) mymalloc(max_states * sizeof(int), M_ARRAY);
+
+    subs->first_child[0] = subs->next_sibling[0] = subs->found[0] = -1;
+    subs->fail[0] = subs->output[0] = subs->depth[0] = 0;
+
+    /* The trie of all of the WHATs; equal WHATs share a state, which
+     * ends the first of them.
+     */
+    for (i = 0; i < count; i++) {
+	subs->with[i] = with[i];
+	subs->what_length[i] = strlen(what[i]);
+	state = 0;
+	for (j = 0; what[i][j]; j++) {
+	    c = (unsigned char) what[i][j];
+	    if (!case_matters)
+		c = tolower(c);
+	    for (t = subs->first_child[state]; t >= 0; t = subs->next_sibling[t])
+		if (subs->edge[t] == c)
+		    break;
+	    if (t < 0) {
+		t = states++;
+		subs->edge[t] = c;
+		subs->first_child[t] = -1;
+		subs->next_sibling[t] = subs->first_child[state];
+		subs->first_child[state] = t;
+		subs->found[t] = -1;
+		subs->depth[t] = j + 1;
+	    }
+	    state = t;
+	}
+	if (subs->found[state] < 0)
+	    subs->found[state] = i;
+    }
+
+    memset(subs->root, 0, sizeof(subs->root));
+    for (t = subs->first_child[0]; t >= 0; t = subs->next_sibling[t])
+	subs->root[subs->edge[t]] = t;
+
+    /* Fail links, breadth first so that each state's fail link is set
+     * before those of its children.
+     */
+    queue = (int *) mymalloc(states * sizeof(int), M_ARRAY);
+    head = tail = 0;
+    for (t = subs->first_child[0]; t >= 0; t = subs->next_sibling[t]) {
+	subs->fail[t] = 0;
+	subs->output[t] = subs->found[t] >= 0 ? t : 0;
+	queue[tail++] = t;
+    }
+    while (head < tail) {
+	state = queue[head++];
+	for (t = subs->first_child[state]; t >= 0; t = subs->next_sibling[t]) {
+	    subs->fail[t] = substitution_step(subs, subs->fail[state],
+					      subs->edge[t]);
+	    subs->output[t] = subs->found[t] >= 0 ? t
+		: subs->output[subs->fail[t]];
+	    queue[tail++] = t;
+	}
+    }
+    myfree(queue, M_ARRAY);
+
+    return subs;
+}
+
+/* BEST has room for an entry for each byte of SOURCE. */
+static void
+stream_add_substitutions(Stream *s, const char *source, int length,
+			 const substitutions *subs, int case_matters,
+			 int *best)
+{
+    int i, o, c, start, run, state = 0;
+
+    memset(best, 0, length * sizeof(int));
+    for (i = 0; i < length; i++) {
+	c = (unsigned char) source[i];
+	if (!case_matters)
+	    c = tolower(c);
+	state = substitution_step(subs, state, c);
+	for (o = subs->output[state]; o; o = subs->output[subs->fail[o]]) {
+	    start = i - subs->depth[o] + 1;
+	    if (!best[start]
+		|| subs->what_length[best[start] - 1] < subs->depth[o])
+		best[start] = subs->found[o] + 1;
+	}
+    }
+
+    for (i = run = 0; i < length;)
+	if (best[i]) {
+	    stream_add_bytes(s, source + run, i - run);
+	    stream_add_string(s, subs->with[best[i] - 1]);
+	    i += subs->what_length[best[i] - 1];
+	    run = i;
+	} else
+	    i++;
+    stream_add_bytes(s, source + run, length - run);
+}
+
+struct subs_cache_entry {
+    Var replacements;		/* held by a reference */
+    int case_matters;
+    substitutions *subs;	/* 0 if the entry is unused */
+    struct subs_cache_entry *next;
+};
+
+static struct subs_cache_entry *subs_cache;
+static struct subs_cache_entry subs_cache_entries[PATTERN_CACHE_SIZE];
+
+static void
+setup_substitution_cache()
+{
+    int i;
+
+    for (i = 0; i < PATTERN_CACHE_SIZE; i++)
+	subs_cache_entries[i].subs = 0;
+
+    for (i = 0; i < PATTERN_CACHE_SIZE - 1; i++)
+	subs_cache_entries[i].next = &(subs_cache_entries[i + 1]);
+    subs_cache_entries[PATTERN_CACHE_SIZE - 1].next = 0;
+
+    subs_cache = &(subs_cache_entries[0]);
+}
+
+struct replacement_data {
+    const char **what, **with;
+    int count;
+    enum error e;
+};
+
+static int
+add_replacement(Var what, Var with, void *data, int first)
+{
+    struct replacement_data *d = (struct replacement_data *)data;
+
+    if (what.type != TYPE_STR || with.type != TYPE_STR)
+	d->e = E_TYPE;
+    else if (what.v.str[0] == '\0')
+	d->e = E_INVARG;
+    else {
+	d->what[d->count] = what.v.str;
+	d->with[d->count] = with.v.str;
+	d->count++;
+	return 0;
+    }
+    return 1;
+}
+
+/* Returns the automaton for REPLACEMENTS, or 0 (setting *E) if they are
+ * not valid.
+ */
+static const substitutions *
+get_substitutions(Var replacements, int case_matters, enum error *e)
+{
+    struct subs_cache_entry *entry, **entry_ptr;
+    struct replacement_data d;
+    int i, count;
+
+    entry = subs_cache;
+    entry_ptr = &subs_cache;
+
+    while (1) {
+	if (entry->subs && case_matters == entry->case_matters
+	    && equality(replacements, entry->replacements, 1)) {
+	    /* A cache hit; move this entry to the front of the cache. */
+	    break;
+	} else if (!entry->next) {
+	    /* A cache miss; reuse the last entry, moving it to the front
+	     * iff the replacements are valid.
+	     */
+	    if (replacements.type == TYPE_MAP)
+		count = maplength(replacements);
+	    else
+		count = replacements.v.list[0].v.num;
+	    d.what = (const char **) mymalloc((count + 1) * sizeof(char *), M_ARRAY);
+	    d.with = (const char **) mymalloc((count + 1) * sizeof(char *), M_ARRAY);
+	    d.count = 0;
+	    d.e = E_NONE;
+	    if (replacements.type == TYPE_MAP)
+		mapforeach(replacements, add_replacement, &d);
+	    else
+		for (i = 1; i <= count && d.e == E_NONE; i++) {
+		    Var pair = replacements.v.list[i];
+
+		    if (pair.type != TYPE_LIST || pair.v.list[0].v.num != 2)
+			d.e = E_INVARG;
+		    else
+			add_replacement(pair.v.list[1], pair.v.list[2], &d, 0);
+		}
+	    if (d.e == E_NONE) {
+		if (entry->subs) {
+		    free_var(entry->replacements);
+		    free_substitutions(entry->subs);
+		}
+		entry->replacements = var_ref(replacements);
+		entry->case_matters = case_matters;
+		entry->subs = new_substitutions(d.what, d.with, d.count,
+						case_matters);
+	    }
+	    myfree(d.what, M_ARRAY);
+	    myfree(d.with, M_ARRAY);
+	    if (d.e != E_NONE) {
+		*e = d.e;
+		return 0;
+	    }
+	    break;
+	} else {
+	    /* not done searching the cache... */
+	    entry_ptr = &(entry->next);
+	    entry = entry->next;
+	}
+    }
+
+    *entry_ptr = entry->next;
+    entry->next = subs_cache;
+    subs_cache = entry;
+    return entry->subs;
+}
+
+static package
+bf_strsubs(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (source, replacements [, case-matters]) */
+    const char *source = arglist.v.list[1].v.str;
+    Var replacements = arglist.v.list[2];
+    int case_matters = 0;
+    int length = memo_strlen(source);
+    const substitutions *subs;
+    enum error e = E_NONE;
+    int *best;
+    Stream *s;
+    package p;
+
+    if (arglist.v.list[0].v.num == 3)
+	case_matters = is_true(arglist.v.list[3]);
+    if (replacements.type != TYPE_LIST && replacements.type != TYPE_MAP) {
+	free_var(arglist);
+	return make_error_pack(E_TYPE);
+    }
+    if (!(subs = get_substitutions(replacements, case_matters, &e))) {
+	free_var(arglist);
+	return make_error_pack(e);
+    }
+    best = (int *) mymalloc((length + 1) * sizeof(int), M_ARRAY);
+    s = new_stream(length + 1);
+    TRY_STREAM;
+    try {
+	Var r;
+	stream_add_substitutions(s, source, length, subs, case_matters, best);
+	r.type = TYPE_STR;
+	r.v.str = str_dup(stream_contents(s));
+	p = make_var_pack(r);
+    }
+    catch (stream_too_big& exception) {
+	p = make_space_pack();
+    }
+    ENDTRY_STREAM;
+    free_stream(s);
+    myfree(best, M_ARRAY);
+    free_var(arglist);
+    return p;
+}
+
+static package
+bf_join(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (list [, separator]) */
+    Var list = arglist.v.list[1];
+    const char *sep = arglist.v.list[0].v.num > 1 ? arglist.v.list[2].v.str : " ";
+    int n = list.v.list[0].v.num;
+    size_t sep_len = strlen(sep), total = 0;
+    int i;
+    char *str, *out;
+    Var r;
+
+    for (i = 1; i <= n; i++) {
+	if (list.v.list[i].type != TYPE_STR) {
+	    free_var(arglist);
+	    return make_error_pack(E_TYPE);
+	}
+	total += memo_strlen(list.v.list[i].v.str);
+    }
+    if (n > 1)
+	total += (n - 1) * sep_len;
+
+    if (total + 1 > stream_alloc_maximum) {
+	free_var(arglist);
+	return make_space_pack();
+    }
+
+    if (total == 0)
+	str = str_dup("");
+    else {
+	str = out = (char *) mymalloc(total + 1, M_STRING);
+	for (i = 1; i <= n; i++) {
+	    size_t len = memo_strlen(list.v.list[i].v.str);
+
+	    if (i > 1) {
+		memcpy(out, sep, sep_len);
+		out += sep_len;
+	    }
+	    memcpy(out, list.v.list[i].v.str, len);
+	    out += len;
+	}
+	*out = '\0';
+    }
+
+    free_var(arglist);
+    r.type = TYPE_STR;
+    r.v.str = str;
+    return make_var_pack(r);
+}
+
+/* Returns the first occurrence of SEP (SEP_LEN > 0 bytes long) in the
+ * LEN bytes at S, or 0.
+ */
+static const char *
+find_separator(const char *s, size_t len, const char *sep, size_t sep_len)
+{
+    if (sep_len == 1)
+	return (const char *) memchr(s, sep[0], len);
+    else
+	return (const char *) memmem(s, len, sep, sep_len);
+}
+
+static package
+bf_explode(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (subject [, separator [, include-empty]]) */
+    const char *subject = arglist.v.list[1].v.str;
+    const char *sep = arglist.v.list[0].v.num > 1 ? arglist.v.list[2].v.str : " ";
+    int include_empty = arglist.v.list[0].v.num > 2
+			&& is_true(arglist.v.list[3]);
+    size_t len = memo_strlen(subject), sep_len = strlen(sep);
+    const char *end = subject + len, *start, *found;
+    int count, i;
+    Var r;
+
+    if (sep_len == 0) {
+	free_var(arglist);
+	return make_error_pack(E_INVARG);
+    }
+
+    /* Count the pieces first so the list is allocated just once. */
+    count = 0;
+    for (start = subject;; start = found + sep_len) {
+	found = find_separator(start, end - start, sep, sep_len);
+	if (!found)
+	    found = end;
+	if (include_empty || found > start)
+	    count++;
+	if (found == end)
+	    break;
+    }
+
+    r = new_list(count);
+    i = 0;
+    for (start = subject;; start = found + sep_len) {
+	found = find_separator(start, end - start, sep, sep_len);
+	if (!found)
+	    found = end;
+	if (found > start) {
+	    char *piece = (char *) mymalloc(found - start + 1, M_STRING);
+
+	    memcpy(piece, start, found - start);
+	    piece[found - start] = '\0';
+	    r.v.list[++i].type = TYPE_STR;
+	    r.v.list[i].v.str = piece;
+	} else if (include_empty) {
+	    r.v.list[++i].type = TYPE_STR;
+	    r.v.list[i].v.str = str_dup("");
+	}
+	if (found == end)
+	    break;
+    }
+
+    free_var(arglist);
+
+    if (value_bytes(r) <= server_int_option_cached(SVO_MAX_LIST_VALUE_BYTES))
+	return make_var_pack(r);
+    else {
+	free_var(r);
+	return make_space_pack();
+    }
+}
+
 static int
 signum(int x)
 {
@@ -1329,6 +2047,8 @@ register_list(void)
     register_function("listset", 3, 3, bf_listset,
 		      TYPE_LIST, TYPE_ANY, TYPE_INT);
     register_function("equal", 2, 2, bf_equal, TYPE_ANY, TYPE_ANY);
+    register_function("sort", 1, 4, bf_sort,
+		      TYPE_LIST, TYPE_LIST, TYPE_ANY, TYPE_ANY);
 
     /* string */
     register_function("tostr", 0, -1, bf_tostr);
@@ -1344,6 +2064,12 @@ register_list(void)
     register_function("strcmp", 2, 2, bf_strcmp, TYPE_STR, TYPE_STR);
     register_function("strsub", 3, 4, bf_strsub,
 		      TYPE_STR, TYPE_STR, TYPE_STR, TYPE_ANY);
+    setup_substitution_cache();
+    register_function("strsubs", 2, 3, bf_strsubs,
+		      TYPE_STR, TYPE_ANY, TYPE_ANY);
+    register_function("join", 1, 2, bf_join, TYPE_LIST, TYPE_STR);
+    register_function("explode", 1, 3, bf_explode,
+		      TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("strtr", 3, 4, bf_strtr,
 		      TYPE_STR, TYPE_STR, TYPE_STR, TYPE_ANY);
 }
@@ -0,0 +1,194 @@
+/*
+ * A compressor and decompressor for the LZ4 block format.
+ *
+ * A block is a series of sequences, each a token byte whose high and low
+ * nibbles are the literal length and the match length less MIN_MATCH
+ * (15 meaning that more length bytes follow, each added in until one is
+ * less than 255), the literals, and a two-byte little-endian offset back
+ * to the match.  The last sequence has literals only.  The compressor is
+ * a greedy one with a single hash table, which is what gives LZ4 its
+ * speed; it is meant for DB files, where speed matters more than ratio.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define MIN_MATCH	4
+#define LAST_LITERALS	5	/* the last bytes are always literals */
+#define MATCH_LIMIT	12	/* no match starts this close to the end */
+#define MAX_OFFSET	65535
+#define HASH_LOG	14
+#define SKIP_TRIGGER	6	/* search faster through incompressible data */
+
+typedef unsigned char byte;
+
+static inline uint32_t
+read32(const byte *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned
+hash4(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline byte *
+write_length(byte *op, size_t len)
+{
+    while (len >= 255) {
+	*op++ = 255;
+	len -= 255;
+    }
+    *op++ = (byte) len;
+    return op;
+}
+
+size_t
+lz4_compress(const char *src, size_t size, char *dst, size_t capacity)
+{
+    const byte *base = (const byte *) src;
+    const byte *ip = base, *anchor = base;
+    const byte *iend = base + size;
+    const byte *mflimit = iend - MATCH_LIMIT;
+    const byte *matchlimit = iend - LAST_LITERALS;
+    byte *op = (byte *) dst, *oend = op + capacity;
+    uint32_t table[1 << HASH_LOG];
+    unsigned searches = 1 << SKIP_TRIGGER;
+    size_t litlen, mlen;
+    byte *token;
+
+    if (size > MATCH_LIMIT) {
+	memset(table, 0, sizeof(table));
+	while (ip < mflimit) {
+	    uint32_t seq = read32(ip);
+	    unsigned h = hash4(seq);
+	    const byte *ref = base + table[h];
+	    const byte *mp, *rp;
+
+	    table[h] = (uint32_t) (ip - base);
+	    if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+		ip += searches++ >> SKIP_TRIGGER;
+		continue;
+	    }
+	    searches = 1 << SKIP_TRIGGER;
+
+	    while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+		ip--;
+		ref--;
+	    }
+	    for (mp = ip + MIN_MATCH, rp = ref + MIN_MATCH;
+		 mp < matchlimit && *mp == *rp;
+		 mp++, rp++)
+		;
+
+	    litlen = ip - anchor;
+	    mlen = (mp - ip) - MIN_MATCH;
+	    if ((size_t) (oend - op) < 1 + litlen / 255 + 1 + litlen + 2
+					 + mlen / 255 + 1)
+		return 0;
+
+	    token = op++;
+	    if (litlen >= 15) {
+		*token = 15 << 4;
+		op = write_length(op, litlen - 15);
+	    } else
+		*token = (byte) (litlen << 4);
+	    memcpy(op, anchor, litlen);
+	    op += litlen;
+
+	    *op++ = (byte) (ip - ref);
+	    *op++ = (byte) ((ip - ref) >> 8);
+
+	    if (mlen >= 15) {
+		*token |= 15;
+		op = write_length(op, mlen - 15);
+	    } else
+		*token |= (byte) mlen;
+
+	    ip = anchor = mp;
+	}
+    }
+
+    litlen = iend - anchor;
+    if ((size_t) (oend - op) < 1 + litlen / 255 + 1 + litlen)
+	return 0;
+    token = op++;
+    if (litlen >= 15) {
+	*token = 15 << 4;
+	op = write_length(op, litlen - 15);
+    } else
+	*token = (byte) (litlen << 4);
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    return op - (byte *) dst;
+}
+
+static inline int
+read_length(const byte **ip, const byte *iend, size_t *len)
+{
+    unsigned s;
+
+    do {
+	if (*ip >= iend)
+	    return 0;
+	s = *(*ip)++;
+	*len += s;
+    } while (s == 255);
+    return 1;
+}
+
+long
+lz4_decompress(const char *src, size_t size, char *dst, size_t capacity)
+{
+    const byte *ip = (const byte *) src, *iend = ip + size;
+    byte *op = (byte *) dst, *oend = op + capacity;
+
+    while (ip < iend) {
+	unsigned token = *ip++;
+	size_t len = token >> 4, offset;
+	const byte *match;
+
+	if (len == 15 && !read_length(&ip, iend, &len))
+	    return -1;
+	if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+	    return -1;
+	memcpy(op, ip, len);
+	op += len;
+	ip += len;
+
+	if (ip == iend)		/* the last sequence has no match */
+	    break;
+
+	if (iend - ip < 2)
+	    return -1;
+	offset = ip[0] | (ip[1] << 8);
+	ip += 2;
+	if (offset == 0 || offset > (size_t) (op - (byte *) dst))
+	    return -1;
+
+	len = token & 15;
+	if (len == 15 && !read_length(&ip, iend, &len))
+	    return -1;
+	len += MIN_MATCH;
+	if (len > (size_t) (oend - op))
+	    return -1;
+
+	match = op - offset;
+	if (offset >= len) {
+	    memcpy(op, match, len);
+	    op += len;
+	} else
+	    while (len--)
+		*op++ = *match++;
+    }
+
+    return op - (byte *) dst;
+}
@@ -0,0 +1,36 @@
+/*
+ * A compressor and decompressor for the LZ4 block format, as described in
+ * lz4_Block_format.md in the LZ4 distribution.  Only single blocks are
+ * handled here; the framing used for DB files is in db_file.cc.
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The largest compressed size of SIZE bytes of input. */
+#define LZ4_COMPRESS_BOUND(size)	((size) + (size) / 255 + 16)
+
+extern size_t lz4_compress(const char *src, size_t size,
+			   char *dst, size_t capacity);
+				/* Returns the compressed size, or 0 if it
+				 * would not fit in CAPACITY bytes.
+				 */
+
+extern long lz4_decompress(const char *src, size_t size,
+			   char *dst, size_t capacity);
+				/* Returns the decompressed size, or -1 if
+				 * SRC is malformed or the result would not
+				 * fit in CAPACITY bytes.
+				 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LZ4_H */
@@ -18,7 +18,10 @@
 /* This module provides IP host name lookup with timeouts.  Because
  * longjmps out of name lookups corrupt some UNIX name lookup modules, this
  * module uses a subprocess to do the name lookup.  On any failure, the
- * subprocess is restarted.
+ * subprocess is restarted.  Requests may also be made without waiting for
+ * the answer, which is then read from the subprocess as it arrives and
+ * passed to a callback; answers are cached for NAME_LOOKUP_CACHE_TTL
+ * seconds either way.
  */
 
 #include "options.h"
@@ -35,13 +38,17 @@
 #include "my-socket.h"		/* AF_INET */
 #include "my-wait.h"
 #include "my-string.h"
+#include "my-time.h"
 #include <errno.h>
 
 #include "config.h"
 #include "log.h"
+#include "name_lookup.h"
+#include "net_multi.h"
 #include "server.h"
 #include "storage.h"
 #include "timers.h"
+#include "utils.h"
 
 /******************************************************************************
  * Utilities
@@ -132,7 +139,7 @@ robust_read(int fd, void *buffer, int len)
  *****************************************************************************/
 
 struct request {
-    enum {
+    enum lookup_kind {
 	REQ_NAME_FROM_ADDR, REQ_ADDR_FROM_NAME
     } kind;
     unsigned timeout;
@@ -290,11 +297,134 @@ intermediary(int to_server, int from_server)
 static int to_intermediary, from_intermediary;
 static int dead_intermediary = 0;
 
+/* Answers are remembered in a small direct-mapped cache; a new answer simply
+ * replaces whatever was in its slot.  Reverse entries are keyed by address
+ * and hold a host name (empty if the lookup failed); forward entries are
+ * keyed by host name and hold an address (0 if the lookup failed).
+ */
+typedef struct cache_entry {
+    int kind;			/* a request kind, or -1 if empty */
+    unsigned32 address;		/* network byte order */
+    const char *name;
+    time_t expires;
+} cache_entry;
+
+static cache_entry name_cache[NAME_LOOKUP_CACHE_SIZE];
+static int name_cache_initialized = 0;
+
+/* Requests not yet answered by the intermediary, oldest first.  Since the
+ * intermediary answers in order, the next reply always belongs to the head
+ * of this queue.  The queue is kept short enough that neither pipe can fill
+ * up while the server is writing a request.
+ */
+#define MAX_PENDING_LOOKUPS	128
 
-int
-initialize_name_lookup(void)
+typedef struct lookup_waiter {
+    struct lookup_waiter *next;
+    name_lookup_callback callback;
+    void *data;
+} lookup_waiter;
+
+typedef struct pending_lookup {
+    struct pending_lookup *next;
+    struct request req;
+    const char *name;		/* host name, for REQ_ADDR_FROM_NAME */
+    lookup_waiter *waiters;
+} pending_lookup;
+
+static pending_lookup *pending_head = 0, **pending_tail = &pending_head;
+static int pending_count = 0;
+
+static cache_entry *
+cache_slot(request::lookup_kind kind, unsigned32 address, const char *name)
+{
+    unsigned hash;
+    int i;
+
+    if (!name_cache_initialized) {
+	for (i = 0; i < NAME_LOOKUP_CACHE_SIZE; i++)
+	    name_cache[i].kind = -1;
+	name_cache_initialized = 1;
+    }
+    if (kind == request::REQ_NAME_FROM_ADDR)
+	hash = ntohl(address) * 2654435761u;
+    else
+	hash = str_hash(name);
+
+    return &name_cache[hash % NAME_LOOKUP_CACHE_SIZE];
+}
+
+static cache_entry *
+cache_find(request::lookup_kind kind, unsigned32 address, const char *name)
+{
+    cache_entry *e = cache_slot(kind, address, name);
+
+    if (e->kind != kind || e->expires < time(0))
+	return 0;
+    if (kind == request::REQ_NAME_FROM_ADDR
+	? e->address != address
+	: mystrcasecmp(e->name, name) != 0)
+	return 0;
+    return e;
+}
+
+static void
+cache_store(request::lookup_kind kind, unsigned32 address, const char *name)
+{
+    cache_entry *e = cache_slot(kind, address, name);
+    int failed = (kind == request::REQ_NAME_FROM_ADDR
+		  ? name[0] == '\0' : address == 0);
+
+    if (e->kind != -1)
+	free_str(e->name);
+    e->kind = kind;
+    e->address = address;
+    e->name = str_dup(name);
+    e->expires = time(0) + (failed ? NAME_LOOKUP_FAILURE_TTL
+			    : NAME_LOOKUP_CACHE_TTL);
+}
+
+static const char *
+dotted_decimal(unsigned32 address)
+{
+    static char decimal[20];
+    unsigned32 a = ntohl(address);
+
+    sprintf(decimal, "%u.%u.%u.%u",
+	    (unsigned) (a >> 24) & 0xff, (unsigned) (a >> 16) & 0xff,
+	    (unsigned) (a >> 8) & 0xff, (unsigned) a & 0xff);
+    return decimal;
+}
+
+static void
+finish_lookup(pending_lookup * p, const char *name)
 {
-    return spawn_pipe(intermediary, &to_intermediary, &from_intermediary);
+    lookup_waiter *w, *next;
+
+    if (p->req.kind == request::REQ_ADDR_FROM_NAME)
+	name = p->name;
+    for (w = p->waiters; w; w = next) {
+	next = w->next;
+	(*w->callback) (w->data, name);
+	myfree(w, M_NETWORK);
+    }
+    if (p->name)
+	free_str(p->name);
+    myfree(p, M_NETWORK);
+}
+
+/* Take the oldest request off the queue, so that callbacks may safely start
+ * new lookups of their own.
+ */
+static pending_lookup *
+dequeue_lookup(void)
+{
+    pending_lookup *p = pending_head;
+
+    if (!(pending_head = p->next))
+	pending_tail = &pending_head;
+    pending_count--;
+    return p;
 }
 
 static void
@@ -302,8 +432,152 @@ abandon_intermediary(const char *prefix)
 {
     errlog("LOOKUP_NAME: %s; presumed dead...\n", prefix);
     dead_intermediary = 1;
+    network_unregister_fd(from_intermediary);
     close(to_intermediary);
     close(from_intermediary);
+
+    /* Nobody is going to answer the pending requests now; let their
+     * waiters fall back on numeric addresses.
+     */
+    while (pending_head) {
+	pending_lookup *p = dequeue_lookup();
+
+	finish_lookup(p, (p->req.kind == request::REQ_NAME_FROM_ADDR
+			  ? dotted_decimal(p->req.u.address.sin_addr.s_addr)
+			  : 0));
+    }
+}
+
+static void
+read_reply(void)
+{
+    pending_lookup *p = pending_head;
+    static char *buffer = 0;
+    static int buflen = 0;
+    unsigned32 addr;
+    int len;
+
+    if (p->req.kind == request::REQ_ADDR_FROM_NAME) {
+	if (robust_read(from_intermediary, &addr, sizeof(addr))
+	    != sizeof(addr)) {
+	    abandon_intermediary("LOOKUP_ADDR: Read from intermediary failed");
+	    return;
+	}
+	cache_store(p->req.kind, addr == 0xffffffff ? 0 : addr, p->name);
+	p = dequeue_lookup();
+	finish_lookup(p, 0);
+    } else {
+	if (robust_read(from_intermediary, &len, sizeof(len)) != sizeof(len)) {
+	    abandon_intermediary("LOOKUP_NAME: Read from intermediary failed");
+	    return;
+	}
+	ensure_buffer(&buffer, &buflen, len + 1);
+	if (len > 0 && robust_read(from_intermediary, buffer, len) != len) {
+	    abandon_intermediary("LOOKUP_NAME: "
+				 "Data-read from intermediary failed");
+	    return;
+	}
+	buffer[len] = '\0';
+	cache_store(p->req.kind, p->req.u.address.sin_addr.s_addr, buffer);
+	p = dequeue_lookup();
+	finish_lookup(p, len > 0 ? buffer
+		      : dotted_decimal(p->req.u.address.sin_addr.s_addr));
+    }
+}
+
+/* The reply descriptor stays registered for as long as the intermediary
+ * lives, so that registrations never change while the network module is
+ * running callbacks.  With nothing outstanding, it can only be readable
+ * because the intermediary has gone away.
+ */
+static void
+reply_readable(int fd, void *data)
+{
+    if (pending_head)
+	read_reply();
+    else
+	abandon_intermediary("LOOKUP_NAME: Unexpected data from intermediary");
+}
+
+int
+initialize_name_lookup(void)
+{
+    if (!spawn_pipe(intermediary, &to_intermediary, &from_intermediary)) {
+	dead_intermediary = 1;
+	return 0;
+    }
+    network_register_fd(from_intermediary, reply_readable, 0, 0);
+    return 1;
+}
+
+/* Wait for the answers to all outstanding requests, so that the next reply
+ * from the intermediary is the one to a request about to be made.
+ */
+static void
+drain_pending_lookups(void)
+{
+    while (pending_head && !dead_intermediary)
+	read_reply();
+}
+
+/* Queue a request for KIND and ADDR or NAME, sharing an identical one that
+ * is already outstanding.  Returns false if the request couldn't be made.
+ */
+static int
+start_lookup(request::lookup_kind kind, struct sockaddr_in *addr, const char *name,
+	     unsigned timeout, name_lookup_callback callback, void *data)
+{
+    pending_lookup *p;
+    lookup_waiter *w;
+
+    if (dead_intermediary)
+	return 0;
+
+    for (p = pending_head; p; p = p->next)
+	if (p->req.kind == kind
+	    && (kind == request::REQ_NAME_FROM_ADDR
+		? (p->req.u.address.sin_addr.s_addr
+		   == addr->sin_addr.s_addr)
+		: mystrcasecmp(p->name, name) == 0))
+	    break;
+
+    if (!p) {
+	if (pending_count >= MAX_PENDING_LOOKUPS)
+	    return 0;
+	p = (pending_lookup *)mymalloc(sizeof(pending_lookup), M_NETWORK);
+	p->req.kind = kind;
+	p->req.timeout = timeout;
+	p->name = 0;
+	p->waiters = 0;
+	if (kind == request::REQ_NAME_FROM_ADDR)
+	    p->req.u.address = *addr;
+	else {
+	    p->req.u.length = strlen(name);
+	    p->name = str_dup(name);
+	}
+	if (write(to_intermediary, &p->req, sizeof(p->req)) != sizeof(p->req)
+	    || (p->name
+		&& write(to_intermediary, p->name, p->req.u.length)
+		   != p->req.u.length)) {
+	    if (p->name)
+		free_str(p->name);
+	    myfree(p, M_NETWORK);
+	    abandon_intermediary("LOOKUP_NAME: Write to intermediary failed");
+	    return 0;
+	}
+	p->next = 0;
+	*pending_tail = p;
+	pending_tail = &p->next;
+	pending_count++;
+    }
+
+    w = (lookup_waiter *)mymalloc(sizeof(lookup_waiter), M_NETWORK);
+    w->callback = callback;
+    w->data = data;
+    w->next = p->waiters;
+    p->waiters = w;
+
+    return 1;
 }
 
 const char *
@@ -312,8 +586,14 @@ lookup_name_from_addr(struct sockaddr_in *addr, unsigned timeout)
     struct request req;
     static char *buffer = 0;
     static int buflen = 0;
+    cache_entry *e;
     int len;
 
+    if ((e = cache_find(request::REQ_NAME_FROM_ADDR,
+			addr->sin_addr.s_addr, 0)))
+	return e->name[0] ? e->name : dotted_decimal(addr->sin_addr.s_addr);
+
+    drain_pending_lookups();
     if (!dead_intermediary) {
 	req.kind = request::REQ_NAME_FROM_ADDR;
 	req.timeout = timeout;
@@ -323,14 +603,16 @@ lookup_name_from_addr(struct sockaddr_in *addr, unsigned timeout)
 	else if (robust_read(from_intermediary, &len, sizeof(len))
 		 != sizeof(len))
 	    abandon_intermediary("LOOKUP_NAME: Read from intermediary failed");
-	else if (len != 0) {
+	else {
 	    ensure_buffer(&buffer, &buflen, len + 1);
-	    if (robust_read(from_intermediary, buffer, len) != len)
+	    if (len > 0 && robust_read(from_intermediary, buffer, len) != len)
 		abandon_intermediary("LOOKUP_NAME: "
 				   "Data-read from intermediary failed");
 	    else {
 		buffer[len] = '\0';
-		return buffer;
+		cache_store(req.kind, addr->sin_addr.s_addr, buffer);
+		if (len != 0)
+		    return buffer;
 	    }
 	}
     }
@@ -338,16 +620,24 @@ lookup_name_from_addr(struct sockaddr_in *addr, unsigned timeout)
      * a name; in either case, we must fall back on a the default, dotted-
      * decimal notation.
      */
+    return dotted_decimal(addr->sin_addr.s_addr);
+}
+
+const char *
+lookup_name_from_addr_async(struct sockaddr_in *addr, unsigned timeout,
+			    name_lookup_callback callback, void *data)
+{
+    cache_entry *e;
 
-    {
-	static char decimal[20];
-	unsigned32 a = ntohl(addr->sin_addr.s_addr);
+    if ((e = cache_find(request::REQ_NAME_FROM_ADDR,
+			addr->sin_addr.s_addr, 0))) {
+	if (e->name[0])
+	    return e->name;
+    } else
+	start_lookup(request::REQ_NAME_FROM_ADDR, addr, 0, timeout,
+		     callback, data);
 
-	sprintf(decimal, "%u.%u.%u.%u",
-		(unsigned) (a >> 24) & 0xff, (unsigned) (a >> 16) & 0xff,
-		(unsigned) (a >> 8) & 0xff, (unsigned) a & 0xff);
-	return decimal;
-    }
+    return dotted_decimal(addr->sin_addr.s_addr);
 }
 
 unsigned32
@@ -355,11 +645,16 @@ lookup_addr_from_name(const char *name, unsigned timeout)
 {
     struct request req;
     unsigned32 addr = 0;
+    cache_entry *e;
 
-    if (dead_intermediary) {
-	/* Numeric addresses should always work... */
-	addr = inet_addr(name);
-    } else {
+    if ((addr = inet_addr(name)) != 0xffffffff)
+	return addr;		/* Numeric addresses don't need a lookup */
+    addr = 0;
+    if ((e = cache_find(request::REQ_ADDR_FROM_NAME, 0, name)))
+	return e->address;
+
+    drain_pending_lookups();
+    if (!dead_intermediary) {
 	req.kind = request::REQ_ADDR_FROM_NAME;
 	req.timeout = timeout;
 	req.u.length = strlen(name);
@@ -369,9 +664,41 @@ lookup_addr_from_name(const char *name, unsigned timeout)
 	else if (robust_read(from_intermediary, &addr, sizeof(addr))
 		 != sizeof(addr))
 	    abandon_intermediary("LOOKUP_ADDR: Read from intermediary failed");
+	else {
+	    if (addr == 0xffffffff)
+		addr = 0;
+	    cache_store(req.kind, addr, name);
+	}
     }
 
     return addr == 0xffffffff ? 0 : addr;
 }
 
+int
+lookup_addr_from_name_async(const char *name, unsigned timeout,
+			    name_lookup_callback callback, void *data)
+{
+    if (inet_addr(name) != 0xffffffff
+	|| cache_find(request::REQ_ADDR_FROM_NAME, 0, name))
+	return 0;
+
+    return start_lookup(request::REQ_ADDR_FROM_NAME, 0, name, timeout,
+			callback, data);
+}
+
+void
+cancel_name_lookups(name_lookup_callback callback, void *data)
+{
+    pending_lookup *p;
+    lookup_waiter **ww, *w;
+
+    for (p = pending_head; p; p = p->next)
+	for (ww = &p->waiters; (w = *ww);)
+	    if (w->callback == callback && w->data == data) {
+		*ww = w->next;
+		myfree(w, M_NETWORK);
+	    } else
+		ww = &w->next;
+}
+
 #endif				/* NETWORK_PROTOCOL == NP_TCP */
@@ -18,7 +18,8 @@
 /*
  * This module provides IP host name lookup with timeouts.  Because
  * many DNS servers are flaky and the normal UNIX name-lookup facilities just
- * hang in such situations, this interface comes in very handy.
+ * hang in such situations, this interface comes in very handy.  Answers are
+ * cached, and the *_async() variants never wait for the name server at all.
  */
 
 #ifndef Name_Lookup_H
@@ -48,4 +49,39 @@ extern const char *lookup_name_from_addr(struct sockaddr_in *addr,
 				 * form.
 				 */
 
+typedef void (*name_lookup_callback) (void *data, const char *name);
+
+extern const char *lookup_name_from_addr_async(struct sockaddr_in *addr,
+					       unsigned timeout,
+					       name_lookup_callback callback,
+					       void *data);
+				/* Like lookup_name_from_addr(), but never
+				 * waits for the name server: if the name
+				 * isn't already known, the address is
+				 * returned in dotted decimal form and (if
+				 * not too many lookups are outstanding) a
+				 * lookup is started in the background.  When
+				 * it finishes, CALLBACK is called with DATA
+				 * and the host name (or the dotted decimal
+				 * address, if the lookup failed).
+				 */
+
+extern int lookup_addr_from_name_async(const char *name, unsigned timeout,
+				       name_lookup_callback callback,
+				       void *data);
+				/* If translating NAME with
+				 * lookup_addr_from_name() would have to wait
+				 * for the name server, start the lookup in
+				 * the background and return true; CALLBACK
+				 * is called with DATA and NAME once the
+				 * answer is known, after which
+				 * lookup_addr_from_name() returns it at once.
+				 * Otherwise, return false.
+				 */
+
+extern void cancel_name_lookups(name_lookup_callback callback, void *data);
+				/* Forget any background lookups that would
+				 * call CALLBACK with DATA.
+				 */
+
 #endif				/* Name_Lookup_H */
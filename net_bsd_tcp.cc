@@ -36,6 +36,7 @@
 #include "list.h"
 #include "log.h"
 #include "name_lookup.h"
+#include "net_multi.h"
 #include "net_proto.h"
 #include "options.h"
 #include "server.h"
@@ -134,11 +135,28 @@ proto_listen(int fd)
     return 1;
 }
 
+static void
+remote_name_found(void *data, const char *host_name)
+{
+    int fd = (int) (intptr_t) data;
+    struct sockaddr_in address;
+    socklen_t addr_length = sizeof(address);
+    static Stream *s = 0;
+
+    if (!s)
+	s = new_stream(100);
+
+    if (getpeername(fd, (struct sockaddr *) &address, &addr_length) < 0)
+	return;
+    stream_printf(s, "%s, port %d", host_name, (int) ntohs(address.sin_port));
+    network_set_remote_name(fd, reset_stream(s));
+}
+
 enum proto_accept_error
 proto_accept_connection(int listener_fd, int *read_fd, int *write_fd,
 			const char **name)
 {
-    int timeout = server_int_option("name_lookup_timeout", 5);
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
     int fd;
     struct sockaddr_in address;
     socklen_t addr_length = sizeof(address);
@@ -157,8 +175,13 @@ proto_accept_connection(int listener_fd, int *read_fd, int *write_fd,
 	}
     }
     *read_fd = *write_fd = fd;
+    /* Don't hold up the server waiting for the host name; the connection
+     * is renamed by remote_name_found() if it turns up later.
+     */
     stream_printf(s, "%s, port %d",
-		  lookup_name_from_addr(&address, timeout),
+		  lookup_name_from_addr_async(&address, timeout,
+					      remote_name_found,
+					      (void *) (intptr_t) fd),
 		  (int) ntohs(address.sin_port));
     *name = reset_stream(s);
     return PA_OKAY;
@@ -168,6 +191,7 @@ void
 proto_close_connection(int read_fd, int write_fd)
 {
     /* read_fd and write_fd are the same, so we only need to deal with one. */
+    cancel_name_lookups(remote_name_found, (void *) (intptr_t) read_fd);
     close(read_fd);
 }
 
@@ -199,6 +223,22 @@ timeout_proc(Timer_ID id, Timer_Data data)
     throw timeout_exception();
 }
 
+int
+proto_resolve_connection(Var arglist,
+			 void (*callback) (void *data, const char *host_name),
+			 void *data)
+{
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
+
+    if (!outbound_network_enabled
+	|| arglist.v.list[0].v.num != 2
+	|| arglist.v.list[1].type != TYPE_STR)
+	return 0;
+
+    return lookup_addr_from_name_async(arglist.v.list[1].v.str, timeout,
+				       callback, data);
+}
+
 enum error
 proto_open_connection(Var arglist, int *read_fd, int *write_fd,
 		      const char **local_name, const char **remote_name)
@@ -212,7 +252,7 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
     static Timer_ID id;
     socklen_t length;
     int s, result;
-    int timeout = server_int_option("name_lookup_timeout", 5);
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
     static struct sockaddr_in addr;
     static Stream *st1 = 0, *st2 = 0;
 
@@ -264,7 +304,7 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
 	}
     }	 
     try {
-	id = set_timer(server_int_option("outbound_connect_timeout", 5),
+	id = set_timer(server_int_option_cached(SVO_OUTBOUND_CONNECT_TIMEOUT),
 		       timeout_proc, 0);
 	result = connect(s, (struct sockaddr *) &addr, sizeof(addr));
 	cancel_timer(id);
@@ -17,6 +17,7 @@
 
 #include "my-ctype.h"
 #include <errno.h>
+#include <sys/uio.h>
 #include "my-fcntl.h"
 #include "my-ioctl.h"
 #include "my-signal.h"
@@ -58,23 +59,41 @@ static int ewouldblock = -1;
 static int *pocket_descriptors = 0;	/* fds we keep around in case we need
 					 * one and no others are left... */
 
+/* Output is queued in blocks of (at least) TEXT_BLOCK_SIZE bytes, each
+ * holding as many complete lines as fit, and written out with one
+ * writev() per call to push_output().  Standard-sized blocks are
+ * recycled through a free list rather than returned to the allocator.
+ */
+#define TEXT_BLOCK_SIZE		4096
+#define TEXT_BLOCK_LINES	64
+#define TEXT_BLOCK_POOL_MAX	256
+#define MAX_OUTPUT_IOVECS	64
+
 typedef struct text_block {
     struct text_block *next;
-    int length;
+    int length;			/* bytes queued but not yet written */
+    int size;			/* capacity of `buffer' */
+    int lines;			/* lines queued in this block */
+    int lines_written;		/* ... of which have been fully written */
+    int line_ends[TEXT_BLOCK_LINES];	/* offsets into `buffer' */
     char *buffer;
-    char *start;
+    char *start;		/* first byte not yet written */
 } text_block;
 
+static text_block *free_text_blocks = 0;
+static int free_text_block_count = 0;
+
 typedef struct nhandle {
     struct nhandle *next, **prev;
     server_handle shandle;
     int rfd, wfd;
     char *name;
+    const char *local_name;
     Stream *input;
     int last_input_was_CR;
     int input_suspended;
     text_block *output_head;
-    text_block **output_tail;
+    text_block *output_tail;
     int output_length;
     int output_lines_flushed;
     int outbound, binary;
@@ -169,23 +188,58 @@ add_registered_fds(void)
 static void
 check_registered_fds(void)
 {
-    fd_reg *reg;
+    int i;
 
-    for (reg = reg_fds; reg < reg_fds + max_reg_fds; reg++)
-	if (reg->fd != -1) {
-	    if (reg->readable && mplex_is_readable(reg->fd))
-		(*reg->readable) (reg->fd, reg->data);
-	    if (reg->writable && mplex_is_writable(reg->fd))
-		(*reg->writable) (reg->fd, reg->data);
-	}
+    /* The callbacks may register new descriptors, moving the table, so
+     * it's indexed afresh each time.
+     */
+    for (i = 0; i < max_reg_fds; i++) {
+	int fd = reg_fds[i].fd;
+
+	if (fd != -1 && reg_fds[i].readable && mplex_is_readable(fd))
+	    (*reg_fds[i].readable) (fd, reg_fds[i].data);
+	if (reg_fds[i].fd == fd && fd != -1
+	    && reg_fds[i].writable && mplex_is_writable(fd))
+	    (*reg_fds[i].writable) (fd, reg_fds[i].data);
+    }
 }
 
 
+static text_block *
+new_text_block(int size)
+{
+    text_block *b;
+
+    if (size <= TEXT_BLOCK_SIZE && free_text_blocks) {
+	b = free_text_blocks;
+	free_text_blocks = b->next;
+	free_text_block_count--;
+    } else {
+	if (size < TEXT_BLOCK_SIZE)
+	    size = TEXT_BLOCK_SIZE;
+	b = (text_block *) mymalloc(sizeof(text_block) + size, M_NETWORK);
+	b->buffer = (char *) (b + 1);
+	b->size = size;
+    }
+    b->next = 0;
+    b->start = b->buffer;
+    b->length = 0;
+    b->lines = 0;
+    b->lines_written = 0;
+
+    return b;
+}
+
 static void
 free_text_block(text_block * b)
 {
-    myfree(b->buffer, M_NETWORK);
-    myfree(b, M_NETWORK);
+    if (b->size == TEXT_BLOCK_SIZE
+	&& free_text_block_count < TEXT_BLOCK_POOL_MAX) {
+	b->next = free_text_blocks;
+	free_text_blocks = b;
+	free_text_block_count++;
+    } else
+	myfree(b, M_NETWORK);
 }
 
 int
@@ -236,21 +290,38 @@ push_output(nhandle * h)
 	else
 	    return count >= 0 || errno == eagain || errno == ewouldblock;
     }
-    while ((b = h->output_head) != 0) {
-	count = write(h->wfd, b->start, b->length);
+    while (h->output_head) {
+	struct iovec iov[MAX_OUTPUT_IOVECS];
+	int n, total = 0;
+
+	for (b = h->output_head, n = 0;
+	     b && n < MAX_OUTPUT_IOVECS;
+	     b = b->next, n++) {
+	    iov[n].iov_base = b->start;
+	    iov[n].iov_len = b->length;
+	    total += b->length;
+	}
+	count = writev(h->wfd, iov, n);
 	if (count < 0)
 	    return (errno == eagain || errno == ewouldblock);
 	h->output_length -= count;
-	if (count == b->length) {
+	while ((b = h->output_head) && count >= b->length) {
+	    count -= b->length;
 	    h->output_head = b->next;
 	    free_text_block(b);
-	} else {
+	}
+	if (count > 0) {
 	    b->start += count;
 	    b->length -= count;
+	    while (b->lines_written < b->lines
+		   && b->line_ends[b->lines_written] <= b->start - b->buffer)
+		b->lines_written++;
 	}
+	if (h->output_head == 0)
+	    h->output_tail = 0;
+	if (count < total && h->output_head)
+	    break;		/* the connection can't take any more now */
     }
-    if (h->output_head == 0)
-	h->output_tail = &(h->output_head);
     return 1;
 }
 
@@ -258,8 +329,8 @@ static int
 pull_input(nhandle * h)
 {
     Stream *s = h->input;
-    int count;
-    char buffer[1024];
+    int count, run;
+    char buffer[16384];
     char *ptr, *end;
 
     if ((count = read(h->rfd, buffer, sizeof(buffer))) > 0) {
@@ -269,9 +340,18 @@ pull_input(nhandle * h)
 	    h->last_input_was_CR = 0;
 	} else {
 	    for (ptr = buffer, end = buffer + count; ptr < end; ptr++) {
-		unsigned char c = *ptr;
-
-		if (isgraph(c) || c == ' ' || c == '\t')
+		unsigned char c;
+
+		/* Copy runs of ordinary characters in bulk */
+		if ((run = printable_prefix_length(ptr, end - ptr, 1)) > 0) {
+		    stream_add_bytes(s, ptr, run);
+		    h->last_input_was_CR = 0;
+		    if ((ptr += run) >= end)
+			break;
+		}
+		c = *ptr;
+
+		if (c == '\t')
 		    stream_add_char(s, c);
 #ifdef INPUT_APPLY_BACKSPACE
 		else if (c == 0x08 || c == 0x7F)
@@ -317,7 +397,7 @@ new_nhandle(int rfd, int wfd, const char *local_name, const char *remote_name,
     h->last_input_was_CR = 0;
     h->input_suspended = 0;
     h->output_head = 0;
-    h->output_tail = &(h->output_head);
+    h->output_tail = 0;
     h->output_length = 0;
     h->output_lines_flushed = 0;
     h->outbound = outbound;
@@ -329,6 +409,7 @@ new_nhandle(int rfd, int wfd, const char *local_name, const char *remote_name,
     stream_printf(s, "%s %s %s",
 		  local_name, outbound ? "to" : "from", remote_name);
     h->name = str_dup(reset_stream(s));
+    h->local_name = str_dup(local_name);
 
     return h;
 }
@@ -351,6 +432,7 @@ close_nhandle(nhandle * h)
     free_stream(h->input);
     proto_close_connection(h->rfd, h->wfd);
     free_str(h->name);
+    free_str(h->local_name);
     myfree(h, M_NETWORK);
 }
 
@@ -446,25 +528,44 @@ enqueue_output(network_handle nh, const char *line, int line_length,
 	if (to_flush > 0 && !flush_ok)
 	    return 0;
 	while (to_flush > 0 && (b = h->output_head)) {
-	    h->output_length -= b->length;
-	    to_flush -= b->length;
+	    /* Discard the oldest line still queued (including whatever is
+	     * left of it if it has been partly written).
+	     */
+	    int dropped = b->buffer + b->line_ends[b->lines_written] - b->start;
+
+	    b->start += dropped;
+	    b->length -= dropped;
+	    b->lines_written++;
+	    h->output_length -= dropped;
+	    to_flush -= dropped;
 	    h->output_lines_flushed++;
-	    h->output_head = b->next;
-	    free_text_block(b);
+	    if (b->lines_written == b->lines) {
+		h->output_head = b->next;
+		free_text_block(b);
+	    }
 	}
 	if (h->output_head == 0)
-	    h->output_tail = &(h->output_head);
+	    h->output_tail = 0;
+    }
+    /* Lines are never split across blocks, so that lines can be
+     * discarded one at a time from the head block above.
+     */
+    block = h->output_tail;
+    if (!block || block->lines == TEXT_BLOCK_LINES
+	|| block->start + block->length + length > block->buffer + block->size) {
+	block = new_text_block(length);
+	if (h->output_tail)
+	    h->output_tail->next = block;
+	else
+	    h->output_head = block;
+	h->output_tail = block;
     }
-    buffer = (char *) mymalloc(length * sizeof(char), M_NETWORK);
-    block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+    buffer = block->start + block->length;
     memcpy(buffer, line, line_length);
     if (add_eol)
 	memcpy(buffer + line_length, proto.eol_out_string, eol_length);
-    block->buffer = block->start = buffer;
-    block->length = length;
-    block->next = 0;
-    *(h->output_tail) = block;
-    h->output_tail = &(block->next);
+    block->length += length;
+    block->line_ends[block->lines++] = buffer + length - block->buffer;
     h->output_length += length;
 
     return 1;
@@ -605,6 +706,25 @@ network_process_io(int timeout)
     }
 }
 
+void
+network_set_remote_name(int fd, const char *remote_name)
+{
+    nhandle *h;
+    static Stream *s = 0;
+
+    if (s == 0)
+	s = new_stream(100);
+
+    for (h = all_nhandles; h; h = h->next)
+	if (h->rfd == fd) {
+	    stream_printf(s, "%s %s %s", h->local_name,
+			  h->outbound ? "to" : "from", remote_name);
+	    free_str(h->name);
+	    h->name = str_dup(reset_stream(s));
+	    break;
+	}
+}
+
 const char *
 network_connection_name(network_handle nh)
 {
@@ -676,6 +796,14 @@ network_open_connection(Var arglist, server_listener sl)
 
     return e;
 }
+
+int
+network_resolve_connection(Var arglist,
+			   void (*callback) (void *data, const char *host_name),
+			   void *data)
+{
+    return proto_resolve_connection(arglist, callback, data);
+}
 #endif
 
 void
@@ -40,6 +40,13 @@ extern void network_unregister_fd(int fd);
 				 * forgotten.
 				 */
 
+extern void network_set_remote_name(int fd, const char *remote_name);
+				/* The connection whose read descriptor is FD,
+				 * if any, is renamed to show REMOTE_NAME as
+				 * its remote end, as when the host name of a
+				 * new connection becomes known.
+				 */
+
 extern int network_set_nonblocking(int fd);
 				/* Enable nonblocking I/O on the file
 				 * descriptor FD.  Return true iff successful.
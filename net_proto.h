@@ -140,6 +140,18 @@ extern enum error proto_open_connection(Var arglist,
 				 * an appropriate error should be returned.
 				 */
 
+extern int proto_resolve_connection(Var arglist,
+				    void (*callback) (void *data,
+						      const char *host_name),
+				    void *data);
+				/* If proto_open_connection() would have to
+				 * wait for a host name in the given MOO
+				 * arguments to be looked up, start the lookup
+				 * in the background and return true; CALLBACK
+				 * is called with DATA once it has finished.
+				 * Otherwise, return false.
+				 */
+
 #endif				/* OUTBOUND_NETWORK */
 
 extern void proto_close_connection(int read_fd, int write_fd);
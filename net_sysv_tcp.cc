@@ -50,9 +50,11 @@
 #include "config.h"
 #include "log.h"
 #include "name_lookup.h"
+#include "net_multi.h"
 #include "net_proto.h"
 #include "options.h"
 #include "server.h"
+#include "storage.h"
 #include "streams.h"
 #include "structures.h"
 #include "timers.h"
@@ -180,11 +182,48 @@ set_rw_able(int fd)
 	return 1;
 }
 
+/* The remote port of each connection, by descriptor, for renaming it
+ * once its host name is known; unlike a socket, a TLI endpoint can't
+ * simply be asked for its peer's address.
+ */
+static unsigned short *remote_ports = 0;
+static int max_remote_ports = 0;
+
+static void
+remote_name_found(void *data, const char *host_name)
+{
+    int fd = (int) (intptr_t) data;
+    static Stream *s = 0;
+
+    if (!s)
+	s = new_stream(100);
+
+    stream_printf(s, "%s, port %d", host_name, (int) remote_ports[fd]);
+    network_set_remote_name(fd, reset_stream(s));
+}
+
+static void
+note_remote_port(int fd, unsigned short port)
+{
+    if (fd >= max_remote_ports) {
+	int n = fd + 1 > 2 * max_remote_ports ? fd + 1 : 2 * max_remote_ports;
+
+	if (remote_ports)
+	    remote_ports = (unsigned short *)
+		myrealloc(remote_ports, n * sizeof(unsigned short), M_ARRAY);
+	else
+	    remote_ports = (unsigned short *)
+		mymalloc(n * sizeof(unsigned short), M_ARRAY);
+	max_remote_ports = n;
+    }
+    remote_ports[fd] = port;
+}
+
 enum proto_accept_error
 proto_accept_connection(int listener_fd, int *read_fd, int *write_fd,
 			const char **name)
 {
-    int timeout = server_int_option("name_lookup_timeout", 5);
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
     int fd;
     struct sockaddr_in *addr = (struct sockaddr_in *) call->addr.buf;
     static Stream *s = 0;
@@ -221,8 +260,14 @@ proto_accept_connection(int listener_fd, int *read_fd, int *write_fd,
 	return PA_OTHER;
     }
     *read_fd = *write_fd = fd;
+    note_remote_port(fd, ntohs(addr->sin_port));
+    /* Don't hold up the server waiting for the host name; the connection
+     * is renamed by remote_name_found() if it turns up later.
+     */
     stream_printf(s, "%s, port %d",
-		  lookup_name_from_addr(addr, timeout),
+		  lookup_name_from_addr_async(addr, timeout,
+					      remote_name_found,
+					      (void *) (intptr_t) fd),
 		  (int) ntohs(addr->sin_port));
     *name = reset_stream(s);
     return PA_OKAY;
@@ -232,6 +277,7 @@ void
 proto_close_connection(int read_fd, int write_fd)
 {
     /* read_fd and write_fd are the same, so we only need to deal with one. */
+    cancel_name_lookups(remote_name_found, (void *) (intptr_t) read_fd);
     t_close(read_fd);
 }
 
@@ -263,6 +309,22 @@ timeout_proc(Timer_ID id, Timer_Data data)
     throw timeout_exception();
 }
 
+int
+proto_resolve_connection(Var arglist,
+			 void (*callback) (void *data, const char *host_name),
+			 void *data)
+{
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
+
+    if (!outbound_network_enabled
+	|| arglist.v.list[0].v.num != 2
+	|| arglist.v.list[1].type != TYPE_STR)
+	return 0;
+
+    return lookup_addr_from_name_async(arglist.v.list[1].v.str, timeout,
+				       callback, data);
+}
+
 enum error
 proto_open_connection(Var arglist, int *read_fd, int *write_fd,
 		      const char **local_name, const char **remote_name)
@@ -277,7 +339,7 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
     static int port;
     static Timer_ID id;
     int fd, result;
-    int timeout = server_int_option("name_lookup_timeout", 5);
+    int timeout = server_int_option_cached(SVO_NAME_LOOKUP_TIMEOUT);
     static struct sockaddr_in addr;
     static Stream *st1 = 0, *st2 = 0;
 
@@ -339,7 +401,7 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
     call->addr.buf = (void *) &addr;
 
     try {
-	id = set_timer(server_int_option("outbound_connect_timeout", 5),
+	id = set_timer(server_int_option_cached(SVO_OUTBOUND_CONNECT_TIMEOUT),
 		       timeout_proc, 0);
 	result = t_connect(fd, call, 0);
 	cancel_timer(id);
@@ -209,6 +209,19 @@ extern enum error network_open_connection(Var arglist, server_listener sl);
 				 * defined.
 				 */
 
+extern int network_resolve_connection(Var arglist,
+				      void (*callback) (void *data,
+							const char *host_name),
+				      void *data);
+				/* If network_open_connection() would have to
+				 * wait for a host name in the given MOO
+				 * arguments to be looked up, start the lookup
+				 * in the background and return true; once it
+				 * has finished, CALLBACK is called with DATA
+				 * and network_open_connection() can proceed
+				 * without waiting.  Otherwise, return false.
+				 */
+
 #endif
 
 extern void network_close(network_handle nh);
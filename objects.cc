@@ -381,16 +381,12 @@ bf_create(Var arglist, Byte next, void *vdata, Objid progr)
 
 	    db_set_object_owner(oid, !valid(owner) ? oid : owner);
 
-	    if (!db_change_parents(Var::new_obj(oid), arglist.v.list[1], none)) {
-		db_destroy_object(oid);
-		db_set_last_used_objid(last);
-		free_var(arglist);
-		return make_error_pack(E_INVARG);
-	    }
-
 	    /*
 	     * If anonymous, clean up the object used to create the
-	     * anonymous object; `oid' is invalid after that.
+	     * anonymous object; `oid' is invalid after that.  This is
+	     * done before its parents are set, so that it never joins
+	     * their children and can share its clear property values
+	     * with its siblings.
 	     */
 	    if (anonymous) {
 		r.type = TYPE_ANON;
@@ -400,6 +396,18 @@ bf_create(Var arglist, Byte next, void *vdata, Objid progr)
 		r.v.obj = oid;
 	    }
 
+	    if (!db_change_parents(r, arglist.v.list[1], none)) {
+		if (anonymous) {
+		    db_set_object_flag2(r, FLAG_INVALID);
+		    free_var(r);
+		} else {
+		    db_destroy_object(oid);
+		    db_set_last_used_objid(last);
+		}
+		free_var(arglist);
+		return make_error_pack(E_INVARG);
+	    }
+
 	    data = (Var *)alloc_data(sizeof(Var));
 	    *data = var_ref(r);
 
@@ -779,6 +787,7 @@ bf_recycle(Var arglist, Byte func_pc, void *vdata, Objid progr)
 	    incr_quota(db_object_owner(oid));
 
 	    db_destroy_object(oid);
+	    player_invalidated(oid);
 
 	    free_var(obj);
 	    free_var(*data);
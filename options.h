@@ -46,6 +46,15 @@
 
 /* #define LOG_GC_STATS */
 
+/******************************************************************************
+ * Anonymous objects that have lost their last reference are recycled (and
+ * their `recycle' verbs called) by the main loop, ANON_RECYCLE_BATCH of them
+ * at a time, so that a task dropping a great many of them doesn't hold up
+ * network I/O and other tasks until they're all gone.
+ */
+
+#define ANON_RECYCLE_BATCH 1000
+
 /******************************************************************************
  * The server normally forks a separate process to make database checkpoints;
  * the original process continues to service user commands as usual while the
@@ -60,6 +69,77 @@
 
 /* #define UNFORKED_CHECKPOINTS */
 
+/******************************************************************************
+ * A forked checkpointer shares the server's memory copy-on-write, but the
+ * server keeps touching reference counts all over its heap while the dump is
+ * being written, so a large database can end up needing most of its memory
+ * twice.  Define SNAPSHOT_CHECKPOINTS to have the server write checkpoints
+ * itself instead: the database is snapshotted when the checkpoint starts,
+ * objects are copied only if they are changed before they have been written,
+ * and the file is written for up to SNAPSHOT_SLICE_USECS microseconds at a
+ * time between tasks.  Databases holding anonymous objects are still
+ * checkpointed by forking.
+ */
+
+/* #define SNAPSHOT_CHECKPOINTS */
+#define SNAPSHOT_SLICE_USECS	20000
+
+/******************************************************************************
+ * Checkpoints and shutdown dumps split the objects and the verb programs into
+ * up to DB_DUMP_SHARDS ranges, each written by a separate forked process into
+ * a file of its own, and then copied into the DB file in order.  Set it to
+ * about the number of CPUs you can spare while a checkpoint is running.  A
+ * range is only given its own process if it holds at least
+ * DB_DUMP_SHARD_OBJECTS objects.  Undefine DB_DUMP_SHARDS to always write in
+ * one process; it is not used with UNFORKED_CHECKPOINTS.
+ */
+
+#define DB_DUMP_SHARDS		4
+#define DB_DUMP_SHARD_OBJECTS	5000
+
+/******************************************************************************
+ * Text DB files are very repetitive and compress well.  Define
+ * COMPRESS_CHECKPOINTS to have checkpoints written compressed with LZ4 (by a
+ * small forked process, at the cost of some CPU time), and
+ * COMPRESS_SHUTDOWN_DUMPS to do the same for the dump written when the server
+ * shuts down.  Binary dumps, snapshot checkpoints and panic dumps are never
+ * compressed.  Compressed DB files are recognized and read whatever these are
+ * set to.
+ */
+
+/* #define COMPRESS_CHECKPOINTS */
+/* #define COMPRESS_SHUTDOWN_DUMPS */
+
+/******************************************************************************
+ * Between checkpoints the server can keep a journal of changed objects in a
+ * file named after the output database with `.journal' appended.  Changes are
+ * appended (and synced to disk) at most once every DB_JOURNAL_INTERVAL
+ * seconds; if the server crashes, the next start replays the journal on top
+ * of the database it was started from, so at most that much work is lost.
+ * The journal is compacted whenever a checkpoint completes and removed after
+ * a clean shutdown.  Changes to anonymous objects are not journaled; once
+ * one reaches the database the journal stops (with a note in the log) until
+ * the next checkpoint, so the journal is of little use to a database that
+ * makes much use of anonymous objects.  Define DB_JOURNAL_INTERVAL to enable
+ * the journal.
+ */
+
+/* #define DB_JOURNAL_INTERVAL	1 */
+
+/******************************************************************************
+ * Most of the time spent loading a database goes into parsing and compiling
+ * verb programs, the great majority of which will not be called for a long
+ * time, if ever.  Define DEFER_VERB_COMPILATION to have the server keep the
+ * source text of each verb read from the database and compile it only when it
+ * is first needed; checkpoints write uncompiled programs back out unchanged.
+ * A program that fails to parse is then reported when it is first needed,
+ * rather than stopping the load; calls to it raise E_INVARG, and its source is
+ * kept and written back out unchanged.  Databases written by an older server
+ * version are always compiled as they are read.
+ */
+
+#define DEFER_VERB_COMPILATION
+
 /******************************************************************************
  * If OUT_OF_BAND_PREFIX is defined as a non-empty string, then any lines of
  * input from any player that begin with that prefix will bypass both normal
@@ -224,6 +304,47 @@
 #define MAX_QUEUED_INPUT	MAX_QUEUED_OUTPUT
 #define DEFAULT_CONNECT_TIMEOUT	300
 
+/******************************************************************************
+ * If NETWORK_PROTOCOL is NP_TCP, host names are looked up by a separate
+ * process so that a slow name server never stalls the whole server: new
+ * connections are named by their numeric address until the lookup answers,
+ * and a task calling open_network_connection() with a host name is suspended
+ * until the address is known.  Answers are remembered for a while so that
+ * repeated connections to or from the same host don't go back to the name
+ * server each time.
+ *
+ * NAME_LOOKUP_CACHE_SIZE is the number of names and addresses remembered.
+ * NAME_LOOKUP_CACHE_TTL is the number of seconds for which a successful
+ *			 lookup is remembered.
+ * NAME_LOOKUP_FAILURE_TTL is the number of seconds for which a failed
+ *			   lookup is remembered.
+ */
+
+#define NAME_LOOKUP_CACHE_SIZE	1024
+#define NAME_LOOKUP_CACHE_TTL	300
+#define NAME_LOOKUP_FAILURE_TTL	30
+
+/******************************************************************************
+ * Each pass through the server's main loop runs ready tasks until one of
+ * the following budgets is exhausted (or there are no more ready tasks).
+ * Tasks are taken round-robin from the active task queues, and pending
+ * network input/output is serviced between tasks.
+ *
+ * DEFAULT_TASKS_PER_PASS is the default maximum number of tasks run per
+ *			  pass; this can be overridden by defining the
+ *			  `tasks_per_pass' property on $server_options.
+ * DEFAULT_TASK_PASS_USECS is the default maximum number of microseconds
+ *			   spent running tasks per pass; this can be
+ *			   overridden by defining the `task_pass_usecs'
+ *			   property on $server_options.
+ *
+ * Setting `tasks_per_pass' to 1 restores the old behavior of running a
+ * single task per pass.
+ */
+
+#define DEFAULT_TASKS_PER_PASS	64
+#define DEFAULT_TASK_PASS_USECS	50000
+
 /******************************************************************************
  * On connections that have not been set to binary mode, the server normally
  * discards incoming characters that are not printable ASCII, including
@@ -235,9 +356,10 @@
 
 /******************************************************************************
  * The server maintains a cache of the most recently used patterns from calls
- * to the match() and rmatch() built-in functions.  PATTERN_CACHE_SIZE controls
- * how many past patterns are remembered by the server.  Do not set it to a
- * number less than 1.
+ * to the match() and rmatch() built-in functions, and another of the most
+ * recently used replacements from calls to strsubs().  PATTERN_CACHE_SIZE
+ * controls how many of each are remembered by the server.  Do not set it to
+ * a number less than 1.
  */
 
 #define PATTERN_CACHE_SIZE	20
@@ -315,6 +437,21 @@
 
 #define MEMO_VALUE_BYTES /* */
 
+/******************************************************************************
+ * Define REFCOUNT_SIDE_TABLE to keep the reference counts (and cycle
+ * collector state) of strings, lists, maps and anonymous objects in a dense
+ * table of their own, rather than in the word in front of each value.  The
+ * word in front of the value then holds only an index into the table, which
+ * is written once when the value is allocated.  Copying a value from the
+ * database into a variable no longer writes to the page holding the value, so
+ * far fewer pages have to be copied while a forked checkpoint is being
+ * written.  The cost is one extra memory reference per reference count
+ * operation.
+ ******************************************************************************
+ */
+
+/* #define REFCOUNT_SIDE_TABLE */
+
 /******************************************************************************
  * DEFAULT_MAX_STRING_CONCAT,      if set to a postive value, is the length
  *                                 of the largest constructible string.
@@ -367,12 +504,19 @@
 /******************************************************************************
  * Configurable options for the Exec subsystem.  EXEC_SUBDIR is the
  * directory inside the working directory in which all executable
- * files must reside.
+ * files must reside.  Executables run by worker_call() are kept
+ * running in pools, one per distinct command line; EXEC_MAX_POOLS
+ * limits the number of pools, and EXEC_POOL_WORKERS is the default
+ * (and EXEC_MAX_POOL_WORKERS the largest allowed) number of worker
+ * processes in each.
  ******************************************************************************
  */
 
 #define EXEC_SUBDIR "executables/"
 #define EXEC_MAX_PROCESSES 256
+#define EXEC_MAX_POOLS 16
+#define EXEC_POOL_WORKERS 4
+#define EXEC_MAX_POOL_WORKERS 32
 
 /******************************************************************************
  * Configurable options for the FileIO subsystem.  FILE_SUBDIR is the
@@ -385,6 +529,53 @@
 #define FILE_IO_BUFFER_LENGTH 4096
 #define FILE_IO_MAX_FILES     256
 
+/******************************************************************************
+ * Some CPU-heavy built-in functions (bcrypt `crypt()', the hash and
+ * HMAC functions, and `encode_base64()') can do their work on a pool
+ * of BACKGROUND_THREADS server threads, suspending the calling task
+ * until the result is ready, so that other tasks keep running in the
+ * meantime.  Hashing and encoding move to the background only when
+ * the input is at least BACKGROUND_MIN_BYTES long; smaller inputs are
+ * cheaper to handle inline, as is everything done by a server task
+ * whose result the server needs at once, like $do_login_command().
+ * Set BACKGROUND_THREADS to 0 to do all such work in the calling
+ * task, as older servers did.  Time spent in background threads is
+ * not charged to the calling task, but since task seconds are
+ * measured in process CPU time it can count against whichever task
+ * happens to be running at the same time.
+ ******************************************************************************
+ */
+
+#define BACKGROUND_THREADS   2
+#define BACKGROUND_MIN_BYTES 65536
+
+/******************************************************************************
+ * `sort()' splits lists of at least PARALLEL_SORT_MIN elements into
+ * PARALLEL_SORT_THREADS runs, sorts them on that many threads at once,
+ * and merges the runs back together; the calling task still waits for
+ * the result.  Set PARALLEL_SORT_THREADS to 1 to sort every list on the
+ * main thread.
+ ******************************************************************************
+ */
+
+#define PARALLEL_SORT_THREADS 4
+#define PARALLEL_SORT_MIN     100000
+
+/******************************************************************************
+ * Membership tests (`in', is_member(), setadd() and the like) against a
+ * list of at least MEMBER_INDEX_MIN elements build a hash index of the
+ * list the second time that same list is searched, and the indexes of
+ * the last MEMBER_INDEX_CACHE lists searched are kept for later tests.
+ * The server holds a reference to each indexed list, so the list is
+ * copied rather than changed in place while its index is kept.  Only
+ * lists of integers, objects, strings, errors and floats are indexed.
+ * Set MEMBER_INDEX_CACHE to 0 to always search lists from the start.
+ ******************************************************************************
+ */
+
+#define MEMBER_INDEX_MIN   64
+#define MEMBER_INDEX_CACHE 16
+
 /******************************************************************************
  * Minimum number of bytes of entropy (random data) to use to seed the
  * built-in pseudo-random number generator.  The server will read at
@@ -438,6 +629,18 @@
 #  error Illegal match() pattern cache size!
 #endif
 
+#if PARALLEL_SORT_THREADS < 1
+#  error Illegal number of sort() threads!
+#endif
+
+#if defined(SNAPSHOT_CHECKPOINTS) && defined(UNFORKED_CHECKPOINTS)
+#  error You cannot define both "SNAPSHOT_CHECKPOINTS" and "UNFORKED_CHECKPOINTS"
+#endif
+
+#if defined(DB_DUMP_SHARDS) && defined(UNFORKED_CHECKPOINTS)
+#  undef DB_DUMP_SHARDS
+#endif
+
 #define NP_SINGLE	1
 #define NP_TCP		2
 #define NP_LOCAL	3
@@ -54,6 +54,27 @@ null_program(void)
     return p;
 }
 
+/* Stands in for a verb whose code, as read from the DB, could not be
+ * parsed (see dbpriv_compile_verb() in db_verbs.c).
+ */
+Program *
+unparsable_program(void)
+{
+    static Program *p = 0;
+    Var code, errors;
+
+    if (!p) {
+	code = new_list(1);
+	code.v.list[1] = str_dup_to_var("raise(E_INVARG, \"Verb code could not be parsed\");");
+	p = parse_list_as_program(code, &errors);
+	if (!p)
+	    panic("Can't create the unparsable program!");
+	free_var(code);
+	free_var(errors);
+    }
+    return p;
+}
+
 Program *
 program_ref(Program * p)
 {
@@ -56,6 +56,7 @@ typedef struct {
 
 extern Program *new_program(void);
 extern Program *null_program(void);
+extern Program *unparsable_program(void);
 extern Program *program_ref(Program *);
 extern int program_bytes(Program *);
 extern void free_program(Program *);
@@ -92,10 +92,26 @@ typedef struct shandle {
     int disconnect_me;
     int outbound, binary;
     int print_messages;
+    time_t timeout_at;		/* when to next check for login timeout */
+    int timeout_index;		/* position in timeout_heap, or -1 */
+    struct shandle *dirty_next, **dirty_prev;
 } shandle;
 
 static shandle *all_shandles = 0;
 
+/* Un-logged-in inbound connections, kept in a binary heap ordered by
+ * `timeout_at', so that `main_loop()' only looks at the connections
+ * that might actually have timed out.
+ */
+static shandle **timeout_heap = 0;
+static int timeout_heap_size = 0;
+static int timeout_heap_max = 0;
+
+/* Connections that have been booted or whose player has been
+ * recycled, waiting for `main_loop()' to close them.
+ */
+static shandle *dirty_shandles = 0;
+
 typedef struct slistener {
     struct slistener *next, **prev;
     network_listener nlistener;
@@ -103,6 +119,7 @@ typedef struct slistener {
     Var desc;
     int print_messages;
     const char *name;
+    int connect_timeout;	/* cached; see `watch_server_options()' */
 } slistener;
 
 static slistener *all_slisteners = 0;
@@ -122,6 +139,100 @@ static unsigned int pending_count = 0;
 /* used once when the server loads the database */
 static Var pending_list = new_list(0);
 
+static void
+timeout_heap_place(shandle * h, int i)
+{
+    timeout_heap[i] = h;
+    h->timeout_index = i;
+}
+
+static void
+timeout_heap_sift(int i)
+{
+    shandle *h = timeout_heap[i];
+
+    while (i > 0 && timeout_heap[(i - 1) / 2]->timeout_at > h->timeout_at) {
+	timeout_heap_place(timeout_heap[(i - 1) / 2], i);
+	i = (i - 1) / 2;
+    }
+    for (;;) {
+	int child = 2 * i + 1;
+
+	if (child >= timeout_heap_size)
+	    break;
+	if (child + 1 < timeout_heap_size
+	    && timeout_heap[child + 1]->timeout_at
+	    < timeout_heap[child]->timeout_at)
+	    child++;
+	if (timeout_heap[child]->timeout_at >= h->timeout_at)
+	    break;
+	timeout_heap_place(timeout_heap[child], i);
+	i = child;
+    }
+    timeout_heap_place(h, i);
+}
+
+static void
+schedule_timeout(shandle * h, time_t when)
+{
+    h->timeout_at = when;
+    if (h->timeout_index < 0) {
+	if (timeout_heap_size == timeout_heap_max) {
+	    int new_max = timeout_heap_max ? 2 * timeout_heap_max : 16;
+	    shandle **new_heap =
+		(shandle **)mymalloc(new_max * sizeof(shandle *), M_NETWORK);
+
+	    if (timeout_heap) {
+		memcpy(new_heap, timeout_heap,
+		       timeout_heap_size * sizeof(shandle *));
+		myfree(timeout_heap, M_NETWORK);
+	    }
+	    timeout_heap = new_heap;
+	    timeout_heap_max = new_max;
+	}
+	timeout_heap_place(h, timeout_heap_size++);
+    }
+    timeout_heap_sift(h->timeout_index);
+}
+
+static void
+unschedule_timeout(shandle * h)
+{
+    int i = h->timeout_index;
+
+    if (i < 0)
+	return;
+    h->timeout_index = -1;
+    if (i != --timeout_heap_size) {
+	timeout_heap_place(timeout_heap[timeout_heap_size], i);
+	timeout_heap_sift(i);
+    }
+}
+
+static void
+mark_dirty(shandle * h)
+{
+    if (h->dirty_prev)
+	return;
+    h->dirty_next = dirty_shandles;
+    h->dirty_prev = &dirty_shandles;
+    if (dirty_shandles)
+	dirty_shandles->dirty_prev = &(h->dirty_next);
+    dirty_shandles = h;
+}
+
+static void
+unmark_dirty(shandle * h)
+{
+    if (!h->dirty_prev)
+	return;
+    *(h->dirty_prev) = h->dirty_next;
+    if (h->dirty_next)
+	h->dirty_next->dirty_prev = h->dirty_prev;
+    h->dirty_next = 0;
+    h->dirty_prev = 0;
+}
+
 static void
 free_shandle(shandle * h)
 {
@@ -129,11 +240,66 @@ free_shandle(shandle * h)
     if (h->next)
 	h->next->prev = h->prev;
 
+    unschedule_timeout(h);
+    unmark_dirty(h);
+
     free_task_queue(h->tasks);
 
     myfree(h, M_NETWORK);
 }
 
+/* Returns the number of seconds an un-logged-in connection on
+ * LISTENER may stay idle, or 0 if there is no limit.
+ */
+static int
+listener_connect_timeout(Objid listener)
+{
+    Var v;
+
+    if (get_server_option(listener, "connect_timeout", &v))
+	return v.type == TYPE_INT && v.v.num > 0 ? v.v.num : 0;
+    else
+	return DEFAULT_CONNECT_TIMEOUT;
+}
+
+static int
+connect_timeout(shandle * h)
+{
+    slistener *l;
+
+    for (l = all_slisteners; l; l = l->next)
+	if (l->oid == h->listener)
+	    return l->connect_timeout;
+
+    return listener_connect_timeout(h->listener);
+}
+
+static void
+watch_server_options_of(Objid oid)
+{
+    Var v;
+
+    db_watch_property(oid, "server_options");
+    if (valid(oid)
+	&& db_find_property(Var::new_obj(oid), "server_options", &v).ptr
+	&& v.type == TYPE_OBJ)
+	db_watch_properties(v.v.obj);
+}
+
+void
+watch_server_options(void)
+{
+    slistener *l;
+
+    db_clear_property_watches();
+    watch_server_options_of(SYSTEM_OBJECT);
+
+    for (l = all_slisteners; l; l = l->next) {
+	watch_server_options_of(l->oid);
+	l->connect_timeout = listener_connect_timeout(l->oid);
+    }
+}
+
 static slistener *
 new_slistener(Objid oid, Var desc, int print_messages, enum error *ee)
 {
@@ -155,6 +321,8 @@ new_slistener(Objid oid, Var desc, int print_messages, enum error *ee)
     l->oid = oid;
     l->print_messages = print_messages;
     l->name = str_dup(name);
+    l->connect_timeout = listener_connect_timeout(oid);
+    watch_server_options_of(oid);
 
     l->next = all_slisteners;
     l->prev = &all_slisteners;
@@ -278,6 +446,12 @@ fork_server(const char *subtask_name)
     }
 }
 
+void
+server_checkpoint_finished(int success)
+{
+    checkpoint_finished = success + 1;
+}
+
 static void
 panic_signal(int sig)
 {
@@ -475,6 +649,7 @@ send_message(Objid listener, network_handle nh, const char *msg_name,...)
  * garbage collector from recycling if the object makes its way onto
  * the list of roots.  After they are recycled, they are freed.
  */
+#ifdef LOG_GC_STATS
 static int
 queue_includes(Var v)
 {
@@ -488,6 +663,7 @@ queue_includes(Var v)
 
     return 0;
 }
+#endif
 
 void
 queue_anonymous_object(Var v)
@@ -495,7 +671,10 @@ queue_anonymous_object(Var v)
     assert(TYPE_ANON == v.type);
     assert(!db_object_has_flag2(v, FLAG_RECYCLED));
     assert(!db_object_has_flag2(v, FLAG_INVALID));
+#ifdef LOG_GC_STATS
+    /* The queue can get long, so only when debugging the collector. */
     assert(!queue_includes(v));
+#endif
 
     if (!pending_free) {
 	pending_free = (struct pending_recycle *)mymalloc(sizeof(struct pending_recycle), M_STRUCT);
@@ -506,24 +685,39 @@ queue_anonymous_object(Var v)
     pending_free = next->next;
 
     next->v = var_ref(v);
-    next->next = pending_head;
-    pending_head = next;
+    next->next = NULL;
 
-    if (!pending_tail)
-	pending_tail = next;
+    if (pending_tail)
+	pending_tail->next = next;
+    else
+	pending_head = next;
+    pending_tail = next;
 
     pending_count++;
 }
 
-static void
+/* Recycles the next batch of pending objects, returning true if there
+ * are more.
+ */
+static int
 recycle_anonymous_objects(void)
 {
     if (!pending_head)
-	return;
+	return 0;
+
+    struct pending_recycle *next, *head = pending_head, *last = head;
+    int n;
 
-    struct pending_recycle *next, *head = pending_head;
-    pending_head = pending_tail = NULL;
-    pending_count = 0;
+    /* Batches are taken from the head and objects queued while these
+     * are recycled go at the tail, so the oldest are recycled first.
+     */
+    for (n = 1; n < ANON_RECYCLE_BATCH && last->next; n++)
+	last = last->next;
+    pending_head = last->next;
+    last->next = NULL;
+    if (!pending_head)
+	pending_tail = NULL;
+    pending_count -= n;
 
     while (head) {
 	Var v = head->v;
@@ -556,6 +750,8 @@ recycle_anonymous_objects(void)
 
 	free_var(v);
     }
+
+    return pending_head != NULL;
 }
 
 /* When the server checkpoints, all of the objects pending recycling
@@ -648,7 +844,9 @@ main_loop(void)
 	 */
 	int task_seconds = next_task_start();
 	int seconds_left = task_seconds < 0 ? 2 : task_seconds;
-	shandle *h, *nexth;
+	shandle *h;
+
+	refresh_server_options();
 
 #ifdef ENABLE_GC
 	if (gc_run_called || gc_roots_count > GC_ROOTS_LIMIT
@@ -673,14 +871,17 @@ main_loop(void)
 	}
 #ifndef UNFORKED_CHECKPOINTS
 	if (checkpoint_finished) {
+	    db_checkpoint_finished(checkpoint_finished - 1);
 	    call_checkpoint_notifier(checkpoint_finished - 1);
 	    checkpoint_finished = 0;
 	}
 #endif
 
-	recycle_anonymous_objects();
+	if (recycle_anonymous_objects())
+	    seconds_left = 0;	/* come back for the rest */
 
-	if (!network_process_io(seconds_left ? 1 : 0) && seconds_left > 1)
+	if (!network_process_io(seconds_left && !db_flush_pending() ? 1 : 0)
+	    && seconds_left > 1)
 	    db_flush(FLUSH_ONE_SECOND);
 	else
 	    db_flush(FLUSH_IF_FULL);
@@ -690,20 +891,22 @@ main_loop(void)
 	/* If a exec'd child process exited, deal with it here */
 	deal_with_child_exit();
 
-	{			/* Get rid of old un-logged-in or useless connections */
-	    int now = time(0);
+	{			/* Get rid of old un-logged-in connections */
+	    time_t now = time(0);
 
-	    for (h = all_shandles; h; h = nexth) {
-		Var v;
+	    while (timeout_heap_size > 0
+		   && timeout_heap[0]->timeout_at <= now) {
+		int timeout;
 
-		nexth = h->next;
+		h = timeout_heap[0];
 
-		if (!h->outbound && h->connection_time == 0
-		    && (get_server_option(h->listener, "connect_timeout", &v)
-			? (v.type == TYPE_INT && v.v.num > 0
-			   && now - h->last_activity_time > v.v.num)
-			: (now - h->last_activity_time
-			   > DEFAULT_CONNECT_TIMEOUT))) {
+		if (h->connection_time != 0) {
+		    unschedule_timeout(h);
+		    continue;
+		}
+
+		timeout = connect_timeout(h);
+		if (timeout > 0 && now - h->last_activity_time > timeout) {
 		    call_notifier(h->player, h->listener, "user_disconnected");
 		    oklog("TIMEOUT: #%d on %s\n",
 			  h->player,
@@ -714,27 +917,40 @@ main_loop(void)
 				     0);
 		    network_close(h->nhandle);
 		    free_shandle(h);
-		} else if (h->connection_time != 0 && !valid(h->player)) {
-		    oklog("RECYCLED: #%d on %s\n",
-			  h->player,
-			  network_connection_name(h->nhandle));
-		    if (h->print_messages)
-			send_message(h->listener, h->nhandle,
-				     "recycle_msg", "*** Recycled ***", 0);
-		    network_close(h->nhandle);
-		    free_shandle(h);
-		} else if (h->disconnect_me) {
-		    call_notifier(h->player, h->listener,
-				  "user_disconnected");
-		    oklog("DISCONNECTED: %s on %s\n",
-			  object_name(h->player),
-			  network_connection_name(h->nhandle));
-		    if (h->print_messages)
-			send_message(h->listener, h->nhandle, "boot_msg",
-				     "*** Disconnected ***", 0);
-		    network_close(h->nhandle);
-		    free_shandle(h);
-		}
+		} else if (timeout > 0)
+		    schedule_timeout(h, h->last_activity_time + timeout + 1);
+		else
+		    /* No timeout right now, but check again later in
+		     * case one is configured.
+		     */
+		    schedule_timeout(h, now + DEFAULT_CONNECT_TIMEOUT);
+	    }
+	}
+
+	/* Get rid of booted connections and those of recycled players */
+	while ((h = dirty_shandles) != 0) {
+	    unmark_dirty(h);
+
+	    if (h->connection_time != 0 && !valid(h->player)) {
+		oklog("RECYCLED: #%d on %s\n",
+		      h->player,
+		      network_connection_name(h->nhandle));
+		if (h->print_messages)
+		    send_message(h->listener, h->nhandle,
+				 "recycle_msg", "*** Recycled ***", 0);
+		network_close(h->nhandle);
+		free_shandle(h);
+	    } else if (h->disconnect_me) {
+		call_notifier(h->player, h->listener,
+			      "user_disconnected");
+		oklog("DISCONNECTED: %s on %s\n",
+		      object_name(h->player),
+		      network_connection_name(h->nhandle));
+		if (h->print_messages)
+		    send_message(h->listener, h->nhandle, "boot_msg",
+				 "*** Disconnected ***", 0);
+		network_close(h->nhandle);
+		free_shandle(h);
 	    }
 	}
     }
@@ -1296,6 +1512,12 @@ server_new_connection(server_listener sl, network_handle nh, int outbound)
     h->outbound = outbound;
     h->binary = 0;
     h->print_messages = l ? l->print_messages : !outbound;
+    h->timeout_index = -1;
+    h->dirty_next = 0;
+    h->dirty_prev = 0;
+
+    if (!outbound)
+	schedule_timeout(h, h->last_activity_time);
 
     if (l || !outbound) {
 	new_input_task(h->tasks, "", 0);
@@ -1488,8 +1710,19 @@ boot_player(Objid player)
 {
     shandle *h = find_shandle(player);
 
-    if (h)
+    if (h) {
 	h->disconnect_me = 1;
+	mark_dirty(h);
+    }
+}
+
+void
+player_invalidated(Objid player)
+{
+    shandle *h = find_shandle(player);
+
+    if (h)
+	mark_dirty(h);
 }
 
 void
@@ -1575,6 +1808,12 @@ main(int argc, char **argv)
 	case 'e':		/* Emergency wizard mode */
 	    emergency = 1;
 	    break;
+	case 'b':		/* Dump the database in binary format */
+	    db_set_dump_format(1);
+	    break;
+	case 't':		/* Dump the database in text format */
+	    db_set_dump_format(0);
+	    break;
 	case 'l':		/* Specified log file */
 	    if (argc > 1) {
 		log_file = argv[1];
@@ -1633,10 +1872,12 @@ main(int argc, char **argv)
     if ((emergency && (script_file || script_line))
 	|| !db_initialize(&argc, &argv)
 	|| !network_initialize(argc, argv, &desc)) {
-	fprintf(stderr, "Usage: %s [-e] [-f script-file] [-c script-line] [-l log-file] %s %s\n",
+	fprintf(stderr, "Usage: %s [-e] [-b | -t] [-f script-file] [-c script-line] [-l log-file] %s %s\n",
 		this_program, db_usage_string(), network_usage_string());
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "\t-e\t\temergency wizard mode\n");
+	fprintf(stderr, "\t-b\t\twrite database dumps in binary format\n");
+	fprintf(stderr, "\t-t\t\twrite database dumps in text format\n");
 	fprintf(stderr, "\t-f\t\tfile to load and pass to `#0:do_start_script()'\n");
 	fprintf(stderr, "\t-c\t\tline to pass to `#0:do_start_script()'\n");
 	fprintf(stderr, "\t-l\t\toptional log file\n\n");
@@ -1749,6 +1990,7 @@ bf_renumber(Var arglist, Byte next, void *vdata, Objid progr)
 
     r.type = TYPE_OBJ;
     r.v.obj = db_renumber_object(o);
+    player_invalidated(o);
     return make_var_pack(r);
 }
 
@@ -1830,32 +2072,19 @@ find_slistener_by_oid(Objid obj)
 
     return 0;
 }
-#endif /* OUTBOUND_NETWORK */
 
-static package
-bf_open_network_connection(Var arglist, Byte next, void *vdata, Objid progr)
+/* Open the connection specified by ARGLIST, as if accepted by the listener
+ * OID if USE_LISTENER is true, and return the new connection or an error.
+ */
+static Var
+open_connection(Var arglist, int use_listener, Objid oid)
 {
-#ifdef OUTBOUND_NETWORK
-
     Var r;
     enum error e;
     server_listener sl;
     slistener l;
 
-    if (!is_wizard(progr)) {
-        free_var(arglist);
-        return make_error_pack(E_PERM);
-    }
-
-    if (arglist.v.list[0].v.num == 3) {
-	Objid oid;
-
-	if (arglist.v.list[3].type != TYPE_OBJ) {
-	    return make_error_pack(E_TYPE);
-	}
-	oid = arglist.v.list[3].v.obj;
-	arglist = listdelete(arglist, 3);
-
+    if (use_listener) {
 	sl.ptr = find_slistener_by_oid(oid);
 	if (!sl.ptr) {
 	    /* Create a temporary */
@@ -1870,7 +2099,6 @@ bf_open_network_connection(Var arglist, Byte next, void *vdata, Objid progr)
     }
 
     e = network_open_connection(arglist, sl);
-    free_var(arglist);
     if (e == E_NONE) {
 	/* The connection was successfully opened, implying that
 	 * server_new_connection was called, implying and a new negative
@@ -1883,6 +2111,109 @@ bf_open_network_connection(Var arglist, Byte next, void *vdata, Objid progr)
 	r.type = TYPE_ERR;
 	r.v.err = e;
     }
+    return r;
+}
+
+/* Tasks whose call to open_network_connection() is waiting for a host name
+ * to be looked up.  A killed task's entry is taken off the list at once but
+ * only freed when the lookup finishes.
+ */
+typedef struct connection_waiter {
+    struct connection_waiter *next;
+    Var arglist;
+    int use_listener;
+    Objid oid;
+    vm the_vm;			/* 0 once the task has been killed */
+} connection_waiter;
+
+static connection_waiter *connection_waiters = 0;
+
+static task_enum_action
+connection_waiter_enumerator(task_closure closure, void *data)
+{
+    connection_waiter **ww, *w;
+
+    for (ww = &connection_waiters; (w = *ww); ww = &w->next) {
+	task_enum_action tea = (*closure) (w->the_vm, "name-lookup", data);
+
+	if (tea == TEA_KILL) {
+	    *ww = w->next;
+	    w->the_vm = 0;
+	}
+	if (tea != TEA_CONTINUE)
+	    return tea;
+    }
+
+    return TEA_CONTINUE;
+}
+
+static void
+connection_host_resolved(void *data, const char *host_name)
+{
+    connection_waiter *w = (connection_waiter *) data, **ww;
+
+    if (w->the_vm) {
+	for (ww = &connection_waiters; *ww != w; ww = &(*ww)->next)
+	    ;
+	*ww = w->next;
+	resume_task(w->the_vm,
+		    open_connection(w->arglist, w->use_listener, w->oid));
+    }
+    free_var(w->arglist);
+    myfree(w, M_TASK);
+}
+
+static enum error
+connection_waiter_suspender(vm the_vm, void *data)
+{
+    connection_waiter *w = (connection_waiter *) data;
+
+    w->the_vm = the_vm;
+    w->next = connection_waiters;
+    connection_waiters = w;
+
+    return E_NONE;
+}
+#endif /* OUTBOUND_NETWORK */
+
+static package
+bf_open_network_connection(Var arglist, Byte next, void *vdata, Objid progr)
+{
+#ifdef OUTBOUND_NETWORK
+
+    Var r;
+    int use_listener = 0;
+    Objid oid = NOTHING;
+    connection_waiter *w;
+
+    if (!is_wizard(progr)) {
+        free_var(arglist);
+        return make_error_pack(E_PERM);
+    }
+
+    if (arglist.v.list[0].v.num == 3) {
+	if (arglist.v.list[3].type != TYPE_OBJ) {
+	    return make_error_pack(E_TYPE);
+	}
+	oid = arglist.v.list[3].v.obj;
+	arglist = listdelete(arglist, 3);
+	use_listener = 1;
+    }
+
+    /* Rather than hold up the whole server while the host name is looked
+     * up, suspend this task until the answer is in.
+     */
+    w = (connection_waiter *)mymalloc(sizeof(connection_waiter), M_TASK);
+    w->arglist = arglist;
+    w->use_listener = use_listener;
+    w->oid = oid;
+    w->the_vm = 0;
+    if (network_resolve_connection(arglist, connection_host_resolved, w))
+	return make_suspend_pack(connection_waiter_suspender, w);
+    myfree(w, M_TASK);
+
+    r = open_connection(arglist, use_listener, oid);
+    free_var(arglist);
     if (r.type == TYPE_ERR)
 	return make_error_pack(r.v.err);
     else
@@ -2216,6 +2547,9 @@ bf_process_id(Var arglist, Byte next, void *vdata, Objid progr)
 void
 register_server(void)
 {
+#ifdef OUTBOUND_NETWORK
+    register_task_queue(connection_waiter_enumerator);
+#endif
     register_function("server_version", 0, 1, bf_server_version, TYPE_ANY);
     register_function("renumber", 1, 1, bf_renumber, TYPE_OBJ);
     register_function("reset_max_object", 0, 0, bf_reset_max_object);
@@ -101,6 +101,12 @@ extern void server_resume_input(Objid connection);
 				 * tasks for the given connection.
 				 */
 
+extern void server_checkpoint_finished(int success);
+				/* Called by the database module when a
+				 * checkpoint that it is writing without
+				 * forking has finished.
+				 */
+
 extern void set_server_cmdline(const char *line);
 				/* If possible, the server's command line, as
 				 * shown in the output of the `ps' command, is
@@ -146,6 +152,15 @@ extern int get_server_option(Objid oid, const char *name, Var * r);
 				 * OPT.NAME and return 1; else return 0.
 				 */
 
+extern void watch_server_options(void);
+				/* Arranges for any change to the server
+				 * options of the system object or of a
+				 * listener to be noticed by
+				 * `refresh_server_options()', and refreshes
+				 * the per-listener option caches.  Called by
+				 * `load_server_options()'.
+				 */
+
 extern void queue_anonymous_object(Var v);
 				/* Adds the specified value to the queue of
 				 * values to be recycled in between running
@@ -158,8 +173,10 @@ extern int read_values_pending_finalization(void);
 #include "db.h"
 
 /* Some server options are cached for performance reasons.
-   Changes to cached options must be followed by load_server_options()
-   in order to have any effect.  Three categories of cached options
+   The cache is reloaded by load_server_options(), which happens
+   automatically (see refresh_server_options()) before the next task
+   runs after a property on $server_options (or on a listener's
+   server_options object) is written.  Three categories of cached options
    (1)  "protect_<bi-function>" cached in bf_table (functions.c).
    (2)  "protect_<bi-property>" cached here.
    (3)  SERVER_OPTIONS_CACHED_MISC cached here.
@@ -208,6 +225,75 @@ extern int read_values_pending_finalization(void);
 	   }))							\
 								\
   DEFINE( SVO_MAX_CONCAT_CATCHABLE, max_concat_catchable,	\
+	  flag, 0, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_TASKS_PER_PASS, tasks_per_pass,			\
+								\
+	  int, DEFAULT_TASKS_PER_PASS,				\
+	 _STATEMENT({						\
+	     if (value < 1)					\
+		 value = 1;					\
+	   }))							\
+								\
+  DEFINE( SVO_TASK_PASS_USECS, task_pass_usecs,			\
+								\
+	  int, DEFAULT_TASK_PASS_USECS,				\
+	 _STATEMENT({						\
+	     if (value < 1)					\
+		 value = 1;					\
+	   }))							\
+								\
+  DEFINE( SVO_FG_SECONDS, fg_seconds,				\
+	  int, DEFAULT_FG_SECONDS, /* already canonical */	\
+	  )							\
+								\
+  DEFINE( SVO_BG_SECONDS, bg_seconds,				\
+	  int, DEFAULT_BG_SECONDS, /* already canonical */	\
+	  )							\
+								\
+  DEFINE( SVO_FG_TICKS, fg_ticks,				\
+	  int, DEFAULT_FG_TICKS, /* already canonical */	\
+	  )							\
+								\
+  DEFINE( SVO_BG_TICKS, bg_ticks,				\
+	  int, DEFAULT_BG_TICKS, /* already canonical */	\
+	  )							\
+								\
+  DEFINE( SVO_MAX_STACK_DEPTH, max_stack_depth,			\
+								\
+	  int, DEFAULT_MAX_STACK_DEPTH,				\
+	 _STATEMENT({						\
+	     if (value < DEFAULT_MAX_STACK_DEPTH)		\
+		 value = DEFAULT_MAX_STACK_DEPTH;		\
+	   }))							\
+								\
+  DEFINE( SVO_QUEUED_TASK_LIMIT, queued_task_limit,		\
+	  int, -1, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_PLAYER_HUH, player_huh,				\
+	  int, PLAYER_HUH, /* already canonical */		\
+	  )							\
+								\
+  DEFINE( SVO_PROTECT_SET_VERB_CODE, protect_set_verb_code,	\
+	  flag, 0, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_SUPPORT_NUMERIC_VERBNAME_STRINGS,			\
+	  support_numeric_verbname_strings,			\
+	  flag, 0, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_NAME_LOOKUP_TIMEOUT, name_lookup_timeout,		\
+	  int, 5, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_OUTBOUND_CONNECT_TIMEOUT, outbound_connect_timeout, \
+	  int, 5, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_BACKGROUND_FILE_IO, background_file_io,		\
 	  flag, 0, /* already canonical */			\
 	  )
 
@@ -256,6 +342,11 @@ extern void player_connected(Objid old_id, Objid new_id,
 extern int is_player_connected(Objid player);
 extern void notify(Objid player, const char *message);
 extern void boot_player(Objid player);
+extern void player_invalidated(Objid player);
+				/* Called when PLAYER has been recycled or
+				 * renumbered; any connection it has is closed
+				 * the next time through the main loop.
+				 */
 
 extern void write_active_connections(void);
 extern int read_active_connections(void);
@@ -27,6 +27,46 @@
 
 static unsigned alloc_num[Sizeof_Memory_Type];
 
+#ifdef REFCOUNT_SIDE_TABLE
+
+refcount_entry *refcount_table;
+static unsigned int refcount_table_size;
+static unsigned int refcount_table_used = 1;	/* entry 0 is never used */
+static unsigned int refcount_free_list;
+
+static unsigned int
+new_refcount_entry(void)
+{
+    unsigned int i;
+
+    if ((i = refcount_free_list) != 0) {
+	refcount_free_list = refcount_table[i].next;
+	return i;
+    }
+    if (refcount_table_used >= refcount_table_size) {
+	unsigned int size = refcount_table_size ? refcount_table_size * 2
+						: 65536;
+	refcount_entry *table;
+
+	table = (refcount_entry *) realloc(refcount_table,
+					   size * sizeof(refcount_entry));
+	if (!table)
+	    panic("refcount table allocation failed!");
+	refcount_table = table;
+	refcount_table_size = size;
+    }
+    return refcount_table_used++;
+}
+
+static inline void
+free_refcount_entry(unsigned int i)
+{
+    refcount_table[i].next = refcount_free_list;
+    refcount_free_list = i;
+}
+
+#endif /* REFCOUNT_SIDE_TABLE */
+
 static inline int
 refcount_overhead(Memory_Type type)
 {
@@ -85,10 +125,13 @@ mymalloc(unsigned size, Memory_Type type)
 
     if (offs) {
 	memptr += offs;
-	((reference_overhead *)memptr)[-1].count = 1;
+#ifdef REFCOUNT_SIDE_TABLE
+	((unsigned int *)memptr)[-1] = new_refcount_entry();
+#endif /* REFCOUNT_SIDE_TABLE */
+	ref_overhead(memptr)->count = 1;
 #ifdef ENABLE_GC
-	((reference_overhead *)memptr)[-1].buffered = 0;
-	((reference_overhead *)memptr)[-1].color = (type == M_ANON) ? GC_BLACK : GC_GREEN;
+	ref_overhead(memptr)->buffered = 0;
+	ref_overhead(memptr)->color = (type == M_ANON) ? GC_BLACK : GC_GREEN;
 #endif /* ENABLE_GC */
 #ifdef MEMO_STRLEN
 	if (type == M_STRING)
@@ -150,9 +193,15 @@ myrealloc(void *ptr, unsigned size, Memory_Type type)
 void
 myfree(void *ptr, Memory_Type type)
 {
+    int offs = refcount_overhead(type);
+
     alloc_num[type]--;
 
-    free((char *) ptr - refcount_overhead(type));
+#ifdef REFCOUNT_SIDE_TABLE
+    if (offs)
+	free_refcount_entry(((unsigned int *)ptr)[-1]);
+#endif /* REFCOUNT_SIDE_TABLE */
+    free((char *) ptr - offs);
 }
 
 /* XXX stupid fix for non-gcc compilers, already in storage.h */
@@ -42,52 +42,80 @@ typedef struct reference_overhead {
     GC_Color color:3;
 } reference_overhead;
 
+#ifdef REFCOUNT_SIDE_TABLE
+
+/* The word in front of a reference counted value is the index of its
+ * entry in `refcount_table'.  Free entries are chained through `next'.
+ */
+typedef union refcount_entry {
+    reference_overhead ref;
+    unsigned int next;
+} refcount_entry;
+
+extern refcount_entry *refcount_table;
+
+static inline reference_overhead *
+ref_overhead(const void *ptr)
+{
+    return &refcount_table[((const unsigned int *)ptr)[-1]].ref;
+}
+
+#else
+
+static inline reference_overhead *
+ref_overhead(const void *ptr)
+{
+    return &((reference_overhead *)ptr)[-1];
+}
+
+#endif /* REFCOUNT_SIDE_TABLE */
+
 static inline int
 addref(const void *ptr)
 {
-    return ++((reference_overhead *)ptr)[-1].count;
+    return ++ref_overhead(ptr)->count;
 }
 
 static inline int
 delref(const void *ptr)
 {
-    return --((reference_overhead *)ptr)[-1].count;
+    return --ref_overhead(ptr)->count;
 }
 
 static inline int
 refcount(const void *ptr)
 {
-    return ((reference_overhead *)ptr)[-1].count;
+    return ref_overhead(ptr)->count;
 }
 
 static inline void
 gc_set_buffered(const void *ptr)
 {
-    ((reference_overhead *)ptr)[-1].buffered = 1;
+    ref_overhead(ptr)->buffered = 1;
 }
 
 static inline void
 gc_clear_buffered(const void *ptr)
 {
-    ((reference_overhead *)ptr)[-1].buffered = 0;
+    ref_overhead(ptr)->buffered = 0;
 }
 
 static inline int
 gc_is_buffered(const void *ptr)
 {
-    return ((reference_overhead *)ptr)[-1].buffered;
+    return ref_overhead(ptr)->buffered;
 }
 
 static inline void
 gc_set_color(const void *ptr, GC_Color color)
 {
-    ((reference_overhead *)ptr)[-1].color = color;
+    ref_overhead(ptr)->color = color;
 }
 
 static inline GC_Color
 gc_get_color(const void *ptr)
 {
-    return ((reference_overhead *)ptr)[-1].color;
+    return ref_overhead(ptr)->color;
 }
 
 typedef enum Memory_Type {
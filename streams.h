@@ -32,6 +32,7 @@ extern Stream *new_stream(int size);
 extern void stream_add_char(Stream *, char);
 extern void stream_delete_char(Stream *);
 extern void stream_add_string(Stream *, const char *);
+extern void stream_add_bytes(Stream *, const char *, int);
 extern void stream_printf(Stream *, const char *,...);
 extern void free_stream(Stream *);
 extern char *stream_contents(Stream *);
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 
 #include "my-string.h"
+#include "my-sys-time.h"
 #include "my-time.h"
 
 #include "config.h"
@@ -215,6 +216,8 @@ Var current_local;
 int current_task_id;
 static tqueue *idle_tqueues = 0, *active_tqueues = 0;
 static task *waiting_tasks = 0;	/* forked and suspended tasks */
+static int reading_task_queue = 0;
+static task *last_loaded_task = 0;	/* while reading_task_queue */
 static ext_queue *external_queues = 0;
 
 /*
@@ -818,11 +821,11 @@ do_command_task(tqueue * tq, char *command)
 		       || find_verb_on(_this = pc->dobj, pc, &vh)
 		       || find_verb_on(_this = pc->iobj, pc, &vh)
 		       || (valid(location)
-			   && !server_int_option("player_huh", PLAYER_HUH)
+			   && !server_int_option_cached(SVO_PLAYER_HUH)
 			   && (vh = db_find_callable_verb(Var::new_obj(_this = location), "huh"),
 			       vh.ptr))
 		       || (valid(tq->player)
-			   && server_int_option("player_huh", PLAYER_HUH)
+			   && server_int_option_cached(SVO_PLAYER_HUH)
 			   && (vh = db_find_callable_verb(Var::new_obj(_this = tq->player), "huh"),
 			       vh.ptr))) {
 		do_input_task(tq->player, pc, _this, vh);
@@ -1139,14 +1142,22 @@ enqueue_waiting(task * t)
 	t->next = waiting_tasks;
 	waiting_tasks = t;
     } else {
-	task *tt;
+	task *tt = waiting_tasks;
 
-	for (tt = waiting_tasks; tt->next; tt = tt->next)
+	/* Tasks are dumped in order, so when loading they can usually be
+	 * put right after the previous one instead of walking the whole
+	 * queue.  Nothing leaves the queue while it's being loaded.
+	 */
+	if (last_loaded_task && get_start_time(last_loaded_task) <= start_time)
+	    tt = last_loaded_task;
+	for (; tt->next; tt = tt->next)
 	    if (start_time < get_start_time(tt->next))
 		break;
 	t->next = tt->next;
 	tt->next = t;
     }
+    if (reading_task_queue)
+	last_loaded_task = t;
 }
 
 static void
@@ -1189,7 +1200,7 @@ check_user_task_limit(Objid user)
 	limit = v.v.num;
 
     if (limit < 0)
-	limit = server_int_option("queued_task_limit", -1);
+	limit = server_int_option_cached(SVO_QUEUED_TASK_LIMIT);
 
     if (limit < 0)
 	return 1;
@@ -1559,189 +1570,228 @@ static http_parser_settings settings = {on_message_begin_callback,
  * that fails, it handles the input command.  The same "task" is used
  * for both.  Messy.
  */
-void
-run_ready_tasks(void)
+static int
+run_next_ready_task(void)
 {
-    task *t, *next_t;
-    time_t now = time(0);
-    tqueue *tq, *next_tq;
+    task *t;
+    tqueue *tq;
+    int did_one = 0;
+    time_t start = time(0);
 
-    for (t = waiting_tasks; t && get_start_time(t) <= now; t = next_t) {
-	Objid progr = (t->kind == TASK_FORKED
-		       ? t->t.forked.a.progr
-		       : progr_of_cur_verb(t->t.suspended.the_vm));
-	tqueue *tq = find_tqueue(progr, 1);
+    /* Loop over tqueues, looking for a task */
+    while (active_tqueues && !did_one) {
+	tq = active_tqueues;
 
-	next_t = t->next;
-	ensure_usage(tq);
-	enqueue_bg_task(tq, t);
-    }
-    waiting_tasks = t;
+	if (tq->reading && is_out_of_input(tq)) {
+	    Var v;
 
-    {
-	int did_one = 0;
-	time_t start = time(0);
-
-	/* Loop over tqueues, looking for a task */
-	while (active_tqueues && !did_one) {
-	    tq = active_tqueues;
-
-	    if (tq->reading && is_out_of_input(tq)) {
-		Var v;
-
-		tq->reading = 0;
-		tq->parsing = 0;
-		if (tq->parsing_state != NULL)
-		    reset_http_parsing_state(tq->parsing_state);
-		current_task_id = tq->reading_vm->task_id;
-		current_local = var_ref(tq->reading_vm->local);
-		v.type = TYPE_ERR;
-		v.v.err = E_INVARG;
-		resume_from_previous_vm(tq->reading_vm, v);
-		current_task_id = -1;
-		free_var(current_local);
-		did_one = 1;
-	    }
+	    tq->reading = 0;
+	    tq->parsing = 0;
+	    if (tq->parsing_state != NULL)
+		reset_http_parsing_state(tq->parsing_state);
+	    current_task_id = tq->reading_vm->task_id;
+	    current_local = var_ref(tq->reading_vm->local);
+	    v.type = TYPE_ERR;
+	    v.v.err = E_INVARG;
+	    resume_from_previous_vm(tq->reading_vm, v);
+	    current_task_id = -1;
+	    free_var(current_local);
+	    did_one = 1;
+	}
 
-	    /* Loop over tasks, looking for runnable one */
-	    while (!did_one) {
-		t = dequeue_input_task(tq, ((tq->hold_input && !tq->reading)
-					    ? DQ_OOB
-					    : DQ_FIRST));
-		if (!t)
-		    t = dequeue_bg_task(tq);
-		if (!t)
-		    break;
-
-		switch (t->kind) {
-		default:
-		    panic("Unexpected task kind in run_ready_tasks()");
-		    break;
-		case TASK_OOB:
-		    do_out_of_band_command(tq, t->t.input.string);
-		    did_one = 1;
-		    break;
-		case TASK_BINARY:
-		case TASK_INBAND:
-		    if (tq->reading && tq->parsing) {
-			int done = 0;
-			int len;
-			const char *binary = binary_to_raw_bytes(t->t.input.string, &len);
-			if (binary == NULL) {
-			    /* This can happen if someone forces an
-			     * invalid binary string as input on this
-			     * connection!
-			     */
-			    /* It can happen even before the
-			     * `on_message_begin_callback()' is
-			     * called.
-			     */
-			    if (tq->parsing_state->status == PARSING)
-				free_var(tq->parsing_state->result);
-			    tq->parsing_state->result = var_ref(zero);
+	/* Loop over tasks, looking for runnable one */
+	while (!did_one) {
+	    t = dequeue_input_task(tq, ((tq->hold_input && !tq->reading)
+					? DQ_OOB
+					: DQ_FIRST));
+	    if (!t)
+		t = dequeue_bg_task(tq);
+	    if (!t)
+		break;
+
+	    switch (t->kind) {
+	    default:
+		panic("Unexpected task kind in run_ready_tasks()");
+		break;
+	    case TASK_OOB:
+		do_out_of_band_command(tq, t->t.input.string);
+		did_one = 1;
+		break;
+	    case TASK_BINARY:
+	    case TASK_INBAND:
+		if (tq->reading && tq->parsing) {
+		    int done = 0;
+		    int len;
+		    const char *binary = binary_to_raw_bytes(t->t.input.string, &len);
+		    if (binary == NULL) {
+			/* This can happen if someone forces an
+			 * invalid binary string as input on this
+			 * connection!
+			 */
+			/* It can happen even before the
+			 * `on_message_begin_callback()' is
+			 * called.
+			 */
+			if (tq->parsing_state->status == PARSING)
+			    free_var(tq->parsing_state->result);
+			tq->parsing_state->result = var_ref(zero);
+			done = 1;
+		    }
+		    else {
+			http_parser_execute(&tq->parsing_state->parser, &settings, binary, len);
+			if (tq->parsing_state->parser.http_errno != HPE_OK) {
+			    Var key, value;
+			    key.type = TYPE_STR;
+			    key.v.str = str_dup("error");
+			    value = new_list(2);
+			    value.v.list[1].type = TYPE_STR;
+			    value.v.list[1].v.str = str_dup(http_errno_name((http_errno)tq->parsing_state->parser.http_errno));
+			    value.v.list[2].type = TYPE_STR;
+			    value.v.list[2].v.str = str_dup(http_errno_description((http_errno)tq->parsing_state->parser.http_errno));
+			    tq->parsing_state->result = mapinsert(tq->parsing_state->result, key, value);
 			    done = 1;
 			}
-			else {
-			    http_parser_execute(&tq->parsing_state->parser, &settings, binary, len);
-			    if (tq->parsing_state->parser.http_errno != HPE_OK) {
-				Var key, value;
-				key.type = TYPE_STR;
-				key.v.str = str_dup("error");
-				value = new_list(2);
-				value.v.list[1].type = TYPE_STR;
-				value.v.list[1].v.str = str_dup(http_errno_name((http_errno)tq->parsing_state->parser.http_errno));
-				value.v.list[2].type = TYPE_STR;
-				value.v.list[2].v.str = str_dup(http_errno_description((http_errno)tq->parsing_state->parser.http_errno));
-				tq->parsing_state->result = mapinsert(tq->parsing_state->result, key, value);
-				done = 1;
-			    }
-			    else if (tq->parsing_state->parser.upgrade) {
-				Var key;
-				key.type = TYPE_STR;
-				key.v.str = str_dup("upgrade");
-				tq->parsing_state->result = mapinsert(tq->parsing_state->result, key, Var::new_int(1));
-				done = 1;
-			    }
-			    else if (tq->parsing_state->status == DONE)
-				done = 1;
-			}
-			if (done) {
-			    Var v = var_ref(tq->parsing_state->result);
-			    tq->reading = 0;
-			    tq->parsing = 0;
-			    reset_http_parsing_state(tq->parsing_state);
-			    current_task_id = tq->reading_vm->task_id;
-			    current_local = var_ref(tq->reading_vm->local);
-			    resume_from_previous_vm(tq->reading_vm, v);
-                            free_var(v);
-			    current_task_id = -1;
-			    free_var(current_local);
+			else if (tq->parsing_state->parser.upgrade) {
+			    Var key;
+			    key.type = TYPE_STR;
+			    key.v.str = str_dup("upgrade");
+			    tq->parsing_state->result = mapinsert(tq->parsing_state->result, key, Var::new_int(1));
+			    done = 1;
 			}
-			did_one = 1;
+			else if (tq->parsing_state->status == DONE)
+			    done = 1;
 		    }
-		    else if (tq->reading) {
-			Var v;
+		    if (done) {
+			Var v = var_ref(tq->parsing_state->result);
 			tq->reading = 0;
 			tq->parsing = 0;
+			reset_http_parsing_state(tq->parsing_state);
 			current_task_id = tq->reading_vm->task_id;
 			current_local = var_ref(tq->reading_vm->local);
-			v.type = TYPE_STR;
-			v.v.str = t->t.input.string;
 			resume_from_previous_vm(tq->reading_vm, v);
+			free_var(v);
 			current_task_id = -1;
 			free_var(current_local);
-			did_one = 1;
-		    } else {
-			/* Used to insist on tq->connected here, but Pavel
-			 * couldn't come up with a good reason to keep that
-			 * restriction.
-			 */
-			add_command_to_history(tq->player, t->t.input.string);
-			did_one = (tq->player >= 0
-				   ? do_command_task
-				: do_login_task) (tq, t->t.input.string);
 		    }
-		    break;
-		case TASK_FORKED:
-		    {
-			forked_task ft;
-			ft = t->t.forked;
-			current_task_id = ft.id;
-			current_local = new_map();
-			do_forked_task(ft.program, ft.rt_env, ft.a,
-				       ft.f_index);
-			current_task_id = -1;
-			free_var(current_local);
-			did_one = 1;
-		    }
-		    break;
-		case TASK_SUSPENDED:
-		    current_task_id = t->t.suspended.the_vm->task_id;
-		    current_local = var_ref(t->t.suspended.the_vm->local);
-		    resume_from_previous_vm(t->t.suspended.the_vm,
-					    t->t.suspended.value);
-		    /* must free value passed in to resume_task() and do_resume() */
-		    free_var(t->t.suspended.value);
+		    did_one = 1;
+		}
+		else if (tq->reading) {
+		    Var v;
+		    tq->reading = 0;
+		    tq->parsing = 0;
+		    current_task_id = tq->reading_vm->task_id;
+		    current_local = var_ref(tq->reading_vm->local);
+		    v.type = TYPE_STR;
+		    v.v.str = t->t.input.string;
+		    resume_from_previous_vm(tq->reading_vm, v);
 		    current_task_id = -1;
 		    free_var(current_local);
 		    did_one = 1;
-		    break;
+		} else {
+		    /* Used to insist on tq->connected here, but Pavel
+		     * couldn't come up with a good reason to keep that
+		     * restriction.
+		     */
+		    add_command_to_history(tq->player, t->t.input.string);
+		    did_one = (tq->player >= 0
+			       ? do_command_task
+			    : do_login_task) (tq, t->t.input.string);
 		}
-		free_task(t, 0);
+		break;
+	    case TASK_FORKED:
+		{
+		    forked_task ft;
+		    ft = t->t.forked;
+		    current_task_id = ft.id;
+		    current_local = new_map();
+		    do_forked_task(ft.program, ft.rt_env, ft.a,
+				   ft.f_index);
+		    current_task_id = -1;
+		    free_var(current_local);
+		    did_one = 1;
+		}
+		break;
+	    case TASK_SUSPENDED:
+		current_task_id = t->t.suspended.the_vm->task_id;
+		current_local = var_ref(t->t.suspended.the_vm->local);
+		resume_from_previous_vm(t->t.suspended.the_vm,
+					t->t.suspended.value);
+		/* must free value passed in to resume_task() and do_resume() */
+		free_var(t->t.suspended.value);
+		current_task_id = -1;
+		free_var(current_local);
+		did_one = 1;
+		break;
 	    }
+	    free_task(t, 0);
+	}
 
-	    active_tqueues = tq->next;
+	active_tqueues = tq->next;
 
-	    if (did_one) {
-		/* Bump the usage level of this tqueue */
-		time_t end = time(0);
+	if (did_one) {
+	    /* Bump the usage level of this tqueue */
+	    time_t end = time(0);
 
-		tq->usage += end - start;
-		activate_tqueue(tq);
-	    } else {
-		/* There was nothing to do on this tqueue, so deactivate it */
-		deactivate_tqueue(tq);
-	    }
+	    tq->usage += end - start;
+	    activate_tqueue(tq);
+	} else {
+	    /* There was nothing to do on this tqueue, so deactivate it */
+	    deactivate_tqueue(tq);
+	}
+    }
+
+    return did_one;
+}
+
+static long
+usecs_since(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, 0);
+    return (now.tv_sec - start->tv_sec) * 1000000L
+	+ (now.tv_usec - start->tv_usec);
+}
+
+/* Runs ready tasks, one at a time and round-robin across the active
+ * tqueues, until there are none left or the per-pass budget (see
+ * `tasks_per_pass' and `task_pass_usecs' in options.h) is used up.
+ * Network I/O is polled (without blocking) between tasks so that
+ * connections are not starved while the queue drains.
+ */
+void
+run_ready_tasks(void)
+{
+    task *t, *next_t;
+    time_t now = time(0);
+    tqueue *tq, *next_tq;
+
+    for (t = waiting_tasks; t && get_start_time(t) <= now; t = next_t) {
+	Objid progr = (t->kind == TASK_FORKED
+		       ? t->t.forked.a.progr
+		       : progr_of_cur_verb(t->t.suspended.the_vm));
+	tqueue *tq = find_tqueue(progr, 1);
+
+	next_t = t->next;
+	ensure_usage(tq);
+	enqueue_bg_task(tq, t);
+    }
+    waiting_tasks = t;
+
+    {
+	int max_tasks = server_int_option_cached(SVO_TASKS_PER_PASS);
+	long max_usecs = server_int_option_cached(SVO_TASK_PASS_USECS);
+	int tasks_run = 0;
+	struct timeval pass_start;
+
+	gettimeofday(&pass_start, 0);
+
+	while (run_next_ready_task()) {
+	    if (++tasks_run >= max_tasks
+		|| usecs_since(&pass_start) >= max_usecs
+		|| !active_tqueues)
+		break;
+	    network_process_io(0);
 	}
     }
 
@@ -1837,6 +1887,15 @@ write_forked_task(forked_task ft)
 {
     unsigned lineno = find_line_number(ft.program, ft.f_index, 0);
 
+    if (dbio_writing_binary()) {
+	dbio_write_num(lineno);
+	dbio_write_num(ft.start_time);
+	dbio_write_num(ft.id);
+	write_activ_as_pi(ft.a);
+	write_task_program(ft.program, ft.f_index, ft.rt_env);
+	return;
+    }
+
     dbio_printf("0 %d %d %d\n", lineno, ft.start_time, ft.id);
     write_activ_as_pi(ft.a);
     write_rt_env(ft.program->var_names, ft.rt_env, ft.program->num_var_names);
@@ -1846,11 +1905,38 @@ write_forked_task(forked_task ft)
 static void
 write_suspended_task(suspended_task st)
 {
-    dbio_printf("%d %d ", st.start_time, st.the_vm->task_id);
-    dbio_write_var(st.value);
+    if (dbio_writing_binary()) {
+	dbio_write_num(st.start_time);
+	dbio_write_num(st.the_vm->task_id);
+    } else
+	dbio_printf("%d %d ", st.start_time, st.the_vm->task_id);
+    write_task_value(st.value);
     write_vm(st.the_vm);
 }
 
+static void
+write_interrupted_task(vm the_vm, const char *status)
+{
+    if (dbio_writing_binary()) {
+	dbio_write_num(the_vm->task_id);
+	dbio_write_string(status);
+    } else
+	dbio_printf("%d %s\n", the_vm->task_id, status);
+    write_vm(the_vm);
+}
+
+/* In the binary format, the counts are just numbers and the obsolete clocks
+ * are left out.
+ */
+static void
+write_task_count(int count, const char *what)
+{
+    if (dbio_writing_binary())
+	dbio_write_num(count);
+    else
+	dbio_printf("%d %s\n", count, what);
+}
+
 void
 write_task_queue(void)
 {
@@ -1859,7 +1945,10 @@ write_task_queue(void)
     task *t;
     tqueue *tq;
 
-    dbio_printf("0 clocks\n");	/* for compatibility's sake */
+    if (dbio_writing_binary())
+	begin_task_state();
+    else
+	dbio_printf("0 clocks\n");	/* for compatibility's sake */
 
     for (t = waiting_tasks; t; t = t->next)
 	if (t->kind == TASK_FORKED)
@@ -1874,7 +1963,7 @@ write_task_queue(void)
 	    else		/* t->kind == TASK_SUSPENDED */
 		suspended_count++;
 
-    dbio_printf("%d queued tasks\n", forked_count);
+    write_task_count(forked_count, "queued tasks");
 
     for (t = waiting_tasks; t; t = t->next)
 	if (t->kind == TASK_FORKED)
@@ -1885,7 +1974,7 @@ write_task_queue(void)
 	    if (t->kind == TASK_FORKED)
 		write_forked_task(t->t.forked);
 
-    dbio_printf("%d suspended tasks\n", suspended_count);
+    write_task_count(suspended_count, "suspended tasks");
 
     for (t = waiting_tasks; t; t = t->next)
 	if (t->kind == TASK_SUSPENDED)
@@ -1918,7 +2007,7 @@ write_task_queue(void)
 	if (tq->reading)
 	    interrupted_count++;
 
-    dbio_printf("%d interrupted tasks\n", interrupted_count);
+    write_task_count(interrupted_count, "interrupted tasks");
 
     qdata.progr = NOTHING;
     qdata.show_all = 1;
@@ -1927,15 +2016,93 @@ write_task_queue(void)
 	(*eq->enumerator) (writing_closure, &qdata);
 
     for (tq = idle_tqueues; tq; tq = tq->next) {
-	if (tq->reading) {
-	    dbio_printf("%d %s\n", tq->reading_vm->task_id, "interrupted reading task");
-	    write_vm(tq->reading_vm);
+	if (tq->reading)
+	    write_interrupted_task(tq->reading_vm, "interrupted reading task");
+    }
+
+    if (dbio_writing_binary())
+	end_task_state();
+}
+
+static int
+read_binary_task_queue(void)
+{
+    int count, i;
+
+    begin_task_state();
+
+    count = dbio_read_num();
+    for (i = 1; i <= count; i++) {
+	int first_lineno = dbio_read_num();
+	time_t start_time = dbio_read_num();
+	int id = dbio_read_num();
+	Program *program;
+	Var *rt_env;
+	activation a;
+
+	if (!read_activ_as_pi(&a)) {
+	    errlog("READ_TASK_QUEUE: Bad activation, count = %d.\n", i);
+	    goto failed;
+	}
+	a.temp.type = TYPE_NONE;
+	if (!(program = read_task_program(&rt_env, "forked task"))) {
+	    errlog("READ_TASK_QUEUE: Bad program, count = %d.\n", i);
+	    goto failed;
+	}
+	program->first_lineno = first_lineno;
+
+	enqueue_forked(program, a, rt_env, MAIN_VECTOR, start_time, id);
+    }
+
+    count = dbio_read_num();
+    for (i = 1; i <= count; i++) {
+	task *t = (task *)mymalloc(sizeof(task), M_TASK);
+	int task_id;
+
+	t->kind = TASK_SUSPENDED;
+	t->t.suspended.start_time = dbio_read_num();
+	task_id = dbio_read_num();
+	t->t.suspended.value = read_task_value();
+	if (!(t->t.suspended.the_vm = read_vm(task_id))) {
+	    errlog("READ_TASK_QUEUE: Bad suspended task vm, count = %d\n", i);
+	    free_var(t->t.suspended.value);
+	    myfree(t, M_TASK);
+	    goto failed;
+	}
+	enqueue_waiting(t);
+    }
+
+    count = dbio_read_num();
+    for (i = 1; i <= count; i++) {
+	int task_id = dbio_read_num();
+	vm the_vm;
+
+	dbio_read_string();	/* status */
+	if (!(the_vm = read_vm(task_id))) {
+	    errlog("READ_TASK_QUEUE: Bad interrupted task vm, count = %d\n",
+		   i);
+	    goto failed;
 	}
+
+	task *t = (task *)mymalloc(sizeof(task), M_TASK);
+	t->kind = TASK_SUSPENDED;
+	t->t.suspended.start_time = 0;
+	t->t.suspended.value.type = TYPE_ERR;
+	t->t.suspended.value.v.err = E_INTRPT;
+	t->t.suspended.the_vm = the_vm;
+	enqueue_waiting(t);
     }
+
+    end_task_state();
+    return 1;
+
+  failed:
+    end_task_state();
+    return 0;
 }
 
-int
-read_task_queue(void)
+static int
+read_text_task_queue(void)
 {
     int count, dummy;
     int suspended_count, suspended_task_header;
@@ -2014,6 +2181,7 @@ read_task_queue(void)
 	if (dbio_scanf("%d %d%c", &start_time, &task_id, &c) != 3) {
 	    errlog("READ_TASK_QUEUE: Bad suspended task header, count = %d\n",
 		   suspended_count);
+	    myfree(t, M_TASK);
 	    return 0;
 	}
 	t->t.suspended.start_time = start_time;
@@ -2024,12 +2192,15 @@ read_task_queue(void)
 	else {
 	    errlog("READ_TASK_QUEUE: Bad suspended task value, count = %d\n",
 		   suspended_count);
+	    myfree(t, M_TASK);
 	    return 0;
 	}
 
 	if (!(t->t.suspended.the_vm = read_vm(task_id))) {
 	    errlog("READ_TASK_QUEUE: Bad suspended task vm, count = %d\n",
 		   suspended_count);
+	    free_var(t->t.suspended.value);
+	    myfree(t, M_TASK);
 	    return 0;
 	}
 	enqueue_waiting(t);
@@ -2080,6 +2251,22 @@ read_task_queue(void)
     return 1;
 }
 
+int
+read_task_queue(void)
+{
+    int result;
+
+    reading_task_queue = 1;
+    if (dbio_reading_binary())
+	result = read_binary_task_queue();
+    else
+	result = read_text_task_queue();
+    reading_task_queue = 0;
+    last_loaded_task = 0;
+
+    return result;
+}
+
 /* Used in emergency mode and when handling the `.program' intrinsic
  * command.  Is only capable of finding verbs defined on permanent
  * objects (relies on `Objid' internally).
@@ -2139,7 +2326,7 @@ find_verb_for_programming(Objid player, const char *verbref,
     if (!h.ptr)
 	*message = "That object does not have that verb definition.";
     else if (!db_verb_allows(h, player, VF_WRITE)
-	     || (server_flag_option("protect_set_verb_code", 0)
+	     || (server_flag_option_cached(SVO_PROTECT_SET_VERB_CODE)
 		 && !is_wizard(player))) {
 	*message = "Permission denied.";
 	h.ptr = 0;
@@ -2363,10 +2550,8 @@ writing_closure(vm the_vm, const char *status, void *data)
 {
     struct qcl_data *qdata = (struct qcl_data *)data;
 
-    if (qdata->show_all || qdata->progr == progr_of_cur_verb(the_vm)) {
-	dbio_printf("%d %s\n", the_vm->task_id, status);
-	write_vm(the_vm);
-    }
+    if (qdata->show_all || qdata->progr == progr_of_cur_verb(the_vm))
+	write_interrupted_task(the_vm, status);
 
     return TEA_CONTINUE;
 }
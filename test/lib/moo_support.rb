@@ -189,6 +189,10 @@ module MooSupport
     simplify command %Q|; return is_member(#{value_ref(value)}, #{value_ref(collection)});|
   end
 
+  def sort(list, *args)
+    simplify command %Q|; return sort(#{([list] + args).map { |a| value_ref(a) }.join(', ')});|
+  end
+
   ### General Operations Applicable to all Values
 
   def typeof(value)
@@ -247,6 +251,14 @@ module MooSupport
     end
   end
 
+  def strsubs(source, replacements, case_matters = nil)
+    if case_matters
+      simplify command %Q|; return strsubs(#{value_ref(source)}, #{value_ref(replacements)}, #{value_ref(case_matters)});|
+    else
+      simplify command %Q|; return strsubs(#{value_ref(source)}, #{value_ref(replacements)});|
+    end
+  end
+
   def index(source, what, case_matters = nil, offset = nil)
     if offset
       simplify command %Q|; return index(#{value_ref(source)}, #{value_ref(what)}, #{value_ref(case_matters)}, #{value_ref(offset)});|
@@ -747,6 +759,22 @@ module MooSupport
     end
   end
 
+  def worker_call(args, request, max_workers = nil)
+    if max_workers
+      simplify command %|; return worker_call(#{value_ref(args)}, #{value_ref(request)}, #{value_ref(max_workers)});|
+    else
+      simplify command %|; return worker_call(#{value_ref(args)}, #{value_ref(request)});|
+    end
+  end
+
+  def worker_pools()
+    simplify command %|; return worker_pools();|
+  end
+
+  def kill_worker_pool(args)
+    simplify command %|; return kill_worker_pool(#{value_ref(args)});|
+  end
+
   ## System Operations
 
   def getenv(name)
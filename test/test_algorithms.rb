@@ -617,6 +617,45 @@ class TestAlgorithms < Test::Unit::TestCase
     end
   end
 
+  def test_that_hashing_and_encoding_large_inputs_works
+    run_test_as('programmer') do
+      assert_equal [65536,
+                    "FB3069E25864E843EF670CD824AE0A019B1F85BACFD890395D70A5F7759ADAD3",
+                    "33B612414F430DB85CFB9795F5251075",
+                    "7E3650CB020B0B97D45C2248398E8C9072C2CDB4",
+                    "77F7438369734B2BD61911A7D625D9D407C0AB0B",
+                    87384, 1],
+                   simplify(command(%Q|; s = ""; for i in [1..16] s = s + "abcdefgh"; endfor; for i in [1..9] s = s + s; endfor; return {length(s), string_hash(s), binary_hash(s, "md5"), string_hmac(s, "foo", "sha1"), value_hash(s, "sha1"), length(encode_base64(s)), decode_base64(encode_base64(s)) == s};|))
+    end
+  end
+
+  def test_that_crypt_with_bcrypt_waits_in_the_background
+    run_test_as('wizard') do
+      assert_equal 'crypt', simplify(command(%Q|; fork t (0) crypt("foobar", "$2a$14$KRGxLBS0Lxe3KBCwKxOzLe"); endfork; suspend(0); for q in (queued_tasks()) if (q[1] == t) kill_task(t); return q[2]; endif endfor; return 0;|))
+    end
+  end
+
+  def test_that_crypt_with_bcrypt_works_in_a_login_command
+    run_test_as('wizard') do
+      port = options['port'] + 1
+      l = simplify(command(%Q|; l = create($nothing); p = create($nothing); set_player_flag(p, 1); add_property(l, "hash", crypt("secret", "$2a$08$KRGxLBS0Lxe3KBCwKxOzLe"), {player, ""}); add_property(l, "who", p, {player, ""}); add_verb(l, {player, "xd", "do_login_command"}, {"this", "none", "this"}); set_verb_code(l, "do_login_command", {"return length(args) == 2 && crypt(args[2], this.hash) == this.hash ? this.who \| 0;"}); listen(l, #{port}); return l;|))
+      sock = TCPSocket.open(options['host'], port)
+      begin
+        sock.puts 'connect secret'
+        connected = 0
+        50.times do
+          connected = simplify(command(%Q|; return #{l}.who in connected_players();|))
+          break if connected > 0
+          sleep 0.1
+        end
+        assert connected > 0
+      ensure
+        sock.close
+        command(%Q|; unlisten(#{port});|)
+      end
+    end
+  end
+
   class << self
     def supports_md5
       ''.crypt('$1$')[0..2] == '$1$'
@@ -940,4 +979,59 @@ class TestAlgorithms < Test::Unit::TestCase
     end
   end
 
+  def test_that_sort_sorts_lists
+    run_test_as('programmer') do
+      assert_equal [], sort([])
+      assert_equal [1, 2, 3], sort([3, 1, 2])
+      assert_equal [3, 2, 1], sort([3, 1, 2], [], 0, 1)
+      assert_equal ['A', 'a', 'b', 'B', 'c'], sort(['b', 'A', 'a', 'B', 'c'])
+      assert_equal ['Item1', 'item10', 'item2'], sort(['item10', 'item2', 'Item1'])
+      assert_equal ['Item1', 'item2', 'item10'], sort(['item10', 'item2', 'Item1'], [], 1)
+      assert_equal [-1.0, 0.2, 0.3, 1.5], _('sort({1.5, 0.3, 0.2, -1.0})')
+      assert_equal [E_NONE, E_TYPE, E_PERM], _('sort({E_PERM, E_NONE, E_TYPE})')
+    end
+  end
+
+  def test_that_sort_sorts_by_keys_and_is_stable
+    run_test_as('programmer') do
+      assert_equal ['y', 'w', 'x', 'z'], sort(['x', 'y', 'z', 'w'], [2, 1, 2, 1])
+      assert_equal ['x', 'z', 'y', 'w'], sort(['x', 'y', 'z', 'w'], [2, 1, 2, 1], 0, 1)
+      assert_equal [[2, 'a'], [1, 'b']], sort([[1, 'b'], [2, 'a']], ['b', 'a'])
+    end
+  end
+
+  def test_that_sort_rejects_bad_keys
+    run_test_as('programmer') do
+      assert_equal E_TYPE, sort([1, 'a'])
+      assert_equal E_TYPE, sort([[1], [2]])
+      assert_equal E_TYPE, _('sort({1, 2.0})')
+      assert_equal E_INVARG, sort([1, 2], [1])
+    end
+  end
+
+  def test_that_sort_sorts_large_lists
+    run_test_as('programmer') do
+      assert_equal [200000, 1], simplify(command(%Q|; l = {}; for j in [0..199] c = {}; for i in [1..1000] c = {@c, ((j * 1000 + i) * 7919) % 100003}; endfor l = {@l, @c}; ticks_left() < 100000 && suspend(0); endfor s = sort(l); ok = 1; for i in [2..length(s)] ticks_left() < 2000 && suspend(0); s[i - 1] > s[i] && (ok = 0); endfor return {length(s), ok};|))
+    end
+  end
+
+  def test_that_set_functions_work
+    run_test_as('programmer') do
+      assert_equal [1, 2, 'a', 3], _('unique({1, 2, 1, "a", "A", 3, 2})')
+      assert_equal [1, 2, 3, 'x'], _('union({1, 2}, {2, 3}, {"x", 1, "X"})')
+      assert_equal [2, 3, 'Foo'], _('intersection({1, 2, 3, "Foo", 2}, {"foo", 2, 3}, {3, "FOO", 2})')
+      assert_equal [1, 3], _('diff({1, 2, 3, 2, "a"}, {2}, {"A"})')
+      assert_equal [[1, 'a'], {1 => 2}, 1], _('unique({{1, "a"}, {1, "A"}, [1 -> 2], [1 -> 2], 1})')
+      assert_equal [], _('union({})')
+      assert_equal E_TYPE, _('union({1}, 2)')
+    end
+  end
+
+  def test_that_membership_in_long_lists_survives_changes
+    run_test_as('programmer') do
+      assert_equal [50, 50, 50, 0, 50, 0, 50, 100, 99], simplify(command(%Q|; l = {}; for i in [1..100] l = {@l, i}; endfor a = 50 in l; b = 50 in l; c = 50 in l; l[50] = "x"; return {a, b, c, 50 in l, "X" in l, 50 in l, "x" in l, setadd(l, 100)[$], length(setremove(l, "x"))};|))
+      assert_equal [0, 500, 500, 0], simplify(command(%Q|; l = {}; for i in [1..1000] l = {@l, tostr("Name", i)}; endfor r = {}; for k in [1..3] r = {is_member("name500", l), is_member("Name500", l), "name500" in l, "nope" in l}; endfor return r;|))
+    end
+  end
+
 end
@@ -104,6 +104,26 @@ class TestAnonymous < Test::Unit::TestCase
     end
   end
 
+  def test_that_setting_a_property_on_an_anonymous_object_does_not_change_its_siblings
+    run_test_as('programmer') do
+      x = create(:nothing)
+      add_property(x, 'x', 123, ['player', 'c'])
+
+      assert_equal [456, 123, 123, 0, 1], simplify(command("; a = create(#{x}, 1); b = create(#{x}, 1); a.x = 456; return {a.x, b.x, #{x}.x, is_clear_property(a, \"x\"), is_clear_property(b, \"x\")};"))
+      assert_equal ['r', 'c'], simplify(command("; a = create(#{x}, 1); b = create(#{x}, 1); set_property_info(a, \"x\", {player, \"r\"}); return {property_info(a, \"x\")[2], property_info(b, \"x\")[2]};"))
+      assert_equal [['r', 'c'], 1], simplify(command("; a = create(#{x}, 1); b = create(#{x}, 1); property_info(a, \"x\"); set_property_info(a, \"x\", {player, \"r\"}); return {{property_info(a, \"x\")[2], property_info(b, \"x\")[2]}, is_clear_property(a, \"x\")};"))
+    end
+  end
+
+  def test_that_an_anonymous_object_keeps_the_property_permissions_it_was_created_with
+    run_test_as('programmer') do
+      x = create(:nothing)
+      add_property(x, 'x', 123, ['player', 'r'])
+
+      assert_equal ['r', 'rw'], simplify(command("; a = create(#{x}, 1); set_property_info(#{x}, \"x\", {player, \"rw\"}); b = create(#{x}, 1); return {property_info(a, \"x\")[2], property_info(b, \"x\")[2]};"))
+    end
+  end
+
   def test_that_verb_calls_work_on_anonymous_objects
     run_test_as('programmer') do
       x = create(:nothing)
@@ -159,6 +179,20 @@ class TestAnonymous < Test::Unit::TestCase
     end
   end
 
+  def test_that_anonymous_objects_are_recycled_in_the_order_they_were_lost
+    run_test_as('programmer') do
+      a = create(:object)
+      add_property(a, 'n', 0, [player, ''])
+      add_property(a, 'order', [], [player, ''])
+      add_verb(a, ['player', 'xd', 'recycle'], ['this', 'none', 'this'])
+      set_verb_code(a, 'recycle') do |vc|
+        vc << %Q<#{a}.order = {@#{a}.order, this.n};>
+      end
+      simplify(command("; for i in [1..5] x = create(#{a}, 1); x.n = i; endfor"))
+      assert_equal [1, 2, 3, 4, 5], get(a, 'order')
+    end
+  end
+
   def test_that_losing_all_references_to_an_anonymous_object_calls_recycle_once
     run_test_as('programmer') do
       a = create(:object)
@@ -210,4 +210,15 @@ class TestCannedDbs < Test::Unit::TestCase
     assert log.any? { |l| l =~ /#2 not in it's content's \(#3\) location/ }
   end
 
+  def test_that_a_verb_that_does_not_parse_keeps_its_source
+    log1, diff1 = log_and_diff('test/Unparsable.db', '/tmp/Foo.db')
+    log2, diff2 = log_and_diff('/tmp/Foo.db', '/tmp/Bar.db')
+
+    assert_equal 1, log1.count { |l| l =~ /Unparsable program #0:broken/ }
+    assert_equal 2, log1.count { |l| l =~ /> E_INVARG/ }
+
+    assert_equal [], diff1
+    assert_equal [], diff2
+  end
+
 end
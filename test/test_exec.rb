@@ -103,6 +103,61 @@ class TestExec < Test::Unit::TestCase
     end
   end
 
+  def test_that_worker_call_fails_for_non_wizards
+    run_test_as('programmer') do
+      assert_equal E_PERM, worker_call(['test_worker'], 'foo')
+      assert_equal E_PERM, worker_pools()
+      assert_equal E_PERM, kill_worker_pool(['test_worker'])
+    end
+  end
+
+  def test_that_worker_call_works
+    run_test_as('wizard') do
+      assert_equal 'HELLO, WORLD!', worker_call(['test_worker'], 'Hello, world!')
+      assert_equal [[['test_worker'], 4, 1, 0, 0]], worker_pools()
+      assert_equal 0, kill_worker_pool(['test_worker'])
+    end
+  end
+
+  def test_that_worker_call_reuses_workers
+    run_test_as('wizard') do
+      pid = worker_call(['test_worker'], 'pid')
+      assert_equal pid, worker_call(['test_worker'], 'pid')
+      assert_equal 0, kill_worker_pool(['test_worker'])
+    end
+  end
+
+  def test_that_worker_call_fails_for_bad_requests_and_paths
+    run_test_as('wizard') do
+      assert_equal E_INVARG, worker_call(['test_worker'], 'one~0Atwo')
+      assert_equal E_INVARG, worker_call(['test_worker'], 'foo', 0)
+      assert_equal E_INVARG, worker_call(['../test_worker'], 'foo')
+      assert_equal E_INVARG, worker_call(['test_does_not_exist'], 'foo')
+      assert_equal E_INVARG, kill_worker_pool(['test_does_not_exist'])
+    end
+  end
+
+  def test_that_worker_call_fails_when_the_worker_exits
+    run_test_as('wizard') do
+      assert_equal E_EXEC, worker_call(['test_worker'], 'exit')
+      assert_equal 'STILL HERE', worker_call(['test_worker'], 'still here')
+      assert_equal 0, kill_worker_pool(['test_worker'])
+    end
+  end
+
+  def test_that_worker_pools_limit_concurrency
+    run_test_as('wizard') do
+      assert_equal [], queued_tasks()
+      6.times { eval('fork (0) worker_call({"test_worker"}, "sleep 2", 2); endfork') }
+      eval('suspend(0)')
+      assert_equal [[['test_worker'], 2, 2, 2, 4]], worker_pools()
+      assert_equal 6, queued_tasks().length
+      sleep 8
+      assert_equal [], queued_tasks()
+      assert_equal 0, kill_worker_pool(['test_worker'])
+    end
+  end
+
   TIMES = 10
   DURATION = 5
 
@@ -199,6 +199,90 @@ class TestFileio < Test::Unit::TestCase
     end
   end
 
+  def test_that_readlines_reads_a_file_in_batches
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      1.upto(25) { |i| file_writeline(fh, "line #{i}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal (1..10).map { |i| "line #{i}" }, file_readlines(fh, 1, 10)
+      assert_equal (11..20).map { |i| "line #{i}" }, file_readlines(fh, 11, 20)
+      assert_equal (21..25).map { |i| "line #{i}" }, file_readlines(fh, 21, 30)
+      assert_equal ['line 2'], file_readlines(fh, 2, 2)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_readlines_sees_a_file_truncated_between_batches
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      1.upto(25) { |i| file_writeline(fh, "line #{i}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal (1..10).map { |i| "line #{i}" }, file_readlines(fh, 1, 10)
+      wh = file_open('test_fileio.tmp', 'w-tn')
+      1.upto(12) { |i| file_writeline(wh, "line #{i}") }
+      file_close(wh)
+      assert_equal ['line 11', 'line 12'], file_readlines(fh, 11, 20)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_read_reads_no_more_than_asked
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-bn')
+      file_write(fh, '1234567890' * 1000)
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-bn')
+      assert_equal '1234567890' * 500, file_read(fh, 5000)
+      assert_equal 5000, file_tell(fh)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_file_operations_work_on_background_threads
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "background_file_io", 1, {player, "r"})')
+      evaluate('load_server_options();')
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      file_writeline(fh, 'one')
+      file_writeline(fh, 'two')
+      file_writeline(fh, 'three')
+      file_writeline(fh, 'four')
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      first = file_readline(fh)
+      rest = file_readlines(fh, 1, 3)
+      file_close(fh)
+      assert_equal 'one', first
+      assert_equal ['one', 'two', 'three'], rest
+      assert_equal 19, file_size('test_fileio.tmp')
+      file_remove('test_fileio.tmp')
+      evaluate('delete_property($server_options, "background_file_io")')
+      evaluate('load_server_options();')
+    end
+  end
+
+  def test_that_seeking_waits_for_earlier_background_operations
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "background_file_io", 1, {player, "r"})')
+      evaluate('load_server_options();')
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      file_writeline(fh, 'one')
+      file_writeline(fh, 'two')
+      file_writeline(fh, 'three')
+      file_close(fh)
+      r = simplify(command(%Q|; fh = file_open("test_fileio.tmp", "r-tn"); fork (0); file_seek(fh, 4, "SEEK_SET"); endfork; lines = file_readlines(fh, 1, 3); suspend(0); r = {lines, file_tell(fh), file_readline(fh)}; file_close(fh); return r;|))
+      assert_equal [['one', 'two', 'three'], 4, 'two'], r
+      file_remove('test_fileio.tmp')
+      evaluate('delete_property($server_options, "background_file_io")')
+      evaluate('load_server_options();')
+    end
+  end
+
   # I don't necessarily agree with the output of the following two
   # tests, but at least the semantics are clear.
 
@@ -151,4 +151,71 @@ class TestStringOperations < Test::Unit::TestCase
     end
   end
 
+  def test_that_strsubs_makes_all_of_the_substitutions_in_one_pass
+    run_test_as('programmer') do
+      assert_equal 'the dog sat on the rug', strsubs('the cat sat on the mat', {'cat' => 'dog', 'mat' => 'rug'})
+      assert_equal 'a dog', strsubs('The Cat', [['the', 'a'], ['cat', 'dog']])
+      assert_equal 'The Cat', strsubs('The Cat', [['the', 'a'], ['cat', 'dog']], 1)
+      assert_equal '1yz2', strsubs('xyzX', [['x', '1'], ['X', '2']], 1)
+      assert_equal 'abbc', strsubs('abc', [['b', 'bb'], ['bb', 'x']])
+      assert_equal 'abc', strsubs('abc', [])
+      assert_equal '', strsubs('', [['a', 'b']])
+    end
+  end
+
+  def test_that_strsubs_replaces_the_longest_match_at_each_position
+    run_test_as('programmer') do
+      assert_equal 'Yd', strsubs('abcd', [['ab', 'X'], ['abc', 'Y'], ['bcd', 'Z']])
+      assert_equal 'bb', strsubs('aaaa', [['aa', 'b']])
+      assert_equal '1 said 2', strsubs('he said she', [['he', '1'], ['she', '2'], ['hers', '3']])
+    end
+  end
+
+  def test_that_strsubs_agrees_with_repeated_strsub
+    run_test_as('programmer') do
+      assert_equal 1, simplify(command(%Q|; p = {}; for i in [1..50]; p = {@p, {"w" + tostr(i) + "x", "<" + tostr(i) + ">"}}; endfor; s = ""; for i in [1..500]; s = s + "w" + tostr(random(80)) + "x "; endfor; r = s; for i in (p); r = strsub(r, i[1], i[2]); endfor; return r == strsubs(s, p);|))
+    end
+  end
+
+  def test_that_strsubs_fails_on_bad_replacements
+    run_test_as('programmer') do
+      assert_equal E_INVARG, strsubs('abc', [['', 'x']])
+      assert_equal E_INVARG, strsubs('abc', [['a']])
+      assert_equal E_INVARG, strsubs('abc', ['a'])
+      assert_equal E_TYPE, strsubs('abc', [['a', 1]])
+      assert_equal E_TYPE, strsubs('abc', {1 => 'x'})
+      assert_equal E_TYPE, strsubs('abc', 5)
+    end
+  end
+
+  def test_that_join_concatenates_strings_with_a_separator
+    run_test_as('programmer') do
+      assert_equal 'a b c', _('join({"a", "b", "c"})')
+      assert_equal 'a, b, c', _('join({"a", "b", "c"}, ", ")')
+      assert_equal 'x', _('join({"x"}, "--")')
+      assert_equal '--', _('join({"", "", ""}, "-")')
+      assert_equal '', _('join({})')
+      assert_equal E_TYPE, _('join({"a", 1})')
+    end
+  end
+
+  def test_that_explode_splits_a_string_on_a_separator
+    run_test_as('programmer') do
+      assert_equal ['the', 'quick', 'fox'], _('explode("  the  quick fox ")')
+      assert_equal ['a', 'b', 'c'], _('explode("a,b,,c,", ",")')
+      assert_equal ['a', 'b', '', 'c', ''], _('explode("a,b,,c,", ",", 1)')
+      assert_equal ['a', 'b', '', 'c'], _('explode("a::b::::c", "::", 1)')
+      assert_equal ['', ':'], _('explode(":::", "::", 1)')
+      assert_equal [''], _('explode("", ",", 1)')
+      assert_equal [], _('explode("")')
+      assert_equal E_INVARG, _('explode("abc", "")')
+    end
+  end
+
+  def test_that_explode_undoes_join
+    run_test_as('programmer') do
+      assert_equal 1, simplify(command(%Q|; l = {}; for i in [1..1000]; l = {@l, tostr(random(1000))}; endfor; return explode(join(l, "<>"), "<>") == l;|))
+    end
+  end
+
 end
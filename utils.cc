@@ -658,18 +658,49 @@ clean_to_raw_bytes(const char *buffer, int *buflen)
     return buffer;
 }
 
+/* Checks eight bytes at a time for any byte below ' ' or above the
+ * last allowed character, using the usual carry tricks on a 64-bit
+ * word; the exact position is then found a byte at a time.
+ */
+int
+printable_prefix_length(const char *buffer, int buflen, int allow_tilde)
+{
+    static const uint64_t ones = 0x0101010101010101ULL;
+    static const uint64_t highs = 0x8080808080808080ULL;
+    const uint64_t last = allow_tilde ? '~' : '}';
+    const unsigned char *p = (const unsigned char *) buffer;
+    const unsigned char *end = p + buflen;
+
+    while (end - p >= 8) {
+	uint64_t x;
+
+	memcpy(&x, p, 8);
+	if ((((x - ones * ' ') & ~x)
+	     | ((x + ones * (127 - last)) | x)) & highs)
+	    break;
+	p += 8;
+    }
+    while (p < end && *p >= ' ' && *p <= last)
+	p++;
+
+    return p - (const unsigned char *) buffer;
+}
+
 void
 stream_add_raw_bytes_to_binary(Stream *s, const char *buffer, int buflen)
 {
-    int i;
+    int i, run;
 
     for (i = 0; i < buflen; i++) {
-	unsigned char c = buffer[i];
+	unsigned char c;
 
-	if (c != '~' && (isgraph(c) || c == ' '))
-	    stream_add_char(s, c);
-	else
-	    stream_printf(s, "~%02x", (int) c);
+	if ((run = printable_prefix_length(buffer + i, buflen - i, 0)) > 0) {
+	    stream_add_bytes(s, buffer + i, run);
+	    if ((i += run) >= buflen)
+		break;
+	}
+	c = buffer[i];
+	stream_printf(s, "~%02x", (int) c);
     }
 }
 
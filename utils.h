@@ -89,6 +89,13 @@ extern void stream_add_raw_bytes_to_clean(Stream *, const char *buffer, int bufl
 extern const char *raw_bytes_to_clean(const char *buffer, int buflen);
 extern const char *clean_to_raw_bytes(const char *binary, int *rawlen);
 
+extern int printable_prefix_length(const char *buffer, int buflen,
+				   int allow_tilde);
+				/* Returns the number of leading bytes in
+				 * BUFFER that are printable ASCII characters
+				 * (space through `~', or through `}' if
+				 * ALLOW_TILDE is false).
+				 */
 extern void stream_add_raw_bytes_to_binary(Stream *, const char *buffer, int buflen);
 extern const char *raw_bytes_to_binary(const char *buffer, int buflen);
 extern const char *binary_to_raw_bytes(const char *binary, int *rawlen);
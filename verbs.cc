@@ -231,7 +231,7 @@ find_described_verb(Var obj, Var desc)
     if (desc.type == TYPE_INT)
 	return db_find_indexed_verb(obj, desc.v.num);
     else {
-	int flag = server_flag_option("support_numeric_verbname_strings", 0);
+	int flag = server_flag_option_cached(SVO_SUPPORT_NUMERIC_VERBNAME_STRINGS);
 	return db_find_defined_verb(obj, desc.v.str, flag);
     }
 }